@@ -0,0 +1,105 @@
+/*
+ * Common helpers for the V4L2 bridge benchmarks
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/* open a report, path NULL or "-" for stdout */
+int bench_report_open(struct bench_report *r, const char *suite,
+		const char *path, unsigned int repeats)
+{
+	memset(r, 0, sizeof(*r));
+
+	if (!path || !strcmp(path, "-"))
+		r->fp = stdout;
+	else
+		r->fp = fopen(path, "w");
+	if (!r->fp)
+		return -1;
+
+	fprintf(r->fp, "{\n");
+	fprintf(r->fp, "  \"suite\": \"%s\",\n", suite);
+	fprintf(r->fp, "  \"version\": %d,\n", BENCH_VERSION);
+	fprintf(r->fp, "  \"repeats\": %u,\n", repeats);
+	fprintf(r->fp, "  \"metrics\": [");
+
+	return 0;
+}
+
+/* write a metric with one sample per repeat */
+void bench_report_metric(struct bench_report *r, const char *name,
+		const char *unit, enum bench_better better,
+		const double *samples, unsigned int n)
+{
+	unsigned int i;
+
+	fprintf(r->fp, "%s\n    { \"name\": \"%s\", \"unit\": \"%s\", "
+			"\"better\": \"%s\", \"samples\": [",
+			r->count ? "," : "", name, unit,
+			better == BENCH_HIGHER ? "higher" : "lower");
+	for (i = 0; i < n; i++)
+		fprintf(r->fp, "%s%.6g", i ? ", " : "",
+				isfinite(samples[i]) ? samples[i] : 0.0);
+	fprintf(r->fp, "] }");
+
+	r->count++;
+}
+
+void bench_report_close(struct bench_report *r)
+{
+	fprintf(r->fp, "\n  ]\n}\n");
+	if (r->fp != stdout)
+		fclose(r->fp);
+	else
+		fflush(r->fp);
+	r->fp = NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* compute summary of samples */
+void bench_stats(const double *v, unsigned int n, struct bench_stats *st)
+{
+	double *sorted;
+	double sum = 0, sq = 0;
+	unsigned int i;
+
+	memset(st, 0, sizeof(*st));
+	st->n = n;
+	if (!n)
+		return;
+
+	for (i = 0; i < n; i++)
+		sum += v[i];
+	st->mean = sum / n;
+	for (i = 0; i < n; i++)
+		sq += (v[i] - st->mean) * (v[i] - st->mean);
+	st->stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+
+	sorted = malloc(sizeof(*sorted) * n);
+	memcpy(sorted, v, sizeof(*sorted) * n);
+	qsort(sorted, n, sizeof(*sorted), cmp_double);
+	st->min = sorted[0];
+	st->max = sorted[n - 1];
+	st->median = (n & 1) ? sorted[n / 2] :
+		(sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+	free(sorted);
+}
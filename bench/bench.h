@@ -0,0 +1,68 @@
+/*
+ * Common helpers for the V4L2 bridge benchmarks
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdio.h>
+
+/*
+ * RESULT FORMAT
+ *
+ * every benchmark writes one json document per run:
+ *
+ * {
+ *   "suite": "<name>",
+ *   "version": 1,
+ *   "repeats": <n>,
+ *   "metrics": [
+ *     { "name": "<a/b/c>", "unit": "<unit>", "better": "lower|higher",
+ *       "samples": [ <one value per repeat>, ... ] },
+ *     ...
+ *   ]
+ * }
+ */
+
+#define BENCH_VERSION	1
+
+/* direction of improvement */
+enum bench_better {
+	BENCH_LOWER,
+	BENCH_HIGHER,
+};
+
+/* json result writer */
+struct bench_report {
+	FILE *fp;			/* output */
+	unsigned int count;		/* metrics written */
+};
+
+/* summary of samples */
+struct bench_stats {
+	unsigned int n;			/* number of samples */
+	double mean;			/* mean */
+	double stddev;			/* sample standard deviation */
+	double min;			/* minimum */
+	double max;			/* maximum */
+	double median;			/* median */
+};
+
+int bench_report_open(struct bench_report *r, const char *suite,
+		const char *path, unsigned int repeats);
+void bench_report_metric(struct bench_report *r, const char *name,
+		const char *unit, enum bench_better better,
+		const double *samples, unsigned int n);
+void bench_report_close(struct bench_report *r);
+
+void bench_stats(const double *v, unsigned int n, struct bench_stats *st);
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,580 @@
+/*
+ * Compare benchmark results of the V4L2 bridge against a stored baseline
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Loads result files in the format of bench.h, looks up the baseline of the
+ * same suite(<baseline dir>/<suite>.json), and compares the median of every
+ * metric. A metric fails only when the whole bootstrap confidence interval of
+ * the change is worse than its tolerance, so a noisy run is reported but
+ * doesn't break the gate.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <ctype.h>
+#include <fnmatch.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define MAX_SAMPLES	64
+#define MAX_TOLERANCES	64
+#define BOOTSTRAP	2000
+
+/* metric of a suite */
+struct metric {
+	char name[64];			/* metric name */
+	char unit[16];			/* unit */
+	enum bench_better better;	/* direction of improvement */
+	double samples[MAX_SAMPLES];	/* one sample per repeat */
+	unsigned int num_samples;	/* number of samples */
+};
+
+/* results of a suite */
+struct suite {
+	char name[32];			/* suite name */
+	struct metric *metrics;		/* metrics */
+	unsigned int num_metrics;	/* number of metrics */
+};
+
+/* tolerance for metrics matching a pattern */
+struct tolerance {
+	char pattern[64];		/* fnmatch() pattern of metric name */
+	double percent;			/* allowed relative change */
+	double absolute;		/* changes below this are always ok */
+};
+
+/* kind of metric, to summarize */
+enum kind {
+	KIND_THROUGHPUT,
+	KIND_LATENCY,
+	KIND_CPU,
+	KIND_MAX,
+};
+
+static const char *kind_names[KIND_MAX] = {
+	[KIND_THROUGHPUT]	= "throughput",
+	[KIND_LATENCY]		= "latency",
+	[KIND_CPU]		= "cpu",
+};
+
+/* verdict of a metric */
+enum verdict {
+	V_PASS,				/* within tolerance */
+	V_BETTER,			/* improved beyond tolerance */
+	V_NOISY,			/* worse median, but not significant */
+	V_FAIL,				/* significantly worse than tolerance */
+	V_NEW,				/* no baseline */
+	V_MAX,
+};
+
+static const char *verdict_names[V_MAX] = {
+	[V_PASS]	= "pass",
+	[V_BETTER]	= "better",
+	[V_NOISY]	= "noisy",
+	[V_FAIL]	= "FAIL",
+	[V_NEW]		= "new",
+};
+
+static struct tolerance tolerances[MAX_TOLERANCES];
+static unsigned int num_tolerances;
+static double default_percent = 5;
+static double confidence = 0.95;
+
+static void usage(char *name)
+{
+#define HELP(...) fprintf(stderr, __VA_ARGS__);
+	HELP("usage: %s [-Btdch] <result.json>...\n", name);
+
+	HELP(" -B\tbaseline directory\t<dir>(default bench/baseline)\n");
+	HELP(" -t\ttolerance file\t\t<file>(<pattern> <percent> [absolute])\n");
+	HELP(" -d\tdefault tolerance\t<percent>(default 5)\n");
+	HELP(" -c\tconfidence level\t<0..1>(default 0.95)\n");
+	HELP(" -h\tshow this help\n");
+#undef HELP
+}
+
+/*
+ * json reader, just enough for the result format
+ */
+
+struct json {
+	const char *p;			/* current position */
+	bool err;			/* parse error */
+};
+
+static void json_ws(struct json *j)
+{
+	while (isspace((unsigned char)*j->p))
+		j->p++;
+}
+
+static bool json_peek(struct json *j, char c)
+{
+	json_ws(j);
+	return *j->p == c;
+}
+
+static bool json_expect(struct json *j, char c)
+{
+	json_ws(j);
+	if (*j->p != c) {
+		j->err = true;
+		return false;
+	}
+	j->p++;
+	return true;
+}
+
+/* read a string into buf(truncated), escapes are copied as is */
+static void json_string(struct json *j, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	if (!json_expect(j, '"'))
+		return;
+	while (*j->p && *j->p != '"') {
+		if (*j->p == '\\' && j->p[1])
+			j->p++;
+		if (buf && len + 1 < size)
+			buf[len++] = *j->p;
+		j->p++;
+	}
+	if (buf && size)
+		buf[len] = '\0';
+	json_expect(j, '"');
+}
+
+static double json_number(struct json *j)
+{
+	char *end;
+	double v;
+
+	json_ws(j);
+	v = strtod(j->p, &end);
+	if (end == j->p)
+		j->err = true;
+	j->p = end;
+	return v;
+}
+
+/* skip any value */
+static void json_skip(struct json *j)
+{
+	json_ws(j);
+	switch (*j->p) {
+	case '"':
+		json_string(j, NULL, 0);
+		break;
+	case '{':
+	case '[': {
+		char close = *j->p == '{' ? '}' : ']';
+
+		j->p++;
+		while (!j->err && !json_peek(j, close)) {
+			if (close == '}') {
+				json_string(j, NULL, 0);
+				json_expect(j, ':');
+			}
+			json_skip(j);
+			if (!json_peek(j, close))
+				json_expect(j, ',');
+		}
+		json_expect(j, close);
+		break;
+	}
+	case 't':
+	case 'f':
+	case 'n':
+		while (isalpha((unsigned char)*j->p))
+			j->p++;
+		break;
+	default:
+		json_number(j);
+		break;
+	}
+}
+
+/* iterate members of an object, returns false at the end */
+static bool json_member(struct json *j, char *key, size_t size, bool first)
+{
+	if (first && !json_expect(j, '{'))
+		return false;
+	if (json_peek(j, '}')) {
+		j->p++;
+		return false;
+	}
+	if (!first && !json_expect(j, ','))
+		return false;
+	json_string(j, key, size);
+	json_expect(j, ':');
+	return !j->err;
+}
+
+/* iterate elements of an array, returns false at the end */
+static bool json_element(struct json *j, bool first)
+{
+	if (first && !json_expect(j, '['))
+		return false;
+	if (json_peek(j, ']')) {
+		j->p++;
+		return false;
+	}
+	if (!first && !json_expect(j, ','))
+		return false;
+	return !j->err;
+}
+
+static void parse_metric(struct json *j, struct metric *m)
+{
+	char key[32], better[16];
+	bool first, efirst;
+
+	memset(m, 0, sizeof(*m));
+	for (first = true; json_member(j, key, sizeof(key), first);
+			first = false) {
+		if (!strcmp(key, "name")) {
+			json_string(j, m->name, sizeof(m->name));
+		} else if (!strcmp(key, "unit")) {
+			json_string(j, m->unit, sizeof(m->unit));
+		} else if (!strcmp(key, "better")) {
+			json_string(j, better, sizeof(better));
+			m->better = strcmp(better, "higher") ?
+				BENCH_LOWER : BENCH_HIGHER;
+		} else if (!strcmp(key, "samples")) {
+			for (efirst = true; json_element(j, efirst);
+					efirst = false) {
+				double v = json_number(j);
+
+				if (m->num_samples < MAX_SAMPLES)
+					m->samples[m->num_samples++] = v;
+			}
+		} else {
+			json_skip(j);
+		}
+	}
+}
+
+/* load a result file, returns 0 on success */
+static int suite_load(struct suite *s, const char *path)
+{
+	struct json j;
+	char key[32];
+	char *buf;
+	long size;
+	bool first, efirst;
+	FILE *fp;
+
+	memset(s, 0, sizeof(*s));
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = calloc(1, size + 1);
+	if (!buf || fread(buf, 1, size, fp) != (size_t)size) {
+		fclose(fp);
+		free(buf);
+		return -1;
+	}
+	fclose(fp);
+
+	j.p = buf;
+	j.err = false;
+	for (first = true; json_member(&j, key, sizeof(key), first);
+			first = false) {
+		if (!strcmp(key, "suite")) {
+			json_string(&j, s->name, sizeof(s->name));
+		} else if (!strcmp(key, "metrics")) {
+			for (efirst = true; json_element(&j, efirst);
+					efirst = false) {
+				s->metrics = realloc(s->metrics,
+						sizeof(*s->metrics) *
+						(s->num_metrics + 1));
+				parse_metric(&j, &s->metrics[s->num_metrics++]);
+			}
+		} else {
+			json_skip(&j);
+		}
+	}
+	free(buf);
+
+	return j.err || !s->name[0] ? -1 : 0;
+}
+
+static struct metric *suite_find(struct suite *s, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->num_metrics; i++)
+		if (!strcmp(s->metrics[i].name, name))
+			return &s->metrics[i];
+	return NULL;
+}
+
+/*
+ * tolerances
+ */
+
+/* load tolerance lines: <pattern> <percent> [absolute], first match wins */
+static int tolerances_load(const char *path)
+{
+	char line[256];
+	FILE *fp;
+	char *p;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	while (num_tolerances < MAX_TOLERANCES && fgets(line, sizeof(line), fp)) {
+		struct tolerance *t = &tolerances[num_tolerances];
+
+		p = strchr(line, '#');
+		if (p)
+			*p = '\0';
+		t->absolute = 0;
+		if (sscanf(line, "%63s %lf %lf", t->pattern, &t->percent,
+					&t->absolute) >= 2)
+			num_tolerances++;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+static void tolerance_lookup(const char *suite, const char *name,
+		double *percent, double *absolute)
+{
+	char full[128];
+	unsigned int i;
+
+	snprintf(full, sizeof(full), "%s/%s", suite, name);
+	for (i = 0; i < num_tolerances; i++) {
+		if (!fnmatch(tolerances[i].pattern, full, 0)) {
+			*percent = tolerances[i].percent;
+			*absolute = tolerances[i].absolute;
+			return;
+		}
+	}
+	*percent = default_percent;
+	*absolute = 0;
+}
+
+/*
+ * statistics
+ */
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+/* xorshift, deterministic so that reruns give the same intervals */
+static unsigned int rng(unsigned int n)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state % n;
+}
+
+static double median(const double *v, unsigned int n)
+{
+	struct bench_stats st;
+
+	bench_stats(v, n, &st);
+	return st.median;
+}
+
+static double resampled_median(const double *v, unsigned int n)
+{
+	double r[MAX_SAMPLES];
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		r[i] = v[rng(n)];
+	return median(r, n);
+}
+
+/* change in %, positive is worse */
+static double worse_percent(double base, double cur, enum bench_better better)
+{
+	double d;
+
+	if (base == 0)
+		return cur == 0 ? 0 : (better == BENCH_LOWER ? 1 : -1) *
+			copysign(INFINITY, cur);
+	d = (cur - base) / fabs(base) * 100.0;
+	return better == BENCH_LOWER ? d : -d;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* bootstrap confidence interval of the change in % */
+static void bootstrap(const struct metric *b, const struct metric *c,
+		double *lo, double *hi)
+{
+	static double d[BOOTSTRAP];
+	unsigned int i;
+
+	for (i = 0; i < BOOTSTRAP; i++)
+		d[i] = worse_percent(
+				resampled_median(b->samples, b->num_samples),
+				resampled_median(c->samples, c->num_samples),
+				b->better);
+	qsort(d, BOOTSTRAP, sizeof(*d), cmp_double);
+	*lo = d[(unsigned int)((1 - confidence) / 2 * (BOOTSTRAP - 1))];
+	*hi = d[(unsigned int)((1 + confidence) / 2 * (BOOTSTRAP - 1))];
+}
+
+static enum kind metric_kind(const struct metric *m)
+{
+	if (strstr(m->unit, "cpu") || strstr(m->unit, "cycles"))
+		return KIND_CPU;
+	if (m->better == BENCH_HIGHER)
+		return KIND_THROUGHPUT;
+	return KIND_LATENCY;
+}
+
+/*
+ * compare
+ */
+
+static unsigned int counts[KIND_MAX][V_MAX];
+
+static void compare_metric(const struct suite *s, const struct metric *c,
+		const struct metric *b)
+{
+	double mb, mc, delta, lo, hi, percent, absolute;
+	enum verdict v;
+
+	mc = median(c->samples, c->num_samples);
+	if (!b || !b->num_samples || !c->num_samples) {
+		v = V_NEW;
+		printf("%-40s %10s %12.4g %8s %17s %6s  %s\n", c->name, "-", mc,
+				"-", "-", "-", verdict_names[v]);
+		counts[metric_kind(c)][v]++;
+		return;
+	}
+
+	tolerance_lookup(s->name, c->name, &percent, &absolute);
+	mb = median(b->samples, b->num_samples);
+	delta = worse_percent(mb, mc, c->better);
+	bootstrap(b, c, &lo, &hi);
+
+	if (fabs(mc - mb) <= absolute || fabs(delta) <= percent)
+		v = V_PASS;
+	else if (delta < 0)
+		v = V_BETTER;
+	else if (lo > percent)
+		v = V_FAIL;
+	else
+		v = V_NOISY;
+
+	printf("%-40s %10.4g %12.4g %+7.1f%% [%+6.1f,%+6.1f]%% %5.1f%%  %s\n",
+			c->name, mb, mc, c->better == BENCH_LOWER ? delta : -delta,
+			c->better == BENCH_LOWER ? lo : -hi,
+			c->better == BENCH_LOWER ? hi : -lo,
+			percent, verdict_names[v]);
+	counts[metric_kind(c)][v]++;
+}
+
+/* compare a result file with its baseline, returns number of failures */
+static int compare(const char *basedir, const char *path)
+{
+	struct suite cur, base;
+	char bpath[256];
+	unsigned int i;
+	bool have_base;
+
+	if (suite_load(&cur, path) < 0) {
+		fprintf(stderr, "failed to load %s\n", path);
+		return 1;
+	}
+	snprintf(bpath, sizeof(bpath), "%s/%s.json", basedir, cur.name);
+	have_base = suite_load(&base, bpath) == 0;
+
+	printf("\nsuite %s(%s vs %s)\n", cur.name, path,
+			have_base ? bpath : "no baseline");
+	printf("%-40s %10s %12s %8s %17s %6s  %s\n", "metric", "baseline",
+			"current", "delta", "ci", "tol", "result");
+	for (i = 0; i < cur.num_metrics; i++)
+		compare_metric(&cur, &cur.metrics[i], have_base ?
+				suite_find(&base, cur.metrics[i].name) : NULL);
+
+	free(cur.metrics);
+	if (have_base)
+		free(base.metrics);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *basedir = "bench/baseline";
+	unsigned int failed = 0, k, v;
+	int c, i, err = 0;
+
+	while ((c = getopt(argc, argv, "hB:t:d:c:")) != -1) {
+		switch (c) {
+		case 'B':
+			basedir = optarg;
+			break;
+		case 't':
+			if (tolerances_load(optarg) < 0) {
+				fprintf(stderr, "failed to load %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'd':
+			default_percent = strtod(optarg, NULL);
+			break;
+		case 'c':
+			confidence = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (optind >= argc || confidence <= 0 || confidence >= 1) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	for (i = optind; i < argc; i++)
+		err += compare(basedir, argv[i]);
+
+	printf("\n%-12s", "summary");
+	for (v = 0; v < V_MAX; v++)
+		printf(" %7s", verdict_names[v]);
+	printf("\n");
+	for (k = 0; k < KIND_MAX; k++) {
+		printf("%-12s", kind_names[k]);
+		for (v = 0; v < V_MAX; v++)
+			printf(" %7u", counts[k][v]);
+		printf("\n");
+		failed += counts[k][V_FAIL];
+	}
+	printf("\n%s\n", failed || err ? "FAILED" : "PASSED");
+
+	return failed || err ? 1 : 0;
+}
@@ -0,0 +1,296 @@
+/*
+ * Colour grading benchmark for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Writes a warm grade and an identity 3d lut(.cube) and sets up the grade
+ * stage(grade.c) with them on XR24, YUYV and NV12 frames of 720p, 1080p and
+ * 4K. Grades frames on one core through the warm lut and reports megapixels
+ * per second, the throughput per core of the stage, and how many cores
+ * keep up with 1080p60. The identity lut checks the stage leaves frames as
+ * they are: rgb exactly, and grey yuv within one step.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../bridge_priv.h"
+#include "../kernel.h"
+#include "bench.h"
+
+/* megapixels per second of 1080p60 */
+#define HD60_MPIX	(1920.0 * 1080 * 60 / 1e6)
+
+/* frame sizes */
+static const struct {
+	const char *name;
+	unsigned int width;
+	unsigned int height;
+} sizes[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "4k", 3840, 2160 },
+};
+#define NUM_SIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+/* formats, bytes per line per pixel and size of frame per pixel in 1/2 */
+static const struct {
+	const char *name;
+	unsigned int fourcc;
+	unsigned int bpp;
+	unsigned int halves;
+} formats[] = {
+	{ "XR24", V4L2_PIX_FMT_XBGR32, 4, 8 },
+	{ "YUYV", V4L2_PIX_FMT_YUYV, 2, 4 },
+	{ "NV12", V4L2_PIX_FMT_NV12, 1, 3 },
+};
+#define NUM_FORMATS	(sizeof(formats) / sizeof(formats[0]))
+
+/* the stage runs on its own here, stripes run on the calling thread */
+void workers_run(struct workers *w, struct task **tasks, unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++)
+		tasks[i]->run(tasks[i]);
+}
+
+static void usage(char *name)
+{
+#define HELP(...) fprintf(stderr, __VA_ARGS__);
+	HELP("usage: %s [-nrfoh]\n", name);
+
+	HELP(" -n\tnodes per axis\t\t<count>(default 33)\n");
+	HELP(" -r\trepeats\t\t\t<count>(default 3)\n");
+	HELP(" -f\tframes per repeat\t<count>(default 30)\n");
+	HELP(" -o\tjson output\t\t<file>(default stdout)\n");
+	HELP(" -h\tshow this help\n");
+#undef HELP
+}
+
+/* write a lut of n nodes per axis, warm grade or identity */
+static int write_cube(const char *path, unsigned int n, bool warm)
+{
+	unsigned int r, g, b;
+	double in[3], l;
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return -1;
+	fprintf(fp, "TITLE \"%s\"\nLUT_3D_SIZE %u\n",
+			warm ? "warm" : "identity", n);
+	for (b = 0; b < n; b++)
+		for (g = 0; g < n; g++)
+			for (r = 0; r < n; r++) {
+				in[0] = (double)r / (n - 1);
+				in[1] = (double)g / (n - 1);
+				in[2] = (double)b / (n - 1);
+				if (warm) {
+					/* lift reds, cut blues, less colour */
+					l = 0.2126 * in[0] + 0.7152 * in[1] +
+						0.0722 * in[2];
+					in[0] = pow(l + (in[0] - l) * 0.85,
+							0.9);
+					in[1] = l + (in[1] - l) * 0.85;
+					in[2] = 0.95 * pow(l + (in[2] - l) *
+							0.85, 1.1);
+				}
+				fprintf(fp, "%.6f %.6f %.6f\n", in[0], in[1],
+						in[2]);
+			}
+	fclose(fp);
+
+	return 0;
+}
+
+/* set up stage for format f of size s through lut at path */
+static void setup(struct grade *g, const char *path, unsigned int f,
+		unsigned int s)
+{
+	struct config c;
+
+	memset(&c, 0, sizeof(c));
+	c.format.width = sizes[s].width;
+	c.format.height = sizes[s].height;
+	c.format.pixelformat = formats[f].fourcc;
+	c.num_planes = 1;
+	c.planes[0].bytesperline = sizes[s].width * formats[f].bpp;
+	c.planes[0].sizeimage = sizes[s].width * sizes[s].height *
+		formats[f].halves / 2;
+
+	memset(g, 0, sizeof(*g));
+	if (grade_parse_args(g, path) < 0 ||
+			grade_format(g, &c, c.planes[0].bytesperline) < 0) {
+		fprintf(stderr, "can't grade %s through %s\n",
+				formats[f].name, path);
+		exit(1);
+	}
+}
+
+/* largest change of bytes of grey frames(or any, for rgb) through identity */
+static unsigned int identity_error(const char *path, unsigned int f,
+		uint8_t *frame)
+{
+	unsigned int w = sizes[0].width, h = sizes[0].height, i, d, err = 0;
+	size_t size = (size_t)w * h * formats[f].halves / 2;
+	uint8_t *ref;
+	struct grade g;
+
+	ref = malloc(size);
+	if (!ref)
+		return 256;
+	for (i = 0; i < size; i++) {
+		if (f == 0)
+			ref[i] = rand();
+		else if (f == 1)
+			ref[i] = i % 2 ? 128 : 16 + rand() % 220;
+		else
+			ref[i] = i >= w * h ? 128 : 16 + rand() % 220;
+	}
+	memcpy(frame, ref, size);
+
+	setup(&g, path, f, 0);
+	grade_stripe(&g, frame, 0, g.height / g.vsub);
+	grade_close(&g);
+
+	for (i = 0; i < size; i++) {
+		/* x of xrgb isn't a channel */
+		if (f == 0 && i % 4 == 3)
+			continue;
+		d = abs(frame[i] - ref[i]);
+		err = d > err ? d : err;
+	}
+	free(ref);
+
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_report report;
+	struct bench_stats st;
+	struct grade g;
+	const char *output = NULL;
+	unsigned int repeats = 3, frames = 30, nodes = 33;
+	unsigned int f, s, r, i, k, err[NUM_FORMATS];
+	char dir[] = "/tmp/bench_grade.XXXXXX", warm[64], identity[64];
+	char name[64];
+	double *mpix;
+	uint8_t *frame;
+	uint64_t start;
+	bool wrong = false;
+	size_t size;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "hn:r:f:o:")) != -1) {
+		switch (ch) {
+		case 'n':
+			nodes = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeats = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			frames = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!repeats || !frames || nodes < 2 || nodes > 256) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	kernel_init();
+	size = 3840 * 2160 * 4;
+	frame = malloc(size);
+	mpix = calloc(NUM_FORMATS * NUM_SIZES * repeats, sizeof(*mpix));
+	if (!frame || !mpix || !mkdtemp(dir)) {
+		fprintf(stderr, "failed to allocate frames\n");
+		return 1;
+	}
+	snprintf(warm, sizeof(warm), "%s/warm.cube", dir);
+	snprintf(identity, sizeof(identity), "%s/identity.cube", dir);
+	if (write_cube(warm, nodes, true) < 0 ||
+			write_cube(identity, nodes, false) < 0) {
+		fprintf(stderr, "failed to write luts in %s\n", dir);
+		return 1;
+	}
+	srand(1);
+
+	for (f = 0; f < NUM_FORMATS; f++) {
+		err[f] = identity_error(identity, f, frame);
+		wrong |= err[f] > (f ? 1 : 0);
+
+		for (i = 0; i < size; i++)
+			frame[i] = rand();
+		for (s = 0; s < NUM_SIZES; s++) {
+			k = (f * NUM_SIZES + s) * repeats;
+			setup(&g, warm, f, s);
+			for (r = 0; r < repeats; r++) {
+				start = timing_now();
+				for (i = 0; i < frames; i++)
+					grade_stripe(&g, frame, 0,
+							g.height / g.vsub);
+				mpix[k + r] = (double)g.width * g.height *
+					frames * 1000 / (timing_now() - start);
+			}
+			grade_close(&g);
+		}
+	}
+	unlink(warm);
+	unlink(identity);
+	rmdir(dir);
+
+	if (bench_report_open(&report, "grade", output, repeats) < 0) {
+		fprintf(stderr, "failed to open %s\n", output);
+		return 1;
+	}
+
+	fprintf(stderr, "%-6s %-6s %12s %14s  %s\n", "format", "size",
+			"mpix/s/core", "cores/1080p60", "identity");
+	for (f = 0; f < NUM_FORMATS; f++) {
+		for (s = 0; s < NUM_SIZES; s++) {
+			k = (f * NUM_SIZES + s) * repeats;
+			snprintf(name, sizeof(name), "%s/%s/mpix",
+					formats[f].name, sizes[s].name);
+			bench_report_metric(&report, name, "Mpix/s",
+					BENCH_HIGHER, &mpix[k], repeats);
+
+			bench_stats(&mpix[k], repeats, &st);
+			fprintf(stderr, "%-6s %-6s %12.1f %14.2f  ",
+					formats[f].name, sizes[s].name,
+					st.median, HD60_MPIX / st.median);
+			if (s)
+				fprintf(stderr, "\n");
+			else
+				fprintf(stderr, "max error %u%s\n", err[f],
+						err[f] > (f ? 1 : 0) ?
+						" WRONG" : "");
+		}
+	}
+
+	bench_report_close(&report);
+	free(frame);
+	free(mpix);
+
+	return wrong ? 1 : 0;
+}
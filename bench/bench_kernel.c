@@ -0,0 +1,390 @@
+/*
+ * Pixel processing kernel benchmark for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Runs every kernel at every tier built in and supported by this cpu over
+ * 720p, 1366x768, 1080p and 4K frames, reports GB/s and cycles per pixel,
+ * and checks that each tier is bit exact with the scalar reference. Lines
+ * of 1366x768 aren't a multiple of the vectors, so heads and tails of the
+ * tiers are checked too.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../kernel.h"
+#include "bench.h"
+
+/* frame sizes */
+static const struct {
+	const char *name;
+	unsigned int width;
+	unsigned int height;
+} sizes[] = {
+	{ "720p", 1280, 720 },
+	{ "768p", 1366, 768 },
+	{ "1080p", 1920, 1080 },
+	{ "4k", 3840, 2160 },
+};
+#define NUM_SIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+/* kernels under test */
+enum {
+	K_COPY,
+	K_YUYV_TO_NV12,
+	K_DOWNSCALE2X,
+	K_BLEND,
+	K_HASH,
+	K_STATS,
+	K_REMAP,
+	K_LUT3D,
+	K_MAX,
+};
+
+static const char *kernel_names[K_MAX] = {
+	[K_COPY]		= "copy",
+	[K_YUYV_TO_NV12]	= "yuyv_to_nv12",
+	[K_DOWNSCALE2X]		= "downscale2x",
+	[K_BLEND]		= "blend",
+	[K_HASH]		= "hash",
+	[K_STATS]		= "stats",
+	[K_REMAP]		= "remap",
+	[K_LUT3D]		= "lut3d",
+};
+
+/* remap lut, 4k wide, over a 4k luma plane of the source */
+#define LUT_WIDTH	3840
+#define LUT_HEIGHT	2160
+
+/* 3d lut, the common size of .cube files */
+#define LUT3D_SIZE	33
+
+/* frame buffers, sized for 4k xrgb */
+struct frames {
+	uint8_t *a;			/* source */
+	uint8_t *b;			/* second source */
+	uint8_t *dst;			/* output of the tier */
+	uint8_t *ref;			/* output of the scalar reference */
+	size_t size;			/* size of each */
+	uint64_t hash;			/* hash of the tier */
+	struct kernel_stats stats;	/* stats of the tier */
+	uint32_t *offset;		/* remap lut */
+	uint16_t *weight;
+	struct kernel_lut3d lut3d;	/* 3d lut of xrgb */
+};
+
+static void usage(char *name)
+{
+#define HELP(...) fprintf(stderr, __VA_ARGS__);
+	HELP("usage: %s [-trkoh]\n", name);
+
+	HELP(" -t\tmin time per case\t<ms>(default 200)\n");
+	HELP(" -r\trepeats\t\t\t<count>(default 3)\n");
+	HELP(" -k\tonly this kernel\t<name>\n");
+	HELP(" -o\tjson output\t\t<file>(default stdout)\n");
+	HELP(" -h\tshow this help\n");
+#undef HELP
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* cycle counter: perf if allowed, else the tsc on x86 */
+static int perf_fd = -1;
+
+static void cycles_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	perf_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static bool cycles_read(uint64_t *c)
+{
+	if (perf_fd >= 0)
+		return read(perf_fd, c, sizeof(*c)) == sizeof(*c);
+#if defined(__x86_64__) || defined(__i386__)
+	*c = __rdtsc();
+	return true;
+#else
+	return false;
+#endif
+}
+
+/* run a kernel once over a frame, returns bytes read and written */
+static size_t run(const struct kernel_ops *ops, unsigned int k,
+		unsigned int w, unsigned int h, struct frames *f, uint8_t *dst)
+{
+	switch (k) {
+	case K_COPY:
+		ops->copy(dst, 2 * w, f->a, 2 * w, 2 * w, h);
+		return 2 * (size_t)w * h * 2;
+	case K_YUYV_TO_NV12:
+		ops->yuyv_to_nv12(dst, w, dst + w * h, w, f->a, 2 * w, w, h);
+		return (size_t)w * h * 2 + (size_t)w * h * 3 / 2;
+	case K_DOWNSCALE2X:
+		ops->downscale2x(dst, w / 2, f->a, w, w / 2, h / 2);
+		return (size_t)w * h + (size_t)w * h / 4;
+	case K_BLEND:
+		ops->blend(dst, 2 * w, f->a, f->b, 2 * w, 2 * w, h, 77);
+		return 3 * (size_t)w * h * 2;
+	case K_HASH:
+		f->hash = ops->hash(f->a, 2 * w, 2 * w, h);
+		return (size_t)w * h * 2;
+	case K_STATS:
+		/* luma of yuyv against the previous frame */
+		memset(&f->stats, 0, sizeof(f->stats));
+		ops->stats(f->a, f->b, 2 * w, 2 * w, h, 2, &f->stats);
+		return 2 * (size_t)w * h * 2;
+	case K_REMAP:
+		/* luma, the lut is 6 bytes a pixel */
+		ops->remap(dst, w, f->a, LUT_WIDTH, f->offset, f->weight,
+				LUT_WIDTH, w, h, 1);
+		return 8 * (size_t)w * h;
+	case K_LUT3D:
+	default:
+		ops->lut3d(dst, f->a, w * h, &f->lut3d);
+		return 2 * (size_t)w * h * 4;
+	}
+}
+
+/* bytes written by a kernel */
+static size_t output_size(unsigned int k, unsigned int w, unsigned int h)
+{
+	switch (k) {
+	case K_COPY:
+	case K_BLEND:
+		return (size_t)w * h * 2;
+	case K_YUYV_TO_NV12:
+		return (size_t)w * h * 3 / 2;
+	case K_DOWNSCALE2X:
+		return (size_t)w * h / 4;
+	case K_REMAP:
+		return (size_t)w * h;
+	case K_LUT3D:
+		return (size_t)w * h * 4;
+	default:
+		return 0;
+	}
+}
+
+static kernel_copy_t kernel_get(const struct kernel_ops *ops, unsigned int k)
+{
+	const void *fn[K_MAX] = {
+		[K_COPY]		= ops->copy,
+		[K_YUYV_TO_NV12]	= ops->yuyv_to_nv12,
+		[K_DOWNSCALE2X]		= ops->downscale2x,
+		[K_BLEND]		= ops->blend,
+		[K_HASH]		= ops->hash,
+		[K_STATS]		= ops->stats,
+		[K_REMAP]		= ops->remap,
+		[K_LUT3D]		= ops->lut3d,
+	};
+
+	return (kernel_copy_t)fn[k];
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_report report;
+	struct bench_stats gbps_st, cpp_st;
+	struct frames f;
+	const struct kernel_ops *ops;
+	const char *output = NULL, *only = NULL;
+	unsigned int min_ms = 200, repeats = 3;
+	unsigned int k, t, s, r, iters;
+	uint64_t start, end, c0, c1, ref_hash;
+	uint32_t *nodes;
+	struct kernel_stats ref_stats;
+	bool have_cycles, mismatch = false, exact;
+	double *gbps, *cpp;
+	size_t bytes;
+	char name[64];
+	int c;
+
+	while ((c = getopt(argc, argv, "ht:r:k:o:")) != -1) {
+		switch (c) {
+		case 't':
+			min_ms = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeats = strtoul(optarg, NULL, 10);
+			break;
+		case 'k':
+			only = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!repeats) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	f.size = 3840 * 2160 * 4;
+	f.a = aligned_alloc(64, f.size);
+	f.b = aligned_alloc(64, f.size);
+	f.dst = aligned_alloc(64, f.size);
+	f.ref = aligned_alloc(64, f.size);
+	gbps = calloc(repeats, sizeof(*gbps));
+	cpp = calloc(repeats, sizeof(*cpp));
+	f.offset = malloc(LUT_WIDTH * LUT_HEIGHT * sizeof(*f.offset));
+	f.weight = malloc(LUT_WIDTH * LUT_HEIGHT * sizeof(*f.weight));
+	nodes = malloc(LUT3D_SIZE * LUT3D_SIZE * LUT3D_SIZE * sizeof(*nodes));
+	if (!f.a || !f.b || !f.dst || !f.ref || !f.offset || !f.weight ||
+			!nodes || !gbps || !cpp) {
+		fprintf(stderr, "failed to allocate frames\n");
+		return 1;
+	}
+	srand(1);
+	for (s = 0; s < f.size; s++) {
+		f.a[s] = rand();
+		f.b[s] = rand();
+	}
+	/* lens like: a few pixels off the identity, within the plane */
+	for (s = 0; s < LUT_WIDTH * LUT_HEIGHT; s++) {
+		unsigned int x = s % LUT_WIDTH + rand() % 8;
+		unsigned int y = s / LUT_WIDTH + rand() % 8;
+
+		x = x < 4 ? 0 : x - 4 > LUT_WIDTH - 2 ? LUT_WIDTH - 2 : x - 4;
+		y = y < 4 ? 0 : y - 4 > LUT_HEIGHT - 2 ? LUT_HEIGHT - 2 : y - 4;
+		f.offset[s] = y * LUT_WIDTH + x;
+		f.weight[s] = rand();
+	}
+	/* any 10 bit channels, with the pixel order of XR24 */
+	for (s = 0; s < LUT3D_SIZE * LUT3D_SIZE * LUT3D_SIZE; s++)
+		nodes[s] = rand() % 1021 | rand() % 1021 << 10 |
+			rand() % 1021 << 20;
+	f.lut3d.nodes = nodes;
+	f.lut3d.size = LUT3D_SIZE;
+	f.lut3d.scale = (LUT3D_SIZE - 1) * 65536 / 255;
+	f.lut3d.shift[0] = 16;
+	f.lut3d.shift[1] = 8;
+	f.lut3d.shift[2] = 0;
+
+	cycles_open();
+	if (perf_fd >= 0)
+		ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+
+	if (bench_report_open(&report, "kernel", output, repeats) < 0) {
+		fprintf(stderr, "failed to open %s\n", output);
+		return 1;
+	}
+
+	fprintf(stderr, "%-14s %-8s %-6s %10s %12s  %s\n", "kernel", "tier",
+			"size", "GB/s", "cycles/px", "exact");
+	for (k = 0; k < K_MAX; k++) {
+		if (only && strcmp(only, kernel_names[k]))
+			continue;
+		for (t = 0; t < KERNEL_TIER_MAX; t++) {
+			ops = kernel_tier_ops(t);
+			if (!ops || !kernel_get(ops, k) ||
+					!kernel_tier_supported(t))
+				continue;
+			for (s = 0; s < NUM_SIZES; s++) {
+				unsigned int w = sizes[s].width;
+				unsigned int h = sizes[s].height;
+
+				/* reference, then the tier over a dirty dst */
+				memset(f.ref, 0, f.size);
+				run(&kernel_scalar_ops, k, w, h, &f, f.ref);
+				ref_hash = f.hash;
+				ref_stats = f.stats;
+				memset(f.dst, 0x5a, f.size);
+				run(ops, k, w, h, &f, f.dst);
+				if (k == K_HASH)
+					exact = f.hash == ref_hash;
+				else if (k == K_STATS)
+					exact = !memcmp(&f.stats, &ref_stats,
+						sizeof(ref_stats));
+				else
+					exact = !memcmp(f.dst, f.ref,
+						output_size(k, w, h));
+				mismatch |= !exact;
+
+				for (r = 0; r < repeats; r++) {
+					have_cycles = cycles_read(&c0);
+					start = now_ns();
+					iters = 0;
+					bytes = 0;
+					do {
+						bytes += run(ops, k, w, h, &f,
+								f.dst);
+						iters++;
+						end = now_ns();
+					} while (end - start <
+						(uint64_t)min_ms * 1000000ull);
+					have_cycles &= cycles_read(&c1);
+					gbps[r] = bytes / (double)(end - start);
+					cpp[r] = have_cycles ? (c1 - c0) /
+						((double)w * h * iters) : 0;
+				}
+
+				snprintf(name, sizeof(name), "%s/%s/%s/gbps",
+						kernel_names[k],
+						kernel_tier_name(t),
+						sizes[s].name);
+				bench_report_metric(&report, name, "GB/s",
+						BENCH_HIGHER, gbps, repeats);
+				snprintf(name, sizeof(name), "%s/%s/%s/cpp",
+						kernel_names[k],
+						kernel_tier_name(t),
+						sizes[s].name);
+				bench_report_metric(&report, name, "cycles/px",
+						BENCH_LOWER, cpp, repeats);
+
+				bench_stats(gbps, repeats, &gbps_st);
+				bench_stats(cpp, repeats, &cpp_st);
+				fprintf(stderr, "%-14s %-8s %-6s %10.2f %12.3f  %s\n",
+						kernel_names[k],
+						kernel_tier_name(t),
+						sizes[s].name, gbps_st.median,
+						cpp_st.median,
+						exact ? "yes" : "MISMATCH");
+			}
+		}
+	}
+
+	bench_report_close(&report);
+	if (perf_fd >= 0)
+		close(perf_fd);
+
+	return mismatch ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * Signal monitor benchmark for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Feeds the signal monitor(monitor.c) YUYV frames at 720p, 1080p and 4K:
+ * changing noise, which must raise nothing, then a black picture, a still
+ * one and colour bars, which must raise their alarms. Reports the time of
+ * a check and the share of a core it takes at 30 fps with the period given
+ * to the monitor, and fails if an alarm is wrong.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../bridge_priv.h"
+#include "../kernel.h"
+#include "bench.h"
+
+#define NUM_NOISE	4	/* noise frames cycled through */
+#define FPS		30
+
+/* frame sizes */
+static const struct {
+	const char *name;
+	unsigned int width;
+	unsigned int height;
+} sizes[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "4k", 3840, 2160 },
+};
+#define NUM_SIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+/* pictures fed to the monitor, and the alarms they must end in */
+enum {
+	P_NOISE,
+	P_BLACK,
+	P_STILL,
+	P_BARS,
+	P_MAX,
+};
+
+static const struct {
+	const char *name;
+	unsigned int alarms;
+} pictures[P_MAX] = {
+	[P_NOISE]	= { "noise", 0 },
+	[P_BLACK]	= { "black", BRIDGE_ALARM_BLACK | BRIDGE_ALARM_FROZEN },
+	[P_STILL]	= { "still", BRIDGE_ALARM_FROZEN },
+	[P_BARS]	= { "bars", BRIDGE_ALARM_FROZEN |
+				BRIDGE_ALARM_NO_SIGNAL },
+};
+
+static void usage(char *name)
+{
+#define HELP(...) fprintf(stderr, __VA_ARGS__);
+	HELP("usage: %s [-prfoh]\n", name);
+
+	HELP(" -p\tmonitor period\t\t<frames>(default 5)\n");
+	HELP(" -r\trepeats\t\t\t<count>(default 3)\n");
+	HELP(" -f\tframes per picture\t<count>(default 300)\n");
+	HELP(" -o\tjson output\t\t<file>(default stdout)\n");
+	HELP(" -h\tshow this help\n");
+#undef HELP
+}
+
+/* yuyv of picture p, noise frames differ by seed */
+static void fill(uint8_t *f, unsigned int w, unsigned int h, unsigned int p,
+		unsigned int seed)
+{
+	static const uint8_t bars[8][2] = {
+		{ 180, 128 }, { 168, 44 }, { 145, 147 }, { 133, 63 },
+		{ 63, 193 }, { 51, 109 }, { 28, 212 }, { 16, 128 },
+	};
+	unsigned int x, y;
+	uint8_t *l;
+
+	srand(seed);
+	for (y = 0; y < h; y++) {
+		l = f + (size_t)y * w * 2;
+		for (x = 0; x < w * 2; x += 2) {
+			switch (p) {
+			case P_BLACK:
+				l[x] = 16 + rand() % 3;
+				l[x + 1] = 128;
+				break;
+			case P_BARS:
+				l[x] = bars[x / 2 * 8 / w][0];
+				l[x + 1] = bars[x / 2 * 8 / w][1];
+				break;
+			default:
+				l[x] = 16 + rand() % 220;
+				l[x + 1] = 16 + rand() % 225;
+				break;
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_report report;
+	struct bench_stats check_st, cpu_st;
+	struct config c;
+	struct monitor mon;
+	const char *output = NULL;
+	unsigned int period = 5, repeats = 3, frames = 300;
+	unsigned int s, r, p, i, alarms[NUM_SIZES][P_MAX];
+	uint8_t *noise[NUM_NOISE], *still, *pic;
+	bool wrong = false, ok;
+	double *check, *cpu;
+	char name[64], args[16];
+	size_t size;
+	int ch, fd;
+
+	while ((ch = getopt(argc, argv, "hp:r:f:o:")) != -1) {
+		switch (ch) {
+		case 'p':
+			period = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeats = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			frames = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!period || !repeats || frames < period * (MONITOR_HOLD + 2)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	kernel_init();
+	size = 3840 * 2160 * 2;
+	for (i = 0, pic = still = malloc(size); pic && i < NUM_NOISE; i++)
+		pic = noise[i] = malloc(size);
+	check = calloc(NUM_SIZES * repeats, sizeof(*check));
+	cpu = calloc(NUM_SIZES * repeats, sizeof(*cpu));
+	if (!pic || !check || !cpu) {
+		fprintf(stderr, "failed to allocate frames\n");
+		return 1;
+	}
+
+	/* the monitor reports alarms on stdout, which may be the report */
+	fflush(stdout);
+	fd = dup(STDOUT_FILENO);
+	if (fd < 0 || !freopen("/dev/null", "w", stdout))
+		return 1;
+
+	snprintf(args, sizeof(args), "%u", period);
+	for (s = 0; s < NUM_SIZES; s++) {
+		unsigned int w = sizes[s].width;
+		unsigned int h = sizes[s].height;
+
+		memset(&c, 0, sizeof(c));
+		c.format.width = w;
+		c.format.height = h;
+		c.format.pixelformat = V4L2_PIX_FMT_YUYV;
+		c.planes[0].bytesperline = w * 2;
+		for (i = 0; i < NUM_NOISE; i++)
+			fill(noise[i], w, h, P_NOISE, i + 1);
+
+		for (r = 0; r < repeats; r++) {
+			memset(&mon, 0, sizeof(mon));
+			monitor_parse_args(&mon, args);
+			monitor_init(&mon, sizes[s].name);
+			for (p = 0; p < P_MAX; p++) {
+				if (p != P_NOISE)
+					fill(still, w, h, p, 1);
+				for (i = 0; i < frames; i++) {
+					pic = p == P_NOISE ?
+						noise[i % NUM_NOISE] : still;
+					monitor_frame(&mon, &c, pic);
+				}
+				alarms[s][p] = mon.alarms;
+			}
+			check[s * repeats + r] = mon.ns / 1000.0 / mon.checks;
+			cpu[s * repeats + r] = check[s * repeats + r] * FPS /
+				period / 1e4;
+			monitor_exit(&mon);
+		}
+	}
+
+	fflush(stdout);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	if (bench_report_open(&report, "monitor", output, repeats) < 0) {
+		fprintf(stderr, "failed to open %s\n", output);
+		return 1;
+	}
+
+	fprintf(stderr, "%-6s %10s %10s  %s\n", "size", "check(us)",
+			"cpu(%)", "alarms");
+	for (s = 0; s < NUM_SIZES; s++) {
+		ok = true;
+		for (p = 0; p < P_MAX; p++)
+			ok &= alarms[s][p] == pictures[p].alarms;
+		wrong |= !ok;
+
+		snprintf(name, sizeof(name), "%s/check", sizes[s].name);
+		bench_report_metric(&report, name, "us", BENCH_LOWER,
+				&check[s * repeats], repeats);
+		snprintf(name, sizeof(name), "%s/cpu", sizes[s].name);
+		bench_report_metric(&report, name, "%cpu", BENCH_LOWER,
+				&cpu[s * repeats], repeats);
+
+		bench_stats(&check[s * repeats], repeats, &check_st);
+		bench_stats(&cpu[s * repeats], repeats, &cpu_st);
+		fprintf(stderr, "%-6s %10.1f %10.3f  %s\n", sizes[s].name,
+				check_st.median, cpu_st.median,
+				ok ? "yes" : "WRONG");
+		for (p = 0; !ok && p < P_MAX; p++)
+			fprintf(stderr, "\t%s: 0x%x, expected 0x%x\n",
+					pictures[p].name, alarms[s][p],
+					pictures[p].alarms);
+	}
+
+	bench_report_close(&report);
+	for (i = 0; i < NUM_NOISE; i++)
+		free(noise[i]);
+	free(still);
+	free(check);
+	free(cpu);
+
+	return wrong ? 1 : 0;
+}
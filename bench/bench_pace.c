@@ -0,0 +1,239 @@
+/*
+ * Pacing accuracy benchmark for the V4L2 bridge frame rate limiter
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Runs the limiter of stream_on() against a fake source which produces
+ * frames from a periodic timer, as a sensor running faster than the target
+ * would. Output frame intervals are recorded for a grid of target rates and
+ * reported per pacing implementation.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <math.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "../pace.h"
+#include "bench.h"
+
+static const double rates[] = {
+	5, 10, 15, 24, 25, 29.97, 30, 50, 59.94, 60, 90, 120, 144, 240,
+};
+#define NUM_RATES	(sizeof(rates) / sizeof(rates[0]))
+
+/* per frame metrics */
+enum {
+	M_MEAN_ERROR,
+	M_JITTER,
+	M_MAX_DEV,
+	M_DRIFT,
+	M_MAX,
+};
+
+static const char *metric_names[M_MAX] = {
+	[M_MEAN_ERROR]	= "mean_error",
+	[M_JITTER]	= "jitter",
+	[M_MAX_DEV]	= "max_dev",
+	[M_DRIFT]	= "drift",
+};
+
+static const char *metric_units[M_MAX] = {
+	[M_MEAN_ERROR]	= "us",
+	[M_JITTER]	= "us",
+	[M_MAX_DEV]	= "us",
+	[M_DRIFT]	= "ppm",
+};
+
+static void usage(char *name)
+{
+#define HELP(...) fprintf(stderr, __VA_ARGS__);
+	HELP("usage: %s [-fsroh]\n", name);
+
+	HELP(" -f\tframes per rate\t\t<count>(default 50)\n");
+	HELP(" -s\tfake source rate\t<fps>(default 1000)\n");
+	HELP(" -r\trepeats\t\t\t<count>(default 3)\n");
+	HELP(" -o\tjson output\t\t<file>(default stdout)\n");
+	HELP(" -h\tshow this help\n");
+#undef HELP
+}
+
+/* open fake source which has a frame ready every period */
+static int source_open(double fps)
+{
+	struct itimerspec its;
+	uint64_t ns = (uint64_t)(1000000000.0 / fps);
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = ns / 1000000000ull;
+	its.it_interval.tv_nsec = ns % 1000000000ull;
+	its.it_value = its.it_interval;
+	timerfd_settime(fd, 0, &its, NULL);
+
+	return fd;
+}
+
+/* run a stream loop and record release time of each frame */
+static void run_stream(int src, struct pace *p, uint64_t *t, unsigned int n)
+{
+	struct pollfd fds[] = {
+		{.fd = src, .events = POLLIN},
+	};
+	uint64_t expired;
+	unsigned int i = 0;
+
+	while (i < n && poll(fds, 1, 5000) > 0) {
+		if (fds[0].revents & POLLIN) {
+			/* same order as stream_on(): pace, dequeue, queue */
+			pace_wait(p);
+			if (read(src, &expired, sizeof(expired)) < 0)
+				break;
+			t[i++] = pace_now_ns();
+		}
+	}
+}
+
+/* compute metrics of one run */
+static void analyze(const uint64_t *t, unsigned int n, double fps,
+		double *m)
+{
+	double period = 1000000.0 / fps;
+	double sum = 0, sum_abs = 0, sq = 0, max = 0;
+	double mean, elapsed, d;
+	unsigned int i;
+
+	for (i = 1; i < n; i++) {
+		d = (t[i] - t[i - 1]) / 1000.0;
+		sum += d;
+		sum_abs += fabs(d - period);
+		if (fabs(d - period) > max)
+			max = fabs(d - period);
+	}
+	mean = sum / (n - 1);
+	for (i = 1; i < n; i++) {
+		d = (t[i] - t[i - 1]) / 1000.0;
+		sq += (d - mean) * (d - mean);
+	}
+	elapsed = (t[n - 1] - t[0]) / 1000.0;
+
+	m[M_MEAN_ERROR] = sum_abs / (n - 1);
+	m[M_JITTER] = n > 2 ? sqrt(sq / (n - 2)) : 0;
+	m[M_MAX_DEV] = max;
+	m[M_DRIFT] = fabs(elapsed - period * (n - 1)) / elapsed * 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_report report;
+	struct bench_stats st[M_MAX];
+	struct pace p;
+	const char *output = NULL;
+	unsigned int frames = 50, repeats = 3;
+	double src_fps = 1000;
+	double *samples;
+	double m[M_MAX];
+	uint64_t *t;
+	unsigned int mode, r, i, k;
+	char name[64];
+	int src, c;
+
+	while ((c = getopt(argc, argv, "hf:s:r:o:")) != -1) {
+		switch (c) {
+		case 'f':
+			frames = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			src_fps = strtod(optarg, NULL);
+			break;
+		case 'r':
+			repeats = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (frames < 3 || !repeats || src_fps <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	samples = calloc(PACE_MAX * NUM_RATES * M_MAX * repeats,
+			sizeof(*samples));
+	t = calloc(frames, sizeof(*t));
+	src = source_open(src_fps);
+	if (!samples || !t || src < 0) {
+		fprintf(stderr, "failed to set up fake source\n");
+		return 1;
+	}
+#define SAMPLE(mode, rate, metric) \
+	(&samples[(((mode) * NUM_RATES + (rate)) * M_MAX + (metric)) * repeats])
+
+	for (r = 0; r < repeats; r++) {
+		for (mode = 0; mode < PACE_MAX; mode++) {
+			for (i = 0; i < NUM_RATES; i++) {
+				pace_init(&p, mode, rates[i]);
+				run_stream(src, &p, t, frames);
+				analyze(t, frames, rates[i], m);
+				for (k = 0; k < M_MAX; k++)
+					SAMPLE(mode, i, k)[r] = m[k];
+			}
+		}
+	}
+
+	if (bench_report_open(&report, "pace", output, repeats) < 0) {
+		fprintf(stderr, "failed to open %s\n", output);
+		return 1;
+	}
+
+	fprintf(stderr, "%-10s %8s %12s %12s %12s %12s\n", "pacing", "fps",
+			"mean_err(us)", "jitter(us)", "max_dev(us)",
+			"drift(ppm)");
+	for (mode = 0; mode < PACE_MAX; mode++) {
+		for (i = 0; i < NUM_RATES; i++) {
+			for (k = 0; k < M_MAX; k++) {
+				snprintf(name, sizeof(name), "%s/%g/%s",
+						pace_mode_name(mode), rates[i],
+						metric_names[k]);
+				bench_report_metric(&report, name,
+						metric_units[k], BENCH_LOWER,
+						SAMPLE(mode, i, k), repeats);
+				bench_stats(SAMPLE(mode, i, k), repeats, &st[k]);
+			}
+			fprintf(stderr, "%-10s %8g %12.1f %12.1f %12.1f %12.1f\n",
+					pace_mode_name(mode), rates[i],
+					st[M_MEAN_ERROR].median,
+					st[M_JITTER].median,
+					st[M_MAX_DEV].median,
+					st[M_DRIFT].median);
+		}
+	}
+#undef SAMPLE
+
+	bench_report_close(&report);
+	close(src);
+	free(samples);
+	free(t);
+
+	return 0;
+}
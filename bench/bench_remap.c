@@ -0,0 +1,243 @@
+/*
+ * Lens correction remap benchmark for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Sets up the remap stage(remap.c) for a fisheye lens on 720p, 1080p and 4K
+ * NV12 frames, once generating the lut into an empty cache directory and
+ * once loading it from there, and checks that both luts are the same. Then
+ * remaps frames on one core and reports megapixels per second, the
+ * throughput per core of the stage.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../bridge_priv.h"
+#include "../kernel.h"
+#include "bench.h"
+
+/* frame sizes */
+static const struct {
+	const char *name;
+	unsigned int width;
+	unsigned int height;
+} sizes[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "4k", 3840, 2160 },
+};
+#define NUM_SIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+/* the stage runs on its own here, frames aren't mapped through streams */
+void *bridge_frame_map(struct bridge_stream *s, struct bridge_frame *f)
+{
+	return f->data;
+}
+
+/* nor written into buffers of an output device */
+struct buffer *stage_pool_get(struct stage_pool *pool)
+{
+	return NULL;
+}
+
+void stage_pool_sync(struct buffer *b, unsigned int flags)
+{
+}
+
+void workers_run(struct workers *w, struct task **tasks, unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++)
+		tasks[i]->run(tasks[i]);
+}
+
+static void usage(char *name)
+{
+#define HELP(...) fprintf(stderr, __VA_ARGS__);
+	HELP("usage: %s [-lrfoh]\n", name);
+
+	HELP(" -l\tlens\t\t\t<remap args>(default fisheye,fov=190)\n");
+	HELP(" -r\trepeats\t\t\t<count>(default 3)\n");
+	HELP(" -f\tframes per repeat\t<count>(default 30)\n");
+	HELP(" -o\tjson output\t\t<file>(default stdout)\n");
+	HELP(" -h\tshow this help\n");
+#undef HELP
+}
+
+/* remove cache files, so the next setup generates the lut */
+static void clean(const char *dir)
+{
+	char path[512];
+	struct dirent *e;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		return;
+	while ((e = readdir(d)))
+		if (e->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+			unlink(path);
+		}
+	closedir(d);
+}
+
+/* set up stage for config, with the lut in cache, returns ms it took */
+static double setup(struct remap *rm, const char *lens, const char *cache,
+		struct config *c)
+{
+	char args[512];
+
+	memset(rm, 0, sizeof(*rm));
+	snprintf(args, sizeof(args), "%s,cache=%s", lens, cache);
+	if (remap_parse_args(rm, args) < 0 ||
+			remap_format(rm, c, c->planes[0].bytesperline,
+				c->planes[0].bytesperline) < 0) {
+		fprintf(stderr, "can't remap %s\n", args);
+		exit(1);
+	}
+
+	return rm->lut_ns / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_report report;
+	struct bench_stats gen_st, load_st, mpix_st;
+	struct remap gen, load;
+	struct config c;
+	const char *output = NULL, *lens = "fisheye,fov=190";
+	unsigned int repeats = 3, frames = 30;
+	unsigned int s, r, i;
+	double *generate, *loaded, *mpix;
+	bool same[NUM_SIZES], wrong = false;
+	char dir[] = "/tmp/bench_remap.XXXXXX", name[64];
+	uint8_t *src, *dst;
+	uint64_t start;
+	size_t size;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "hl:r:f:o:")) != -1) {
+		switch (ch) {
+		case 'l':
+			lens = optarg;
+			break;
+		case 'r':
+			repeats = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			frames = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!repeats || !frames) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	kernel_init();
+	size = 3840 * 2160 * 3 / 2;
+	src = malloc(size);
+	dst = malloc(size);
+	generate = calloc(NUM_SIZES * repeats, sizeof(*generate));
+	loaded = calloc(NUM_SIZES * repeats, sizeof(*loaded));
+	mpix = calloc(NUM_SIZES * repeats, sizeof(*mpix));
+	if (!src || !dst || !generate || !loaded || !mpix || !mkdtemp(dir)) {
+		fprintf(stderr, "failed to allocate frames\n");
+		return 1;
+	}
+	srand(1);
+	for (i = 0; i < size; i++)
+		src[i] = rand();
+
+	for (s = 0; s < NUM_SIZES; s++) {
+		unsigned int w = sizes[s].width;
+		unsigned int h = sizes[s].height;
+		unsigned int k = s * repeats;
+
+		memset(&c, 0, sizeof(c));
+		c.format.width = w;
+		c.format.height = h;
+		c.format.pixelformat = V4L2_PIX_FMT_NV12;
+		c.num_planes = 1;
+		c.planes[0].bytesperline = w;
+		c.planes[0].sizeimage = w * h * 3 / 2;
+
+		same[s] = true;
+		for (r = 0; r < repeats; r++) {
+			clean(dir);
+			generate[k + r] = setup(&gen, lens, dir, &c);
+			loaded[k + r] = setup(&load, lens, dir, &c);
+			same[s] &= load.loaded && gen.lut_size == load.lut_size &&
+				!memcmp(gen.lut, load.lut, gen.lut_size);
+			remap_close(&gen);
+
+			start = timing_now();
+			for (i = 0; i < frames; i++)
+				remap_stripe(&load, src, dst, 0, h);
+			mpix[k + r] = (double)w * h * frames * 1000 /
+				(timing_now() - start);
+			remap_close(&load);
+		}
+		wrong |= !same[s];
+	}
+	clean(dir);
+	rmdir(dir);
+
+	if (bench_report_open(&report, "remap", output, repeats) < 0) {
+		fprintf(stderr, "failed to open %s\n", output);
+		return 1;
+	}
+
+	fprintf(stderr, "%-6s %12s %10s %12s  %s\n", "size", "generate(ms)",
+			"load(ms)", "mpix/s/core", "same");
+	for (s = 0; s < NUM_SIZES; s++) {
+		unsigned int k = s * repeats;
+
+		snprintf(name, sizeof(name), "%s/generate", sizes[s].name);
+		bench_report_metric(&report, name, "ms", BENCH_LOWER,
+				&generate[k], repeats);
+		snprintf(name, sizeof(name), "%s/load", sizes[s].name);
+		bench_report_metric(&report, name, "ms", BENCH_LOWER,
+				&loaded[k], repeats);
+		snprintf(name, sizeof(name), "%s/mpix", sizes[s].name);
+		bench_report_metric(&report, name, "Mpix/s", BENCH_HIGHER,
+				&mpix[k], repeats);
+
+		bench_stats(&generate[k], repeats, &gen_st);
+		bench_stats(&loaded[k], repeats, &load_st);
+		bench_stats(&mpix[k], repeats, &mpix_st);
+		fprintf(stderr, "%-6s %12.1f %10.2f %12.1f  %s\n",
+				sizes[s].name, gen_st.median, load_st.median,
+				mpix_st.median, same[s] ? "yes" : "MISMATCH");
+	}
+
+	bench_report_close(&report);
+	free(src);
+	free(dst);
+	free(generate);
+	free(loaded);
+	free(mpix);
+
+	return wrong ? 1 : 0;
+}
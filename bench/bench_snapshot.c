@@ -0,0 +1,294 @@
+/*
+ * Snapshot benchmark for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Runs the forwarding side of snapshots(snapshot_take() when a frame is
+ * forwarded, snapshot_hold() when it comes back from output) in a loop over
+ * YUYV frames in memfds at 720p, 1080p and 4K, without snapshots and with
+ * one taken as soon as the previous one is written. Reports the time the
+ * forwarding loop spends per frame in both cases, how long a snapshot keeps
+ * a buffer from the input, and the time of conversion and write.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../bridge_priv.h"
+#include "../kernel.h"
+#include "bench.h"
+
+#define NUM_BUFFERS	4
+
+/* frame sizes */
+static const struct {
+	const char *name;
+	unsigned int width;
+	unsigned int height;
+} sizes[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "4k", 3840, 2160 },
+};
+#define NUM_SIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+/* metrics of a size */
+enum {
+	M_IDLE_P99,
+	M_SNAP_P99,
+	M_SNAP_MAX,
+	M_HOLD,
+	M_WRITE,
+	M_MAX,
+};
+
+static const char *metric_names[M_MAX] = {
+	[M_IDLE_P99]	= "forward_p99_idle",
+	[M_SNAP_P99]	= "forward_p99_snapshot",
+	[M_SNAP_MAX]	= "forward_max_snapshot",
+	[M_HOLD]	= "hold",
+	[M_WRITE]	= "write",
+};
+
+static const char *metric_units[M_MAX] = {
+	[M_IDLE_P99]	= "ns",
+	[M_SNAP_P99]	= "ns",
+	[M_SNAP_MAX]	= "ns",
+	[M_HOLD]	= "us",
+	[M_WRITE]	= "ms",
+};
+
+/* buffers held back by a snapshot, given back by its thread */
+static volatile int held[NUM_BUFFERS];
+
+static void usage(char *name)
+{
+#define HELP(...) fprintf(stderr, __VA_ARGS__);
+	HELP("usage: %s [-ndproh]\n", name);
+
+	HELP(" -n\tsnapshots per run\t<count>(default 5)\n");
+	HELP(" -d\timage directory\t\t<dir>(default /tmp)\n");
+	HELP(" -p\twrite png\n");
+	HELP(" -r\trepeats\t\t\t<count>(default 3)\n");
+	HELP(" -o\tjson output\t\t<file>(default stdout)\n");
+	HELP(" -h\tshow this help\n");
+#undef HELP
+}
+
+static void release(void *priv, struct buffer *b)
+{
+	held[b->index] = 0;
+}
+
+/* yuyv frames in memfds, as the dmabufs of a stream */
+static int buffers_open(struct buffer *bs, unsigned int w, unsigned int h)
+{
+	size_t size = (size_t)w * h * 2;
+	unsigned int i;
+	uint8_t *p;
+
+	memset(bs, 0, sizeof(*bs) * NUM_BUFFERS);
+	for (i = 0; i < NUM_BUFFERS; i++) {
+		bs[i].index = i;
+		bs[i].frame.size = size;
+		bs[i].dbuf_fd[0] = memfd_create("frame", 0);
+		if (bs[i].dbuf_fd[0] < 0 || ftruncate(bs[i].dbuf_fd[0], size))
+			return -1;
+		p = mmap(NULL, size, PROT_WRITE, MAP_SHARED, bs[i].dbuf_fd[0],
+				0);
+		if (p == MAP_FAILED)
+			return -1;
+		memset(p, 0x80 + i * 16, size);
+		munmap(p, size);
+	}
+
+	return 0;
+}
+
+static void buffers_close(struct buffer *bs)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_BUFFERS; i++)
+		close(bs[i].dbuf_fd[0]);
+}
+
+/* forward frames of format until num snapshots are written(0: for frames),
+ * returns frames forwarded */
+static uint64_t run_stream(struct snapshot *sn, struct buffer *bs,
+		const struct v4l2_pix_format *format, unsigned int num,
+		uint64_t frames, struct latency *l)
+{
+	struct buffer *b;
+	uint64_t i, start;
+
+	memset(l, 0, sizeof(*l));
+	for (i = 0; num ? sn->written + sn->failed < num : i < frames; i++) {
+		b = &bs[i % NUM_BUFFERS];
+		/* the input doesn't have it yet */
+		if (held[b->index])
+			continue;
+		if (num && sn->taken == sn->written + sn->failed &&
+				sn->taken < num)
+			snapshot_arm(sn);
+
+		b->frame.sequence = sn->taken;
+
+		/* what stream_forward() and stream_requeue() add, marked held
+		 * first as the thread may give it back right after */
+		start = timing_now();
+		snapshot_take(sn, b, format, b->frame.sequence);
+		held[b->index] = 1;
+		if (!snapshot_hold(sn, b))
+			held[b->index] = 0;
+		latency_add(l, timing_now() - start);
+	}
+
+	return i;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_report report;
+	struct bench_stats st[M_MAX];
+	struct buffer bs[NUM_BUFFERS];
+	struct snapshot sn;
+	struct v4l2_pix_format format;
+	struct latency l;
+	const char *output = NULL, *dir = "/tmp";
+	unsigned int num = 5, repeats = 3;
+	unsigned int s, r, k, i;
+	uint64_t frames;
+	double *samples;
+	bool png = false;
+	char name[64], path[320];
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "hn:d:pr:o:")) != -1) {
+		switch (c) {
+		case 'n':
+			num = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'p':
+			png = true;
+			break;
+		case 'r':
+			repeats = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!num || !repeats) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	kernel_init();
+	samples = calloc(NUM_SIZES * M_MAX * repeats, sizeof(*samples));
+	if (!samples)
+		return 1;
+#define SAMPLE(size, metric) \
+	(&samples[((size) * M_MAX + (metric)) * repeats])
+
+	/* the thread reports each image on stdout, which may be the report */
+	fflush(stdout);
+	fd = dup(STDOUT_FILENO);
+	if (fd < 0 || !freopen("/dev/null", "w", stdout))
+		return 1;
+
+	for (r = 0; r < repeats; r++) {
+		for (s = 0; s < NUM_SIZES; s++) {
+			if (buffers_open(bs, sizes[s].width,
+						sizes[s].height) < 0) {
+				fprintf(stderr, "failed to set up frames\n");
+				return 1;
+			}
+			memset(&sn, 0, sizeof(sn));
+			snprintf(path, sizeof(path), "%s/bench_snapshot.%s",
+					dir, png ? "png" : "ppm");
+			snapshot_parse_args(&sn, path);
+			memset(&format, 0, sizeof(format));
+			format.width = sizes[s].width;
+			format.height = sizes[s].height;
+			format.pixelformat = V4L2_PIX_FMT_YUYV;
+			format.bytesperline = sizes[s].width * 2;
+			format.sizeimage = bs[0].frame.size;
+			snapshot_start(&sn, release, NULL);
+
+			frames = run_stream(&sn, bs, &format, num, 0, &l);
+			SAMPLE(s, M_SNAP_P99)[r] = latency_percentile(&l, 0.99);
+			SAMPLE(s, M_SNAP_MAX)[r] = l.max;
+			SAMPLE(s, M_HOLD)[r] = sn.hold_ns / 1e3 / sn.taken;
+			SAMPLE(s, M_WRITE)[r] = sn.write_ns / 1e6 / sn.taken;
+
+			/* as many frames without snapshots */
+			run_stream(&sn, bs, &format, 0, frames, &l);
+			SAMPLE(s, M_IDLE_P99)[r] = latency_percentile(&l, 0.99);
+
+			snapshot_stop(&sn);
+			buffers_close(bs);
+			if (sn.failed) {
+				fprintf(stderr, "failed to write snapshots\n");
+				return 1;
+			}
+			for (i = 0; i < num; i++) {
+				snprintf(path, sizeof(path), "%s-%u.%s",
+						sn.prefix, i, png ? "png" : "ppm");
+				unlink(path);
+			}
+		}
+	}
+
+	fflush(stdout);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	if (bench_report_open(&report, "snapshot", output, repeats) < 0) {
+		fprintf(stderr, "failed to open %s\n", output);
+		return 1;
+	}
+
+	fprintf(stderr, "%-6s %14s %14s %14s %10s %10s\n", "size",
+			"idle_p99(ns)", "snap_p99(ns)", "snap_max(ns)",
+			"hold(us)", "write(ms)");
+	for (s = 0; s < NUM_SIZES; s++) {
+		for (k = 0; k < M_MAX; k++) {
+			snprintf(name, sizeof(name), "%s/%s", sizes[s].name,
+					metric_names[k]);
+			bench_report_metric(&report, name, metric_units[k],
+					BENCH_LOWER, SAMPLE(s, k), repeats);
+			bench_stats(SAMPLE(s, k), repeats, &st[k]);
+		}
+		fprintf(stderr, "%-6s %14.0f %14.0f %14.0f %10.1f %10.1f\n",
+				sizes[s].name, st[M_IDLE_P99].median,
+				st[M_SNAP_P99].median, st[M_SNAP_MAX].median,
+				st[M_HOLD].median, st[M_WRITE].median);
+	}
+#undef SAMPLE
+
+	bench_report_close(&report);
+	free(samples);
+
+	return 0;
+}
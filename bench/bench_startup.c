@@ -0,0 +1,278 @@
+/*
+ * Startup and teardown time benchmark for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Starts the bridge cold with 1 to 32 streams, lets every stream forward a
+ * few frames and shuts it down through manager_off()/manager_exit(). The
+ * phase timing dumped by the bridge(-t) is collected per stream count.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../timing.h"
+#include "bench.h"
+
+#define MAX_STREAMS	32
+
+static const unsigned int grid[] = { 1, 2, 4, 8, 16, 32 };
+#define NUM_GRID	(sizeof(grid) / sizeof(grid[0]))
+
+/* summary metrics next to the phases */
+enum {
+	M_STARTUP = PHASE_MAX,		/* epoch to first frame of all streams */
+	M_MAX,
+};
+
+static void usage(char *name)
+{
+#define HELP(...) fprintf(stderr, __VA_ARGS__);
+	HELP("usage: %s [-bSFcrwoh]\n", name);
+
+	HELP(" -b\tbridge binary\t\t<path>(default ./v4l2_bridge)\n");
+	HELP(" -S\tstream config\t\t<bridge -S config>(repeat per stream)\n");
+	HELP(" -F\tstream config file\t<file>(one config per line)\n");
+	HELP(" -c\tframes per stream\t<count>(default 1)\n");
+	HELP(" -r\trepeats\t\t\t<count>(default 3)\n");
+	HELP(" -w\ttimeout per run\t\t<seconds>(default 20)\n");
+	HELP(" -o\tjson output\t\t<file>(default stdout)\n");
+	HELP(" -h\tshow this help\n");
+	HELP(" each stream needs its own devices, ex, vivid with n_devs=32\n");
+#undef HELP
+}
+
+/* read configs from file, '#' starts a comment */
+static int read_configs(const char *path, char **cfgs, int n)
+{
+	char line[256];
+	FILE *fp;
+	char *p;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	while (n < MAX_STREAMS && fgets(line, sizeof(line), fp)) {
+		p = strpbrk(line, "#\r\n");
+		if (p)
+			*p = '\0';
+		if (line[0])
+			cfgs[n++] = strdup(line);
+	}
+	fclose(fp);
+
+	return n;
+}
+
+/* run the bridge once, returns 0 if it exited cleanly */
+static int run_bridge(const char *bridge, char **cfgs, unsigned int n,
+		unsigned int count, const char *timing, unsigned int timeout)
+{
+	char *argv[8 + 2 * MAX_STREAMS];
+	char num[16], cnt[16];
+	struct timespec ts = { .tv_nsec = 10000000 };
+	unsigned int i, waited;
+	int argc = 0, status;
+	pid_t pid;
+
+	snprintf(num, sizeof(num), "%u", n);
+	snprintf(cnt, sizeof(cnt), "%u", count);
+	argv[argc++] = (char *)bridge;
+	argv[argc++] = "-n";
+	argv[argc++] = num;
+	for (i = 0; i < n; i++) {
+		argv[argc++] = "-S";
+		argv[argc++] = cfgs[i];
+	}
+	argv[argc++] = "-c";
+	argv[argc++] = cnt;
+	argv[argc++] = "-t";
+	argv[argc++] = (char *)timing;
+	argv[argc] = NULL;
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (!pid) {
+		/* keep the bridge quiet, its format logs are not of interest */
+		if (!freopen("/dev/null", "w", stdout))
+			_exit(127);
+		execv(bridge, argv);
+		_exit(127);
+	}
+
+	for (waited = 0; waitpid(pid, &status, WNOHANG) == 0; waited++) {
+		if (waited >= timeout * 100) {
+			kill(pid, SIGKILL);
+			waitpid(pid, &status, 0);
+			return -1;
+		}
+		nanosleep(&ts, NULL);
+	}
+
+	return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+}
+
+/* fold the timing dump into metrics(us, startup in ms) */
+static int collect(const char *timing, unsigned int n, double *m)
+{
+	unsigned long long ns, at;
+	char who[16], phase[32];
+	unsigned int cnt[PHASE_MAX] = { 0 };
+	double sum[PHASE_MAX] = { 0 };
+	char line[128];
+	FILE *fp;
+	int i;
+
+	fp = fopen(timing, "r");
+	if (!fp)
+		return -1;
+
+	memset(m, 0, sizeof(*m) * M_MAX);
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%15s %31s %llu %llu", who, phase, &ns, &at)
+				!= 4)
+			continue;
+		i = timing_phase_parse(phase);
+		if (i < 0)
+			continue;
+		sum[i] += ns / 1000.0;
+		cnt[i]++;
+		if (i == PHASE_FIRST_FRAME && at / 1000000.0 > m[M_STARTUP])
+			m[M_STARTUP] = at / 1000000.0;
+	}
+	fclose(fp);
+
+	for (i = 0; i < PHASE_MAX; i++)
+		m[i] = cnt[i] ? sum[i] / cnt[i] : 0;
+	m[PHASE_SHUTDOWN] /= 1000.0;
+
+	return cnt[PHASE_FIRST_FRAME] == n ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_report report;
+	struct bench_stats st;
+	const char *bridge = "./v4l2_bridge";
+	const char *output = NULL;
+	char *cfgs[MAX_STREAMS];
+	char timing[] = "/tmp/bench_startup.XXXXXX";
+	unsigned int count = 1, repeats = 3, timeout = 20;
+	unsigned int g, r, k, num_grid;
+	double *samples;
+	double m[M_MAX];
+	char name[64];
+	int num_cfgs = 0;
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "hb:S:F:c:r:w:o:")) != -1) {
+		switch (c) {
+		case 'b':
+			bridge = optarg;
+			break;
+		case 'S':
+			if (num_cfgs < MAX_STREAMS)
+				cfgs[num_cfgs++] = optarg;
+			break;
+		case 'F':
+			num_cfgs = read_configs(optarg, cfgs, num_cfgs);
+			if (num_cfgs < 0) {
+				fprintf(stderr, "failed to read %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'c':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeats = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			timeout = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (!num_cfgs || !count || !repeats) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (num_grid = 0; num_grid < NUM_GRID; num_grid++)
+		if (grid[num_grid] > (unsigned int)num_cfgs)
+			break;
+
+	fd = mkstemp(timing);
+	if (fd < 0) {
+		fprintf(stderr, "failed to create timing file\n");
+		return 1;
+	}
+	close(fd);
+
+	samples = calloc(NUM_GRID * M_MAX * repeats, sizeof(*samples));
+#define SAMPLE(g, metric) (&samples[((g) * M_MAX + (metric)) * repeats])
+
+	for (r = 0; r < repeats; r++) {
+		for (g = 0; g < num_grid; g++) {
+			if (run_bridge(bridge, cfgs, grid[g], count, timing,
+						timeout) ||
+					collect(timing, grid[g], m)) {
+				fprintf(stderr, "run with %u streams failed\n",
+						grid[g]);
+				unlink(timing);
+				return 1;
+			}
+			for (k = 0; k < M_MAX; k++)
+				SAMPLE(g, k)[r] = m[k];
+		}
+	}
+	unlink(timing);
+
+	if (bench_report_open(&report, "startup", output, repeats) < 0) {
+		fprintf(stderr, "failed to open %s\n", output);
+		return 1;
+	}
+
+	fprintf(stderr, "%-8s %-12s %12s\n", "streams", "phase", "median");
+	for (g = 0; g < num_grid; g++) {
+		for (k = 0; k < M_MAX; k++) {
+			const char *phase = k == M_STARTUP ? "startup" :
+				timing_phase_name(k);
+			const char *unit = k == M_STARTUP ||
+				k == PHASE_SHUTDOWN ? "ms" : "us";
+
+			snprintf(name, sizeof(name), "%u/%s", grid[g], phase);
+			bench_report_metric(&report, name, unit, BENCH_LOWER,
+					SAMPLE(g, k), repeats);
+			bench_stats(SAMPLE(g, k), repeats, &st);
+			fprintf(stderr, "%-8u %-12s %10.1f%s\n", grid[g], phase,
+					st.median, unit);
+		}
+	}
+#undef SAMPLE
+
+	bench_report_close(&report);
+	free(samples);
+
+	return 0;
+}
@@ -0,0 +1,2148 @@
+/*
+ * Bridge engine which transfers buffers between V4L2 pipelines
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ * Author: hyun woo kwon <hyunk@xilinx.com>
+ *
+ * Description:
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+
+#include "bridge_priv.h"
+#include "kernel.h"
+
+/*
+ * video device operations
+ */
+
+/* metadata of capture buffers which output devices take as well */
+#define BUF_FLAGS_PROPAGATE	(V4L2_BUF_FLAG_KEYFRAME |	\
+				 V4L2_BUF_FLAG_PFRAME |		\
+				 V4L2_BUF_FLAG_BFRAME |		\
+				 V4L2_BUF_FLAG_TIMECODE)
+
+/* fill v4l2 buffer of b, with metadata of the capture device if it's output */
+static void device_fill_buffer(struct device *d, struct buffer *b,
+		struct v4l2_buffer *vb, struct v4l2_plane *planes)
+{
+	bool output = d->type == V4L2_CAP_VIDEO_OUTPUT;
+	unsigned int i;
+
+	memset(vb, 0, sizeof(*vb));
+	vb->type = d->buf_type;
+	vb->memory = d->mem_type;
+	vb->index = b->index;
+	if (output) {
+		vb->flags = b->flags & BUF_FLAGS_PROPAGATE;
+		vb->field = b->field;
+		vb->timestamp = b->frame.timestamp;
+		vb->timecode = b->timecode;
+	}
+
+	if (d->mplane) {
+		memset(planes, 0, sizeof(*planes) * VIDEO_MAX_PLANES);
+		vb->m.planes = planes;
+		vb->length = d->num_planes;
+		for (i = 0; i < d->num_planes; i++) {
+			planes[i].m.fd = b->dbuf_fd[i];
+			if (output) {
+				planes[i].bytesused = b->bytesused[i];
+				planes[i].data_offset = b->data_offset[i];
+			}
+		}
+	} else {
+		vb->m.fd = b->dbuf_fd[0];
+		if (output)
+			vb->bytesused = b->bytesused[0];
+	}
+}
+
+/* queue buffer, with metadata of the capture device if it's output */
+static void device_queue_buffer(struct device *d, struct buffer *b)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer vb;
+	uint64_t bit, start;
+	int ret;
+
+	if (d->wb) {
+		writeback_queue(d, b);
+		return;
+	}
+	if (d->rtpsrc) {
+		rtp_source_queue(d, b);
+		return;
+	}
+
+	device_fill_buffer(d, b, &vb, planes);
+	if (d->enc)
+		encoder_queued(d->enc, &vb.timestamp);
+	if (d->req)
+		request_prepare(d, &vb);
+
+	start = timing_now();
+	ret = ioctl(d->fd, VIDIOC_QBUF, &vb);
+	if (ret && errno == ENODEV && d->replug) {
+		/* unplugged, the stream suspends */
+		d->gone = true;
+		return;
+	}
+	ASSERT(ret, "VIDIOC_QBUF(index = %d) failed: %s\n", b->index, ERRSTR);
+	latency_add(&d->qbuf, timing_now() - start);
+	bit = 1ull << b->index;
+	if (d->prepared & bit) {
+		__sync_fetch_and_and(&d->prepared, ~bit);
+		__sync_add_and_fetch(&d->ahead, 1);
+	}
+	__sync_fetch_and_or(&d->queued, bit);
+	if (d->req)
+		request_queue(d, b->index);
+}
+
+/* prepare buffers of mask ahead of their qbuf, which then skips the cache
+ * maintenance and dmabuf mapping of the driver */
+static void device_prepare_ahead(struct device *d, struct buffer *bs,
+		uint64_t mask)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer vb;
+	struct buffer *b;
+	int ret;
+
+	for (mask &= ~d->prepared; mask; mask &= mask - 1) {
+		b = &bs[__builtin_ctzll(mask)];
+		/* output takes the bytes of the last capture, wait for one */
+		if (d->type == V4L2_CAP_VIDEO_OUTPUT && !b->bytesused[0])
+			continue;
+
+		device_fill_buffer(d, b, &vb, planes);
+		ret = ioctl(d->fd, VIDIOC_PREPARE_BUF, &vb);
+		if (WARN_ON(ret, "%s: VIDIOC_PREPARE_BUF failed: %s, "
+					"qbuf prepares\n", d->devname, ERRSTR)) {
+			d->prepare = false;
+			return;
+		}
+		__sync_fetch_and_or(&d->prepared, 1ull << b->index);
+	}
+}
+
+/* dequeue buffer, and keep metadata if it's from capture */
+static struct buffer *device_dequeue_buffer(struct device *d, struct buffer *bs)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer vb;
+	struct buffer *b;
+	unsigned int i;
+	int ret;
+
+	memset(&vb, 0, sizeof vb);
+
+	vb.type = d->buf_type;
+	vb.memory = d->mem_type;
+	if (d->mplane) {
+		memset(planes, 0, sizeof(planes));
+		vb.m.planes = planes;
+		vb.length = d->num_planes;
+	}
+	ret = ioctl(d->fd, VIDIOC_DQBUF, &vb);
+	if (ret && errno == EPIPE && d->dec)
+		return NULL;
+	if (ret && errno == ENODEV && d->replug) {
+		d->gone = true;
+		return NULL;
+	}
+	ASSERT(ret, "VIDIOC_DQBUF failed: %s\n", ERRSTR);
+
+	b = &bs[vb.index];
+	__sync_fetch_and_and(&d->queued, ~(1ull << vb.index));
+	if (d->type == V4L2_CAP_VIDEO_CAPTURE) {
+		if (d->mplane) {
+			for (i = 0; i < d->num_planes; i++) {
+				b->bytesused[i] = planes[i].bytesused;
+				b->data_offset[i] = planes[i].data_offset;
+			}
+		} else {
+			b->bytesused[0] = vb.bytesused;
+			b->data_offset[0] = 0;
+		}
+		b->flags = vb.flags;
+		b->field = vb.field;
+		b->timecode = vb.timecode;
+
+		b->frame.sequence = vb.sequence;
+		b->frame.timestamp = vb.timestamp;
+		b->frame.dequeued_ns = timing_now();
+		b->frame.bytesused = b->bytesused[0];
+		b->frame.flags = vb.flags;
+		if (d->req)
+			request_done(d, b);
+	}
+
+	return b;
+}
+
+/* prepare buffer */
+static void device_prepare_buffer(struct device *d, struct buffer *b)
+{
+	struct v4l2_exportbuffer eb;
+	unsigned int i;
+	int res;
+
+	/* display imports dmabufs as framebuffers, writeback exports them */
+	if (d->kms) {
+		kms_import(d, b);
+		return;
+	}
+	if (d->wb) {
+		writeback_prepare(d, b);
+		return;
+	}
+	if (d->rtp || d->rtpsrc)
+		return;
+
+	/* export buffer, a dmabuf per plane */
+	if (d->export) {
+		for (i = 0; i < d->num_planes; i++) {
+			memset(&eb, 0, sizeof(eb));
+			eb.type = d->buf_type;
+			eb.index = b->index;
+			eb.plane = i;
+			res = ioctl(d->fd, VIDIOC_EXPBUF, &eb);
+			ASSERT(res < 0, "VIDIOC_EXPBUF failed: %s\n", ERRSTR);
+			b->dbuf_fd[i] = eb.fd;
+		}
+	}
+
+	return;
+}
+
+/* turn off video device */
+static void device_off(struct device *d)
+{
+	int res;
+	if (d->kms) {
+		kms_off(d);
+		return;
+	}
+	if (d->wb) {
+		writeback_off(d);
+		return;
+	}
+	if (d->rtp || d->rtpsrc)
+		return;
+	if (d->gone)
+		return;
+	if (d->enc)
+		encoder_off(d);
+	res = ioctl(d->fd, VIDIOC_STREAMOFF, &d->buf_type);
+	ASSERT(res < 0, "STREAMOFF failed: %s\n", ERRSTR);
+	if (d->dec)
+		decoder_off(d);
+	return;
+}
+
+/* turn on video device */
+static void device_on(struct device *d)
+{
+	int res;
+	if (d->kms) {
+		kms_on(d);
+		return;
+	}
+	if (d->wb) {
+		writeback_on(d);
+		return;
+	}
+	if (d->rtp || d->rtpsrc)
+		return;
+	res = ioctl(d->fd, VIDIOC_STREAMON, &d->buf_type);
+	ASSERT(res < 0, "STREAMON failed: %s\n", ERRSTR);
+	if (d->enc)
+		encoder_on(d);
+	return;
+}
+
+/* exit device */
+static void device_exit(struct device *d)
+{
+	if (d->kms) {
+		kms_exit(d);
+		return;
+	}
+	if (d->wb) {
+		writeback_exit(d);
+		return;
+	}
+	if (d->rtp) {
+		rtp_exit(d);
+		return;
+	}
+	if (d->rtpsrc) {
+		rtp_source_exit(d);
+		return;
+	}
+	if (d->enc)
+		encoder_exit(d);
+	if (d->dec)
+		decoder_exit(d);
+	if (d->req)
+		request_exit(d);
+	close(d->fd);
+}
+
+/* check if fourcc is a compressed format of device */
+static bool device_format_compressed(struct device *d, unsigned int fourcc)
+{
+	struct v4l2_fmtdesc desc;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.type = d->buf_type;
+	while (!ioctl(d->fd, VIDIOC_ENUM_FMT, &desc)) {
+		if (desc.pixelformat == fourcc)
+			return desc.flags & V4L2_FMT_FLAG_COMPRESSED;
+		desc.index++;
+	}
+
+	return false;
+}
+
+/* get format of single or multi-planar device */
+static void device_get_format(struct device *d, struct v4l2_format *fmt,
+		struct v4l2_pix_format *pix)
+{
+	int ret;
+
+	ret = ioctl(d->fd, VIDIOC_G_FMT, fmt);
+	ASSERT(ret < 0, "VIDIOC_G_FMT failed: %s\n", ERRSTR);
+
+	if (!d->mplane) {
+		*pix = fmt->fmt.pix;
+		d->num_planes = 1;
+		return;
+	}
+
+	memset(pix, 0, sizeof(*pix));
+	pix->width = fmt->fmt.pix_mp.width;
+	pix->height = fmt->fmt.pix_mp.height;
+	pix->pixelformat = fmt->fmt.pix_mp.pixelformat;
+	pix->field = fmt->fmt.pix_mp.field;
+	pix->colorspace = fmt->fmt.pix_mp.colorspace;
+	pix->bytesperline = fmt->fmt.pix_mp.plane_fmt[0].bytesperline;
+	pix->sizeimage = fmt->fmt.pix_mp.plane_fmt[0].sizeimage;
+	d->num_planes = fmt->fmt.pix_mp.num_planes;
+}
+
+/* set format(g_fmt->s_fmt->g_fmt), and flag config if it was adjusted */
+static void device_set_format(struct device *d, struct config *c)
+{
+	struct v4l2_format fmt;
+	struct v4l2_pix_format pix;
+	unsigned int i;
+	int ret;
+
+	memset(&fmt, 0, sizeof fmt);
+	fmt.type = d->buf_type;
+
+	device_get_format(d, &fmt, &pix);
+	printf("G_FMT(start): width = %u, height = %u, 4cc = %.4s\n",
+		pix.width, pix.height, (char*)&pix.pixelformat);
+
+	if (!c->compressed && device_format_compressed(d, c->fourcc)) {
+		printf("%.4s is compressed\n", (char *)&c->fourcc);
+		c->compressed = true;
+	}
+
+	c->format.pixelformat = c->fourcc;
+	if (d->mplane) {
+		fmt.fmt.pix_mp.width = c->format.width;
+		fmt.fmt.pix_mp.height = c->format.height;
+		fmt.fmt.pix_mp.pixelformat = c->format.pixelformat;
+		fmt.fmt.pix_mp.field = c->format.field;
+		fmt.fmt.pix_mp.num_planes = c->num_planes;
+		for (i = 0; i < c->num_planes; i++)
+			fmt.fmt.pix_mp.plane_fmt[i] = c->planes[i];
+	} else {
+		fmt.fmt.pix = c->format;
+	}
+
+	ret = ioctl(d->fd, VIDIOC_S_FMT, &fmt);
+	ASSERT(ret < 0, "VIDIOC_S_FMT failed: %s\n", ERRSTR);
+
+	device_get_format(d, &fmt, &pix);
+	printf("G_FMT(final): width = %u, height = %u, 4cc = %.4s, "
+		"planes = %u\n", pix.width, pix.height,
+		(char*)&pix.pixelformat, d->num_planes);
+
+	if (c->compressed) {
+		/* size of a frame varies, buffers must fit the largest one */
+		if ((pix.pixelformat != c->format.pixelformat) ||
+			(c->format.sizeimage &&
+			 pix.sizeimage > c->format.sizeimage))
+			c->updated = true;
+		if (pix.sizeimage < c->format.sizeimage)
+			pix.sizeimage = c->format.sizeimage;
+	} else if ((pix.width != c->format.width) ||
+		(pix.height != c->format.height) ||
+		(pix.pixelformat != c->format.pixelformat)) {
+		c->updated = true;
+	}
+
+	c->format = pix;
+	if (d->mplane) {
+		c->num_planes = fmt.fmt.pix_mp.num_planes;
+		for (i = 0; i < c->num_planes; i++)
+			c->planes[i] = fmt.fmt.pix_mp.plane_fmt[i];
+		c->planes[0].sizeimage = pix.sizeimage;
+	} else {
+		c->num_planes = 1;
+		c->planes[0].bytesperline = pix.bytesperline;
+		c->planes[0].sizeimage = pix.sizeimage;
+	}
+	d->bytesperline = pix.bytesperline;
+}
+
+/* check if fps of device is within 0.5% of target */
+static bool device_runs_at(struct device *d, double fps)
+{
+	return fps > 0 && d->fps >= fps * 0.995 && d->fps <= fps * 1.005;
+}
+
+/* pick interval of capture for fps: the longest one it enumerates that
+ * isn't longer than 1/fps, else the shortest, or 1/fps clamped to a range */
+static void device_find_interval(struct device *d, struct config *c,
+		struct v4l2_fract *tpf)
+{
+	struct v4l2_frmivalenum ival;
+	double want = 1.0 / c->fps, t, best = 0, fastest = 0;
+	struct v4l2_fract shortest;
+
+	memset(&ival, 0, sizeof(ival));
+	ival.pixel_format = c->fourcc;
+	ival.width = c->format.width;
+	ival.height = c->format.height;
+	if (ioctl(d->fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) < 0)
+		return;
+
+	if (ival.type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+		t = (double)ival.stepwise.min.numerator /
+			ival.stepwise.min.denominator;
+		if (want < t)
+			*tpf = ival.stepwise.min;
+		t = (double)ival.stepwise.max.numerator /
+			ival.stepwise.max.denominator;
+		if (want > t)
+			*tpf = ival.stepwise.max;
+		return;
+	}
+
+	do {
+		t = (double)ival.discrete.numerator /
+			ival.discrete.denominator;
+		if (t <= want * 1.005 && t > best) {
+			best = t;
+			*tpf = ival.discrete;
+		}
+		if (!fastest || t < fastest) {
+			fastest = t;
+			shortest = ival.discrete;
+		}
+		ival.index++;
+	} while (!ioctl(d->fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival));
+	if (!best)
+		*tpf = shortest;
+}
+
+/* set frame rate of device to fps with VIDIOC_S_PARM, if it takes one */
+static void device_set_rate(struct device *d, struct config *c)
+{
+	struct v4l2_streamparm parm;
+	struct v4l2_fract *tpf;
+	bool output = d->type == V4L2_CAP_VIDEO_OUTPUT;
+	unsigned int cap;
+
+	d->fps = 0;
+	if (c->fps <= 0 || d->dec)
+		return;
+
+	memset(&parm, 0, sizeof(parm));
+	parm.type = d->buf_type;
+	if (ioctl(d->fd, VIDIOC_G_PARM, &parm) < 0)
+		return;
+	cap = output ? parm.parm.output.capability :
+		parm.parm.capture.capability;
+	tpf = output ? &parm.parm.output.timeperframe :
+		&parm.parm.capture.timeperframe;
+	if (!(cap & V4L2_CAP_TIMEPERFRAME))
+		return;
+
+	tpf->numerator = 1000;
+	tpf->denominator = c->fps * 1000 + 0.5;
+	if (!output)
+		device_find_interval(d, c, tpf);
+	if (WARN_ON(ioctl(d->fd, VIDIOC_S_PARM, &parm) < 0,
+				"VIDIOC_S_PARM failed: %s\n", ERRSTR))
+		return;
+	if (tpf->numerator)
+		d->fps = (double)tpf->denominator / tpf->numerator;
+	printf("S_PARM: %.2f fps of %.2f\n", d->fps, c->fps);
+}
+
+/* request buffers(0 to free) */
+static void device_request_buffers(struct device *d, unsigned int count)
+{
+	struct v4l2_requestbuffers rqbufs;
+	int ret;
+
+	memset(&rqbufs, 0, sizeof(rqbufs));
+	rqbufs.count = count;
+	rqbufs.type = d->buf_type;
+	rqbufs.memory = d->mem_type;
+
+	ret = ioctl(d->fd, VIDIOC_REQBUFS, &rqbufs);
+	ASSERT(ret < 0, "VIDIOC_REQBUFS failed: %s\n", ERRSTR);
+	ASSERT(rqbufs.count < count, "video node allocated only "
+		"%u of %u buffers\n", rqbufs.count, count);
+}
+
+/* initialize device */
+static void device_init(struct device *d, struct config *c, unsigned int type)
+{
+	struct v4l2_capability caps;
+	unsigned int dev_caps, mplane;
+	int ret;
+
+	if (d->kms) {
+		kms_init(d, c);
+		return;
+	}
+	if (d->wb) {
+		writeback_init(d, c);
+		return;
+	}
+	if (d->rtp) {
+		rtp_init(d, c);
+		return;
+	}
+	if (d->rtpsrc) {
+		rtp_source_init(d, c);
+		return;
+	}
+
+	d->queued = 0;
+	d->prepared = 0;
+
+	timing_begin(d->timing, PHASE_OPEN);
+	d->fd = open(d->devname, O_RDWR);
+	ASSERT(d->fd < 0, "failed to open %s: %s\n", d->devname, ERRSTR);
+	timing_end(d->timing, PHASE_OPEN);
+
+	/* query caps */
+	memset(&caps, 0, sizeof caps);
+
+	timing_begin(d->timing, PHASE_QUERYCAP);
+	ret = ioctl(d->fd, VIDIOC_QUERYCAP, &caps);
+	ASSERT(ret, "VIDIOC_QUERYCAP failed: %s\n", ERRSTR);
+	timing_end(d->timing, PHASE_QUERYCAP);
+
+	/* m2m devices are both */
+	dev_caps = caps.capabilities & V4L2_CAP_DEVICE_CAPS ?
+		caps.device_caps : caps.capabilities;
+	if (dev_caps & V4L2_CAP_VIDEO_M2M)
+		dev_caps |= V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_OUTPUT;
+	if (dev_caps & V4L2_CAP_VIDEO_M2M_MPLANE)
+		dev_caps |= V4L2_CAP_VIDEO_CAPTURE_MPLANE |
+			V4L2_CAP_VIDEO_OUTPUT_MPLANE;
+	mplane = (type == V4L2_CAP_VIDEO_CAPTURE) ?
+		V4L2_CAP_VIDEO_CAPTURE_MPLANE : V4L2_CAP_VIDEO_OUTPUT_MPLANE;
+	ASSERT(!(dev_caps & (type | mplane)),
+		"video: output or capture is not supported(%d, %d)\n",
+		dev_caps, type);
+	d->type = type;
+	d->mplane = !(dev_caps & type);
+	ASSERT(d->mplane && (d->enc || d->dec),
+		"multi-planar encoders and decoders are not supported\n");
+	if (d->type == V4L2_CAP_VIDEO_CAPTURE)
+		d->buf_type = d->mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+			V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	else
+		d->buf_type = d->mplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
+			V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	d->mem_type = d->export ? V4L2_MEMORY_MMAP : V4L2_MEMORY_DMABUF;
+
+	/* set format */
+	timing_begin(d->timing, PHASE_FORMAT);
+	if (d->enc)
+		encoder_format(d, c);
+	if (d->dec)
+		decoder_start(d, c);
+	device_set_format(d, c);
+	device_set_rate(d, c);
+	timing_end(d->timing, PHASE_FORMAT);
+
+	/* request buffers */
+	timing_begin(d->timing, PHASE_REQBUFS);
+	device_request_buffers(d, c->num_buffers);
+	if (d->enc)
+		encoder_init(d, c);
+	if (d->req)
+		request_init(d, c);
+	timing_end(d->timing, PHASE_REQBUFS);
+
+	return;
+}
+
+/*
+ * stream operations
+ */
+
+/* dump stream config */
+static void stream_dump_config(struct bridge_stream *s)
+{
+	char fourcc[5];
+#define DUMP(...) fprintf(stderr, __VA_ARGS__);
+	DUMP("input device name:%s(exp: %d)\n", s->in.devname, s->in.export);
+	DUMP("output device name:%s(exp: %d)\n", s->out.devname, s->out.export);
+	DUMP("width: %d\n", s->config.format.width);
+	DUMP("height: %d\n", s->config.format.height);
+	DUMP("buffer count:%d\n", s->config.num_buffers);
+	DUMP("fps:%.2f(%s)\n", s->config.fps, pace_mode_name(s->config.pace));
+	fourcc[0] = (char)(s->config.fourcc);
+	fourcc[1] = (char)(s->config.fourcc >> 8);
+	fourcc[2] = (char)(s->config.fourcc >> 16);
+	fourcc[3] = (char)(s->config.fourcc >> 24);
+	fourcc[4] = '\0';
+	DUMP("fourcc %s\n", fourcc);
+#undef DUMP
+}
+
+#define NEXT_ARG(s, e, x)		\
+	do {				\
+		e = strchr(s, x);	\
+		if (!e) {		\
+			ret = -1;	\
+			goto err_out;	\
+		}			\
+	} while(0);
+
+/*
+ * parse stream args, which are these parts in this order, all optional but
+ * the second one:
+ *
+ * {media_dev;items}			links and pad formats of a pipeline
+ * in:out@exp@fps:num_buf:w,h:fourcc	devices, device to export(o/i),
+ *					fps limit, buffers and format
+ * =fourcc				decode mjpeg into fourcc
+ * ~model[,param=v]			correct lens distortion
+ * ^file.cube				grade colours through a 3d lut
+ * %ctrl=v1/v2[,ctrl=v1/v2]		per frame controls
+ * &meta_dev[,seq|ts[:us]][,window]	metadata node of the input
+ * +plugin.so[,args]			a plugin, any number of them
+ * <fourcc,path[,loop]			decode path, the input is a decoder
+ * >fourcc,path				encode into path, the output is an
+ *					encoder
+ */
+static int stream_parse_args(struct bridge_stream *s, const char *arg)
+{
+	const char *startp;
+	char *endp;
+	char spec[512];
+	unsigned int len;
+	int ret;
+
+	/* media graph({media_dev;item;item...}) */
+	startp = arg;
+	if (*startp == '{') {
+		NEXT_ARG(startp, endp, '}');
+		s->media = calloc(1, sizeof(*s->media));
+		ASSERT(!s->media, "failed to allocate media graph\n");
+		ret = media_parse_args(s->media, startp + 1, endp - startp - 1);
+		if (WARN_ON(ret < 0, "invalid media graph\n"))
+			goto err_out;
+		startp = endp + 1;
+	}
+
+	/* input device name, or its identity([link] or [card=..,bus=..]) */
+	if (*startp == '[') {
+		NEXT_ARG(startp, endp, ']');
+		s->hotplug = calloc(1, sizeof(*s->hotplug));
+		ASSERT(!s->hotplug, "failed to allocate hotplug\n");
+		ret = hotplug_parse_args(s->hotplug, startp + 1,
+				endp - startp - 1);
+		if (WARN_ON(ret < 0 || endp[1] != ':', "invalid identity\n")) {
+			ret = -1;
+			goto err_out;
+		}
+		endp++;
+	} else {
+		NEXT_ARG(startp, endp, ':');
+		len = min(sizeof(s->in.devname) - 1, endp - startp);
+		strncpy(s->in.devname, startp, len);
+		s->in.devname[len] = '\0';
+	}
+
+	/* output device name */
+	startp = endp + 1;
+	NEXT_ARG(startp, endp, '@');
+	len = min(sizeof(s->out.devname) - 1, endp - startp);
+	strncpy(s->out.devname, startp, len);
+	s->out.devname[len] = '\0';
+
+	/* device to export */
+	startp = endp + 1;
+	NEXT_ARG(startp, endp, '@');
+	if (*startp == 'o') {
+		s->out.export = true;
+		s->in.export = false;
+	} else if (*startp == 'i') {
+		s->out.export = false;
+		s->in.export = true;
+	} else {
+		ret = -1;
+		goto err_out;
+	}
+
+	/* display(/dev/dri/cardN[,plane=id][,connector=id]) imports buffers */
+	if (!strncmp(s->out.devname, "/dev/dri/", 9)) {
+		s->out.kms = calloc(1, sizeof(*s->out.kms));
+		ASSERT(!s->out.kms, "failed to allocate kms sink\n");
+		ret = kms_parse_args(s->out.kms, s->out.devname);
+		if (WARN_ON(ret < 0, "invalid kms args\n"))
+			goto err_out;
+		s->in.export = true;
+		s->out.export = false;
+	}
+
+	/* network(rtp/host/port[,mtu=bytes][,rate=mbps][,copy]) maps them */
+	if (!strncmp(s->out.devname, "rtp/", 4)) {
+		s->out.rtp = calloc(1, sizeof(*s->out.rtp));
+		ASSERT(!s->out.rtp, "failed to allocate rtp sink\n");
+		ret = rtp_parse_args(s->out.rtp, s->out.devname);
+		if (WARN_ON(ret < 0, "invalid rtp args\n"))
+			goto err_out;
+		s->in.export = true;
+		s->out.export = false;
+	}
+
+	/* network(rtp/host/port) receives into buffers of output */
+	if (!strncmp(s->in.devname, "rtp/", 4)) {
+		s->in.rtpsrc = calloc(1, sizeof(*s->in.rtpsrc));
+		ASSERT(!s->in.rtpsrc, "failed to allocate rtp source\n");
+		ret = rtp_source_parse_args(s->in.rtpsrc, s->in.devname);
+		if (WARN_ON(ret < 0, "invalid rtp source args\n"))
+			goto err_out;
+		s->in.export = false;
+		s->out.export = true;
+	}
+
+	/* writeback(/dev/dri/cardN[,connector=id]) exports buffers */
+	if (!strncmp(s->in.devname, "/dev/dri/", 9)) {
+		s->in.wb = calloc(1, sizeof(*s->in.wb));
+		ASSERT(!s->in.wb, "failed to allocate writeback source\n");
+		ret = writeback_parse_args(s->in.wb, s->in.devname);
+		if (WARN_ON(ret < 0, "invalid writeback args\n"))
+			goto err_out;
+		s->in.export = true;
+		s->out.export = false;
+	}
+
+	/* fps */
+	startp = endp + 1;
+	NEXT_ARG(startp, endp, ':');
+	s->config.fps = strtod(startp, &endp);
+
+	/* num of buffers */
+	startp = endp + 1;
+	NEXT_ARG(startp, endp, ':');
+	s->config.num_buffers = strtoul(startp, &endp, 10);
+	/* devices keep queued and prepared buffers as bits of 64 */
+	if (WARN_ON(!s->config.num_buffers ||
+				s->config.num_buffers > sizeof(s->in.queued) * 8,
+				"num_buf must be 1 to %zu\n",
+				sizeof(s->in.queued) * 8)) {
+		ret = -1;
+		goto err_out;
+	}
+
+	/* size(width, height) */
+	startp = endp + 1;
+	NEXT_ARG(startp, endp, ':');
+	ret = sscanf(startp, "%u,%u",
+			&s->config.format.width, &s->config.format.height);
+	if (ret < 0)
+		goto err_out;
+
+	/* fourcc */
+	startp = endp + 1;
+	s->config.fourcc = ((unsigned)startp[0] << 0) |
+		((unsigned)startp[1] << 8) |
+		((unsigned)startp[2] << 16) |
+		((unsigned)startp[3] << 24);
+
+	/* mjpeg decode(=fourcc) */
+	startp += strnlen(startp, 4);
+	if (*startp == '=') {
+		s->mjpeg = calloc(1, sizeof(*s->mjpeg));
+		ASSERT(!s->mjpeg, "failed to allocate mjpeg stage\n");
+		ret = mjpeg_parse_args(s->mjpeg, startp + 1);
+		if (WARN_ON(ret < 0, "invalid mjpeg output format\n"))
+			goto err_out;
+		/* devices don't share buffers */
+		s->in.export = true;
+		s->out.export = true;
+		startp += 1 + strnlen(startp + 1, 4);
+	}
+
+	/* lens correction(~fisheye|radial[,fov=deg][,k1=n][,k2=n][,zoom=n]) */
+	if (*startp == '~') {
+		s->remap = calloc(1, sizeof(*s->remap));
+		ASSERT(!s->remap, "failed to allocate remap stage\n");
+		ret = remap_parse_args(s->remap, startp + 1);
+		if (WARN_ON(ret < 0, "invalid lens correction args\n"))
+			goto err_out;
+		/* devices don't share buffers */
+		s->in.export = true;
+		s->out.export = true;
+		startp += 1 + ret;
+	}
+
+	/* colour grading(^file.cube) */
+	if (*startp == '^') {
+		s->grade = calloc(1, sizeof(*s->grade));
+		ASSERT(!s->grade, "failed to allocate grade stage\n");
+		ret = grade_parse_args(s->grade, startp + 1);
+		if (WARN_ON(ret < 0, "invalid colour grading args\n"))
+			goto err_out;
+		startp += 1 + ret;
+	}
+
+	/* control schedule through requests(%name=v1/v2/...[,name=...]) */
+	if (*startp == '%') {
+		s->in.req = calloc(1, sizeof(*s->in.req));
+		ASSERT(!s->in.req, "failed to allocate requests\n");
+		ret = request_parse_args(s->in.req, startp + 1);
+		if (WARN_ON(ret < 0, "invalid control schedule\n"))
+			goto err_out;
+		startp += 1 + ret;
+	}
+
+	/* metadata node(&dev[,seq|ts[:us]][,window]) */
+	if (*startp == '&') {
+		s->meta = calloc(1, sizeof(*s->meta));
+		ASSERT(!s->meta, "failed to allocate meta\n");
+		ret = meta_parse_args(s->meta, startp + 1);
+		if (WARN_ON(ret < 0, "invalid meta args\n"))
+			goto err_out;
+		startp += 1 + ret;
+	}
+
+	/* plugins(+path[,args]) */
+	while (*startp == '+') {
+		startp++;
+		endp = strpbrk(startp, "+<>");
+		len = endp ? endp - startp : strlen(startp);
+		if (WARN_ON(s->num_plugins == MAX_PLUGINS ||
+					len >= sizeof(spec),
+					"too many plugins or too long\n")) {
+			ret = -1;
+			goto err_out;
+		}
+		memcpy(spec, startp, len);
+		spec[len] = '\0';
+		ret = plugin_load(&s->plugins[s->num_plugins], spec);
+		if (ret < 0)
+			goto err_out;
+		s->num_plugins++;
+		startp += len;
+	}
+
+	/* decoder(<fourcc,path[,loop]) */
+	if (*startp == '<') {
+		s->in.dec = calloc(1, sizeof(*s->in.dec));
+		ASSERT(!s->in.dec, "failed to allocate decoder\n");
+		ret = decoder_parse_args(s->in.dec, startp + 1);
+		if (WARN_ON(ret < 0, "invalid decoder args\n"))
+			goto err_out;
+		startp += strcspn(startp, ">");
+	}
+
+	/* encoder(>fourcc,path) */
+	if (*startp == '>') {
+		s->out.enc = calloc(1, sizeof(*s->out.enc));
+		ASSERT(!s->out.enc, "failed to allocate encoder\n");
+		ret = encoder_parse_args(s->out.enc, startp + 1);
+		if (WARN_ON(ret < 0, "invalid encoder args\n"))
+			goto err_out;
+	}
+
+	if (WARN_ON(s->mjpeg && (s->num_plugins || s->in.dec),
+				"mjpeg decode takes no plugins or decoder\n")) {
+		ret = -1;
+		goto err_out;
+	}
+	if (WARN_ON(s->remap && (s->mjpeg || s->in.dec || s->out.enc ||
+					s->in.wb || s->in.rtpsrc || s->out.kms ||
+					s->out.rtp),
+				"lens correction takes no mjpeg decode, "
+				"decoder, encoder, writeback, display or rtp\n")) {
+		ret = -1;
+		goto err_out;
+	}
+	if (WARN_ON(s->remap && !remap_fourcc(s->config.fourcc),
+				"lens correction takes GREY, NV12, NV21, NV16 "
+				"or NV61, not %.4s\n",
+				(char *)&s->config.fourcc)) {
+		ret = -1;
+		goto err_out;
+	}
+	if (WARN_ON(s->grade && s->mjpeg,
+				"colour grading takes no mjpeg decode\n")) {
+		ret = -1;
+		goto err_out;
+	}
+	if (WARN_ON(s->out.kms && (s->mjpeg || s->out.enc),
+				"display takes no mjpeg decode or encoder\n")) {
+		ret = -1;
+		goto err_out;
+	}
+	if (WARN_ON(s->out.rtp && (s->mjpeg || s->out.enc),
+				"rtp takes no mjpeg decode or encoder\n")) {
+		ret = -1;
+		goto err_out;
+	}
+	if (WARN_ON(s->in.wb && (s->mjpeg || s->meta || s->in.req ||
+					s->in.dec || s->media),
+				"writeback takes no mjpeg decode, metadata, "
+				"requests, decoder or media graph\n")) {
+		ret = -1;
+		goto err_out;
+	}
+	if (WARN_ON(s->in.rtpsrc && (s->mjpeg || s->meta || s->in.req ||
+					s->media || s->out.kms || s->out.rtp),
+				"rtp source takes no mjpeg decode, metadata, "
+				"requests, media graph, display or rtp sink\n")) {
+		ret = -1;
+		goto err_out;
+	}
+	if (WARN_ON(s->hotplug && (s->in.dec || s->meta),
+				"decoder or metadata takes no identity\n")) {
+		ret = -1;
+		goto err_out;
+	}
+	if (WARN_ON(s->in.req && s->in.dec,
+				"decoder takes no control schedule\n")) {
+		ret = -1;
+		goto err_out;
+	}
+
+	return 0;
+
+err_out:
+	return ret;
+}
+
+/* turn off stream */
+static void stream_off(void *data)
+{
+	struct bridge_stream *s = data;
+	/* suspended streams are off already */
+	if (s->suspended) {
+		timing_end(&s->timing, PHASE_STREAMOFF);
+		return;
+	}
+	/* turn off devices */
+	device_off(&s->in);
+	device_off(&s->out);
+	if (s->meta)
+		meta_off(s->meta);
+	timing_end(&s->timing, PHASE_STREAMOFF);
+	return;
+}
+
+static void manager_off(struct bridge *m);
+
+/* stream forwarded requested frames, stop manager once all are done */
+static void stream_done(struct bridge_stream *s)
+{
+	if (__sync_add_and_fetch(&s->m->streams_done, 1) == s->m->num_streams)
+		manager_off(s->m);
+}
+
+/* end cpu access of a mapped buffer before it goes back to a device */
+static void stream_sync_end(struct buffer *b)
+{
+	struct dma_buf_sync sync = {
+		.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW,
+	};
+
+	if (!b->synced)
+		return;
+	WARN_ON(ioctl(b->dbuf_fd[0], DMA_BUF_IOCTL_SYNC, &sync) < 0,
+			"DMA_BUF_IOCTL_SYNC failed: %s\n", ERRSTR);
+	b->synced = false;
+}
+
+/* give buffer back to input, unless a snapshot still reads it */
+static void stream_requeue(struct bridge_stream *s, struct buffer *b)
+{
+	if (!s->snapshot || !snapshot_hold(s->snapshot, b))
+		device_queue_buffer(&s->in, b);
+}
+
+/* buffers of the stage that writes frames for output, NULL if none does */
+static struct stage_pool *stream_stage_pool(struct bridge_stream *s)
+{
+	if (s->mjpeg)
+		return &s->mjpeg->pool;
+	if (s->repack)
+		return &s->repack->pool;
+	if (s->remap)
+		return &s->remap->pool;
+	return NULL;
+}
+
+/* give buffer back to the stage that wrote it for output */
+static void stream_stage_release(struct bridge_stream *s, struct buffer *b)
+{
+	stage_pool_release(stream_stage_pool(s), b);
+}
+
+/* give buffer back to its stage, unless a snapshot still reads it */
+static void stream_stage_requeue(struct bridge_stream *s, struct buffer *b)
+{
+	if (!s->snapshot || !snapshot_hold(s->snapshot, b))
+		stream_stage_release(s, b);
+}
+
+/* buffer held by a snapshot is copied, after it came back from output */
+static void stream_snapshot_release(void *priv, struct buffer *b)
+{
+	struct bridge_stream *s = priv;
+
+	/* the input's, or one a stage wrote */
+	if (b >= s->buffers && b < s->buffers + s->config.num_buffers)
+		device_queue_buffer(&s->in, b);
+	else
+		stream_stage_release(s, b);
+}
+
+/* hand the forwarded frame to snapshot, what a stage wrote if it did */
+static void stream_snapshot(struct bridge_stream *s, struct buffer *b)
+{
+	const struct config *c = &s->config;
+
+	if (b->decoded) {
+		c = s->mjpeg ? &s->mjpeg->config : s->repack ?
+			&s->repack->config : &s->remap->config;
+		snapshot_take(s->snapshot, b->decoded, &c->format,
+				b->frame.sequence);
+	} else {
+		snapshot_take(s->snapshot, b, &c->format, b->frame.sequence);
+	}
+}
+
+/* hand frame to signal monitor, a decoded one if the input is mjpeg */
+static void stream_monitor(struct bridge_stream *s, struct buffer *b)
+{
+	void *data;
+
+	if (s->mjpeg && b->decoded) {
+		monitor_frame(s->monitor, &s->mjpeg->config,
+				b->decoded->frame.data);
+	} else if (!s->config.compressed) {
+		data = bridge_frame_map(s, &b->frame);
+		if (data)
+			monitor_frame(s->monitor, &s->config, data);
+	}
+}
+
+/* queue buffer to output */
+void stream_forward(struct bridge_stream *s, struct buffer *b)
+{
+	if (s->meta)
+		meta_release(s->meta, b);
+	if (s->snapshot)
+		stream_snapshot(s, b);
+	if (s->monitor)
+		stream_monitor(s, b);
+
+	if (b->decoded) {
+		/* a stage wrote it into a buffer of output */
+		device_queue_buffer(&s->out, b->decoded);
+		b->decoded = NULL;
+		stream_drop(s, b);
+	} else if (s->out.kms) {
+		/* a frame replaced before the flip goes back */
+		stream_sync_end(b);
+		b = kms_queue(&s->out, b);
+		if (b)
+			stream_requeue(s, b);
+	} else if (s->out.rtp) {
+		/* a frame sent with zero copy goes back once completed */
+		if (rtp_send(&s->out, b)) {
+			stream_sync_end(b);
+			stream_requeue(s, b);
+		}
+	} else {
+		stream_sync_end(b);
+		device_queue_buffer(&s->out, b);
+	}
+
+	if (__sync_add_and_fetch(&s->frames, 1) == 1)
+		timing_end(&s->timing, PHASE_FIRST_FRAME);
+	if (s->frames == s->config.count)
+		stream_done(s);
+}
+
+/* give buffer back to input */
+void stream_drop(struct bridge_stream *s, struct buffer *b)
+{
+	if (s->meta)
+		meta_release(s->meta, b);
+	stream_sync_end(b);
+	stream_requeue(s, b);
+}
+
+/* run plugins, mjpeg, grade, repack or remap stage on buffer, and forward
+ * it */
+static void stream_process(struct bridge_stream *s, struct buffer *b)
+{
+	if (!s->num_plugins && !s->mjpeg && !s->grade && !s->repack &&
+			!s->remap)
+		stream_forward(s, b);
+	else if (s->m->workers.num)
+		workers_queue(&s->m->workers, b);
+	else
+		plugin_process(s, b);
+}
+
+/* pass buffer from input to output through callback */
+static void stream_pass_buffer(struct bridge_stream *s, struct buffer *b)
+{
+	enum bridge_action action = BRIDGE_FORWARD;
+
+	if (s->meta)
+		meta_match(s->meta, b);
+
+	if (s->cb)
+		action = s->cb(s, &b->frame, s->cb_priv);
+
+	switch (action) {
+	case BRIDGE_HOLD:
+		break;
+	case BRIDGE_DROP:
+		stream_drop(s, b);
+		break;
+	case BRIDGE_FORWARD:
+	default:
+		stream_process(s, b);
+		break;
+	}
+}
+
+static void stream_init_grade(struct bridge_stream *s);
+static void stream_init_buffers(struct bridge_stream *s);
+static void stream_exit_buffers(struct bridge_stream *s);
+
+/* reallocate buffers of both devices for the new format of decoder */
+static void stream_reconfigure(struct bridge_stream *s)
+{
+	int res;
+
+	workers_drain(&s->m->workers, s);
+
+	device_off(&s->out);
+	res = ioctl(s->in.fd, VIDIOC_STREAMOFF, &s->in.buf_type);
+	ASSERT(res < 0, "STREAMOFF failed: %s\n", ERRSTR);
+	stream_exit_buffers(s);
+	device_request_buffers(&s->in, 0);
+	device_exit(&s->out);
+
+	/* decoder keeps the OUTPUT queue streaming */
+	decoder_capture_format(&s->in, &s->config);
+	s->config.updated = false;
+	device_set_format(&s->in, &s->config);
+	device_request_buffers(&s->in, s->config.num_buffers);
+	device_init(&s->out, &s->config, V4L2_CAP_VIDEO_OUTPUT);
+	WARN_ON(s->config.updated, "output adjusted the decoded format\n");
+	if (s->grade)
+		stream_init_grade(s);
+	stream_init_buffers(s);
+
+	device_on(&s->in);
+	device_on(&s->out);
+	s->in.dec->changes++;
+}
+
+/* last decoded frame, returns false at the end of stream */
+static bool stream_decoder_last(struct bridge_stream *s, struct buffer *b)
+{
+	if (b && b->bytesused[0])
+		stream_pass_buffer(s, b);
+
+	if (s->in.dec->source_change) {
+		stream_reconfigure(s);
+		return true;
+	}
+
+	printf("decoder: drained\n");
+	stream_done(s);
+	return false;
+}
+
+/* prepare buffers held by the peer device of each, before sleeping in poll */
+static void stream_prepare_ahead(struct bridge_stream *s)
+{
+	uint64_t in = s->in.queued, out = s->out.queued;
+
+	if (s->in.prepare)
+		device_prepare_ahead(&s->in, s->buffers, out & ~in);
+	if (s->out.prepare)
+		device_prepare_ahead(&s->out, s->buffers, in & ~out);
+}
+
+/* turn on stream */
+static void stream_run(struct bridge_stream *s)
+{
+	struct stage_pool *pool = stream_stage_pool(s);
+	struct buffer *b, *next;
+	struct pollfd fds[] = {
+		{.fd = s->in.fd, .events = POLLIN},
+		{.fd = s->out.fd, .events = POLLOUT},
+		{.fd = s->meta ? s->meta->fd : -1, .events = POLLIN},
+	};
+	int res, state;
+
+	/* coded frames of encoder */
+	if (s->out.enc)
+		fds[1].events |= POLLIN;
+	/* flip events of display */
+	if (s->out.kms)
+		fds[1].events = POLLIN;
+	/* completions of network sends come as errors */
+	if (s->out.rtp)
+		fds[1].events = 0;
+	/* coded frames and events of decoder */
+	if (s->in.dec)
+		fds[0].events |= POLLOUT | POLLPRI;
+
+	/* turn on devices */
+	timing_begin(&s->timing, PHASE_STREAMON);
+	device_on(&s->in);
+	device_on(&s->out);
+	if (s->meta)
+		meta_on(s->meta);
+	timing_end(&s->timing, PHASE_STREAMON);
+	timing_begin(&s->timing, PHASE_FIRST_FRAME);
+
+	/* poll and pass buffers, with the devices idle until then */
+	stream_prepare_ahead(s);
+	while ((res = poll(fds, 3, 5000)) > 0) {
+
+		/* a removed node polls as hung up */
+		if (fds[0].revents & POLLHUP && s->hotplug &&
+				hotplug_gone(&s->in))
+			break;
+
+		if (fds[2].revents & POLLIN)
+			meta_dequeue(s->meta);
+
+		if (fds[0].revents & POLLPRI)
+			decoder_event(&s->in);
+
+		if (fds[0].revents & POLLOUT)
+			decoder_feed(&s->in);
+
+		if (fds[0].revents & POLLIN && (s->in.wb || s->in.rtpsrc)) {
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+			b = s->in.wb ? writeback_capture(&s->in) :
+				rtp_source_receive(&s->in);
+			for (; b; b = next) {
+				next = b->next;
+				b->next = NULL;
+				pace_wait(&s->pace);
+				stream_pass_buffer(s, b);
+			}
+			pthread_setcancelstate(state, NULL);
+		} else if (fds[0].revents & POLLIN) {
+			/* sleep for specified fps if needed */
+			pace_wait(&s->pace);
+
+			/* don't cancel in the middle of callback/plugins */
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+			b = device_dequeue_buffer(&s->in, s->buffers);
+			if (s->in.dec && (!b || b->flags & V4L2_BUF_FLAG_LAST)) {
+				/* stop polling input at end of stream */
+				if (!stream_decoder_last(s, b))
+					fds[0].fd = -1;
+				fds[1].fd = s->out.fd;
+			} else if (b) {
+				if (s->hotplug && s->hotplug->replug_ns)
+					hotplug_frame(s->hotplug, s->in.devname);
+				stream_pass_buffer(s, b);
+			}
+			pthread_setcancelstate(state, NULL);
+		}
+
+		if (fds[1].revents & POLLOUT && pool) {
+			b = device_dequeue_buffer(&s->out, pool->buffers);
+			stream_stage_requeue(s, b);
+		} else if (fds[1].revents & POLLOUT) {
+			b = device_dequeue_buffer(&s->out, s->buffers);
+			stream_requeue(s, b);
+		}
+
+		if (fds[1].revents & POLLERR && s->out.rtp) {
+			for (b = rtp_complete(&s->out); b; b = next) {
+				next = b->next;
+				b->next = NULL;
+				stream_sync_end(b);
+				stream_requeue(s, b);
+			}
+		}
+
+		if (fds[1].revents & POLLIN && s->out.kms) {
+			b = kms_flipped(&s->out);
+			if (b)
+				stream_requeue(s, b);
+		} else if (fds[1].revents & POLLIN) {
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+			encoder_dequeue(&s->out);
+			pthread_setcancelstate(state, NULL);
+		}
+
+		if (s->in.gone)
+			break;
+		stream_prepare_ahead(s);
+	}
+}
+
+static void stream_init(struct bridge_stream *s);
+static void stream_exit(struct bridge_stream *s);
+
+/* tear down stream of an unplugged input */
+static void stream_suspend(struct bridge_stream *s)
+{
+	printf("%s: unplugged, suspending\n", s->in.devname);
+	workers_drain(&s->m->workers, s);
+	device_off(&s->in);
+	device_off(&s->out);
+	if (s->meta)
+		meta_off(s->meta);
+	stream_exit(s);
+	s->suspended = true;
+	s->hotplug->unplugs++;
+}
+
+/* set up stream again on the replugged input */
+static void stream_resume(struct bridge_stream *s)
+{
+	s->in.gone = false;
+	stream_init(s);
+	s->suspended = false;
+	printf("%s: replugged, resuming\n", s->in.devname);
+}
+
+static void *stream_on(void *data)
+{
+	struct bridge_stream *s = data;
+	int state;
+
+	/* push cleanup handler */
+	pthread_cleanup_push(stream_off, s);
+
+	stream_run(s);
+	/* an unplugged input suspends the stream until it's back */
+	while (s->in.gone) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+		stream_suspend(s);
+		pthread_setcancelstate(state, NULL);
+
+		hotplug_wait(s->hotplug, &s->in);
+
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+		stream_resume(s);
+		pthread_setcancelstate(state, NULL);
+		stream_run(s);
+	}
+
+	/* pop cleanup handler */
+	pthread_cleanup_pop(s);
+
+	return NULL;
+}
+
+/* unmap, close and free num buffers */
+static void buffers_exit(struct buffer *bs, unsigned int num)
+{
+	struct buffer *b;
+	int i, j;
+
+	for (i = 0; i < num; i++) {
+		b = &bs[i];
+		if (b->frame.data)
+			munmap(b->frame.data, b->frame.size);
+		for (j = 0; j < VIDEO_MAX_PLANES; j++)
+			if (b->dbuf_fd[j] > 0)
+				close(b->dbuf_fd[j]);
+		free(b->scratch);
+	}
+	free(bs);
+}
+
+/* unmap and free buffers */
+static void stream_exit_buffers(struct bridge_stream *s)
+{
+	struct stage_pool *pool = stream_stage_pool(s);
+
+	if (pool && pool->buffers) {
+		buffers_exit(pool->buffers, pool->num_buffers);
+		pool->buffers = NULL;
+		pthread_mutex_destroy(&pool->lock);
+	}
+
+	if (!s->buffers)
+		return;
+
+	buffers_exit(s->buffers, s->config.num_buffers);
+	s->buffers = NULL;
+}
+
+/* exit stream */
+static void stream_exit(struct bridge_stream *s)
+{
+	if (s->suspended)
+		return;
+	timing_begin(&s->timing, PHASE_CLOSE);
+	if (s->snapshot)
+		snapshot_drain(s->snapshot);
+	stream_exit_buffers(s);
+	device_exit(&s->out);
+	device_exit(&s->in);
+	if (s->out.enc)
+		encoder_close(s->out.enc);
+	if (s->in.dec)
+		decoder_close(s->in.dec);
+	if (s->meta)
+		meta_exit(s->meta);
+	timing_end(&s->timing, PHASE_CLOSE);
+}
+
+/* negotiate stride between pipelines, which the loop of format doesn't look
+ * at: the input is asked once for the stride of the output, a loop could go
+ * back and forth, and if it can't take it, lines are repacked */
+static void stream_negotiate_stride(struct bridge_stream *s)
+{
+	struct config out;
+	int ret;
+
+	if (s->in.bytesperline == s->out.bytesperline || s->mjpeg ||
+			s->remap || s->config.compressed || s->in.dec || s->in.wb ||
+			s->in.rtpsrc || s->out.kms || s->out.rtp)
+		return;
+
+	/* config is of the output, which was set up last */
+	out = s->config;
+	printf("%s: stride %u, %s takes %u\n", s->in.devname,
+		s->in.bytesperline, s->out.devname, s->out.bytesperline);
+	device_exit(&s->in);
+	device_init(&s->in, &s->config, V4L2_CAP_VIDEO_CAPTURE);
+	ASSERT(s->config.updated, "input adjusted format to stride\n");
+	/* a resumed stream has both devices exporting already */
+	if (s->in.bytesperline == s->out.bytesperline && !s->repack)
+		return;
+
+	if (!s->repack) {
+		s->repack = calloc(1, sizeof(*s->repack));
+		ASSERT(!s->repack, "failed to allocate repack stage\n");
+	}
+
+	ret = repack_format(s->repack, &s->config, &out);
+	ASSERT(ret < 0, "can't repack %.4s from stride %u to %u\n",
+		(char *)&s->config.fourcc, s->in.bytesperline,
+		s->out.bytesperline);
+	printf("%s: repacking stride %u to %u of %s\n", s->in.devname,
+		s->in.bytesperline, s->out.bytesperline, s->out.devname);
+
+	/* devices don't share buffers */
+	if (s->in.export && s->out.export)
+		return;
+	s->in.export = true;
+	s->out.export = true;
+	device_exit(&s->in);
+	device_init(&s->in, &s->config, V4L2_CAP_VIDEO_CAPTURE);
+	device_exit(&s->out);
+	device_init(&s->out, &s->repack->config, V4L2_CAP_VIDEO_OUTPUT);
+	ASSERT(s->config.updated || s->repack->config.updated,
+		"format changed for export\n");
+}
+
+/* initialize stream */
+static void stream_init(struct bridge_stream *s)
+{
+	int ret;
+
+	s->in.timing = &s->timing;
+	s->out.timing = &s->timing;
+	if (s->out.enc)
+		encoder_open(s->out.enc);
+	if (s->in.dec)
+		decoder_open(s->in.dec);
+
+	/* links and formats of pipelines before their video nodes */
+	if (s->media) {
+		timing_begin(&s->timing, PHASE_MEDIA);
+		media_setup(s->media, s->in.devname);
+		timing_end(&s->timing, PHASE_MEDIA);
+	}
+
+	/* initialize devices */
+	if (s->hotplug) {
+		hotplug_find(s->hotplug, &s->in);
+		s->in.replug = true;
+	}
+	device_init(&s->in, &s->config, V4L2_CAP_VIDEO_CAPTURE);
+	s->config.updated = false;
+	if (s->mjpeg) {
+		/* output takes decoded frames in its own format */
+		mjpeg_format(s->mjpeg, &s->config);
+		device_init(&s->out, &s->mjpeg->config, V4L2_CAP_VIDEO_OUTPUT);
+		ASSERT(s->mjpeg->config.updated || s->out.num_planes != 1,
+			"output doesn't take %ux%u %.4s of mjpeg\n",
+			s->config.format.width, s->config.format.height,
+			(char *)&s->mjpeg->fourcc);
+	} else {
+		device_init(&s->out, &s->config, V4L2_CAP_VIDEO_OUTPUT);
+	}
+
+	/* negotiate format between pipelines */
+	while (s->config.updated) {
+		s->config.updated = false;
+		device_exit(&s->in);
+		device_init(&s->in, &s->config, V4L2_CAP_VIDEO_CAPTURE);
+		device_exit(&s->out);
+		device_init(&s->out, &s->config, V4L2_CAP_VIDEO_OUTPUT);
+	}
+	ASSERT(!s->mjpeg && s->in.num_planes != s->out.num_planes,
+		"%u planes of input, %u planes of output\n",
+		s->in.num_planes, s->out.num_planes);
+	stream_negotiate_stride(s);
+	if (s->remap) {
+		/* config is of the output, which was set up last */
+		ret = remap_format(s->remap, &s->config, s->in.bytesperline,
+				s->out.bytesperline);
+		ASSERT(ret < 0, "can't correct lens of %ux%u %.4s\n",
+			s->config.format.width, s->config.format.height,
+			(char *)&s->config.fourcc);
+		printf("%s: lens lut %s in %.1f ms\n", s->in.devname,
+			s->remap->loaded ? "loaded" : "generated",
+			s->remap->lut_ns / 1e6);
+	}
+	if (s->grade)
+		stream_init_grade(s);
+	if (s->media)
+		media_validate(s->media, &s->config);
+	if (s->hotplug)
+		hotplug_identify(s->hotplug, &s->in);
+
+	stream_init_buffers(s);
+	if (s->meta)
+		meta_init(s->meta, s->config.num_buffers);
+
+	/* buffers going back and forth between plain video nodes */
+	s->in.prepare = s->out.prepare = s->config.prepare &&
+		!s->mjpeg && !s->repack && !s->remap &&
+		!s->config.compressed &&
+		!s->in.dec && !s->in.req && !s->in.wb && !s->in.rtpsrc &&
+		!s->out.kms && !s->out.rtp &&
+		s->config.num_buffers <= sizeof(s->in.queued) * 8;
+
+	/* sleep only if the input can't capture at fps itself */
+	if (device_runs_at(&s->in, s->config.fps)) {
+		pace_init(&s->pace, s->config.pace, 0);
+		printf("%s: %.2f fps by hardware(out %.2f)\n", s->in.devname,
+			s->in.fps, s->out.fps);
+	} else {
+		pace_init(&s->pace, s->config.pace, s->config.fps);
+		if (s->config.fps > 0)
+			printf("%s: %.2f fps by %s(in %.2f, out %.2f)\n",
+				s->in.devname, s->config.fps,
+				pace_mode_name(s->config.pace), s->in.fps,
+				s->out.fps);
+	}
+
+	return;
+}
+
+/* build nodes of grade stage for format of frames */
+static void stream_init_grade(struct bridge_stream *s)
+{
+	int ret;
+
+	/* frames are graded in place, in buffers of input */
+	ret = grade_format(s->grade, &s->config, s->in.bytesperline);
+	ASSERT(ret < 0, "can't grade colours of %ux%u %.4s\n",
+		s->config.format.width, s->config.format.height,
+		(char *)&s->config.fourcc);
+	printf("%s: grading %.4s through %u point lut %s\n", s->in.devname,
+		(char *)&s->config.fourcc, s->grade->size, s->grade->path);
+}
+
+/* export and map buffers of output of a stage, of config c of the output
+ * device, all are free until written into */
+static void stream_init_stage_buffers(struct bridge_stream *s,
+		struct stage_pool *pool, const struct config *c)
+{
+	struct buffer *b;
+	int i;
+
+	pool->buffers = calloc(sizeof(*b), c->num_buffers);
+	ASSERT(!pool->buffers, "failed to allocate stage buffers\n");
+	pool->num_buffers = c->num_buffers;
+	pool->free = NULL;
+	pthread_mutex_init(&pool->lock, NULL);
+	for (i = 0; i < c->num_buffers; i++) {
+		b = &pool->buffers[i];
+		b->index = i;
+		device_prepare_buffer(&s->out, b);
+		b->frame.index = i;
+		b->frame.dmabuf_fd = b->dbuf_fd[0];
+		b->frame.size = c->planes[0].sizeimage;
+		b->s = s;
+		b->frame.data = mmap(NULL, b->frame.size,
+				PROT_READ | PROT_WRITE, MAP_SHARED,
+				b->dbuf_fd[0], 0);
+		ASSERT(b->frame.data == MAP_FAILED,
+				"failed to map stage buffer: %s\n", ERRSTR);
+		stage_pool_release(pool, b);
+	}
+}
+
+/* output buffer is back from output device */
+void stage_pool_release(struct stage_pool *pool, struct buffer *b)
+{
+	pthread_mutex_lock(&pool->lock);
+	b->next = pool->free;
+	pool->free = b;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* free buffer of stage to write a frame into, NULL if all are out */
+struct buffer *stage_pool_get(struct stage_pool *pool)
+{
+	struct buffer *b;
+
+	pthread_mutex_lock(&pool->lock);
+	b = pool->free;
+	if (b)
+		pool->free = b->next;
+	pthread_mutex_unlock(&pool->lock);
+
+	return b;
+}
+
+/* begin or end cpu writes to buffer of stage */
+void stage_pool_sync(struct buffer *b, unsigned int flags)
+{
+	struct dma_buf_sync sync = {
+		.flags = flags | DMA_BUF_SYNC_WRITE,
+	};
+
+	WARN_ON(ioctl(b->dbuf_fd[0], DMA_BUF_IOCTL_SYNC, &sync) < 0,
+			"DMA_BUF_IOCTL_SYNC failed: %s\n", ERRSTR);
+}
+
+/* export buffers, and queue them to input */
+static void stream_init_buffers(struct bridge_stream *s)
+{
+	struct buffer *b;
+	int i;
+
+	s->buffers = calloc(sizeof(*b), s->config.num_buffers);
+	ASSERT(!s->buffers, "failed to allocate buffers\n");
+	timing_begin(&s->timing, PHASE_EXPBUF);
+	for (i = 0; i < s->config.num_buffers; i++) {
+		s->buffers[i].index = i;
+		/* prepare/export buffer */
+		device_prepare_buffer(&s->in, &s->buffers[i]);
+		if (!s->mjpeg && !s->repack && !s->remap)
+			device_prepare_buffer(&s->out, &s->buffers[i]);
+		s->buffers[i].frame.index = i;
+		s->buffers[i].frame.dmabuf_fd = s->buffers[i].dbuf_fd[0];
+		s->buffers[i].frame.size = s->config.planes[0].sizeimage;
+		s->buffers[i].s = s;
+	}
+	if (s->mjpeg)
+		stream_init_stage_buffers(s, &s->mjpeg->pool,
+				&s->mjpeg->config);
+	if (s->repack)
+		stream_init_stage_buffers(s, &s->repack->pool,
+				&s->repack->config);
+	if (s->remap)
+		stream_init_stage_buffers(s, &s->remap->pool,
+				&s->remap->config);
+	timing_end(&s->timing, PHASE_EXPBUF);
+
+	plugin_negotiate(s);
+
+	timing_begin(&s->timing, PHASE_QBUF);
+	for (i = 0; i < s->config.num_buffers; i++) {
+		/* queue buffer to input */
+		device_queue_buffer(&s->in, &s->buffers[i]);
+	}
+	timing_end(&s->timing, PHASE_QBUF);
+}
+
+/*
+ * stream manager operations
+ */
+
+/* turn on manager */
+static void manager_on(struct bridge *m)
+{
+	int i;
+	workers_start(&m->workers);
+	for (i = 0; i < m->num_streams; i++) {
+		/* create a thread for each stream */
+		pthread_create(&m->streams[i]->thread, NULL, stream_on,
+				m->streams[i]);
+	}
+	return;
+}
+
+/* turn off manager */
+static void manager_off(struct bridge *m)
+{
+	int i;
+	if (__sync_lock_test_and_set(&m->off, 1))
+		return;
+	timing_begin(&m->timing, PHASE_SHUTDOWN);
+	for (i = 0; i < m->num_streams; i++) {
+		/* cancel a stream thread */
+		timing_begin(&m->streams[i]->timing, PHASE_STREAMOFF);
+		if (m->streams[i]->thread)
+			pthread_cancel(m->streams[i]->thread);
+	}
+	return;
+}
+
+/* exit manager */
+static void manager_exit(struct bridge *m)
+{
+	int i;
+	/* wait for threads to terminate */
+	for (i = 0; i < m->num_streams; i++)
+		pthread_join(m->streams[i]->thread, NULL);
+	/* workers forward the rest of jobs */
+	workers_stop(&m->workers);
+	for (i = 0; i < m->num_streams; i++) {
+		stream_exit(m->streams[i]);
+		if (m->streams[i]->snapshot)
+			snapshot_stop(m->streams[i]->snapshot);
+	}
+	timing_end(&m->timing, PHASE_SHUTDOWN);
+	return;
+}
+
+/* start snapshots of stream idx into path, as prefix-streamN.ext */
+static void stream_init_snapshot(struct bridge_stream *s, const char *path,
+		int idx)
+{
+	struct snapshot *sn;
+	size_t len;
+	int ret;
+
+	sn = calloc(1, sizeof(*sn));
+	ASSERT(!sn, "failed to allocate snapshot\n");
+	ret = snapshot_parse_args(sn, path);
+	ASSERT(ret < 0, "invalid snapshot path %s\n", path);
+	len = strlen(sn->prefix);
+	snprintf(sn->prefix + len, sizeof(sn->prefix) - len, "-stream%d", idx);
+	snapshot_start(sn, stream_snapshot_release, s);
+	s->snapshot = sn;
+}
+
+/* start signal monitor of stream with args(period[,hold]) */
+static void stream_init_monitor(struct bridge_stream *s, const char *args)
+{
+	struct monitor *mon;
+	int ret;
+
+	mon = calloc(1, sizeof(*mon));
+	ASSERT(!mon, "failed to allocate monitor\n");
+	ret = monitor_parse_args(mon, args);
+	ASSERT(ret < 0, "invalid monitor args %s\n", args);
+	monitor_init(mon, s->in.devname);
+	s->monitor = mon;
+}
+
+/* plain capture inputs are found again by what they were opened as */
+static void stream_init_hotplug(struct bridge_stream *s)
+{
+	if (s->hotplug || s->in.wb || s->in.rtpsrc || s->in.dec || s->meta)
+		return;
+	s->hotplug = calloc(1, sizeof(*s->hotplug));
+	ASSERT(!s->hotplug, "failed to allocate hotplug\n");
+}
+
+/* initialize manager */
+static void manager_init(struct bridge *m)
+{
+	int i;
+	for (i = 0; i < m->num_streams; i++) {
+		m->streams[i]->config.pace = m->pace;
+		m->streams[i]->config.count = m->count;
+		m->streams[i]->config.prepare = m->prepare;
+		if (m->hotplug)
+			stream_init_hotplug(m->streams[i]);
+		stream_init(m->streams[i]);
+		if (*m->snapshot)
+			stream_init_snapshot(m->streams[i], m->snapshot, i);
+		if (*m->monitor)
+			stream_init_monitor(m->streams[i], m->monitor);
+	}
+	return;
+}
+
+/* free stream */
+static void stream_free(struct bridge_stream *s)
+{
+	int i;
+	for (i = 0; i < s->num_plugins; i++)
+		plugin_unload(&s->plugins[i]);
+	stream_exit_buffers(s);
+	free(s->out.enc);
+	free(s->out.kms);
+	free(s->out.rtp);
+	free(s->in.dec);
+	free(s->in.req);
+	free(s->in.wb);
+	free(s->in.rtpsrc);
+	free(s->mjpeg);
+	free(s->repack);
+	if (s->remap)
+		remap_close(s->remap);
+	free(s->remap);
+	if (s->grade)
+		grade_close(s->grade);
+	free(s->grade);
+	free(s->snapshot);
+	if (s->monitor)
+		monitor_exit(s->monitor);
+	free(s->monitor);
+	free(s->media);
+	free(s->meta);
+	free(s->hotplug);
+	free(s);
+}
+
+/* free manager */
+static void manager_free(struct bridge *m)
+{
+	int i;
+	for (i = 0; i < m->num_streams; i++)
+		stream_free(m->streams[i]);
+	pthread_mutex_destroy(&m->workers.lock);
+	pthread_cond_destroy(&m->workers.cond);
+	free(m->streams);
+	free(m);
+	return;
+}
+
+/*
+ * library interface
+ */
+
+/* dump qbuf latency of device */
+static void device_dump_stats(struct device *d, const char *who,
+		const char *name, FILE *fp)
+{
+	if (!d->qbuf.count)
+		return;
+
+	fprintf(fp, "%s qbuf %s count %llu prepared %llu p50_us %.1f "
+			"p90_us %.1f p99_us %.1f max_us %.1f\n", who, name,
+			(unsigned long long)d->qbuf.count,
+			(unsigned long long)d->ahead,
+			latency_percentile(&d->qbuf, 0.5) / 1e3,
+			latency_percentile(&d->qbuf, 0.9) / 1e3,
+			latency_percentile(&d->qbuf, 0.99) / 1e3,
+			d->qbuf.max / 1e3);
+}
+
+/* create manager without streams */
+struct bridge *bridge_create(void)
+{
+	struct bridge *m;
+
+	timing_epoch();
+	kernel_init();
+
+	m = calloc(1, sizeof(*m));
+	ASSERT(!m, "failed to allocate manager\n");
+	m->pace = PACE_DEADLINE;
+	pthread_mutex_init(&m->workers.lock, NULL);
+	pthread_cond_init(&m->workers.cond, NULL);
+
+	return m;
+}
+
+/* free manager, after bridge_wait() if it was started */
+void bridge_destroy(struct bridge *m)
+{
+	manager_free(m);
+}
+
+/* set fps pacing of all streams(sleep or deadline) */
+int bridge_set_pace(struct bridge *m, const char *pace)
+{
+	int ret;
+
+	ret = pace_mode_parse(pace);
+	if (ret < 0)
+		return ret;
+	m->pace = ret;
+
+	return 0;
+}
+
+/* stop once every stream forwarded count frames(0 for no limit) */
+void bridge_set_count(struct bridge *m, unsigned int count)
+{
+	m->count = count;
+}
+
+/* run plugins on num worker threads instead of stream threads */
+void bridge_set_workers(struct bridge *m, unsigned int num)
+{
+	m->workers.num = num;
+}
+
+/* write snapshots as path(prefix.ppm or prefix.png) with -streamN-sequence
+ * inserted before the extension, returns -1 if it's invalid */
+int bridge_set_snapshot(struct bridge *m, const char *path)
+{
+	struct snapshot sn;
+
+	if (snapshot_parse_args(&sn, path) < 0)
+		return -1;
+	snprintf(m->snapshot, sizeof(m->snapshot), "%s", path);
+
+	return 0;
+}
+
+/* snapshot the next frame of every stream, safe to call from a signal
+ * handler */
+void bridge_snapshot(struct bridge *m)
+{
+	int i;
+
+	for (i = 0; i < m->num_streams; i++)
+		bridge_stream_snapshot(m->streams[i]);
+}
+
+/* snapshot the next frame of stream, safe to call from a signal handler */
+void bridge_stream_snapshot(struct bridge_stream *s)
+{
+	if (s->snapshot)
+		snapshot_arm(s->snapshot);
+}
+
+/* monitor streams for black, frozen and missing signal, with
+ * args(period[,hold]): check every period-th frame, and raise or clear
+ * alarms after hold checks */
+int bridge_set_monitor(struct bridge *m, const char *args)
+{
+	struct monitor mon;
+
+	if (monitor_parse_args(&mon, args) < 0)
+		return -1;
+	snprintf(m->monitor, sizeof(m->monitor), "%s", args);
+
+	return 0;
+}
+
+/* raised alarms of stream(enum bridge_alarm) */
+unsigned int bridge_stream_alarms(struct bridge_stream *s)
+{
+	return s->monitor ? s->monitor->alarms : 0;
+}
+
+/* prepare buffers ahead of their qbuf while devices are idle(nonzero) */
+void bridge_set_prepare(struct bridge *m, int prepare)
+{
+	m->prepare = prepare;
+}
+
+void bridge_set_hotplug(struct bridge *m, int hotplug)
+{
+	m->hotplug = hotplug;
+}
+
+/* add stream from config(in:out@expdev@fps:num_buf:w,h:fourcc[+plugin]) */
+struct bridge_stream *bridge_add_stream(struct bridge *m, const char *config)
+{
+	struct bridge_stream **streams;
+	struct bridge_stream *s;
+	int ret;
+
+	s = calloc(1, sizeof(*s));
+	ASSERT(!s, "failed to allocate stream\n");
+
+	timing_begin(&m->timing, PHASE_PARSE);
+	ret = stream_parse_args(s, config);
+	timing_end(&m->timing, PHASE_PARSE);
+	if (WARN_ON(ret < 0, "invalid stream args\n")) {
+		stream_dump_config(s);
+		stream_free(s);
+		return NULL;
+	}
+
+	streams = realloc(m->streams, sizeof(*streams) * (m->num_streams + 1));
+	ASSERT(!streams, "failed to allocate streams\n");
+	m->streams = streams;
+	m->streams[m->num_streams++] = s;
+	s->m = m;
+
+	return s;
+}
+
+/* set per frame callback, before bridge_start() */
+void bridge_stream_set_callback(struct bridge_stream *s, bridge_frame_cb cb,
+		void *priv)
+{
+	s->cb = cb;
+	s->cb_priv = priv;
+}
+
+/* initialize devices of all streams and start a thread per stream */
+void bridge_start(struct bridge *m)
+{
+	manager_init(m);
+	manager_on(m);
+}
+
+/* request streams to stop, safe to call from a signal handler */
+void bridge_stop(struct bridge *m)
+{
+	manager_off(m);
+}
+
+/* wait for streams to stop, and close devices */
+void bridge_wait(struct bridge *m)
+{
+	manager_exit(m);
+}
+
+/* dump phase timing: <who> <phase> <duration ns> <end ns from epoch> */
+void bridge_dump_timing(struct bridge *m, FILE *fp)
+{
+	char who[24];
+	int i;
+
+	fprintf(fp, "# who phase duration_ns end_ns\n");
+	timing_dump(&m->timing, "manager", fp);
+	for (i = 0; i < m->num_streams; i++) {
+		snprintf(who, sizeof(who), "stream%d", i);
+		timing_dump(&m->streams[i]->timing, who, fp);
+	}
+}
+
+/* dump stats of plugins, stages, metadata, requests, sinks and sources */
+void bridge_dump_stats(struct bridge *m, FILE *fp)
+{
+	char who[24];
+	int i;
+
+	for (i = 0; i < m->num_streams; i++) {
+		snprintf(who, sizeof(who), "stream%d", i);
+		plugin_dump_stats(m->streams[i], who, fp);
+		device_dump_stats(&m->streams[i]->in, who, "in", fp);
+		device_dump_stats(&m->streams[i]->out, who, "out", fp);
+		if (m->streams[i]->mjpeg)
+			mjpeg_dump_stats(m->streams[i]->mjpeg, who, fp);
+		if (m->streams[i]->repack)
+			repack_dump_stats(m->streams[i]->repack, who, fp);
+		if (m->streams[i]->remap)
+			remap_dump_stats(m->streams[i]->remap, who, fp);
+		if (m->streams[i]->grade)
+			grade_dump_stats(m->streams[i]->grade, who, fp);
+		if (m->streams[i]->snapshot)
+			snapshot_dump_stats(m->streams[i]->snapshot, who, fp);
+		if (m->streams[i]->monitor)
+			monitor_dump_stats(m->streams[i]->monitor, who, fp);
+		if (m->streams[i]->meta)
+			meta_dump_stats(m->streams[i]->meta, who, fp);
+		if (m->streams[i]->hotplug && m->streams[i]->hotplug->unplugs)
+			hotplug_dump_stats(m->streams[i]->hotplug, who, fp);
+		if (m->streams[i]->in.req)
+			request_dump_stats(m->streams[i]->in.req, who, fp);
+		if (m->streams[i]->out.enc)
+			encoder_dump_stats(m->streams[i]->out.enc, who, fp);
+		if (m->streams[i]->out.kms)
+			kms_dump_stats(m->streams[i]->out.kms, who, fp);
+		if (m->streams[i]->out.rtp)
+			rtp_dump_stats(m->streams[i]->out.rtp, who, fp);
+		if (m->streams[i]->in.rtpsrc)
+			rtp_source_dump_stats(m->streams[i]->in.rtpsrc, who,
+					fp);
+		if (m->streams[i]->in.wb)
+			writeback_dump_stats(m->streams[i]->in.wb, who, fp);
+		if (m->streams[i]->in.dec)
+			decoder_dump_stats(m->streams[i]->in.dec, who, fp);
+	}
+}
+
+/* map frame for cpu access on first call, valid until the frame is released */
+void *bridge_frame_map(struct bridge_stream *s, struct bridge_frame *f)
+{
+	struct buffer *b = &s->buffers[f->index];
+	struct dma_buf_sync sync = {
+		.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW,
+	};
+
+	if (!f->data) {
+		f->data = mmap(NULL, f->size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, b->dbuf_fd[0], 0);
+		if (WARN_ON(f->data == MAP_FAILED, "failed to map buffer %u: "
+					"%s\n", f->index, ERRSTR)) {
+			f->data = NULL;
+			return NULL;
+		}
+	}
+
+	if (!b->synced) {
+		WARN_ON(ioctl(b->dbuf_fd[0], DMA_BUF_IOCTL_SYNC, &sync) < 0,
+				"DMA_BUF_IOCTL_SYNC failed: %s\n", ERRSTR);
+		b->synced = true;
+	}
+
+	return f->data;
+}
+
+/* forward a held frame to the output through plugins */
+void bridge_frame_forward(struct bridge_stream *s, struct bridge_frame *f)
+{
+	stream_process(s, &s->buffers[f->index]);
+}
+
+/* give a held frame back to the input */
+void bridge_frame_drop(struct bridge_stream *s, struct bridge_frame *f)
+{
+	stream_drop(s, &s->buffers[f->index]);
+}
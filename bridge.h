@@ -0,0 +1,114 @@
+/*
+ * libv4l2bridge: passes buffers between V4L2 pipelines
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __BRIDGE_H__
+#define __BRIDGE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * USAGE
+ *
+ * m = bridge_create();
+ * s = bridge_add_stream(m, "/dev/video0:/dev/video1@o@30:4:640,480:YUYV");
+ * bridge_stream_set_callback(s, cb, priv);
+ * bridge_start(m);
+ * ...
+ * bridge_stop(m);		(from any thread or a signal handler)
+ * bridge_wait(m);
+ * bridge_destroy(m);
+ *
+ * device errors abort() as in the bridge application. processing stages can
+ * be loaded as plugins from the stream config, see bridge_plugin.h.
+ */
+
+struct bridge;				/* stream manager */
+struct bridge_stream;			/* stream between 2 pipelines */
+
+/* frame dequeued from the input device */
+struct bridge_frame {
+	unsigned int index;		/* buffer index */
+	int dmabuf_fd;			/* dmabuf fd of the first plane */
+	void *data;			/* cpu mapping, see bridge_frame_map() */
+	size_t size;			/* size of the buffer(first plane) */
+	unsigned int sequence;		/* sequence of the driver */
+	struct timeval timestamp;	/* timestamp of the driver */
+	uint64_t dequeued_ns;		/* CLOCK_MONOTONIC time of dequeue */
+	size_t bytesused;		/* bytes of data(compressed formats) */
+	unsigned int flags;		/* v4l2 buffer flags */
+	const void *meta;		/* matched metadata(mmap), or NULL */
+	size_t meta_size;		/* bytes of metadata */
+	unsigned int bracket;		/* step of control schedule(%ctrls) */
+};
+
+/* what to do with a frame after the callback */
+enum bridge_action {
+	BRIDGE_FORWARD,			/* queue to the output device */
+	BRIDGE_HOLD,			/* keep, release with forward/drop */
+	BRIDGE_DROP,			/* give back to the input device */
+};
+
+/* alarms of the signal monitor */
+enum bridge_alarm {
+	BRIDGE_ALARM_BLACK	= 1 << 0,	/* dark and flat picture */
+	BRIDGE_ALARM_FROZEN	= 1 << 1,	/* picture doesn't change */
+	BRIDGE_ALARM_NO_SIGNAL	= 1 << 2,	/* flat field or colour bars */
+};
+
+/*
+ * called from the stream thread for every frame dequeued from the input
+ * device, before it's forwarded. it must not block for longer than a frame
+ * period, and holding all buffers stalls the input.
+ */
+typedef enum bridge_action (*bridge_frame_cb)(struct bridge_stream *s,
+		struct bridge_frame *f, void *priv);
+
+struct bridge *bridge_create(void);
+void bridge_destroy(struct bridge *m);
+
+int bridge_set_pace(struct bridge *m, const char *pace);
+void bridge_set_count(struct bridge *m, unsigned int count);
+void bridge_set_workers(struct bridge *m, unsigned int num);
+void bridge_set_prepare(struct bridge *m, int prepare);
+void bridge_set_hotplug(struct bridge *m, int hotplug);
+int bridge_set_snapshot(struct bridge *m, const char *path);
+int bridge_set_monitor(struct bridge *m, const char *args);
+
+struct bridge_stream *bridge_add_stream(struct bridge *m, const char *config);
+void bridge_stream_set_callback(struct bridge_stream *s, bridge_frame_cb cb,
+		void *priv);
+
+void bridge_start(struct bridge *m);
+void bridge_stop(struct bridge *m);
+void bridge_wait(struct bridge *m);
+void bridge_dump_timing(struct bridge *m, FILE *fp);
+void bridge_dump_stats(struct bridge *m, FILE *fp);
+
+void bridge_snapshot(struct bridge *m);
+void bridge_stream_snapshot(struct bridge_stream *s);
+unsigned int bridge_stream_alarms(struct bridge_stream *s);
+
+void *bridge_frame_map(struct bridge_stream *s, struct bridge_frame *f);
+void bridge_frame_forward(struct bridge_stream *s, struct bridge_frame *f);
+void bridge_frame_drop(struct bridge_stream *s, struct bridge_frame *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BRIDGE_H__ */
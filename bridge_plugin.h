@@ -0,0 +1,103 @@
+/*
+ * libv4l2bridge processing stage plugin ABI
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __BRIDGE_PLUGIN_H__
+#define __BRIDGE_PLUGIN_H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * PLUGIN
+ *
+ * a plugin is a shared object which exports a struct bridge_plugin named
+ * BRIDGE_PLUGIN_SYMBOL. it's loaded with dlopen from the stream config:
+ *
+ * in:out@expdev@fps:num_buf:w,h:fourcc+path.so[,args]+path.so[,args]...
+ *
+ * plugins of a stream run in the given order on every forwarded frame, in
+ * the stream thread, or on the worker threads of the manager if there are
+ * any(bridge_set_workers()). frames still leave in the order they came in.
+ *
+ * the input and output devices share the buffers, so the format after the
+ * last plugin must be the format of the stream, and any format in between
+ * must fit in a buffer.
+ */
+
+/* bump on any incompatible change of the structures below */
+#define BRIDGE_PLUGIN_ABI_VERSION	1
+
+/* name of the exported struct bridge_plugin */
+#define BRIDGE_PLUGIN_SYMBOL		"bridge_plugin"
+
+/* flags */
+#define BRIDGE_PLUGIN_INPLACE		(1 << 0)	/* out is in */
+
+/* cpu requirements, bits of the kernel tiers(kernel.h) */
+#define BRIDGE_CPU_SSE2			(1 << 1)
+#define BRIDGE_CPU_SSE41		(1 << 2)
+#define BRIDGE_CPU_AVX2			(1 << 3)
+#define BRIDGE_CPU_AVX512		(1 << 4)
+#define BRIDGE_CPU_NEON			(1 << 5)
+
+/* frame format */
+struct bridge_plugin_format {
+	unsigned int width;		/* width in pixels */
+	unsigned int height;		/* height in lines */
+	unsigned int fourcc;		/* v4l2 pixel format */
+	unsigned int bytesperline;	/* stride */
+	unsigned int sizeimage;		/* bytes of a frame */
+};
+
+/* frame given to process() */
+struct bridge_plugin_frame {
+	void *data;			/* cpu mapping */
+	size_t size;			/* size of the mapping */
+	const struct bridge_plugin_format *format;	/* format of data */
+	unsigned int sequence;		/* sequence of the driver */
+	struct timeval timestamp;	/* timestamp of the driver */
+	const void *meta;		/* matched metadata(mmap), or NULL */
+	size_t meta_size;		/* bytes of metadata */
+};
+
+/* entry points, all but process() are optional */
+struct bridge_plugin {
+	unsigned int abi_version;	/* BRIDGE_PLUGIN_ABI_VERSION */
+	const char *name;		/* name for stats */
+	unsigned int flags;		/* BRIDGE_PLUGIN_* */
+	unsigned int cpu;		/* required BRIDGE_CPU_* */
+
+	/* create an instance with args after ',' of the config, or NULL */
+	int (*init)(void **priv, const char *args);
+	/* check the input format, and change out(a copy of in) if needed */
+	int (*negotiate)(void *priv, const struct bridge_plugin_format *in,
+			struct bridge_plugin_format *out);
+	/* process a frame, out is in for BRIDGE_PLUGIN_INPLACE. the frame is
+	 * dropped on error. may run on several threads at once */
+	int (*process)(void *priv, const struct bridge_plugin_frame *in,
+			struct bridge_plugin_frame *out);
+	/* print own stats */
+	void (*stats)(void *priv, FILE *fp);
+	/* destroy the instance */
+	void (*exit)(void *priv);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BRIDGE_PLUGIN_H__ */
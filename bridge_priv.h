@@ -0,0 +1,1059 @@
+/*
+ * libv4l2bridge internals
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ * Author: hyun woo kwon <hyunk@xilinx.com>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __BRIDGE_PRIV_H__
+#define __BRIDGE_PRIV_H__
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+#include <linux/v4l2-subdev.h>
+
+#include "bridge.h"
+#include "bridge_plugin.h"
+#include "kernel.h"
+#include "pace.h"
+#include "timing.h"
+
+/*
+ * OVERALL STRUCTURES
+ *
+ * manager	-> stream	-> media graph
+ *				-> buffers
+ *				-> metadata node
+ *				-> common config
+ *				-> device(in)
+ *				-> device(out)
+ *		-> streams,,,
+ *
+ */
+
+/* video device */
+struct device {
+	char devname[64];		/* device name */
+	int fd;				/* device node fd */
+	unsigned int type;		/* device type */
+
+	unsigned int buf_type;		/* type of buffer */
+	unsigned int mem_type;		/* type of memory */
+	bool mplane;			/* multi-planar api */
+	unsigned int num_planes;	/* planes of a buffer */
+
+	bool export;			/* flag to export using dmabuf */
+	double fps;			/* rate set with S_PARM(0: unset) */
+	unsigned int bytesperline;	/* stride the node took */
+	bool prepare;			/* VIDIOC_PREPARE_BUF ahead of qbuf */
+	uint64_t queued;		/* buffers queued, a bit per index */
+	uint64_t prepared;		/* buffers prepared ahead of qbuf */
+	uint64_t ahead;			/* qbufs of prepared buffers */
+	struct latency qbuf;		/* latency of VIDIOC_QBUF */
+	bool replug;			/* unplug suspends instead of aborting */
+	bool gone;			/* node was unplugged */
+
+	struct timing *timing;		/* phase timing of stream */
+	struct encoder *enc;		/* output device is an encoder */
+	struct decoder *dec;		/* input device is a decoder */
+	struct request *req;		/* per frame controls of input */
+	struct kms *kms;		/* output device is a display */
+	struct writeback *wb;		/* input device is a writeback */
+	struct rtp *rtp;		/* output device is a network sink */
+	struct rtp_source *rtpsrc;	/* input device is a network source */
+};
+
+/* common config for stream */
+struct config {
+	unsigned int fourcc;		/* fourcc */
+	struct v4l2_pix_format format;	/* v4l2 pixel format */
+	unsigned int num_planes;	/* planes of a buffer */
+	struct v4l2_plane_pix_format planes[VIDEO_MAX_PLANES];	/* per plane */
+	bool compressed;		/* fourcc is a compressed format */
+	bool updated;			/* flag if v4l2 format is fixed */
+	unsigned int num_buffers;	/* num of buffers */
+	double fps;			/* fps(<= 0 for free run) */
+	enum pace_mode pace;		/* pacing implementation */
+	unsigned int count;		/* frames to forward before stop(0: no limit) */
+	bool prepare;			/* prepare buffers ahead of qbuf */
+};
+
+/* buffer */
+struct buffer {
+	unsigned int index;		/* buffer index */
+	int dbuf_fd[VIDEO_MAX_PLANES];	/* dmabuf fd per plane */
+	struct bridge_frame frame;	/* frame given to callback */
+	bool synced;			/* cpu access began on mapping */
+
+	/* metadata of last capture, passed on to output */
+	unsigned int bytesused[VIDEO_MAX_PLANES];	/* bytes per plane */
+	unsigned int data_offset[VIDEO_MAX_PLANES];	/* offset per plane */
+	unsigned int flags;		/* v4l2 buffer flags */
+	unsigned int field;		/* v4l2 field */
+	struct v4l2_timecode timecode;	/* timecode */
+
+	void *scratch;			/* output of not in place plugins */
+	struct meta_buffer *meta;	/* matched metadata */
+	struct buffer *decoded;		/* output buffer of mjpeg or repack */
+	struct bridge_stream *s;	/* stream of buffer */
+	struct buffer *next;		/* next job of workers, or free buffer */
+	unsigned int ticket;		/* order of job in stream */
+};
+
+/* mmap buffer of coded frames */
+struct coded_buffer {
+	void *data;			/* mapping */
+	size_t length;			/* size of mapping */
+};
+
+/* raw frame queued to encoder */
+struct encoder_pending {
+	struct timeval timestamp;	/* timestamp copied to coded frame */
+	uint64_t queued_ns;		/* time of queue(0: none) */
+};
+
+/* stateful m2m encoder stage */
+struct encoder {
+	unsigned int fourcc;		/* coded format */
+	char path[256];			/* file sink */
+	int file;			/* fd of file sink */
+
+	struct coded_buffer *buffers;	/* coded buffers */
+	unsigned int num_buffers;	/* number of coded buffers */
+
+	pthread_mutex_t lock;		/* lock of pending */
+	struct encoder_pending *pending;	/* raw frames in flight */
+	unsigned int num_pending;	/* size of pending */
+	unsigned int next_pending;	/* next slot of pending */
+
+	uint64_t frames;		/* coded frames */
+	uint64_t keyframes;		/* coded key frames */
+	uint64_t bytes;			/* bytes written */
+	uint64_t lat_ns;		/* total queue to coded frame time */
+	uint64_t lat_frames;		/* frames with latency */
+	uint64_t lat_min;		/* min latency */
+	uint64_t lat_max;		/* max latency */
+};
+
+/* stateful m2m decoder source */
+struct decoder {
+	unsigned int fourcc;		/* coded format */
+	char path[256];			/* elementary stream file */
+	bool loop;			/* restart at end of file */
+	int file;			/* fd of file */
+	uint8_t *data;			/* mapping of file */
+	size_t size;			/* size of file */
+	size_t pos;			/* position of next frame */
+
+	struct coded_buffer *buffers;	/* coded buffers */
+	unsigned int num_buffers;	/* number of coded buffers */
+
+	bool stopped;			/* V4L2_DEC_CMD_STOP sent */
+	bool source_change;		/* format changes after last buffer */
+
+	uint64_t frames;		/* frames fed */
+	uint64_t dropped;		/* frames larger than a buffer */
+	unsigned int loops;		/* times the file restarted */
+	unsigned int changes;		/* resolution changes */
+};
+
+#define REQUEST_MAX_CTRLS	4	/* controls of a schedule */
+#define REQUEST_MAX_STEPS	8	/* steps of a schedule */
+
+/* control of bracketing schedule */
+struct request_ctrl {
+	char name[32];			/* name as v4l2-ctl, or id */
+	unsigned int id;		/* control id */
+	unsigned int type;		/* control type */
+	int64_t values[REQUEST_MAX_STEPS];	/* value per step */
+};
+
+/* request of a capture buffer */
+struct request_slot {
+	int fd;				/* request fd */
+	unsigned int step;		/* step of schedule queued with */
+	bool used;			/* queued before, needs reinit */
+};
+
+/* per frame controls through the media Request API */
+struct request {
+	struct request_ctrl ctrls[REQUEST_MAX_CTRLS];	/* controls */
+	unsigned int num_ctrls;		/* number of controls */
+	unsigned int num_steps;		/* steps of schedule */
+
+	int media_fd;			/* media device of input */
+	struct request_slot *slots;	/* request per buffer */
+	unsigned int num_slots;		/* number of slots */
+	pthread_mutex_t lock;		/* lock of next_step */
+	unsigned int next_step;		/* step of next queued buffer */
+
+	uint64_t frames;		/* frames dequeued */
+	uint64_t mismatched;		/* frames of adjusted values */
+	uint64_t incomplete;		/* frames read back too early */
+};
+
+/* exported buffers of output device a stage writes frames into */
+struct stage_pool {
+	struct buffer *buffers;		/* buffers of output device */
+	unsigned int num_buffers;	/* number of buffers */
+	pthread_mutex_t lock;		/* lock of free */
+	struct buffer *free;		/* buffers not queued to output */
+};
+
+/* cpu mjpeg decode stage */
+struct mjpeg {
+	unsigned int fourcc;		/* raw format of output */
+	struct config config;		/* config of output device */
+	struct stage_pool pool;		/* buffers of output device */
+
+	uint64_t frames;		/* decoded frames */
+	uint64_t sliced;		/* frames decoded in slices */
+	uint64_t errors;		/* dropped corrupt frames */
+	uint64_t no_buffer;		/* dropped with no free buffer */
+	uint64_t warnings;		/* recoverable corrupt data */
+	uint64_t ns;			/* total decode time */
+};
+
+/* stage repacking rows for the stride of output */
+struct repack {
+	struct config config;		/* config of output device */
+	struct stage_pool pool;		/* buffers of output device */
+	unsigned int src_stride;	/* bytes per line of input */
+	unsigned int dst_stride;	/* bytes per line of output */
+	unsigned int width;		/* bytes copied per line */
+	unsigned int lines;		/* lines of all planes */
+
+	uint64_t frames;		/* repacked frames */
+	uint64_t striped;		/* frames repacked in stripes */
+	uint64_t no_buffer;		/* dropped with no free buffer */
+	uint64_t ns;			/* total repack time */
+};
+
+/* lens models of remap stage */
+enum remap_model {
+	REMAP_RADIAL,			/* r(1 + k1 r^2 + k2 r^4) */
+	REMAP_FISHEYE,			/* equidistant, to rectilinear */
+};
+
+#define REMAP_MAX_PLANES	2
+
+/* what a remap lut is generated from, and the header of its cache file */
+struct remap_key {
+	uint32_t magic;			/* REMAP_MAGIC */
+	uint32_t version;		/* layout of the file */
+	uint32_t model;			/* enum remap_model */
+	uint32_t fourcc;		/* pixel format */
+	uint32_t width;			/* width of frame */
+	uint32_t height;		/* height of frame */
+	uint32_t src_stride;		/* bytes per line of input */
+	uint32_t reserved;		/* 0 */
+	double fov;			/* fisheye field of view in degrees */
+	double k1;			/* distortion coefficients */
+	double k2;
+	double zoom;			/* scale of output, > 1 crops */
+};
+
+/* plane sampled by remap stage */
+struct remap_plane {
+	unsigned int width;		/* pixels per line */
+	unsigned int height;		/* lines */
+	unsigned int bpp;		/* bytes per pixel */
+	unsigned int hsub;		/* subsampling against luma */
+	unsigned int vsub;
+	size_t src_base;		/* start of plane in input */
+	size_t dst_base;		/* start of plane in output */
+	const uint32_t *offset;		/* lut: source byte of each pixel */
+	const uint16_t *weight;		/* lut: fractions(x | y << 8) */
+};
+
+/* stage sampling frames through a lens correction lut */
+struct remap {
+	struct remap_key key;		/* lens, format and stride of lut */
+	char cache[256];		/* directory of lut cache files(cache=) */
+	struct config config;		/* config of output device */
+	struct stage_pool pool;		/* buffers of output device */
+	unsigned int src_stride;	/* bytes per line of input */
+	unsigned int dst_stride;	/* bytes per line of output */
+	unsigned int num_planes;	/* planes sampled */
+	struct remap_plane planes[REMAP_MAX_PLANES];
+	void *lut;			/* key, offsets and weights of planes */
+	size_t lut_size;		/* bytes of lut */
+	bool loaded;			/* lut is read from cache file */
+	uint64_t lut_ns;		/* time to load or generate lut */
+
+	uint64_t frames;		/* remapped frames */
+	uint64_t striped;		/* frames remapped in stripes */
+	uint64_t no_buffer;		/* dropped with no free buffer */
+	uint64_t ns;			/* total remap time */
+	uint64_t busy_ns;		/* total time of stripes on all cores */
+};
+
+/* layouts of frames graded by colour stage */
+enum grade_layout {
+	GRADE_RGB32,			/* 32 bit rgb pixels */
+	GRADE_RGB24,			/* 24 bit rgb pixels */
+	GRADE_YUV422,			/* packed 4:2:2, pairs share chroma */
+	GRADE_NV,			/* semi-planar 4:2:0 or 4:2:2 */
+};
+
+/* stage grading colour of frames in place through a 3d lut */
+struct grade {
+	char path[256];			/* .cube file */
+	float *cube;			/* rgb of nodes of file, r fastest */
+	unsigned int size;		/* nodes per axis */
+	uint32_t *nodes;		/* nodes for frames, rgb or yuv */
+	struct kernel_lut3d lut;	/* lut of frames */
+	enum grade_layout layout;	/* layout of frames */
+	unsigned int off[4];		/* byte of r, g, b or y0, u, y1, v */
+	unsigned int vsub;		/* lines sharing a chroma line */
+	unsigned int fourcc;		/* format of frames */
+	unsigned int width;		/* pixels per line */
+	unsigned int height;		/* lines */
+	unsigned int stride;		/* bytes per line */
+
+	uint64_t frames;		/* graded frames */
+	uint64_t striped;		/* frames graded in stripes */
+	uint64_t ns;			/* total grade time */
+	uint64_t busy_ns;		/* total time of stripes on all cores */
+};
+
+/* on demand still image of the next forwarded frame */
+struct snapshot {
+	char prefix[256];		/* path of images without extension */
+	bool png;			/* png instead of ppm */
+	const struct v4l2_pix_format *frame_format;	/* format of b */
+	struct v4l2_pix_format format;	/* format of the copy */
+	void (*release)(void *priv, struct buffer *b);	/* gives back held */
+	void *priv;			/* data of release */
+	pthread_t thread;		/* copies and writes images */
+	pthread_mutex_t lock;		/* lock of below */
+	pthread_cond_t cond;		/* signals b and stop */
+	int armed;			/* take the next forwarded frame */
+	struct buffer *b;		/* frame being copied */
+	unsigned int sequence;		/* sequence of b */
+	bool returned;			/* b came back from output meanwhile */
+	bool stop;			/* stop thread */
+	uint8_t *copy;			/* private copy of frame */
+	size_t size;			/* size of copy */
+	uint64_t taken_ns;		/* time b was taken */
+
+	uint64_t taken;			/* frames taken */
+	uint64_t written;		/* images written */
+	uint64_t failed;		/* images not written */
+	uint64_t held;			/* frames kept from input until copied */
+	uint64_t hold_ns;		/* total time from take to copied */
+	uint64_t write_ns;		/* total time of conversion and write */
+};
+
+/* conditions of the signal monitor, bits of enum bridge_alarm */
+enum monitor_alarm {
+	MONITOR_BLACK,
+	MONITOR_FROZEN,
+	MONITOR_NO_SIGNAL,
+	MONITOR_ALARMS,
+};
+
+#define MONITOR_HOLD	3	/* default checks to raise or clear */
+
+/* black, frozen and missing signal detection */
+struct monitor {
+	char name[64];			/* device name in messages */
+	unsigned int period;		/* check every period-th frame */
+	unsigned int hold;		/* checks to raise or clear an alarm */
+	pthread_mutex_t lock;		/* one check at a time */
+	uint64_t seen;			/* frames seen */
+
+	unsigned int fourcc;		/* format of sampled frames */
+	unsigned int frame_width;	/* width of frames */
+	unsigned int frame_height;	/* height of frames */
+	unsigned int stride;		/* bytes per line of frames */
+	unsigned int offset;		/* byte of first luma sample */
+	unsigned int step;		/* bytes between luma samples */
+	unsigned int width;		/* bytes sampled per line, 0 if none */
+	unsigned int lines;		/* lines sampled */
+	unsigned int pitch;		/* frame lines between sampled lines */
+	unsigned int top;		/* sampled lines of the top 2/3 */
+	uint8_t *cur;			/* sampled lines of this check */
+	uint8_t *prev;			/* sampled lines of the last check */
+	bool valid;			/* prev is of the same geometry */
+	unsigned int count[MONITOR_ALARMS];	/* checks against alarms */
+	unsigned int alarms;		/* raised alarms(enum bridge_alarm) */
+
+	double luma;			/* mean luma of last check */
+	double var;			/* its variance */
+	double motion;			/* mean abs difference to last check */
+	double bars;			/* mean abs difference to next line */
+	uint64_t checks;		/* frames checked */
+	uint64_t raised;		/* alarms raised */
+	uint64_t ns;			/* total check time */
+};
+
+/* properties of kms objects set in commits */
+enum kms_prop {
+	KMS_PLANE_FB_ID,
+	KMS_PLANE_CRTC_ID,
+	KMS_PLANE_SRC_X,
+	KMS_PLANE_SRC_Y,
+	KMS_PLANE_SRC_W,
+	KMS_PLANE_SRC_H,
+	KMS_PLANE_CRTC_X,
+	KMS_PLANE_CRTC_Y,
+	KMS_PLANE_CRTC_W,
+	KMS_PLANE_CRTC_H,
+	KMS_CRTC_MODE_ID,
+	KMS_CRTC_ACTIVE,
+	KMS_CONN_CRTC_ID,
+	KMS_NUM_PROPS,
+};
+
+/* framebuffer of an imported buffer */
+struct kms_fb {
+	uint32_t fb_id;			/* framebuffer id */
+	uint32_t handles[VIDEO_MAX_PLANES];	/* gem handle per plane */
+	uint64_t queued_ns;		/* time of queue to display */
+};
+
+/* drm/kms display sink */
+struct kms {
+	char path[32];			/* drm device node */
+	uint32_t connector_id;		/* connector(0: first connected) */
+	uint32_t plane_id;		/* plane(0: first taking format) */
+	uint32_t crtc_id;		/* crtc of connector */
+	unsigned int crtc_index;	/* index of crtc in resources */
+	uint32_t mode_blob;		/* blob of preferred mode */
+	unsigned int mode_w, mode_h, mode_hz;	/* preferred mode */
+	uint32_t props[KMS_NUM_PROPS];	/* property ids */
+	uint32_t format;		/* drm fourcc of frames */
+	struct config config;		/* config of frames */
+	int x, y;			/* position of frames on crtc */
+	unsigned int w, h;		/* size of frames on crtc */
+
+	struct kms_fb *fbs;		/* framebuffer per buffer */
+	unsigned int num_fbs;		/* number of framebuffers */
+	bool modeset;			/* next commit sets up the pipe */
+
+	pthread_mutex_t lock;		/* lock of frames below */
+	struct buffer *shown;		/* frame on screen */
+	struct buffer *flipping;	/* frame committed, not flipped yet */
+	struct buffer *next;		/* frame waiting for the flip */
+	bool chained;			/* flipping was committed at a flip */
+	bool flipped;			/* flip event was read */
+	unsigned int flip_seq;		/* vblank sequence of the last flip */
+	uint64_t flip_ns;		/* time of the last flip */
+	unsigned int last_seq;		/* vblank sequence of previous flip */
+
+	uint64_t flips;			/* frames shown */
+	uint64_t dropped;		/* frames replaced before shown */
+	uint64_t missed;		/* vblanks missed with a frame ready */
+	uint64_t lat_ns;		/* total queue to flip time */
+	uint64_t lat_min;		/* min latency */
+	uint64_t lat_max;		/* max latency */
+};
+
+/* properties of writeback commits */
+enum writeback_prop {
+	WRITEBACK_CONN_CRTC_ID,
+	WRITEBACK_CONN_FB_ID,
+	WRITEBACK_CONN_FENCE,
+	WRITEBACK_CRTC_MODE_ID,
+	WRITEBACK_CRTC_ACTIVE,
+	WRITEBACK_NUM_PROPS,
+};
+
+/* framebuffer of writeback */
+struct writeback_fb {
+	uint32_t fb_id;			/* framebuffer id */
+	uint32_t handle;		/* gem handle of dumb buffer */
+	int fence;			/* out fence of job(-1: none) */
+	bool late;			/* job is past the timeout */
+	uint64_t queued_ns;		/* time of commit */
+};
+
+/* drm writeback connector source */
+struct writeback {
+	char path[32];			/* drm device node */
+	uint32_t connector_id;		/* connector(0: first writeback) */
+	uint32_t crtc_id;		/* crtc written back */
+	uint32_t mode_blob;		/* mode of crtc set up by source */
+	bool modeset;			/* next commit sets up the crtc */
+	unsigned int mode_w, mode_h;	/* size of crtc */
+	uint32_t props[WRITEBACK_NUM_PROPS];	/* property ids */
+	uint32_t format;		/* drm fourcc of frames */
+	unsigned int bpp;		/* bits per pixel */
+	unsigned int sizeimage;		/* bytes of a frame */
+
+	struct writeback_fb *fbs;	/* framebuffer per buffer */
+	unsigned int num_fbs;		/* number of framebuffers */
+
+	pthread_mutex_t lock;		/* lock of jobs below */
+	bool on;			/* commits can go out */
+	struct buffer **waiting;	/* buffers queued for jobs */
+	unsigned int num_waiting;	/* number of waiting */
+	struct buffer **inflight;	/* buffers of committed jobs */
+	unsigned int num_inflight;	/* number of inflight */
+	bool committing;		/* last commit isn't latched yet */
+	bool flipped;			/* flip event was read */
+	unsigned int sequence;		/* sequence of next frame */
+
+	uint64_t frames;		/* frames written back */
+	uint64_t timeouts;		/* jobs completed past the timeout */
+	uint64_t lat_ns;		/* total commit to completion time */
+	uint64_t lat_min;		/* min latency */
+	uint64_t lat_max;		/* max latency */
+};
+
+#define RTP_MAX_SEGS	64		/* packets of a segmented send */
+
+/* rfc 4175 sampling of a pixel format */
+struct rtp_format {
+	unsigned int fourcc;		/* v4l2 pixel format */
+	const char *sampling;		/* sampling of sdp */
+	unsigned int pg_bytes;		/* bytes of a pixel group */
+	unsigned int pg_pixels;		/* pixels of a pixel group */
+};
+
+/* frame held until its zero copy sends complete */
+struct rtp_pending {
+	struct buffer *b;		/* frame */
+	uint32_t first;			/* id of first send */
+	uint32_t last;			/* id of last send */
+	uint32_t remaining;		/* sends not completed, +1 sending */
+};
+
+/* rfc 4175 rtp network sink */
+struct rtp {
+	char host[64];			/* destination host */
+	char port[8];			/* destination port */
+	unsigned int mtu;		/* mtu of path */
+	double rate;			/* pacing rate in bits/s(0: none) */
+	bool zerocopy;			/* MSG_ZEROCOPY sends */
+	bool gso;			/* UDP_SEGMENT sends */
+
+	const struct rtp_format *fmt;	/* sampling of frames */
+	unsigned int width, height;	/* size of frames */
+	unsigned int bytesperline;	/* stride of frames */
+	unsigned int line_bytes;	/* bytes of pixels of a line */
+	unsigned int payload;		/* max bytes of data of a packet */
+	unsigned int packets;		/* packets of a frame */
+	uint8_t *headers;		/* headers of packets per buffer */
+	uint32_t ssrc;			/* synchronization source */
+	uint32_t seq;			/* extended sequence number */
+
+	pthread_mutex_t lock;		/* lock of sends and pending */
+	uint32_t next_id;		/* id of next zero copy send */
+	uint64_t frame_ns;		/* time of first send of frame */
+	uint64_t frame_bytes;		/* bytes of frame sent */
+	struct rtp_pending *pending;	/* frames held for completion */
+	unsigned int num_pending;	/* number of pending */
+	unsigned int num_buffers;	/* size of pending */
+
+	uint64_t frames;		/* frames sent */
+	uint64_t packets_sent;		/* packets sent */
+	uint64_t sends;			/* sendmsg calls */
+	uint64_t bytes;			/* bytes sent */
+	uint64_t copied;		/* zero copy sends the kernel copied */
+	uint64_t refused;		/* sends refused by destination */
+	uint64_t first_ns;		/* time of first send */
+	uint64_t last_ns;		/* time of last send */
+	uint64_t cpu_ns;		/* cpu time of sends */
+};
+
+#define RTP_RX_BATCH	32		/* messages of a recvmmsg */
+#define RTP_RX_FRAMES	2		/* frames assembled at once */
+#define RTP_RX_WINDOW	1024		/* sequence numbers kept for dups */
+
+/* frame assembled from packets of a timestamp */
+struct rtp_assembly {
+	bool used;			/* slot holds a frame */
+	uint32_t ts;			/* rtp timestamp of frame */
+	struct buffer *b;		/* buffer(NULL: dropped) */
+	uint8_t *data;			/* mapping of buffer */
+	unsigned int received;		/* bytes of pixels received */
+	uint64_t first_ns;		/* arrival of first packet */
+};
+
+/* rfc 4175 rtp network source */
+struct rtp_source {
+	char host[64];			/* bound address or group */
+	char port[8];			/* bound port */
+	bool gro;			/* UDP_GRO receives */
+
+	const struct rtp_format *fmt;	/* sampling of frames */
+	unsigned int width, height;	/* size of frames */
+	unsigned int bytesperline;	/* stride of frames */
+	unsigned int line_bytes;	/* bytes of pixels of a line */
+	unsigned int sizeimage;		/* bytes of a buffer */
+
+	uint8_t *ring;			/* messages of a batch */
+	struct mmsghdr *msgs;		/* headers of a batch */
+	struct iovec *iovs;		/* iovec per message */
+	char *controls;			/* control per message */
+
+	struct rtp_assembly frames[RTP_RX_FRAMES];	/* frames in assembly */
+	bool started;			/* a packet has been received */
+	uint32_t first_seq;		/* first extended sequence */
+	uint32_t max_seq;		/* highest extended sequence */
+	uint64_t seen[RTP_RX_WINDOW / 64];	/* sequences below max_seq */
+	bool done_valid;		/* done_ts is set */
+	uint32_t done_ts;		/* timestamp of last frame passed on */
+	unsigned int sequence;		/* sequence of next frame */
+
+	pthread_mutex_t lock;		/* lock of free */
+	struct buffer **free;		/* buffers to receive into */
+	unsigned int num_free;		/* number of free */
+	unsigned int num_buffers;	/* size of free */
+
+	uint64_t frames_done;		/* frames passed on */
+	uint64_t packets;		/* valid packets */
+	uint64_t recvs;			/* messages received */
+	uint64_t bytes;			/* bytes of pixels received */
+	uint64_t reordered;		/* packets behind the highest */
+	uint64_t duplicates;		/* packets received twice */
+	uint64_t late;			/* packets of frames already done */
+	uint64_t invalid;		/* malformed packets */
+	uint64_t incomplete;		/* frames abandoned with loss */
+	uint64_t dropped;		/* frames without a free buffer */
+	uint64_t first_ns;		/* time of first packet */
+	uint64_t last_ns;		/* time of last packet */
+};
+
+/* stable identity of an input, to resume on when it's replugged */
+struct hotplug {
+	char path[128];			/* link to the node(by-path, by-id) */
+	char card[32];			/* card of VIDIOC_QUERYCAP */
+	char bus[32];			/* bus_info of VIDIOC_QUERYCAP */
+	char serial[64];		/* serial of usb device */
+
+	unsigned int unplugs;		/* times input was unplugged */
+	unsigned int resumes;		/* frames came after replug */
+	uint64_t replug_ns;		/* time of replug(0: none pending) */
+	uint64_t lat_ns;		/* total replug to first frame time */
+	uint64_t lat_last;		/* last replug to first frame time */
+	uint64_t lat_max;		/* max replug to first frame time */
+};
+
+/* buffer of metadata node */
+struct meta_buffer {
+	unsigned int index;		/* buffer index */
+	void *data;			/* mapping */
+	size_t length;			/* size of mapping */
+	unsigned int bytesused;		/* bytes of metadata */
+	unsigned int sequence;		/* sequence of the driver */
+	struct timeval timestamp;	/* timestamp of the driver */
+};
+
+/* metadata capture node, companion of input */
+struct meta {
+	char devname[32];		/* device name */
+	int fd;				/* device node fd */
+	bool by_timestamp;		/* match timestamps, else sequences */
+	unsigned int tolerance_us;	/* max difference of timestamps */
+	unsigned int window;		/* unmatched buffers to keep */
+	unsigned int dataformat;	/* fourcc of metadata */
+
+	struct meta_buffer *buffers;	/* buffers */
+	unsigned int num_buffers;	/* number of buffers */
+	pthread_mutex_t lock;		/* lock of pending */
+	struct meta_buffer **pending;	/* dequeued, oldest first */
+	unsigned int num_pending;	/* number of pending */
+
+	uint64_t matched;		/* frames with metadata */
+	uint64_t unmatched;		/* frames without metadata */
+	uint64_t expired;		/* metadata out of window */
+};
+
+#define MEDIA_MAX_ITEMS	32
+
+/* pad of an entity by name */
+struct media_pad_ref {
+	char entity[32];		/* entity name */
+	unsigned int pad;		/* pad index */
+};
+
+/* link or pad format of media graph */
+struct media_item {
+	bool link;			/* link, else pad format */
+	struct media_pad_ref pad;	/* source pad of link, or pad */
+	struct media_pad_ref sink;	/* sink pad of link */
+	unsigned int flags;		/* flags of link */
+	struct v4l2_mbus_framefmt fmt;	/* format of pad(code 0: none) */
+	struct v4l2_rect crop;		/* crop of pad(width 0: none) */
+	struct v4l2_rect compose;	/* compose of pad(width 0: none) */
+};
+
+/* media graph set up before the devices of stream */
+struct media {
+	char devname[32];		/* media device node */
+	bool reset;			/* disable links first */
+	struct media_item items[MEDIA_MAX_ITEMS];	/* in order of config */
+	unsigned int num_items;		/* number of items */
+
+	int fd;				/* media device fd */
+	struct media_ent *ents;		/* entities of graph */
+	unsigned int num_ents;		/* number of entities */
+	unsigned int links;		/* links changed */
+	unsigned int formats;		/* pad formats set */
+	char video_src[40];		/* pad which feeds input video node */
+	struct v4l2_mbus_framefmt video;	/* its format(code 0: none) */
+};
+
+#define MAX_PLUGINS	8
+
+/* loaded processing stage */
+struct plugin {
+	void *handle;			/* dlopen handle */
+	const struct bridge_plugin *ops;	/* entry points */
+	void *priv;			/* instance */
+	struct bridge_plugin_format in;	/* negotiated input format */
+	struct bridge_plugin_format out;	/* negotiated output format */
+	uint64_t frames;		/* processed frames */
+	uint64_t errors;		/* dropped frames */
+	uint64_t ns;			/* total time in process() */
+};
+
+/* part of a frame run on workers(workers_run()) */
+struct task {
+	void (*run)(struct task *t);	/* work */
+	struct task *next;		/* next task */
+	unsigned int *pending;		/* tasks of the caller left */
+};
+
+/* threads which run plugins off the forwarding loop */
+struct workers {
+	pthread_t *threads;		/* threads */
+	unsigned int num;		/* number of threads */
+	pthread_mutex_t lock;		/* lock of below and tickets */
+	pthread_cond_t cond;		/* new job or task, or one is done */
+	struct buffer *head;		/* first job */
+	struct buffer *tail;		/* last job */
+	struct task *tasks;		/* tasks, run before jobs */
+	bool stop;			/* exit once jobs are done */
+};
+
+/* manager stream between 2 pipelines */
+struct bridge_stream {
+	struct device in;		/* input device */
+	struct device out;		/* output device */
+	struct buffer *buffers;		/* buffers */
+	struct config config;		/* common config */
+	struct pace pace;		/* frame rate limiter */
+	struct timing timing;		/* startup/teardown timing */
+	unsigned int frames;		/* frames forwarded */
+	pthread_t thread;		/* thread */
+
+	bridge_frame_cb cb;		/* per frame callback */
+	void *cb_priv;			/* data of callback */
+
+	struct plugin plugins[MAX_PLUGINS];	/* processing stages */
+	unsigned int num_plugins;	/* number of plugins */
+	bool inplace;			/* all plugins work in place */
+	unsigned int tickets;		/* tickets given to jobs */
+	unsigned int next_ticket;	/* ticket of next job to forward */
+
+	struct mjpeg *mjpeg;		/* mjpeg decode stage */
+	struct repack *repack;		/* stride repack stage */
+	struct remap *remap;		/* lens correction stage */
+	struct grade *grade;		/* colour grading stage */
+	struct snapshot *snapshot;	/* still images on demand */
+	struct monitor *monitor;	/* black/frozen/no signal alarms */
+	struct media *media;		/* media graph of pipelines */
+	struct meta *meta;		/* metadata of input */
+	struct hotplug *hotplug;	/* identity of input for replug */
+	bool suspended;			/* input unplugged, devices closed */
+
+	struct bridge *m;		/* manager */
+};
+
+/* bridge stream  manager */
+struct bridge {
+	struct bridge_stream **streams;	/* streams */
+	int num_streams;		/* number of streams */
+	int streams_done;		/* streams which forwarded count */
+	enum pace_mode pace;		/* pacing for all streams */
+	unsigned int count;		/* frames to forward before stop */
+	bool prepare;			/* prepare buffers ahead of qbuf */
+	bool hotplug;			/* plain inputs resume on replug */
+	char snapshot[256];		/* path of snapshots(ppm or png) */
+	char monitor[32];		/* args of signal monitor */
+	struct timing timing;		/* parse/shutdown timing */
+	struct workers workers;		/* plugin workers */
+	int off;			/* streams are turned off */
+};
+
+#define ERRSTR strerror(errno)
+
+#define ASSERT(cond, ...) 					\
+	do {							\
+		if (cond) {					\
+			int errsv = errno;			\
+			fprintf(stderr, "ERROR(%s:%d) : ",	\
+					__FILE__, __LINE__);	\
+			errno = errsv;				\
+			fprintf(stderr,  __VA_ARGS__);		\
+			abort();				\
+		}						\
+	} while(0)
+
+static inline int warn(const char *file, int line, const char *fmt, ...)
+{
+	int errsv = errno;
+	va_list va;
+	va_start(va, fmt);
+	fprintf(stderr, "WARN(%s:%d): ", file, line);
+	vfprintf(stderr, fmt, va);
+	va_end(va);
+	errno = errsv;
+	return 1;
+}
+
+#define WARN_ON(cond, ...) \
+	((cond) ? warn(__FILE__, __LINE__, __VA_ARGS__) : 0)
+
+#define min(a, b)		((a) < (b) ? (a):(b))
+
+/* bridge.c */
+void stream_forward(struct bridge_stream *s, struct buffer *b);
+void stream_drop(struct bridge_stream *s, struct buffer *b);
+struct buffer *stage_pool_get(struct stage_pool *p);
+void stage_pool_release(struct stage_pool *p, struct buffer *b);
+void stage_pool_sync(struct buffer *b, unsigned int flags);
+
+/* plugin.c */
+int plugin_load(struct plugin *p, const char *spec);
+void plugin_unload(struct plugin *p);
+void plugin_negotiate(struct bridge_stream *s);
+void plugin_process(struct bridge_stream *s, struct buffer *b);
+void plugin_dump_stats(struct bridge_stream *s, const char *who, FILE *fp);
+
+/* encoder.c */
+int encoder_parse_args(struct encoder *e, const char *arg);
+void encoder_open(struct encoder *e);
+void encoder_close(struct encoder *e);
+void encoder_format(struct device *d, struct config *c);
+void encoder_init(struct device *d, struct config *c);
+void encoder_exit(struct device *d);
+void encoder_on(struct device *d);
+void encoder_off(struct device *d);
+void encoder_queued(struct encoder *e, struct timeval *timestamp);
+int encoder_dequeue(struct device *d);
+void encoder_dump_stats(struct encoder *e, const char *who, FILE *fp);
+
+/* decoder.c */
+int decoder_parse_args(struct decoder *dec, const char *arg);
+void decoder_open(struct decoder *dec);
+void decoder_close(struct decoder *dec);
+void decoder_start(struct device *d, struct config *c);
+void decoder_capture_format(struct device *d, struct config *c);
+void decoder_feed(struct device *d);
+void decoder_event(struct device *d);
+void decoder_off(struct device *d);
+void decoder_exit(struct device *d);
+void decoder_dump_stats(struct decoder *dec, const char *who, FILE *fp);
+
+/* kms.c */
+#ifdef HAVE_DRM
+int kms_open(const char *path, bool writeback);
+uint32_t kms_format(unsigned int fourcc);
+uint32_t kms_prop(int fd, uint32_t obj, uint32_t type, const char *name,
+		uint64_t *value);
+int kms_parse_args(struct kms *k, const char *arg);
+void kms_init(struct device *d, struct config *c);
+void kms_import(struct device *d, struct buffer *b);
+void kms_exit(struct device *d);
+void kms_on(struct device *d);
+void kms_off(struct device *d);
+struct buffer *kms_queue(struct device *d, struct buffer *b);
+struct buffer *kms_flipped(struct device *d);
+void kms_dump_stats(struct kms *k, const char *who, FILE *fp);
+#else
+static inline int kms_parse_args(struct kms *k, const char *arg)
+{
+	return -warn(__FILE__, __LINE__, "built without libdrm\n");
+}
+static inline void kms_init(struct device *d, struct config *c) {}
+static inline void kms_import(struct device *d, struct buffer *b) {}
+static inline void kms_exit(struct device *d) {}
+static inline void kms_on(struct device *d) {}
+static inline void kms_off(struct device *d) {}
+static inline struct buffer *kms_queue(struct device *d, struct buffer *b)
+{
+	return b;
+}
+static inline struct buffer *kms_flipped(struct device *d)
+{
+	return NULL;
+}
+static inline void kms_dump_stats(struct kms *k, const char *who,
+		FILE *fp) {}
+#endif
+
+/* writeback.c */
+#ifdef HAVE_DRM
+int writeback_parse_args(struct writeback *wb, const char *arg);
+void writeback_init(struct device *d, struct config *c);
+void writeback_prepare(struct device *d, struct buffer *b);
+void writeback_exit(struct device *d);
+void writeback_queue(struct device *d, struct buffer *b);
+void writeback_on(struct device *d);
+void writeback_off(struct device *d);
+struct buffer *writeback_capture(struct device *d);
+void writeback_dump_stats(struct writeback *wb, const char *who, FILE *fp);
+#else
+static inline int writeback_parse_args(struct writeback *wb, const char *arg)
+{
+	return -warn(__FILE__, __LINE__, "built without libdrm\n");
+}
+static inline void writeback_init(struct device *d, struct config *c) {}
+static inline void writeback_prepare(struct device *d, struct buffer *b) {}
+static inline void writeback_exit(struct device *d) {}
+static inline void writeback_queue(struct device *d, struct buffer *b) {}
+static inline void writeback_on(struct device *d) {}
+static inline void writeback_off(struct device *d) {}
+static inline struct buffer *writeback_capture(struct device *d)
+{
+	return NULL;
+}
+static inline void writeback_dump_stats(struct writeback *wb,
+		const char *who, FILE *fp) {}
+#endif
+
+/* rtp.c */
+const struct rtp_format *rtp_format(unsigned int fourcc);
+int rtp_parse_addr(const char *arg, char *spec, size_t size, char *host,
+		size_t host_size, char *port, size_t port_size, char **save);
+int rtp_socket(const char *host, const char *port, bool source);
+int rtp_parse_args(struct rtp *r, const char *arg);
+void rtp_init(struct device *d, struct config *c);
+void rtp_exit(struct device *d);
+bool rtp_send(struct device *d, struct buffer *b);
+struct buffer *rtp_complete(struct device *d);
+void rtp_dump_stats(struct rtp *r, const char *who, FILE *fp);
+
+/* rtp_source.c */
+int rtp_source_parse_args(struct rtp_source *r, const char *arg);
+void rtp_source_init(struct device *d, struct config *c);
+void rtp_source_exit(struct device *d);
+void rtp_source_queue(struct device *d, struct buffer *b);
+struct buffer *rtp_source_receive(struct device *d);
+void rtp_source_dump_stats(struct rtp_source *r, const char *who, FILE *fp);
+
+/* hotplug.c */
+int hotplug_parse_args(struct hotplug *hp, const char *arg, size_t len);
+void hotplug_find(struct hotplug *hp, struct device *d);
+void hotplug_identify(struct hotplug *hp, struct device *d);
+bool hotplug_gone(struct device *d);
+void hotplug_wait(struct hotplug *hp, struct device *d);
+void hotplug_frame(struct hotplug *hp, const char *devname);
+void hotplug_dump_stats(struct hotplug *hp, const char *who, FILE *fp);
+
+/* repack.c */
+int repack_format(struct repack *r, struct config *in, struct config *out);
+int repack_frame(struct bridge_stream *s, struct buffer *b);
+void repack_dump_stats(struct repack *r, const char *who, FILE *fp);
+
+/* remap.c */
+int remap_parse_args(struct remap *rm, const char *args);
+bool remap_fourcc(unsigned int fourcc);
+int remap_format(struct remap *rm, struct config *c, unsigned int src_stride,
+		unsigned int dst_stride);
+void remap_stripe(struct remap *rm, const uint8_t *src, uint8_t *dst,
+		unsigned int y, unsigned int rows);
+int remap_frame(struct bridge_stream *s, struct buffer *b);
+void remap_close(struct remap *rm);
+void remap_dump_stats(struct remap *rm, const char *who, FILE *fp);
+
+/* grade.c */
+int grade_parse_args(struct grade *g, const char *args);
+int grade_format(struct grade *g, const struct config *c, unsigned int stride);
+void grade_stripe(struct grade *g, uint8_t *data, unsigned int first,
+		unsigned int units);
+void grade_frame(struct bridge_stream *s, uint8_t *data);
+void grade_close(struct grade *g);
+void grade_dump_stats(struct grade *g, const char *who, FILE *fp);
+
+/* snapshot.c */
+int snapshot_parse_args(struct snapshot *sn, const char *path);
+void snapshot_start(struct snapshot *sn,
+		void (*release)(void *priv, struct buffer *b), void *priv);
+void snapshot_stop(struct snapshot *sn);
+void snapshot_arm(struct snapshot *sn);
+void snapshot_take(struct snapshot *sn, struct buffer *b,
+		const struct v4l2_pix_format *format, unsigned int sequence);
+bool snapshot_hold(struct snapshot *sn, struct buffer *b);
+void snapshot_drain(struct snapshot *sn);
+void snapshot_dump_stats(struct snapshot *sn, const char *who, FILE *fp);
+
+/* monitor.c */
+int monitor_parse_args(struct monitor *mon, const char *args);
+void monitor_init(struct monitor *mon, const char *name);
+void monitor_exit(struct monitor *mon);
+void monitor_frame(struct monitor *mon, const struct config *c,
+		const uint8_t *data);
+void monitor_dump_stats(struct monitor *mon, const char *who, FILE *fp);
+
+/* request.c */
+int request_parse_args(struct request *rq, const char *arg);
+void request_init(struct device *d, struct config *c);
+void request_exit(struct device *d);
+void request_prepare(struct device *d, struct v4l2_buffer *vb);
+void request_queue(struct device *d, unsigned int index);
+void request_done(struct device *d, struct buffer *b);
+void request_dump_stats(struct request *rq, const char *who, FILE *fp);
+
+/* meta.c */
+int meta_parse_args(struct meta *mt, const char *arg);
+void meta_init(struct meta *mt, unsigned int num_frames);
+void meta_exit(struct meta *mt);
+void meta_on(struct meta *mt);
+void meta_off(struct meta *mt);
+void meta_dequeue(struct meta *mt);
+void meta_match(struct meta *mt, struct buffer *b);
+void meta_release(struct meta *mt, struct buffer *b);
+void meta_dump_stats(struct meta *mt, const char *who, FILE *fp);
+
+/* media.c */
+int media_parse_args(struct media *md, const char *arg, size_t len);
+void media_setup(struct media *md, const char *video);
+void media_validate(struct media *md, struct config *c);
+
+void workers_start(struct workers *w);
+void workers_queue(struct workers *w, struct buffer *b);
+void workers_run(struct workers *w, struct task **tasks, unsigned int num);
+void workers_drain(struct workers *w, struct bridge_stream *s);
+void workers_stop(struct workers *w);
+
+/* mjpeg.c */
+#ifdef HAVE_JPEG
+int mjpeg_parse_args(struct mjpeg *j, const char *arg);
+void mjpeg_format(struct mjpeg *j, struct config *c);
+int mjpeg_decode(struct bridge_stream *s, struct buffer *b);
+void mjpeg_dump_stats(struct mjpeg *j, const char *who, FILE *fp);
+#else
+static inline int mjpeg_parse_args(struct mjpeg *j, const char *arg)
+{
+	return -warn(__FILE__, __LINE__, "built without libjpeg\n");
+}
+static inline void mjpeg_format(struct mjpeg *j, struct config *c) {}
+static inline int mjpeg_decode(struct bridge_stream *s, struct buffer *b)
+{
+	return -1;
+}
+static inline void mjpeg_dump_stats(struct mjpeg *j, const char *who,
+		FILE *fp) {}
+#endif
+
+#endif /* __BRIDGE_PRIV_H__ */
@@ -0,0 +1,429 @@
+/*
+ * Stateful V4L2 M2M decoder source fed from a file
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * The input device of a stream can be a stateful decoder. Its OUTPUT
+ * queue(mmap) is fed with frames of a compressed elementary stream, and
+ * the decoded frames of its CAPTURE queue are passed to the output device
+ * by dmabuf as from any capture device.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bridge_priv.h"
+
+#define DECODER_NUM_BUFFERS	4	/* coded buffers */
+#define DECODER_TIMEOUT_MS	2000	/* for the first source change */
+
+/* header of a vicodec FWHT frame */
+#define FWHT_MAGIC1		0x4f4f4f4f
+#define FWHT_MAGIC2		0xffffffff
+#define FWHT_HDR_SIZE		44
+#define FWHT_SIZE_OFFSET	40
+
+/* parse decoder args(fourcc,path[,loop]) */
+int decoder_parse_args(struct decoder *dec, const char *arg)
+{
+	const char *path, *opt;
+	unsigned int len;
+
+	path = strchr(arg, ',');
+	if (!path || path - arg != 4 || !path[1])
+		return -1;
+	path++;
+
+	dec->fourcc = ((unsigned)arg[0] << 0) |
+		((unsigned)arg[1] << 8) |
+		((unsigned)arg[2] << 16) |
+		((unsigned)arg[3] << 24);
+
+	/* path ends at the next stage */
+	len = strcspn(path, ",>");
+	opt = path + len;
+	if (len >= sizeof(dec->path))
+		return -1;
+	memcpy(dec->path, path, len);
+	dec->path[len] = '\0';
+
+	if (!strncmp(opt, ",loop", 5))
+		dec->loop = true;
+	else if (*opt == ',')
+		return -1;
+	dec->file = -1;
+
+	return 0;
+}
+
+/* map file of elementary stream */
+void decoder_open(struct decoder *dec)
+{
+	struct stat st;
+	int ret;
+
+	dec->file = open(dec->path, O_RDONLY);
+	ASSERT(dec->file < 0, "failed to open %s: %s\n", dec->path, ERRSTR);
+	ret = fstat(dec->file, &st);
+	ASSERT(ret < 0 || !st.st_size, "%s is empty\n", dec->path);
+
+	dec->size = st.st_size;
+	dec->data = mmap(NULL, dec->size, PROT_READ, MAP_PRIVATE, dec->file, 0);
+	ASSERT(dec->data == MAP_FAILED, "failed to map %s: %s\n", dec->path,
+			ERRSTR);
+}
+
+/* unmap file */
+void decoder_close(struct decoder *dec)
+{
+	if (dec->data && dec->data != MAP_FAILED)
+		munmap(dec->data, dec->size);
+	dec->data = NULL;
+	if (dec->file >= 0)
+		close(dec->file);
+	dec->file = -1;
+}
+
+/*
+ * elementary stream parsers, return size of the frame at pos
+ */
+
+static uint32_t be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* offset of next start code(0 0 1, or 0 0 0 1) from pos, or end */
+static size_t h264_start_code(const uint8_t *data, size_t pos, size_t end)
+{
+	for (; pos + 3 <= end; pos++) {
+		if (data[pos] || data[pos + 1] || data[pos + 2] != 1)
+			continue;
+		if (pos && !data[pos - 1])
+			pos--;
+		return pos;
+	}
+
+	return end;
+}
+
+/* an access unit ends before aud/sps/pps/sei or the first slice of next */
+static size_t h264_frame(const uint8_t *data, size_t pos, size_t end)
+{
+	size_t nal = pos, hdr;
+	bool vcl = false;
+	unsigned int type;
+
+	while (nal < end) {
+		/* nal header after start code */
+		hdr = nal;
+		while (hdr < end && !data[hdr])
+			hdr++;
+		hdr++;
+		if (hdr >= end)
+			break;
+
+		type = data[hdr] & 0x1f;
+		if (vcl && nal != pos && ((type >= 6 && type <= 9) ||
+				((type == 1 || type == 5) && hdr + 1 < end &&
+				 (data[hdr + 1] & 0x80))))
+			return nal - pos;
+		if (type == 1 || type == 5)
+			vcl = true;
+
+		nal = h264_start_code(data, hdr, end);
+	}
+
+	return end - pos;
+}
+
+/* size of the next frame, which may be larger than max, or of the next
+ * max bytes of formats fed as they are */
+static size_t decoder_next_frame(struct decoder *dec, size_t max)
+{
+	const uint8_t *p = dec->data + dec->pos;
+	size_t left = dec->size - dec->pos;
+	size_t len;
+
+	switch (dec->fourcc) {
+	case V4L2_PIX_FMT_FWHT:
+		if (left >= FWHT_HDR_SIZE && be32(p) == FWHT_MAGIC1 &&
+				be32(p + 4) == FWHT_MAGIC2) {
+			len = FWHT_HDR_SIZE + be32(p + FWHT_SIZE_OFFSET);
+			break;
+		}
+		/* fall through */
+	default:
+		/* decoders which take any part of the stream */
+		len = min(left, max);
+		break;
+	case V4L2_PIX_FMT_H264:
+		len = h264_frame(dec->data, dec->pos, dec->size);
+		break;
+	}
+
+	return min(len, left);
+}
+
+/*
+ * decoder operations
+ */
+
+/* fill coded buffer with the next frame and queue it */
+static void decoder_fill(struct device *d, unsigned int index)
+{
+	struct decoder *dec = d->dec;
+	struct v4l2_decoder_cmd cmd;
+	struct v4l2_buffer vb;
+	unsigned int wraps = 0;
+	uint64_t now;
+	size_t len;
+	int ret;
+
+next:
+	if (dec->pos >= dec->size) {
+		if (dec->loop) {
+			/* a whole pass skipped */
+			ASSERT(wraps, "no frame of %s fits a buffer of %zu "
+					"bytes\n", dec->path,
+					dec->buffers[index].length);
+			wraps++;
+			dec->pos = 0;
+			dec->loops++;
+		} else {
+			/* drain, the last decoded frame has V4L2_BUF_FLAG_LAST */
+			if (!dec->stopped) {
+				memset(&cmd, 0, sizeof(cmd));
+				cmd.cmd = V4L2_DEC_CMD_STOP;
+				ret = ioctl(d->fd, VIDIOC_DECODER_CMD, &cmd);
+				WARN_ON(ret < 0, "V4L2_DEC_CMD_STOP failed: "
+						"%s\n", ERRSTR);
+				dec->stopped = true;
+			}
+			return;
+		}
+	}
+
+	len = decoder_next_frame(dec, dec->buffers[index].length);
+	if (len > dec->buffers[index].length) {
+		/* a part of a frame would only decode into garbage */
+		WARN_ON(1, "frame of %zu bytes dropped, buffer has %zu\n",
+				len, dec->buffers[index].length);
+		dec->pos += len;
+		dec->dropped++;
+		goto next;
+	}
+	memcpy(dec->buffers[index].data, dec->data + dec->pos, len);
+	dec->pos += len;
+
+	/* decoded frames get the timestamp of feeding */
+	now = timing_now();
+	memset(&vb, 0, sizeof vb);
+	vb.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	vb.memory = V4L2_MEMORY_MMAP;
+	vb.index = index;
+	vb.bytesused = len;
+	vb.timestamp.tv_sec = now / 1000000000ull;
+	vb.timestamp.tv_usec = now / 1000 % 1000000;
+	ret = ioctl(d->fd, VIDIOC_QBUF, &vb);
+	ASSERT(ret < 0, "decoder VIDIOC_QBUF failed: %s\n", ERRSTR);
+	dec->frames++;
+}
+
+/* refill a consumed coded buffer */
+void decoder_feed(struct device *d)
+{
+	struct v4l2_buffer vb;
+	int ret;
+
+	memset(&vb, 0, sizeof vb);
+	vb.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	vb.memory = V4L2_MEMORY_MMAP;
+	ret = ioctl(d->fd, VIDIOC_DQBUF, &vb);
+	if (ret < 0 && errno == EAGAIN)
+		return;
+	ASSERT(ret < 0, "decoder VIDIOC_DQBUF failed: %s\n", ERRSTR);
+
+	decoder_fill(d, vb.index);
+}
+
+/* handle a pending event */
+void decoder_event(struct device *d)
+{
+	struct decoder *dec = d->dec;
+	struct v4l2_event ev;
+	int ret;
+
+	memset(&ev, 0, sizeof(ev));
+	ret = ioctl(d->fd, VIDIOC_DQEVENT, &ev);
+	if (WARN_ON(ret < 0, "VIDIOC_DQEVENT failed: %s\n", ERRSTR))
+		return;
+
+	switch (ev.type) {
+	case V4L2_EVENT_SOURCE_CHANGE:
+		/* new format applies after the last buffer of the old one */
+		if (ev.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION)
+			dec->source_change = true;
+		break;
+	case V4L2_EVENT_EOS:
+		printf("decoder: end of stream\n");
+		break;
+	}
+}
+
+/* get decoded format after a source change */
+void decoder_capture_format(struct device *d, struct config *c)
+{
+	struct v4l2_format fmt;
+	struct v4l2_control ctrl;
+	int ret;
+
+	memset(&fmt, 0, sizeof fmt);
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	ret = ioctl(d->fd, VIDIOC_G_FMT, &fmt);
+	ASSERT(ret < 0, "decoder VIDIOC_G_FMT failed: %s\n", ERRSTR);
+	printf("decoder: %ux%u %.4s\n", fmt.fmt.pix.width,
+		fmt.fmt.pix.height, (char *)&fmt.fmt.pix.pixelformat);
+
+	c->format.width = fmt.fmt.pix.width;
+	c->format.height = fmt.fmt.pix.height;
+	c->format.bytesperline = 0;
+	c->format.sizeimage = 0;
+	c->num_planes = 0;
+	memset(c->planes, 0, sizeof(c->planes));
+
+	memset(&ctrl, 0, sizeof(ctrl));
+	ctrl.id = V4L2_CID_MIN_BUFFERS_FOR_CAPTURE;
+	if (!ioctl(d->fd, VIDIOC_G_CTRL, &ctrl) &&
+			c->num_buffers < ctrl.value) {
+		printf("decoder: needs %d buffers\n", ctrl.value);
+		c->num_buffers = ctrl.value;
+	}
+
+	d->dec->source_change = false;
+}
+
+/* set coded format, feed the stream until the decoded format is known */
+void decoder_start(struct device *d, struct config *c)
+{
+	struct decoder *dec = d->dec;
+	struct v4l2_event_subscription sub;
+	struct v4l2_requestbuffers rqbufs;
+	struct v4l2_format fmt;
+	struct v4l2_buffer vb;
+	struct pollfd fd = {.fd = d->fd, .events = POLLPRI | POLLOUT};
+	unsigned int i, type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	int ret;
+
+	memset(&fmt, 0, sizeof fmt);
+	fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	fmt.fmt.pix.pixelformat = dec->fourcc;
+	fmt.fmt.pix.width = c->format.width;
+	fmt.fmt.pix.height = c->format.height;
+	ret = ioctl(d->fd, VIDIOC_S_FMT, &fmt);
+	ASSERT(ret < 0, "decoder VIDIOC_S_FMT failed: %s\n", ERRSTR);
+	ASSERT(fmt.fmt.pix.pixelformat != dec->fourcc,
+		"decoder doesn't support %.4s\n", (char *)&dec->fourcc);
+
+	memset(&sub, 0, sizeof(sub));
+	sub.type = V4L2_EVENT_SOURCE_CHANGE;
+	ret = ioctl(d->fd, VIDIOC_SUBSCRIBE_EVENT, &sub);
+	ASSERT(ret < 0, "failed to subscribe source change: %s\n", ERRSTR);
+	sub.type = V4L2_EVENT_EOS;
+	ret = ioctl(d->fd, VIDIOC_SUBSCRIBE_EVENT, &sub);
+	WARN_ON(ret < 0, "failed to subscribe eos: %s\n", ERRSTR);
+
+	memset(&rqbufs, 0, sizeof(rqbufs));
+	rqbufs.count = DECODER_NUM_BUFFERS;
+	rqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	rqbufs.memory = V4L2_MEMORY_MMAP;
+	ret = ioctl(d->fd, VIDIOC_REQBUFS, &rqbufs);
+	ASSERT(ret < 0 || !rqbufs.count, "decoder VIDIOC_REQBUFS failed: %s\n",
+			ERRSTR);
+
+	dec->num_buffers = rqbufs.count;
+	dec->buffers = calloc(dec->num_buffers, sizeof(*dec->buffers));
+	ASSERT(!dec->buffers, "failed to allocate decoder buffers\n");
+	for (i = 0; i < dec->num_buffers; i++) {
+		memset(&vb, 0, sizeof vb);
+		vb.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		vb.memory = V4L2_MEMORY_MMAP;
+		vb.index = i;
+		ret = ioctl(d->fd, VIDIOC_QUERYBUF, &vb);
+		ASSERT(ret < 0, "decoder VIDIOC_QUERYBUF failed: %s\n", ERRSTR);
+
+		dec->buffers[i].length = vb.length;
+		dec->buffers[i].data = mmap(NULL, vb.length,
+				PROT_READ | PROT_WRITE, MAP_SHARED, d->fd,
+				vb.m.offset);
+		ASSERT(dec->buffers[i].data == MAP_FAILED,
+				"failed to map decoder buffer: %s\n", ERRSTR);
+	}
+
+	/* feed from the start */
+	dec->pos = 0;
+	dec->stopped = false;
+	dec->source_change = false;
+	ret = ioctl(d->fd, VIDIOC_STREAMON, &type);
+	ASSERT(ret < 0, "decoder STREAMON failed: %s\n", ERRSTR);
+	for (i = 0; i < dec->num_buffers; i++)
+		decoder_fill(d, i);
+
+	/* decoded format is known once the headers are parsed */
+	while (!dec->source_change) {
+		ret = poll(&fd, 1, DECODER_TIMEOUT_MS);
+		ASSERT(ret <= 0, "decoder found no stream in %s\n", dec->path);
+		if (fd.revents & POLLPRI)
+			decoder_event(d);
+		if (fd.revents & POLLOUT)
+			decoder_feed(d);
+	}
+
+	decoder_capture_format(d, c);
+}
+
+/* turn off OUTPUT queue */
+void decoder_off(struct device *d)
+{
+	unsigned int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	int res;
+
+	res = ioctl(d->fd, VIDIOC_STREAMOFF, &type);
+	ASSERT(res < 0, "decoder STREAMOFF failed: %s\n", ERRSTR);
+}
+
+/* unmap coded buffers */
+void decoder_exit(struct device *d)
+{
+	struct decoder *dec = d->dec;
+	unsigned int i;
+
+	for (i = 0; i < dec->num_buffers; i++)
+		if (dec->buffers[i].data && dec->buffers[i].data != MAP_FAILED)
+			munmap(dec->buffers[i].data, dec->buffers[i].length);
+	free(dec->buffers);
+	dec->buffers = NULL;
+	dec->num_buffers = 0;
+}
+
+/* dump stats of decoder */
+void decoder_dump_stats(struct decoder *dec, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s decoder %.4s fed %llu dropped %llu loops %u "
+			"resolution_changes %u\n", who, (char *)&dec->fourcc,
+			(unsigned long long)dec->frames,
+			(unsigned long long)dec->dropped, dec->loops,
+			dec->changes);
+}
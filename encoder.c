@@ -0,0 +1,272 @@
+/*
+ * Stateful V4L2 M2M encoder stage with a file sink
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * The output device of a stream can be a stateful encoder. Raw frames go
+ * to its OUTPUT queue by dmabuf as to any output device, and the coded
+ * frames of its CAPTURE queue(mmap) are written to a file as they are.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bridge_priv.h"
+
+/* parse encoder args(fourcc,path) */
+int encoder_parse_args(struct encoder *e, const char *arg)
+{
+	const char *path;
+
+	path = strchr(arg, ',');
+	if (!path || path - arg != 4 || !path[1])
+		return -1;
+
+	e->fourcc = ((unsigned)arg[0] << 0) |
+		((unsigned)arg[1] << 8) |
+		((unsigned)arg[2] << 16) |
+		((unsigned)arg[3] << 24);
+	snprintf(e->path, sizeof(e->path), "%s", path + 1);
+	e->file = -1;
+
+	return 0;
+}
+
+/* open file sink */
+void encoder_open(struct encoder *e)
+{
+	e->file = open(e->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ASSERT(e->file < 0, "failed to open %s: %s\n", e->path, ERRSTR);
+	pthread_mutex_init(&e->lock, NULL);
+	e->lat_min = UINT64_MAX;
+}
+
+/* close file sink */
+void encoder_close(struct encoder *e)
+{
+	if (e->file >= 0)
+		close(e->file);
+	e->file = -1;
+	pthread_mutex_destroy(&e->lock);
+}
+
+/* set coded format, before the raw format of the OUTPUT queue */
+void encoder_format(struct device *d, struct config *c)
+{
+	struct encoder *e = d->enc;
+	struct v4l2_format fmt;
+	int ret;
+
+	memset(&fmt, 0, sizeof fmt);
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	ret = ioctl(d->fd, VIDIOC_G_FMT, &fmt);
+	ASSERT(ret < 0, "encoder VIDIOC_G_FMT failed: %s\n", ERRSTR);
+
+	fmt.fmt.pix.pixelformat = e->fourcc;
+	fmt.fmt.pix.width = c->format.width;
+	fmt.fmt.pix.height = c->format.height;
+	fmt.fmt.pix.sizeimage = 0;
+	ret = ioctl(d->fd, VIDIOC_S_FMT, &fmt);
+	ASSERT(ret < 0, "encoder VIDIOC_S_FMT failed: %s\n", ERRSTR);
+	ASSERT(fmt.fmt.pix.pixelformat != e->fourcc,
+		"encoder doesn't support %.4s\n", (char *)&e->fourcc);
+	printf("encoder: %.4s, sizeimage = %u\n", (char *)&e->fourcc,
+		fmt.fmt.pix.sizeimage);
+}
+
+/* allocate, map and queue coded buffers */
+void encoder_init(struct device *d, struct config *c)
+{
+	struct encoder *e = d->enc;
+	struct v4l2_requestbuffers rqbufs;
+	struct v4l2_buffer vb;
+	unsigned int i;
+	int ret;
+
+	memset(&rqbufs, 0, sizeof(rqbufs));
+	rqbufs.count = c->num_buffers;
+	rqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	rqbufs.memory = V4L2_MEMORY_MMAP;
+	ret = ioctl(d->fd, VIDIOC_REQBUFS, &rqbufs);
+	ASSERT(ret < 0, "encoder VIDIOC_REQBUFS failed: %s\n", ERRSTR);
+	ASSERT(!rqbufs.count, "encoder allocated no buffers\n");
+
+	e->num_buffers = rqbufs.count;
+	e->buffers = calloc(e->num_buffers, sizeof(*e->buffers));
+	ASSERT(!e->buffers, "failed to allocate encoder buffers\n");
+
+	for (i = 0; i < e->num_buffers; i++) {
+		memset(&vb, 0, sizeof vb);
+		vb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		vb.memory = V4L2_MEMORY_MMAP;
+		vb.index = i;
+		ret = ioctl(d->fd, VIDIOC_QUERYBUF, &vb);
+		ASSERT(ret < 0, "encoder VIDIOC_QUERYBUF failed: %s\n", ERRSTR);
+
+		e->buffers[i].length = vb.length;
+		e->buffers[i].data = mmap(NULL, vb.length, PROT_READ,
+				MAP_SHARED, d->fd, vb.m.offset);
+		ASSERT(e->buffers[i].data == MAP_FAILED,
+				"failed to map encoder buffer: %s\n", ERRSTR);
+
+		ret = ioctl(d->fd, VIDIOC_QBUF, &vb);
+		ASSERT(ret < 0, "encoder VIDIOC_QBUF failed: %s\n", ERRSTR);
+	}
+
+	/* timestamps of raw frames in flight */
+	e->num_pending = c->num_buffers;
+	e->pending = calloc(e->num_pending, sizeof(*e->pending));
+	ASSERT(!e->pending, "failed to allocate encoder timestamps\n");
+}
+
+/* unmap and free coded buffers */
+void encoder_exit(struct device *d)
+{
+	struct encoder *e = d->enc;
+	unsigned int i;
+
+	for (i = 0; i < e->num_buffers; i++)
+		if (e->buffers[i].data && e->buffers[i].data != MAP_FAILED)
+			munmap(e->buffers[i].data, e->buffers[i].length);
+	free(e->buffers);
+	e->buffers = NULL;
+	e->num_buffers = 0;
+	free(e->pending);
+	e->pending = NULL;
+}
+
+/* turn on CAPTURE queue */
+void encoder_on(struct device *d)
+{
+	unsigned int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	int res;
+
+	res = ioctl(d->fd, VIDIOC_STREAMON, &type);
+	ASSERT(res < 0, "encoder STREAMON failed: %s\n", ERRSTR);
+}
+
+/* drain coded frames of queued raw frames, and turn off CAPTURE queue */
+void encoder_off(struct device *d)
+{
+	unsigned int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	struct v4l2_encoder_cmd cmd;
+	struct pollfd fd = {.fd = d->fd, .events = POLLIN};
+	int res;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.cmd = V4L2_ENC_CMD_STOP;
+	if (!ioctl(d->fd, VIDIOC_ENCODER_CMD, &cmd))
+		while (poll(&fd, 1, 100) > 0 && !encoder_dequeue(d))
+			;
+
+	res = ioctl(d->fd, VIDIOC_STREAMOFF, &type);
+	ASSERT(res < 0, "encoder STREAMOFF failed: %s\n", ERRSTR);
+}
+
+/* raw frame with timestamp is queued to the encoder */
+void encoder_queued(struct encoder *e, struct timeval *timestamp)
+{
+	struct encoder_pending *p;
+
+	pthread_mutex_lock(&e->lock);
+	p = &e->pending[e->next_pending++ % e->num_pending];
+	p->timestamp = *timestamp;
+	p->queued_ns = timing_now();
+	pthread_mutex_unlock(&e->lock);
+}
+
+/* find queue time of raw frame by the timestamp copied to coded frame */
+static uint64_t encoder_queued_ns(struct encoder *e, struct timeval *timestamp)
+{
+	uint64_t ns = 0;
+	unsigned int i;
+
+	pthread_mutex_lock(&e->lock);
+	for (i = 0; i < e->num_pending; i++) {
+		if (e->pending[i].queued_ns &&
+				e->pending[i].timestamp.tv_sec ==
+				timestamp->tv_sec &&
+				e->pending[i].timestamp.tv_usec ==
+				timestamp->tv_usec) {
+			ns = e->pending[i].queued_ns;
+			e->pending[i].queued_ns = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&e->lock);
+
+	return ns;
+}
+
+/* write a coded frame to the file, returns 1 on the last frame */
+int encoder_dequeue(struct device *d)
+{
+	struct encoder *e = d->enc;
+	struct v4l2_buffer vb;
+	uint64_t queued, lat;
+	ssize_t len;
+	int ret;
+
+	memset(&vb, 0, sizeof vb);
+	vb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	vb.memory = V4L2_MEMORY_MMAP;
+	ret = ioctl(d->fd, VIDIOC_DQBUF, &vb);
+	if (ret < 0 && errno == EPIPE)
+		return 1;
+	ASSERT(ret < 0, "encoder VIDIOC_DQBUF failed: %s\n", ERRSTR);
+
+	if (vb.bytesused) {
+		len = write(e->file, e->buffers[vb.index].data, vb.bytesused);
+		WARN_ON(len != vb.bytesused, "failed to write %s: %s\n",
+				e->path, ERRSTR);
+
+		e->frames++;
+		e->bytes += vb.bytesused;
+		if (vb.flags & V4L2_BUF_FLAG_KEYFRAME)
+			e->keyframes++;
+
+		queued = encoder_queued_ns(e, &vb.timestamp);
+		if (queued) {
+			lat = timing_now() - queued;
+			e->lat_ns += lat;
+			e->lat_frames++;
+			if (lat < e->lat_min)
+				e->lat_min = lat;
+			if (lat > e->lat_max)
+				e->lat_max = lat;
+		}
+	}
+
+	if (vb.flags & V4L2_BUF_FLAG_LAST)
+		return 1;
+
+	ret = ioctl(d->fd, VIDIOC_QBUF, &vb);
+	ASSERT(ret < 0, "encoder VIDIOC_QBUF failed: %s\n", ERRSTR);
+
+	return 0;
+}
+
+/* dump stats of encoder */
+void encoder_dump_stats(struct encoder *e, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s encoder %.4s frames %llu keyframes %llu bytes %llu "
+			"latency_us min %.1f avg %.1f max %.1f\n", who,
+			(char *)&e->fourcc,
+			(unsigned long long)e->frames,
+			(unsigned long long)e->keyframes,
+			(unsigned long long)e->bytes,
+			e->lat_frames ? e->lat_min / 1000.0 : 0,
+			e->lat_frames ? e->lat_ns / 1000.0 / e->lat_frames : 0,
+			e->lat_max / 1000.0);
+}
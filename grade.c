@@ -0,0 +1,484 @@
+/*
+ * Colour grading stage on 3d luts
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Panels differ in colour, and a 3d lut(.cube file) of the output corrects
+ * it: a grid of rgb points in the unit cube and the rgb they become. Frames
+ * are graded in place after plugins, before the repack or remap stage, with
+ * the tetrahedral simd lut kernel in stripes of lines on workers. The grid
+ * is packed into 32 bit nodes, 10 bits a channel, so a 33 point grid takes
+ * 144KB and stays in the l2 cache, and the 4 nodes of a pixel are a gather
+ * each.
+ *
+ * RGB frames go through the grid of the file as is. For YUV frames, the
+ * grid is resampled once into a grid over Y, U and V(BT.601 or BT.709,
+ * limited range, as the format says), so pixels need no conversion: luma
+ * of each pixel goes through it with the chroma it shares, and the shared
+ * chroma is the average of what it became with each luma.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <ctype.h>
+
+#include "bridge_priv.h"
+#include "kernel.h"
+
+#define GRADE_CHUNK		256	/* pixels of a line graded at once */
+#define GRADE_STRIPE_MIN_LINES	64	/* don't split into smaller stripes */
+#define GRADE_MAX_STRIPES	8
+
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+/* units(a line, or the lines sharing a chroma line) graded by a task */
+struct grade_stripe {
+	struct task task;		/* task of workers, must be first */
+	struct grade *g;		/* stage */
+	uint8_t *data;			/* frame */
+	unsigned int first;		/* first unit */
+	unsigned int units;		/* units */
+};
+
+/* parse args(path of .cube file), which end at the next part of the stream
+ * config, and load the file. returns length of args */
+int grade_parse_args(struct grade *g, const char *args)
+{
+	unsigned int len, c, n = 0, total = 0;
+	char line[256], *p;
+	float v[3];
+	FILE *fp;
+
+	len = strcspn(args, "%&+<>");
+	if (!len || len >= sizeof(g->path))
+		return -1;
+	memcpy(g->path, args, len);
+	g->path[len] = '\0';
+
+	fp = fopen(g->path, "r");
+	if (WARN_ON(!fp, "failed to open %s: %s\n", g->path, ERRSTR))
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		p = line + strspn(line, " \t");
+		if (!strncmp(p, "LUT_3D_SIZE", 11)) {
+			if (sscanf(p + 11, "%u", &g->size) != 1 ||
+					g->size < 2 || g->size > 256 || g->cube)
+				break;
+			total = g->size * g->size * g->size;
+			g->cube = malloc(total * 3 * sizeof(*g->cube));
+			ASSERT(!g->cube, "failed to allocate 3d lut\n");
+		} else if (!strncmp(p, "DOMAIN_MIN", 10) ||
+				!strncmp(p, "DOMAIN_MAX", 10)) {
+			/* only the unit cube */
+			c = !strncmp(p, "DOMAIN_MAX", 10);
+			if (sscanf(p + 10, "%f %f %f", &v[0], &v[1],
+						&v[2]) != 3 ||
+					v[0] != c || v[1] != c || v[2] != c)
+				break;
+		} else if (isdigit(*p) || *p == '-' || *p == '.') {
+			if (n == total || sscanf(p, "%f %f %f", &v[0], &v[1],
+						&v[2]) != 3)
+				break;
+			for (c = 0; c < 3; c++)
+				g->cube[n * 3 + c] = v[c] < 0 ? 0 :
+					v[c] > 1 ? 1 : v[c];
+			n++;
+		} else if (!strncmp(p, "LUT_1D_SIZE", 11)) {
+			break;
+		}
+		/* TITLE, comments and other keywords */
+	}
+	fclose(fp);
+
+	if (WARN_ON(!total || n != total, "%s isn't a 3d lut of the unit "
+				"cube\n", g->path)) {
+		free(g->cube);
+		g->cube = NULL;
+		return -1;
+	}
+
+	return len;
+}
+
+/* rgb of file at rgb(0 to 1), tetrahedral like the kernels */
+static void grade_sample(const struct grade *g, const double *in,
+		double *out)
+{
+	static const unsigned int sorts[3][2] = {
+		{ 0, 1 }, { 1, 2 }, { 0, 1 }
+	};
+	unsigned int n1 = g->size, n2 = n1 * n1, stride[3] = { 1, n1, n2 };
+	unsigned int c, t, idx[3], o[3] = { 0, 1, 2 }, base, far;
+	const float *v[4];
+	double pos, f[3], w[4];
+
+	for (c = 0; c < 3; c++) {
+		pos = in[c] * (g->size - 1);
+		idx[c] = min((unsigned int)pos, g->size - 2);
+		f[c] = pos - idx[c];
+	}
+	/* axes by fraction, largest first */
+	for (c = 0; c < 3; c++) {
+		if (f[o[sorts[c][0]]] >= f[o[sorts[c][1]]])
+			continue;
+		t = o[sorts[c][0]];
+		o[sorts[c][0]] = o[sorts[c][1]];
+		o[sorts[c][1]] = t;
+	}
+
+	base = idx[0] + idx[1] * n1 + idx[2] * n2;
+	far = base + 1 + n1 + n2;
+	v[0] = &g->cube[base * 3];
+	v[1] = &g->cube[(base + stride[o[0]]) * 3];
+	v[2] = &g->cube[(far - stride[o[2]]) * 3];
+	v[3] = &g->cube[far * 3];
+	w[0] = 1 - f[o[0]];
+	w[1] = f[o[0]] - f[o[1]];
+	w[2] = f[o[1]] - f[o[2]];
+	w[3] = f[o[2]];
+	for (c = 0; c < 3; c++)
+		out[c] = w[0] * v[0][c] + w[1] * v[1][c] + w[2] * v[2][c] +
+			w[3] * v[3][c];
+}
+
+/* 10 bit channel of a node, from 0 to 255 */
+static uint32_t grade_channel(double x)
+{
+	x = x < 0 ? 0 : x > 255 ? 255 : x;
+	return x * 4 + 0.5;
+}
+
+/* nodes of file as they are */
+static void grade_rgb_nodes(struct grade *g)
+{
+	unsigned int i, total = g->size * g->size * g->size;
+	const float *rgb;
+
+	for (i = 0; i < total; i++) {
+		rgb = &g->cube[i * 3];
+		g->nodes[i] = grade_channel(rgb[0] * 255) |
+			grade_channel(rgb[1] * 255) << 10 |
+			grade_channel(rgb[2] * 255) << 20;
+	}
+}
+
+/* nodes over limited range yuv of matrix kr, kb, from the rgb of file */
+static void grade_yuv_nodes(struct grade *g, double kr, double kb)
+{
+	unsigned int n = g->size, y, u, v, c;
+	double kg = 1 - kr - kb, in[3], cube[3], out[3], ly, cb, cr;
+	uint32_t *node = g->nodes;
+
+	for (v = 0; v < n; v++) {
+		for (u = 0; u < n; u++) {
+			for (y = 0; y < n; y++) {
+				ly = (y * 255.0 / (n - 1) - 16) / 219;
+				cb = (u * 255.0 / (n - 1) - 128) / 224;
+				cr = (v * 255.0 / (n - 1) - 128) / 224;
+				in[0] = ly + 2 * (1 - kr) * cr;
+				in[2] = ly + 2 * (1 - kb) * cb;
+				in[1] = (ly - kr * in[0] - kb * in[2]) / kg;
+				/* out of the cube, colours keep what's
+				 * beyond its faces */
+				for (c = 0; c < 3; c++)
+					cube[c] = in[c] < 0 ? 0 :
+						in[c] > 1 ? 1 : in[c];
+				grade_sample(g, cube, out);
+				for (c = 0; c < 3; c++)
+					out[c] += in[c] - cube[c];
+
+				ly = kr * out[0] + kg * out[1] + kb * out[2];
+				cb = (out[2] - ly) / (2 * (1 - kb));
+				cr = (out[0] - ly) / (2 * (1 - kr));
+				*node++ = grade_channel(16 + 219 * ly) |
+					grade_channel(128 + 224 * cb) << 10 |
+					grade_channel(128 + 224 * cr) << 20;
+			}
+		}
+	}
+}
+
+/* bt.709 for hd, unless the format says otherwise */
+static bool grade_bt709(const struct v4l2_pix_format *f)
+{
+	if (f->ycbcr_enc == V4L2_YCBCR_ENC_601 ||
+			f->colorspace == V4L2_COLORSPACE_SMPTE170M)
+		return false;
+	if (f->ycbcr_enc == V4L2_YCBCR_ENC_709 ||
+			f->colorspace == V4L2_COLORSPACE_REC709)
+		return true;
+	return f->height >= 720;
+}
+
+/* layout of fourcc: byte of red, green and blue of a pixel, or of the
+ * lumas and chroma of a pair of pixels(semi-planar chroma is u, v) */
+static int grade_layout(struct grade *g, unsigned int fourcc)
+{
+	static const struct {
+		unsigned int fourcc;
+		enum grade_layout layout;
+		unsigned int off[4];	/* r, g, b or y0, u, y1, v */
+		unsigned int vsub;
+	} layouts[] = {
+		{ V4L2_PIX_FMT_XBGR32, GRADE_RGB32, { 2, 1, 0 }, 1 },
+		{ V4L2_PIX_FMT_ABGR32, GRADE_RGB32, { 2, 1, 0 }, 1 },
+		{ V4L2_PIX_FMT_XRGB32, GRADE_RGB32, { 1, 2, 3 }, 1 },
+		{ V4L2_PIX_FMT_ARGB32, GRADE_RGB32, { 1, 2, 3 }, 1 },
+		{ V4L2_PIX_FMT_RGB24, GRADE_RGB24, { 0, 1, 2 }, 1 },
+		{ V4L2_PIX_FMT_BGR24, GRADE_RGB24, { 2, 1, 0 }, 1 },
+		{ V4L2_PIX_FMT_YUYV, GRADE_YUV422, { 0, 1, 2, 3 }, 1 },
+		{ V4L2_PIX_FMT_YVYU, GRADE_YUV422, { 0, 3, 2, 1 }, 1 },
+		{ V4L2_PIX_FMT_UYVY, GRADE_YUV422, { 1, 0, 3, 2 }, 1 },
+		{ V4L2_PIX_FMT_VYUY, GRADE_YUV422, { 1, 2, 3, 0 }, 1 },
+		{ V4L2_PIX_FMT_NV12, GRADE_NV, { 0, 0, 0, 1 }, 2 },
+		{ V4L2_PIX_FMT_NV21, GRADE_NV, { 0, 1, 0, 0 }, 2 },
+		{ V4L2_PIX_FMT_NV16, GRADE_NV, { 0, 0, 0, 1 }, 1 },
+		{ V4L2_PIX_FMT_NV61, GRADE_NV, { 0, 1, 0, 0 }, 1 },
+	};
+	unsigned int i, c;
+
+	for (i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+		if (layouts[i].fourcc != fourcc)
+			continue;
+		g->layout = layouts[i].layout;
+		for (c = 0; c < 4; c++)
+			g->off[c] = layouts[i].off[c];
+		g->vsub = layouts[i].vsub;
+		return 0;
+	}
+
+	return -1;
+}
+
+/* nodes and layout for frames of config at stride, in place */
+int grade_format(struct grade *g, const struct config *c, unsigned int stride)
+{
+	const struct v4l2_pix_format *f = &c->format;
+	unsigned int bpp, i;
+	bool yuv;
+
+	if (c->num_planes != 1 || grade_layout(g, f->pixelformat) < 0)
+		return -1;
+	yuv = g->layout == GRADE_YUV422 || g->layout == GRADE_NV;
+	bpp = g->layout == GRADE_RGB32 ? 4 : g->layout == GRADE_RGB24 ? 3 :
+		g->layout == GRADE_YUV422 ? 2 : 1;
+	if ((yuv && f->width % 2) || f->height % g->vsub ||
+			stride < f->width * bpp)
+		return -1;
+
+	g->fourcc = f->pixelformat;
+	g->width = f->width;
+	g->height = f->height;
+	g->stride = stride;
+
+	if (!g->nodes) {
+		g->nodes = malloc(g->size * g->size * g->size *
+				sizeof(*g->nodes));
+		ASSERT(!g->nodes, "failed to allocate 3d lut nodes\n");
+	}
+	g->lut.nodes = g->nodes;
+	g->lut.size = g->size;
+	g->lut.scale = (g->size - 1) * 65536 / 255;
+	if (!yuv) {
+		grade_rgb_nodes(g);
+		/* bits of r, g and b in pixels, or in 32 bit ones of 24 */
+		for (i = 0; i < 3; i++)
+			g->lut.shift[i] = g->off[i] * 8;
+	} else {
+		if (grade_bt709(f))
+			grade_yuv_nodes(g, 0.2126, 0.0722);
+		else
+			grade_yuv_nodes(g, 0.299, 0.114);
+		for (i = 0; i < 3; i++)
+			g->lut.shift[i] = i * 8;
+	}
+
+	return 0;
+}
+
+/* 24 bit pixels of a line, through 32 bit ones */
+static void grade_rgb24(struct grade *g, uint8_t *line)
+{
+	uint32_t tmp[GRADE_CHUNK];
+	unsigned int x, i, n;
+	uint8_t *p;
+
+	for (x = 0; x < g->width; x += n) {
+		n = min(g->width - x, GRADE_CHUNK);
+		p = line + x * 3;
+		for (i = 0; i < n; i++, p += 3)
+			tmp[i] = p[0] | p[1] << 8 | p[2] << 16;
+		kernel.lut3d((uint8_t *)tmp, (uint8_t *)tmp, n, &g->lut);
+		p = line + x * 3;
+		for (i = 0; i < n; i++, p += 3) {
+			p[0] = tmp[i];
+			p[1] = tmp[i] >> 8;
+			p[2] = tmp[i] >> 16;
+		}
+	}
+}
+
+/* pairs of packed 4:2:2 pixels of a line, through y | u << 8 | v << 16 */
+static void grade_yuv422(struct grade *g, uint8_t *line)
+{
+	const unsigned int *o = g->off;
+	uint32_t tmp[GRADE_CHUNK], a, b;
+	unsigned int x, i, n;
+	uint8_t *p;
+
+	for (x = 0; x < g->width; x += n) {
+		n = min(g->width - x, GRADE_CHUNK);
+		p = line + x * 2;
+		for (i = 0; i < n; i += 2, p += 4) {
+			a = p[o[1]] << 8 | p[o[3]] << 16;
+			tmp[i] = p[o[0]] | a;
+			tmp[i + 1] = p[o[2]] | a;
+		}
+		kernel.lut3d((uint8_t *)tmp, (uint8_t *)tmp, n, &g->lut);
+		p = line + x * 2;
+		for (i = 0; i < n; i += 2, p += 4) {
+			a = tmp[i];
+			b = tmp[i + 1];
+			p[o[0]] = a;
+			p[o[2]] = b;
+			p[o[1]] = ((a >> 8 & 0xff) + (b >> 8 & 0xff) + 1) >> 1;
+			p[o[3]] = ((a >> 16 & 0xff) + (b >> 16 & 0xff) +
+					1) >> 1;
+		}
+	}
+}
+
+/* semi-planar: chroma line of unit and the vsub luma lines sharing it */
+static void grade_nv(struct grade *g, uint8_t *data, unsigned int unit)
+{
+	uint32_t tmp[2 * GRADE_CHUNK], s;
+	unsigned int x, i, r, n, cu = g->off[1], cv = g->off[3];
+	unsigned int span = 2 * g->vsub;
+	uint8_t *luma = data + (size_t)unit * g->vsub * g->stride;
+	uint8_t *chroma = data + (size_t)g->height * g->stride +
+		(size_t)unit * g->stride;
+	uint8_t *c;
+
+	for (x = 0; x < g->width; x += n) {
+		n = min(g->width - x, GRADE_CHUNK);
+		for (r = 0; r < g->vsub; r++)
+			for (i = 0; i < n; i++) {
+				c = chroma + ((x + i) & ~1);
+				tmp[r * n + i] = luma[r * g->stride + x + i] |
+					c[cu] << 8 | c[cv] << 16;
+			}
+		kernel.lut3d((uint8_t *)tmp, (uint8_t *)tmp, n * g->vsub,
+				&g->lut);
+		for (r = 0; r < g->vsub; r++)
+			for (i = 0; i < n; i++)
+				luma[r * g->stride + x + i] = tmp[r * n + i];
+		for (i = 0; i < n; i += 2) {
+			c = chroma + x + i;
+			for (s = 0, r = 0; r < g->vsub; r++)
+				s += (tmp[r * n + i] >> 8 & 0xff) +
+					(tmp[r * n + i + 1] >> 8 & 0xff);
+			c[cu] = (s + span / 2) / span;
+			for (s = 0, r = 0; r < g->vsub; r++)
+				s += (tmp[r * n + i] >> 16 & 0xff) +
+					(tmp[r * n + i + 1] >> 16 & 0xff);
+			c[cv] = (s + span / 2) / span;
+		}
+	}
+}
+
+/* grade units first to first + units of frame data in place */
+void grade_stripe(struct grade *g, uint8_t *data, unsigned int first,
+		unsigned int units)
+{
+	unsigned int u;
+	uint8_t *line;
+
+	for (u = first; u < first + units; u++) {
+		line = data + (size_t)u * g->stride;
+		switch (g->layout) {
+		case GRADE_RGB32:
+			kernel.lut3d(line, line, g->width, &g->lut);
+			break;
+		case GRADE_RGB24:
+			grade_rgb24(g, line);
+			break;
+		case GRADE_YUV422:
+			grade_yuv422(g, line);
+			break;
+		case GRADE_NV:
+			grade_nv(g, data, u);
+			break;
+		}
+	}
+}
+
+static void grade_stripe_run(struct task *t)
+{
+	struct grade_stripe *st = (struct grade_stripe *)t;
+	uint64_t start = timing_now();
+
+	grade_stripe(st->g, st->data, st->first, st->units);
+	__sync_add_and_fetch(&st->g->busy_ns, timing_now() - start);
+}
+
+/* grade mapped frame data of stream in place */
+void grade_frame(struct bridge_stream *s, uint8_t *data)
+{
+	struct grade *g = s->grade;
+	struct workers *w = &s->m->workers;
+	struct grade_stripe st[GRADE_MAX_STRIPES];
+	struct task *tasks[GRADE_MAX_STRIPES];
+	unsigned int units = g->height / g->vsub;
+	unsigned int num = 1, per, u, i;
+	uint64_t start;
+
+	start = timing_now();
+	if (w->threads)
+		num = min(min(w->num + 1, GRADE_MAX_STRIPES),
+				g->height / GRADE_STRIPE_MIN_LINES);
+	if (!num)
+		num = 1;
+	per = DIV_ROUND_UP(units, num);
+	for (i = 0, u = 0; u < units; i++, u += per) {
+		st[i].task.run = grade_stripe_run;
+		st[i].g = g;
+		st[i].data = data;
+		st[i].first = u;
+		st[i].units = min(per, units - u);
+		tasks[i] = &st[i].task;
+	}
+	num = i;
+
+	workers_run(w, tasks, num);
+
+	__sync_add_and_fetch(&g->frames, 1);
+	if (num > 1)
+		__sync_add_and_fetch(&g->striped, 1);
+	__sync_add_and_fetch(&g->ns, timing_now() - start);
+}
+
+void grade_close(struct grade *g)
+{
+	free(g->cube);
+	free(g->nodes);
+	g->cube = NULL;
+	g->nodes = NULL;
+}
+
+/* dump stats of colour stage, throughput is per core busy with stripes */
+void grade_dump_stats(struct grade *g, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s grade %s size %u frames %llu striped %llu "
+			"avg_us %.1f mpix_core %.1f\n", who, g->path, g->size,
+			(unsigned long long)g->frames,
+			(unsigned long long)g->striped,
+			g->frames ? g->ns / 1000.0 / g->frames : 0,
+			g->busy_ns ? (double)g->frames * g->width *
+			g->height * 1000 / g->busy_ns : 0);
+}
@@ -0,0 +1,302 @@
+/*
+ * Hotplug of input video nodes
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * USB capture devices come back as another /dev/videoN when they're
+ * replugged. The input of a stream is known by a stable identity: a link
+ * like /dev/v4l/by-path/.., or the card, bus info and usb serial of the
+ * node, given in the stream config or taken from the node it opened first.
+ * A stream whose input hangs up suspends, listens for kernel uevents on
+ * netlink, and resumes on the node matching the identity once it's back.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <linux/netlink.h>
+
+#include "bridge_priv.h"
+
+#define HOTPLUG_RETRY_MS	250	/* retry while udev sets up the node */
+#define HOTPLUG_SYSFS		"/sys/class/video4linux"
+#define HOTPLUG_MAX_ADDED	16	/* nodes added while waiting */
+
+/* node added while waiting, and when */
+struct hotplug_added {
+	char name[32];			/* DEVNAME, e.g. video2 */
+	uint64_t ns;			/* time of add uevent */
+};
+
+/* parse identity(/dev/v4l/.. link, or card=name[,bus=info][,serial=sn]) */
+int hotplug_parse_args(struct hotplug *hp, const char *arg, size_t len)
+{
+	char spec[256], *opt, *save;
+
+	if (!len || len >= sizeof(spec))
+		return -1;
+	memcpy(spec, arg, len);
+	spec[len] = '\0';
+
+	if (spec[0] == '/') {
+		if (len >= sizeof(hp->path))
+			return -1;
+		strcpy(hp->path, spec);
+		return 0;
+	}
+
+	for (opt = strtok_r(spec, ",", &save); opt;
+			opt = strtok_r(NULL, ",", &save)) {
+		if (!strncmp(opt, "card=", 5) &&
+				strlen(opt + 5) < sizeof(hp->card))
+			strcpy(hp->card, opt + 5);
+		else if (!strncmp(opt, "bus=", 4) &&
+				strlen(opt + 4) < sizeof(hp->bus))
+			strcpy(hp->bus, opt + 4);
+		else if (!strncmp(opt, "serial=", 7) &&
+				strlen(opt + 7) < sizeof(hp->serial))
+			strcpy(hp->serial, opt + 7);
+		else
+			return -1;
+	}
+
+	return *hp->card || *hp->bus || *hp->serial ? 0 : -1;
+}
+
+/* query caps of a capture node at path, returns -1 if it can't be opened or
+ * isn't one */
+static int hotplug_query(const char *path, struct v4l2_capability *caps)
+{
+	unsigned int dev_caps;
+	int fd, ret;
+
+	fd = open(path, O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		return -1;
+	memset(caps, 0, sizeof(*caps));
+	ret = ioctl(fd, VIDIOC_QUERYCAP, caps);
+	close(fd);
+	if (ret)
+		return -1;
+
+	dev_caps = caps->capabilities & V4L2_CAP_DEVICE_CAPS ?
+		caps->device_caps : caps->capabilities;
+	return dev_caps & (V4L2_CAP_VIDEO_CAPTURE |
+			V4L2_CAP_VIDEO_CAPTURE_MPLANE) ? 0 : -1;
+}
+
+/* check if usb device of node has serial */
+static bool hotplug_serial(const char *node, const char *serial)
+{
+	char path[PATH_MAX], sn[64];
+	FILE *fp;
+	bool match = false;
+
+	snprintf(path, sizeof(path), HOTPLUG_SYSFS "/%s/device/../serial",
+			node);
+	fp = fopen(path, "r");
+	if (!fp)
+		return false;
+	if (fgets(sn, sizeof(sn), fp)) {
+		sn[strcspn(sn, "\n")] = '\0';
+		match = !strcmp(sn, serial);
+	}
+	fclose(fp);
+
+	return match;
+}
+
+/* find the capture node of identity, returns 0 with its path in devname */
+static int hotplug_resolve(struct hotplug *hp, char *devname, size_t size)
+{
+	struct v4l2_capability caps;
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+	int index, best = -1;
+
+	if (*hp->path) {
+		if (!realpath(hp->path, path) || strlen(path) >= size ||
+				hotplug_query(path, &caps))
+			return -1;
+		strcpy(devname, path);
+		return 0;
+	}
+
+	dir = opendir(HOTPLUG_SYSFS);
+	if (!dir)
+		return -1;
+	while ((de = readdir(dir))) {
+		if (sscanf(de->d_name, "video%d", &index) != 1)
+			continue;
+		snprintf(path, sizeof(path), "/dev/%s", de->d_name);
+		if (hotplug_query(path, &caps))
+			continue;
+		if ((*hp->card && strcmp(hp->card, (char *)caps.card)) ||
+			(*hp->bus && strcmp(hp->bus, (char *)caps.bus_info)) ||
+			(*hp->serial && !hotplug_serial(de->d_name, hp->serial)))
+			continue;
+		/* the first capture node of a device */
+		if (best < 0 || index < best)
+			best = index;
+	}
+	closedir(dir);
+
+	if (best < 0)
+		return -1;
+	snprintf(devname, size, "/dev/video%d", best);
+	return 0;
+}
+
+/* point input at the node of identity, if one was given */
+void hotplug_find(struct hotplug *hp, struct device *d)
+{
+	if (!*hp->path && !*hp->card && !*hp->bus && !*hp->serial)
+		return;
+
+	ASSERT(hotplug_resolve(hp, d->devname, sizeof(d->devname)),
+		"no capture node matches %s(card '%s', bus '%s', "
+		"serial '%s')\n", hp->path, hp->card, hp->bus, hp->serial);
+	printf("%s: found by identity\n", d->devname);
+}
+
+/* take identity from the opened node, unless one was given */
+void hotplug_identify(struct hotplug *hp, struct device *d)
+{
+	struct v4l2_capability caps;
+
+	if (*hp->path || *hp->card || *hp->bus || *hp->serial)
+		return;
+
+	memset(&caps, 0, sizeof(caps));
+	if (ioctl(d->fd, VIDIOC_QUERYCAP, &caps))
+		return;
+	snprintf(hp->card, sizeof(hp->card), "%s", (char *)caps.card);
+	snprintf(hp->bus, sizeof(hp->bus), "%s", (char *)caps.bus_info);
+}
+
+/* check if input was unplugged, its ioctls fail with ENODEV then */
+bool hotplug_gone(struct device *d)
+{
+	struct v4l2_capability caps;
+
+	if (!ioctl(d->fd, VIDIOC_QUERYCAP, &caps) || errno != ENODEV)
+		return false;
+	d->gone = true;
+	return true;
+}
+
+/* node of uevent if it adds a video4linux device, else NULL */
+static const char *hotplug_added(const char *msg, size_t len)
+{
+	const char *p, *name = NULL;
+	bool add = false, v4l = false;
+
+	for (p = msg; p < msg + len; p += strlen(p) + 1) {
+		if (!strcmp(p, "ACTION=add"))
+			add = true;
+		else if (!strcmp(p, "SUBSYSTEM=video4linux"))
+			v4l = true;
+		else if (!strncmp(p, "DEVNAME=", 8))
+			name = p + 8;
+	}
+
+	return add && v4l ? name : NULL;
+}
+
+static void hotplug_close(void *data)
+{
+	close(*(int *)data);
+}
+
+/* wait until the input of identity is back, and point input at it */
+void hotplug_wait(struct hotplug *hp, struct device *d)
+{
+	struct hotplug_added added[HOTPLUG_MAX_ADDED];
+	unsigned int num_added = 0, i;
+	struct sockaddr_nl addr;
+	struct pollfd pfd;
+	const char *name;
+	char msg[4096];
+	ssize_t len;
+	int fd, ret;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+			NETLINK_KOBJECT_UEVENT);
+	ASSERT(fd < 0, "failed to open uevent socket: %s\n", ERRSTR);
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;		/* kernel uevents */
+	ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	ASSERT(ret < 0, "failed to bind uevent socket: %s\n", ERRSTR);
+
+	pthread_cleanup_push(hotplug_close, &fd);
+	hp->replug_ns = 0;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	/* the node may be back before the socket listens, or open only once
+	 * udev set it up after the event, so look on timeouts too. nodes of
+	 * other devices are added too, the replug is the add of the node the
+	 * identity resolves to */
+	while (hotplug_resolve(hp, d->devname, sizeof(d->devname))) {
+		if (poll(&pfd, 1, HOTPLUG_RETRY_MS) <= 0)
+			continue;
+		len = recv(fd, msg, sizeof(msg) - 1, MSG_DONTWAIT);
+		if (len <= 0)
+			continue;
+		msg[len] = '\0';
+		name = hotplug_added(msg, len);
+		if (!name || strlen(name) >= sizeof(added[0].name) ||
+				num_added == HOTPLUG_MAX_ADDED)
+			continue;
+		strcpy(added[num_added].name, name);
+		added[num_added++].ns = timing_now();
+	}
+	name = strrchr(d->devname, '/');
+	name = name ? name + 1 : d->devname;
+	for (i = 0; i < num_added; i++)
+		if (!strcmp(added[i].name, name) && !hp->replug_ns)
+			hp->replug_ns = added[i].ns;
+	if (!hp->replug_ns)
+		hp->replug_ns = timing_now();
+
+	pthread_cleanup_pop(1);
+}
+
+/* first frame after replug */
+void hotplug_frame(struct hotplug *hp, const char *devname)
+{
+	uint64_t lat = timing_now() - hp->replug_ns;
+
+	hp->replug_ns = 0;
+	hp->resumes++;
+	hp->lat_ns += lat;
+	hp->lat_last = lat;
+	if (lat > hp->lat_max)
+		hp->lat_max = lat;
+	printf("%s: first frame %.1f ms after replug\n", devname, lat / 1e6);
+}
+
+/* dump stats of hotplug */
+void hotplug_dump_stats(struct hotplug *hp, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s hotplug unplugs %u resumes %u replug_to_frame_ms "
+			"last %.1f avg %.1f max %.1f\n", who, hp->unplugs,
+			hp->resumes, hp->lat_last / 1e6,
+			hp->resumes ? hp->lat_ns / 1e6 / hp->resumes : 0,
+			hp->lat_max / 1e6);
+}
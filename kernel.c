@@ -0,0 +1,384 @@
+/*
+ * Pixel processing kernels for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Scalar reference kernels and dispatch to the best tier of the cpu. The
+ * simd tiers live in kernel_x86.c and kernel_neon.c.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <string.h>
+
+#include "kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNEL_X86
+#endif
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define KERNEL_ARM_NEON
+#endif
+
+#define min(a, b)		((a) < (b) ? (a):(b))
+#define max(a, b)		((a) > (b) ? (a):(b))
+
+static const char *tier_names[KERNEL_TIER_MAX] = {
+	[KERNEL_SCALAR]	= "scalar",
+	[KERNEL_SSE2]	= "sse2",
+	[KERNEL_SSE41]	= "sse4.1",
+	[KERNEL_AVX2]	= "avx2",
+	[KERNEL_AVX512]	= "avx512",
+	[KERNEL_NEON]	= "neon",
+};
+
+static const struct kernel_ops *tiers[KERNEL_TIER_MAX] = {
+	[KERNEL_SCALAR]	= &kernel_scalar_ops,
+#ifdef KERNEL_X86
+	[KERNEL_SSE2]	= &kernel_sse2_ops,
+	[KERNEL_SSE41]	= &kernel_sse41_ops,
+	[KERNEL_AVX2]	= &kernel_avx2_ops,
+	[KERNEL_AVX512]	= &kernel_avx512_ops,
+#endif
+#ifdef KERNEL_ARM_NEON
+	[KERNEL_NEON]	= &kernel_neon_ops,
+#endif
+};
+
+struct kernel_ops kernel;
+
+/*
+ * scalar reference
+ */
+
+static void scalar_copy(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows)
+{
+	unsigned int r;
+
+	for (r = 0; r < rows; r++)
+		memcpy(dst + r * dst_stride, src + r * src_stride, width);
+}
+
+static void scalar_yuyv_to_nv12(uint8_t *y, unsigned int y_stride,
+		uint8_t *uv, unsigned int uv_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows)
+{
+	const uint8_t *s0, *s1;
+	uint8_t *y0, *y1, *c;
+	unsigned int r, x;
+
+	for (r = 0; r < rows; r += 2) {
+		s0 = src + r * src_stride;
+		s1 = s0 + src_stride;
+		y0 = y + r * y_stride;
+		y1 = y0 + y_stride;
+		c = uv + r / 2 * uv_stride;
+		for (x = 0; x < width; x++) {
+			y0[x] = s0[2 * x];
+			y1[x] = s1[2 * x];
+			c[x] = (s0[2 * x + 1] + s1[2 * x + 1] + 1) >> 1;
+		}
+	}
+}
+
+static void scalar_downscale2x(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows)
+{
+	const uint8_t *s0, *s1;
+	uint8_t *d;
+	unsigned int r, x;
+
+	for (r = 0; r < rows; r++) {
+		s0 = src + 2 * r * src_stride;
+		s1 = s0 + src_stride;
+		d = dst + r * dst_stride;
+		for (x = 0; x < width; x++)
+			d[x] = (s0[2 * x] + s0[2 * x + 1] +
+					s1[2 * x] + s1[2 * x + 1] + 2) >> 2;
+	}
+}
+
+static void scalar_blend(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *a, const uint8_t *b, unsigned int src_stride,
+		unsigned int width, unsigned int rows, unsigned int alpha)
+{
+	const uint8_t *pa, *pb;
+	uint8_t *d;
+	unsigned int r, x;
+
+	for (r = 0; r < rows; r++) {
+		pa = a + r * src_stride;
+		pb = b + r * src_stride;
+		d = dst + r * dst_stride;
+		for (x = 0; x < width; x++)
+			d[x] = (pa[x] * alpha + pb[x] * (256 - alpha) + 128)
+				>> 8;
+	}
+}
+
+/* fold the lanes and the tail of a row into the hash */
+uint64_t kernel_hash_finish(const uint32_t *lanes, const uint8_t *tail,
+		unsigned int len, uint64_t h)
+{
+	unsigned int i;
+
+	for (i = 0; i < KERNEL_HASH_LANES; i++)
+		h = (h ^ lanes[i]) * 0x100000001b3ull;
+	for (i = 0; i < len; i++)
+		h = (h ^ tail[i]) * 0x100000001b3ull;
+	return h;
+}
+
+/*
+ * every row is hashed in 64 byte blocks as 16 lanes of 32 bit words,
+ * lane = (lane ^ word) * prime, and the lanes and the remaining bytes are
+ * folded into a 64 bit fnv-1a like hash.
+ */
+static uint64_t scalar_hash(const uint8_t *src, unsigned int stride,
+		unsigned int width, unsigned int rows)
+{
+	uint32_t lanes[KERNEL_HASH_LANES];
+	uint64_t h = 0xcbf29ce484222325ull;
+	const uint8_t *s;
+	unsigned int r, x, i;
+	uint32_t w;
+
+	for (r = 0; r < rows; r++) {
+		s = src + r * stride;
+		for (i = 0; i < KERNEL_HASH_LANES; i++)
+			lanes[i] = KERNEL_HASH_PRIME * (i + 1);
+		for (x = 0; x + 64 <= width; x += 64) {
+			for (i = 0; i < KERNEL_HASH_LANES; i++) {
+				memcpy(&w, s + x + 4 * i, sizeof(w));
+				lanes[i] = (lanes[i] ^ w) * KERNEL_HASH_PRIME;
+			}
+		}
+		h = kernel_hash_finish(lanes, s + x, width - x, h);
+	}
+
+	return h;
+}
+
+static void scalar_stats(const uint8_t *src, const uint8_t *ref,
+		unsigned int stride, unsigned int width, unsigned int rows,
+		unsigned int step, struct kernel_stats *st)
+{
+	const uint8_t *s, *p;
+	unsigned int r, x;
+
+	for (r = 0; r < rows; r++) {
+		s = src + r * stride;
+		p = ref + r * stride;
+		for (x = 0; x < width; x += step) {
+			st->sum += s[x];
+			st->sumsq += s[x] * s[x];
+			st->sad += s[x] > p[x] ? s[x] - p[x] : p[x] - s[x];
+		}
+	}
+}
+
+/*
+ * top = p00 * (256 - fx) + p01 * fx, bottom likewise a row below, and
+ * dst = (top * (256 - fy) + bottom * fy + 32768) >> 16, per channel
+ */
+void kernel_remap_row(uint8_t *dst, const uint8_t *src,
+		unsigned int src_stride, const uint32_t *offset,
+		const uint16_t *weight, unsigned int x, unsigned int width,
+		unsigned int bpp)
+{
+	const uint8_t *s0, *s1;
+	unsigned int c, fx, fy, top, bot;
+
+	for (; x < width; x++) {
+		s0 = src + offset[x];
+		s1 = s0 + src_stride;
+		fx = weight[x] & 0xff;
+		fy = weight[x] >> 8;
+		for (c = 0; c < bpp; c++) {
+			top = s0[c] * (256 - fx) + s0[c + bpp] * fx;
+			bot = s1[c] * (256 - fx) + s1[c + bpp] * fx;
+			dst[x * bpp + c] = (top * (256 - fy) + bot * fy +
+					32768) >> 16;
+		}
+	}
+}
+
+static void scalar_remap(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		const uint32_t *offset, const uint16_t *weight,
+		unsigned int lut_stride, unsigned int width, unsigned int rows,
+		unsigned int bpp)
+{
+	unsigned int r;
+
+	for (r = 0; r < rows; r++)
+		kernel_remap_row(dst + r * dst_stride, src, src_stride,
+				offset + r * lut_stride,
+				weight + r * lut_stride, 0, width, bpp);
+}
+
+/*
+ * each channel c is at q8 position (c * scale + 128) >> 8 along its axis,
+ * in the cell of node i = min(position >> 8, size - 2) with fraction
+ * f = position - 256 * i(0 to 256). the cell is split into 6 tetrahedra by
+ * the order of the fractions, and the one of the pixel is walked from the
+ * first node of the cell along the axis of the largest fraction, then the
+ * next one, to the far node: weights 256 - fmax, fmax - fmid, fmid - fmin
+ * and fmin, and channel = (sum of weight * node + 512) >> 10. ties take
+ * c0 over c1 over c2 as the largest and c2 over c1 over c0 as the smallest,
+ * the node left out either way has no weight.
+ */
+void kernel_lut3d_pixels(uint8_t *dst, const uint8_t *src, unsigned int n,
+		const struct kernel_lut3d *lut)
+{
+	unsigned int n1 = lut->size, n2 = n1 * n1, far = 1 + n1 + n2;
+	uint32_t keep = ~(0xffu << lut->shift[0] | 0xffu << lut->shift[1] |
+			0xffu << lut->shift[2]);
+	unsigned int i, c, pos, idx[3], f[3], w[4], fmax, fmin, fmid;
+	unsigned int base, smax, smin, o;
+	uint32_t p, out, v[4];
+
+	for (i = 0; i < n; i++) {
+		memcpy(&p, src + 4 * i, sizeof(p));
+		for (c = 0; c < 3; c++) {
+			pos = ((p >> lut->shift[c] & 0xff) * lut->scale +
+					128) >> 8;
+			idx[c] = min(pos >> 8, lut->size - 2);
+			f[c] = pos - (idx[c] << 8);
+		}
+		base = idx[0] + idx[1] * n1 + idx[2] * n2;
+		fmax = max(f[0], max(f[1], f[2]));
+		fmin = min(f[0], min(f[1], f[2]));
+		fmid = f[0] + f[1] + f[2] - fmax - fmin;
+		smax = f[0] == fmax ? 1 : f[1] == fmax ? n1 : n2;
+		smin = f[2] == fmin ? n2 : f[1] == fmin ? n1 : 1;
+
+		v[0] = lut->nodes[base];
+		v[1] = lut->nodes[base + smax];
+		v[2] = lut->nodes[base + far - smin];
+		v[3] = lut->nodes[base + far];
+		w[0] = 256 - fmax;
+		w[1] = fmax - fmid;
+		w[2] = fmid - fmin;
+		w[3] = fmin;
+
+		out = p & keep;
+		for (c = 0; c < 3; c++) {
+			o = w[0] * (v[0] >> 10 * c & 1023) +
+				w[1] * (v[1] >> 10 * c & 1023) +
+				w[2] * (v[2] >> 10 * c & 1023) +
+				w[3] * (v[3] >> 10 * c & 1023);
+			out |= (o + 512) >> 10 << lut->shift[c];
+		}
+		memcpy(dst + 4 * i, &out, sizeof(out));
+	}
+}
+
+static void scalar_lut3d(uint8_t *dst, const uint8_t *src, unsigned int n,
+		const struct kernel_lut3d *lut)
+{
+	kernel_lut3d_pixels(dst, src, n, lut);
+}
+
+const struct kernel_ops kernel_scalar_ops = {
+	.copy		= scalar_copy,
+	.yuyv_to_nv12	= scalar_yuyv_to_nv12,
+	.downscale2x	= scalar_downscale2x,
+	.blend		= scalar_blend,
+	.hash		= scalar_hash,
+	.stats		= scalar_stats,
+	.remap		= scalar_remap,
+	.lut3d		= scalar_lut3d,
+};
+
+/*
+ * dispatch
+ */
+
+const char *kernel_tier_name(enum kernel_tier tier)
+{
+	return tier < KERNEL_TIER_MAX ? tier_names[tier] : "unknown";
+}
+
+/* parse tier name, returns tier or -1 */
+int kernel_tier_parse(const char *name)
+{
+	int i;
+
+	for (i = 0; i < KERNEL_TIER_MAX; i++)
+		if (!strcmp(name, tier_names[i]))
+			return i;
+	return -1;
+}
+
+/* check if the tier is built in and runs on this cpu */
+bool kernel_tier_supported(enum kernel_tier tier)
+{
+	if (tier >= KERNEL_TIER_MAX || !tiers[tier])
+		return false;
+
+	switch (tier) {
+	case KERNEL_SCALAR:
+		return true;
+#ifdef KERNEL_X86
+	case KERNEL_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case KERNEL_SSE41:
+		return __builtin_cpu_supports("sse4.1");
+	case KERNEL_AVX2:
+		return __builtin_cpu_supports("avx2");
+	case KERNEL_AVX512:
+		return __builtin_cpu_supports("avx512f") &&
+			__builtin_cpu_supports("avx512bw");
+#endif
+#ifdef KERNEL_ARM_NEON
+	case KERNEL_NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+/* kernels of a tier, NULL if the tier is not built in */
+const struct kernel_ops *kernel_tier_ops(enum kernel_tier tier)
+{
+	return tier < KERNEL_TIER_MAX ? tiers[tier] : NULL;
+}
+
+#define KERNEL_PICK(ops, name)			\
+	do {					\
+		if ((ops)->name)		\
+			kernel.name = (ops)->name;	\
+	} while (0)
+
+/* pick the highest supported tier of each kernel */
+void kernel_init(void)
+{
+	const struct kernel_ops *ops;
+	int i;
+
+	for (i = 0; i < KERNEL_TIER_MAX; i++) {
+		if (!kernel_tier_supported(i))
+			continue;
+		ops = tiers[i];
+		KERNEL_PICK(ops, copy);
+		KERNEL_PICK(ops, yuyv_to_nv12);
+		KERNEL_PICK(ops, downscale2x);
+		KERNEL_PICK(ops, blend);
+		KERNEL_PICK(ops, hash);
+		KERNEL_PICK(ops, stats);
+		KERNEL_PICK(ops, remap);
+		KERNEL_PICK(ops, lut3d);
+	}
+}
@@ -0,0 +1,148 @@
+/*
+ * Pixel processing kernels for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __KERNEL_H__
+#define __KERNEL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * KERNELS
+ *
+ * every kernel works on a range of rows, so that callers can split a frame
+ * into stripes. each tier gives bit exact results of the scalar one, and a
+ * tier leaves a kernel NULL if it has nothing better than a lower tier.
+ */
+
+/* instruction set tiers */
+enum kernel_tier {
+	KERNEL_SCALAR,
+	KERNEL_SSE2,
+	KERNEL_SSE41,
+	KERNEL_AVX2,
+	KERNEL_AVX512,
+	KERNEL_NEON,
+	KERNEL_TIER_MAX,
+};
+
+/* copy width bytes of each row */
+typedef void (*kernel_copy_t)(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows);
+
+/* convert YUYV to NV12, rows must be even, chroma is averaged vertically */
+typedef void (*kernel_yuyv_to_nv12_t)(uint8_t *y, unsigned int y_stride,
+		uint8_t *uv, unsigned int uv_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows);
+
+/* downscale a 8 bit plane by 2 with a 2x2 box, width/rows of destination */
+typedef void (*kernel_downscale2x_t)(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows);
+
+/* blend bytes, dst = (a * alpha + b * (256 - alpha) + 128) >> 8 */
+typedef void (*kernel_blend_t)(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *a, const uint8_t *b, unsigned int src_stride,
+		unsigned int width, unsigned int rows, unsigned int alpha);
+
+/* 64 bit hash of width bytes of each row */
+typedef uint64_t (*kernel_hash_t)(const uint8_t *src, unsigned int stride,
+		unsigned int width, unsigned int rows);
+
+/* statistics of bytes, added to by the stats kernel */
+struct kernel_stats {
+	uint64_t sum;			/* sum of bytes */
+	uint64_t sumsq;			/* sum of squares of bytes */
+	uint64_t sad;			/* sum of absolute differences to ref */
+};
+
+/* statistics of every step-th byte(1, 2 or 4) of width bytes of each row,
+ * against the same bytes of ref */
+typedef void (*kernel_stats_t)(const uint8_t *src, const uint8_t *ref,
+		unsigned int stride, unsigned int width, unsigned int rows,
+		unsigned int step, struct kernel_stats *st);
+
+/* bilinear remap: pixel x of row r of dst samples src at offset[r *
+ * lut_stride + x] and the next pixel and the ones a src_stride below, with
+ * the 8 bit fractions of weight(x | y << 8), for pixels of bpp(1 or 2)
+ * bytes whose channels are sampled apart. reads up to 4 bytes at each
+ * offset of both rows */
+typedef void (*kernel_remap_t)(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		const uint32_t *offset, const uint16_t *weight,
+		unsigned int lut_stride, unsigned int width, unsigned int rows,
+		unsigned int bpp);
+
+/* 3d lut of size^3 nodes, each the 3 channels c0 | c1 << 10 | c2 << 20 at
+ * 4 times their 8 bit value, c0 along the fastest axis */
+struct kernel_lut3d {
+	const uint32_t *nodes;		/* nodes */
+	unsigned int size;		/* nodes per axis, 2 to 256 */
+	unsigned int scale;		/* value to q16 position in nodes */
+	unsigned int shift[3];		/* bit of each channel in a pixel */
+};
+
+/* tetrahedral interpolation of n 32 bit pixels, other bits than the
+ * channels are kept. dst may be src */
+typedef void (*kernel_lut3d_t)(uint8_t *dst, const uint8_t *src,
+		unsigned int n, const struct kernel_lut3d *lut);
+
+/* kernels of a tier */
+struct kernel_ops {
+	kernel_copy_t copy;
+	kernel_yuyv_to_nv12_t yuyv_to_nv12;
+	kernel_downscale2x_t downscale2x;
+	kernel_blend_t blend;
+	kernel_hash_t hash;
+	kernel_stats_t stats;
+	kernel_remap_t remap;
+	kernel_lut3d_t lut3d;
+};
+
+/* kernels picked for this cpu, valid after kernel_init() */
+extern struct kernel_ops kernel;
+
+void kernel_init(void);
+const char *kernel_tier_name(enum kernel_tier tier);
+int kernel_tier_parse(const char *name);
+bool kernel_tier_supported(enum kernel_tier tier);
+const struct kernel_ops *kernel_tier_ops(enum kernel_tier tier);
+
+/* per tier tables */
+extern const struct kernel_ops kernel_scalar_ops;
+extern const struct kernel_ops kernel_sse2_ops;
+extern const struct kernel_ops kernel_sse41_ops;
+extern const struct kernel_ops kernel_avx2_ops;
+extern const struct kernel_ops kernel_avx512_ops;
+extern const struct kernel_ops kernel_neon_ops;
+
+/* hash helpers shared by the tiers */
+#define KERNEL_HASH_LANES	16
+#define KERNEL_HASH_PRIME	0x9e3779b1u
+
+uint64_t kernel_hash_finish(const uint32_t *lanes, const uint8_t *tail,
+		unsigned int len, uint64_t h);
+
+/* remap of pixels x to width of a row, shared by the tiers */
+void kernel_remap_row(uint8_t *dst, const uint8_t *src,
+		unsigned int src_stride, const uint32_t *offset,
+		const uint16_t *weight, unsigned int x, unsigned int width,
+		unsigned int bpp);
+
+/* 3d lut of n pixels, shared by the tiers */
+void kernel_lut3d_pixels(uint8_t *dst, const uint8_t *src, unsigned int n,
+		const struct kernel_lut3d *lut);
+
+#endif /* __KERNEL_H__ */
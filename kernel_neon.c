@@ -0,0 +1,192 @@
+/*
+ * arm neon tier of the pixel processing kernels
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+#include "kernel.h"
+
+/* yuyv to nv12: vld2 splits luma and interleaved chroma */
+static void neon_yuyv_to_nv12(uint8_t *y, unsigned int y_stride,
+		uint8_t *uv, unsigned int uv_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows)
+{
+	const uint8_t *s0, *s1;
+	uint8_t *y0, *y1, *c;
+	uint8x16x2_t a, b;
+	unsigned int r, x;
+
+	for (r = 0; r < rows; r += 2) {
+		s0 = src + r * src_stride;
+		s1 = s0 + src_stride;
+		y0 = y + r * y_stride;
+		y1 = y0 + y_stride;
+		c = uv + r / 2 * uv_stride;
+		for (x = 0; x + 16 <= width; x += 16) {
+			a = vld2q_u8(s0 + 2 * x);
+			b = vld2q_u8(s1 + 2 * x);
+			vst1q_u8(y0 + x, a.val[0]);
+			vst1q_u8(y1 + x, b.val[0]);
+			vst1q_u8(c + x, vrhaddq_u8(a.val[1], b.val[1]));
+		}
+		for (; x < width; x++) {
+			y0[x] = s0[2 * x];
+			y1[x] = s1[2 * x];
+			c[x] = (s0[2 * x + 1] + s1[2 * x + 1] + 1) >> 1;
+		}
+	}
+}
+
+/* 2x2 box: pairwise widening adds and a rounding narrow */
+static void neon_downscale2x(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows)
+{
+	const uint8_t *s0, *s1;
+	uint8_t *d;
+	uint16x8_t sum;
+	unsigned int r, x;
+
+	for (r = 0; r < rows; r++) {
+		s0 = src + 2 * r * src_stride;
+		s1 = s0 + src_stride;
+		d = dst + r * dst_stride;
+		for (x = 0; x + 8 <= width; x += 8) {
+			sum = vpaddlq_u8(vld1q_u8(s0 + 2 * x));
+			sum = vpadalq_u8(sum, vld1q_u8(s1 + 2 * x));
+			vst1_u8(d + x, vrshrn_n_u16(sum, 2));
+		}
+		for (; x < width; x++)
+			d[x] = (s0[2 * x] + s0[2 * x + 1] +
+					s1[2 * x] + s1[2 * x + 1] + 2) >> 2;
+	}
+}
+
+static void neon_blend(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *a, const uint8_t *b, unsigned int src_stride,
+		unsigned int width, unsigned int rows, unsigned int alpha)
+{
+	const uint16x8_t round = vdupq_n_u16(128);
+	const uint8_t *pa, *pb;
+	uint8_t *d;
+	uint8x16_t xa, xb;
+	uint16x8_t lo, hi;
+	unsigned int r, x;
+
+	for (r = 0; r < rows; r++) {
+		pa = a + r * src_stride;
+		pb = b + r * src_stride;
+		d = dst + r * dst_stride;
+		for (x = 0; x + 16 <= width; x += 16) {
+			xa = vld1q_u8(pa + x);
+			xb = vld1q_u8(pb + x);
+			lo = vmulq_n_u16(vmovl_u8(vget_low_u8(xa)), alpha);
+			lo = vmlaq_n_u16(lo, vmovl_u8(vget_low_u8(xb)),
+					256 - alpha);
+			hi = vmulq_n_u16(vmovl_u8(vget_high_u8(xa)), alpha);
+			hi = vmlaq_n_u16(hi, vmovl_u8(vget_high_u8(xb)),
+					256 - alpha);
+			vst1q_u8(d + x, vcombine_u8(
+					vshrn_n_u16(vaddq_u16(lo, round), 8),
+					vshrn_n_u16(vaddq_u16(hi, round), 8)));
+		}
+		for (; x < width; x++)
+			d[x] = (pa[x] * alpha + pb[x] * (256 - alpha) + 128)
+				>> 8;
+	}
+}
+
+static uint64_t neon_hash(const uint8_t *src, unsigned int stride,
+		unsigned int width, unsigned int rows)
+{
+	uint32_t lanes[KERNEL_HASH_LANES];
+	uint64_t h = 0xcbf29ce484222325ull;
+	const uint8_t *s;
+	unsigned int r, x, i;
+	uint32x4_t v[4];
+
+	for (r = 0; r < rows; r++) {
+		s = src + r * stride;
+		for (i = 0; i < KERNEL_HASH_LANES; i++)
+			lanes[i] = KERNEL_HASH_PRIME * (i + 1);
+		for (i = 0; i < 4; i++)
+			v[i] = vld1q_u32(&lanes[4 * i]);
+		for (x = 0; x + 64 <= width; x += 64)
+			for (i = 0; i < 4; i++)
+				v[i] = vmulq_n_u32(veorq_u32(v[i],
+						vreinterpretq_u32_u8(
+						vld1q_u8(s + x + 16 * i))),
+						KERNEL_HASH_PRIME);
+		for (i = 0; i < 4; i++)
+			vst1q_u32(&lanes[4 * i], v[i]);
+		h = kernel_hash_finish(lanes, s + x, width - x, h);
+	}
+
+	return h;
+}
+
+/* stats: masked bytes add nothing, sums are widened pairwise into 32 bit
+ * lanes which are folded every row */
+static void neon_stats(const uint8_t *src, const uint8_t *ref,
+		unsigned int stride, unsigned int width, unsigned int rows,
+		unsigned int step, struct kernel_stats *st)
+{
+	const uint8x16_t mask = step == 1 ? vdupq_n_u8(0xff) :
+		step == 2 ? vreinterpretq_u8_u16(vdupq_n_u16(0xff)) :
+		vreinterpretq_u8_u32(vdupq_n_u32(0xff));
+	uint32_t sum[4], sq[4], sad[4];
+	uint32x4_t vsum, vsq, vsad;
+	const uint8_t *s, *p;
+	uint8x16_t a, b;
+	unsigned int r, x, i;
+
+	for (r = 0; r < rows; r++) {
+		s = src + r * stride;
+		p = ref + r * stride;
+		vsum = vsq = vsad = vdupq_n_u32(0);
+		for (x = 0; x + 16 <= width; x += 16) {
+			a = vandq_u8(vld1q_u8(s + x), mask);
+			b = vandq_u8(vld1q_u8(p + x), mask);
+			vsum = vpadalq_u16(vsum, vpaddlq_u8(a));
+			vsad = vpadalq_u16(vsad, vpaddlq_u8(vabdq_u8(a, b)));
+			vsq = vpadalq_u16(vsq, vmull_u8(vget_low_u8(a),
+						vget_low_u8(a)));
+			vsq = vpadalq_u16(vsq, vmull_u8(vget_high_u8(a),
+						vget_high_u8(a)));
+		}
+		vst1q_u32(sum, vsum);
+		vst1q_u32(sq, vsq);
+		vst1q_u32(sad, vsad);
+		for (i = 0; i < 4; i++) {
+			st->sum += sum[i];
+			st->sumsq += sq[i];
+			st->sad += sad[i];
+		}
+		for (; x < width; x += step) {
+			st->sum += s[x];
+			st->sumsq += s[x] * s[x];
+			st->sad += s[x] > p[x] ? s[x] - p[x] : p[x] - s[x];
+		}
+	}
+}
+
+const struct kernel_ops kernel_neon_ops = {
+	.yuyv_to_nv12	= neon_yuyv_to_nv12,
+	.downscale2x	= neon_downscale2x,
+	.blend		= neon_blend,
+	.hash		= neon_hash,
+	.stats		= neon_stats,
+};
+
+#endif /* __aarch64__ || __ARM_NEON */
@@ -0,0 +1,697 @@
+/*
+ * x86 simd tiers of the pixel processing kernels
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Every function is built for its own tier with a target attribute, so this
+ * file needs no special flags and kernel_init() decides at run time.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "kernel.h"
+
+#define SSE2		__attribute__((target("sse2")))
+#define SSE41		__attribute__((target("sse4.1")))
+#define AVX2		__attribute__((target("avx2")))
+#define AVX512		__attribute__((target("avx512f,avx512bw")))
+
+/*
+ * copy with non temporal stores. frames go to a device, so don't pull them
+ * into the cache on the way out.
+ */
+
+#define DEFINE_STREAM_COPY(name, attr, vec, align, load, store, fence)	\
+attr static void name(uint8_t *dst, unsigned int dst_stride,		\
+		const uint8_t *src, unsigned int src_stride,		\
+		unsigned int width, unsigned int rows)			\
+{									\
+	unsigned int r, x, head;					\
+	uint8_t *d;							\
+	const uint8_t *s;						\
+									\
+	for (r = 0; r < rows; r++) {					\
+		d = dst + r * dst_stride;				\
+		s = src + r * src_stride;				\
+		head = (align - ((uintptr_t)d & (align - 1))) &		\
+			(align - 1);					\
+		if (head > width)					\
+			head = width;					\
+		memcpy(d, s, head);					\
+		for (x = head; x + align <= width; x += align)		\
+			store((vec *)(d + x),				\
+					load((const vec *)(s + x)));	\
+		memcpy(d + x, s + x, width - x);			\
+	}								\
+	fence();							\
+}
+
+DEFINE_STREAM_COPY(sse2_copy, SSE2, __m128i, 16, _mm_loadu_si128,
+		_mm_stream_si128, _mm_sfence)
+DEFINE_STREAM_COPY(avx2_copy, AVX2, __m256i, 32, _mm256_loadu_si256,
+		_mm256_stream_si256, _mm_sfence)
+
+AVX512 static void avx512_copy(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows)
+{
+	unsigned int r, x, head;
+	uint8_t *d;
+	const uint8_t *s;
+
+	for (r = 0; r < rows; r++) {
+		d = dst + r * dst_stride;
+		s = src + r * src_stride;
+		head = (64 - ((uintptr_t)d & 63)) & 63;
+		if (head > width)
+			head = width;
+		memcpy(d, s, head);
+		for (x = head; x + 64 <= width; x += 64)
+			_mm512_stream_si512((void *)(d + x),
+					_mm512_loadu_si512(s + x));
+		memcpy(d + x, s + x, width - x);
+	}
+	_mm_sfence();
+}
+
+/*
+ * yuyv to nv12: even bytes are luma, odd bytes are interleaved chroma which
+ * is already in nv12 order, so it's masks, packs and a rounding average.
+ */
+
+static void tail_yuyv_to_nv12(uint8_t *y0, uint8_t *y1, uint8_t *c,
+		const uint8_t *s0, const uint8_t *s1, unsigned int x,
+		unsigned int width)
+{
+	for (; x < width; x++) {
+		y0[x] = s0[2 * x];
+		y1[x] = s1[2 * x];
+		c[x] = (s0[2 * x + 1] + s1[2 * x + 1] + 1) >> 1;
+	}
+}
+
+SSE2 static void sse2_yuyv_to_nv12(uint8_t *y, unsigned int y_stride,
+		uint8_t *uv, unsigned int uv_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	const uint8_t *s0, *s1;
+	uint8_t *y0, *y1, *c;
+	__m128i a0, a1, b0, b1;
+	unsigned int r, x;
+
+	for (r = 0; r < rows; r += 2) {
+		s0 = src + r * src_stride;
+		s1 = s0 + src_stride;
+		y0 = y + r * y_stride;
+		y1 = y0 + y_stride;
+		c = uv + r / 2 * uv_stride;
+		for (x = 0; x + 16 <= width; x += 16) {
+			a0 = _mm_loadu_si128((const __m128i *)(s0 + 2 * x));
+			a1 = _mm_loadu_si128((const __m128i *)(s0 + 2 * x + 16));
+			b0 = _mm_loadu_si128((const __m128i *)(s1 + 2 * x));
+			b1 = _mm_loadu_si128((const __m128i *)(s1 + 2 * x + 16));
+			_mm_storeu_si128((__m128i *)(y0 + x),
+					_mm_packus_epi16(_mm_and_si128(a0, mask),
+						_mm_and_si128(a1, mask)));
+			_mm_storeu_si128((__m128i *)(y1 + x),
+					_mm_packus_epi16(_mm_and_si128(b0, mask),
+						_mm_and_si128(b1, mask)));
+			_mm_storeu_si128((__m128i *)(c + x), _mm_avg_epu8(
+					_mm_packus_epi16(_mm_srli_epi16(a0, 8),
+						_mm_srli_epi16(a1, 8)),
+					_mm_packus_epi16(_mm_srli_epi16(b0, 8),
+						_mm_srli_epi16(b1, 8))));
+		}
+		tail_yuyv_to_nv12(y0, y1, c, s0, s1, x, width);
+	}
+}
+
+/* packs work per 128 bit lane, put the 64 bit quarters back in order */
+#define AVX2_PACK(a, b) \
+	_mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8)
+
+AVX2 static void avx2_yuyv_to_nv12(uint8_t *y, unsigned int y_stride,
+		uint8_t *uv, unsigned int uv_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows)
+{
+	const __m256i mask = _mm256_set1_epi16(0xff);
+	const uint8_t *s0, *s1;
+	uint8_t *y0, *y1, *c;
+	__m256i a0, a1, b0, b1;
+	unsigned int r, x;
+
+	for (r = 0; r < rows; r += 2) {
+		s0 = src + r * src_stride;
+		s1 = s0 + src_stride;
+		y0 = y + r * y_stride;
+		y1 = y0 + y_stride;
+		c = uv + r / 2 * uv_stride;
+		for (x = 0; x + 32 <= width; x += 32) {
+			a0 = _mm256_loadu_si256((const __m256i *)(s0 + 2 * x));
+			a1 = _mm256_loadu_si256((const __m256i *)(s0 + 2 * x + 32));
+			b0 = _mm256_loadu_si256((const __m256i *)(s1 + 2 * x));
+			b1 = _mm256_loadu_si256((const __m256i *)(s1 + 2 * x + 32));
+			_mm256_storeu_si256((__m256i *)(y0 + x),
+					AVX2_PACK(_mm256_and_si256(a0, mask),
+						_mm256_and_si256(a1, mask)));
+			_mm256_storeu_si256((__m256i *)(y1 + x),
+					AVX2_PACK(_mm256_and_si256(b0, mask),
+						_mm256_and_si256(b1, mask)));
+			_mm256_storeu_si256((__m256i *)(c + x), _mm256_avg_epu8(
+					AVX2_PACK(_mm256_srli_epi16(a0, 8),
+						_mm256_srli_epi16(a1, 8)),
+					AVX2_PACK(_mm256_srli_epi16(b0, 8),
+						_mm256_srli_epi16(b1, 8))));
+		}
+		tail_yuyv_to_nv12(y0, y1, c, s0, s1, x, width);
+	}
+}
+
+/*
+ * 2x2 box downscale: pairs are summed in 16 bit and rounded
+ */
+
+static void tail_downscale2x(uint8_t *d, const uint8_t *s0,
+		const uint8_t *s1, unsigned int x, unsigned int width)
+{
+	for (; x < width; x++)
+		d[x] = (s0[2 * x] + s0[2 * x + 1] +
+				s1[2 * x] + s1[2 * x + 1] + 2) >> 2;
+}
+
+SSE2 static inline __m128i sse2_box(__m128i a, __m128i b)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	__m128i sum;
+
+	sum = _mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8));
+	sum = _mm_add_epi16(sum, _mm_and_si128(b, mask));
+	sum = _mm_add_epi16(sum, _mm_srli_epi16(b, 8));
+	return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+SSE2 static void sse2_downscale2x(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows)
+{
+	const uint8_t *s0, *s1;
+	uint8_t *d;
+	unsigned int r, x;
+	__m128i lo, hi;
+
+	for (r = 0; r < rows; r++) {
+		s0 = src + 2 * r * src_stride;
+		s1 = s0 + src_stride;
+		d = dst + r * dst_stride;
+		for (x = 0; x + 16 <= width; x += 16) {
+			lo = sse2_box(_mm_loadu_si128((const __m128i *)(s0 + 2 * x)),
+				_mm_loadu_si128((const __m128i *)(s1 + 2 * x)));
+			hi = sse2_box(_mm_loadu_si128((const __m128i *)(s0 + 2 * x + 16)),
+				_mm_loadu_si128((const __m128i *)(s1 + 2 * x + 16)));
+			_mm_storeu_si128((__m128i *)(d + x),
+					_mm_packus_epi16(lo, hi));
+		}
+		tail_downscale2x(d, s0, s1, x, width);
+	}
+}
+
+AVX2 static inline __m256i avx2_box(__m256i a, __m256i b)
+{
+	const __m256i mask = _mm256_set1_epi16(0xff);
+	__m256i sum;
+
+	sum = _mm256_add_epi16(_mm256_and_si256(a, mask),
+			_mm256_srli_epi16(a, 8));
+	sum = _mm256_add_epi16(sum, _mm256_and_si256(b, mask));
+	sum = _mm256_add_epi16(sum, _mm256_srli_epi16(b, 8));
+	return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
+}
+
+AVX2 static void avx2_downscale2x(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		unsigned int width, unsigned int rows)
+{
+	const uint8_t *s0, *s1;
+	uint8_t *d;
+	unsigned int r, x;
+	__m256i lo, hi;
+
+	for (r = 0; r < rows; r++) {
+		s0 = src + 2 * r * src_stride;
+		s1 = s0 + src_stride;
+		d = dst + r * dst_stride;
+		for (x = 0; x + 32 <= width; x += 32) {
+			lo = avx2_box(_mm256_loadu_si256((const __m256i *)(s0 + 2 * x)),
+				_mm256_loadu_si256((const __m256i *)(s1 + 2 * x)));
+			hi = avx2_box(_mm256_loadu_si256((const __m256i *)(s0 + 2 * x + 32)),
+				_mm256_loadu_si256((const __m256i *)(s1 + 2 * x + 32)));
+			_mm256_storeu_si256((__m256i *)(d + x), AVX2_PACK(lo, hi));
+		}
+		tail_downscale2x(d, s0, s1, x, width);
+	}
+}
+
+/*
+ * blend: unpack to 16 bit, multiply and pack. unpack and pack pair up per
+ * lane, so no reordering is needed on the wider tiers.
+ */
+
+static void tail_blend(uint8_t *d, const uint8_t *a, const uint8_t *b,
+		unsigned int x, unsigned int width, unsigned int alpha)
+{
+	for (; x < width; x++)
+		d[x] = (a[x] * alpha + b[x] * (256 - alpha) + 128) >> 8;
+}
+
+#define DEFINE_BLEND(name, attr, vec, n, pre)				\
+attr static void name(uint8_t *dst, unsigned int dst_stride,		\
+		const uint8_t *a, const uint8_t *b, unsigned int src_stride,\
+		unsigned int width, unsigned int rows, unsigned int alpha)\
+{									\
+	const vec zero = pre##_setzero_si##n();				\
+	const vec va = pre##_set1_epi16(alpha);				\
+	const vec vb = pre##_set1_epi16(256 - alpha);			\
+	const vec round = pre##_set1_epi16(128);			\
+	const uint8_t *pa, *pb;						\
+	uint8_t *d;							\
+	unsigned int r, x;						\
+	vec xa, xb, lo, hi;						\
+									\
+	for (r = 0; r < rows; r++) {					\
+		pa = a + r * src_stride;				\
+		pb = b + r * src_stride;				\
+		d = dst + r * dst_stride;				\
+		for (x = 0; x + sizeof(vec) <= width; x += sizeof(vec)) {\
+			xa = pre##_loadu_si##n((const void *)(pa + x));	\
+			xb = pre##_loadu_si##n((const void *)(pb + x));	\
+			lo = pre##_add_epi16(pre##_add_epi16(		\
+				pre##_mullo_epi16(pre##_unpacklo_epi8(xa, zero), va),\
+				pre##_mullo_epi16(pre##_unpacklo_epi8(xb, zero), vb)),\
+				round);					\
+			hi = pre##_add_epi16(pre##_add_epi16(		\
+				pre##_mullo_epi16(pre##_unpackhi_epi8(xa, zero), va),\
+				pre##_mullo_epi16(pre##_unpackhi_epi8(xb, zero), vb)),\
+				round);					\
+			pre##_storeu_si##n((void *)(d + x),		\
+				pre##_packus_epi16(pre##_srli_epi16(lo, 8),\
+					pre##_srli_epi16(hi, 8)));	\
+		}							\
+		tail_blend(d, pa, pb, x, width, alpha);			\
+	}								\
+}
+
+DEFINE_BLEND(sse2_blend, SSE2, __m128i, 128, _mm)
+DEFINE_BLEND(avx2_blend, AVX2, __m256i, 256, _mm256)
+DEFINE_BLEND(avx512_blend, AVX512, __m512i, 512, _mm512)
+
+/*
+ * hash: the 16 lanes of kernel.c in 4, 2 or 1 registers
+ */
+
+#define HASH_INIT(i)	(KERNEL_HASH_PRIME * ((i) + 1))
+
+SSE41 static uint64_t sse41_hash(const uint8_t *src, unsigned int stride,
+		unsigned int width, unsigned int rows)
+{
+	const __m128i prime = _mm_set1_epi32(KERNEL_HASH_PRIME);
+	uint32_t lanes[KERNEL_HASH_LANES];
+	uint64_t h = 0xcbf29ce484222325ull;
+	const uint8_t *s;
+	unsigned int r, x, i;
+	__m128i v[4];
+
+	for (r = 0; r < rows; r++) {
+		s = src + r * stride;
+		for (i = 0; i < 4; i++)
+			v[i] = _mm_setr_epi32(HASH_INIT(4 * i),
+					HASH_INIT(4 * i + 1),
+					HASH_INIT(4 * i + 2),
+					HASH_INIT(4 * i + 3));
+		for (x = 0; x + 64 <= width; x += 64)
+			for (i = 0; i < 4; i++)
+				v[i] = _mm_mullo_epi32(_mm_xor_si128(v[i],
+						_mm_loadu_si128((const __m128i *)
+							(s + x + 16 * i))),
+						prime);
+		for (i = 0; i < 4; i++)
+			_mm_storeu_si128((__m128i *)&lanes[4 * i], v[i]);
+		h = kernel_hash_finish(lanes, s + x, width - x, h);
+	}
+
+	return h;
+}
+
+AVX2 static uint64_t avx2_hash(const uint8_t *src, unsigned int stride,
+		unsigned int width, unsigned int rows)
+{
+	const __m256i prime = _mm256_set1_epi32(KERNEL_HASH_PRIME);
+	uint32_t lanes[KERNEL_HASH_LANES];
+	uint64_t h = 0xcbf29ce484222325ull;
+	const uint8_t *s;
+	unsigned int r, x, i;
+	__m256i v[2];
+
+	for (r = 0; r < rows; r++) {
+		s = src + r * stride;
+		for (i = 0; i < 2; i++)
+			v[i] = _mm256_setr_epi32(HASH_INIT(8 * i),
+					HASH_INIT(8 * i + 1),
+					HASH_INIT(8 * i + 2),
+					HASH_INIT(8 * i + 3),
+					HASH_INIT(8 * i + 4),
+					HASH_INIT(8 * i + 5),
+					HASH_INIT(8 * i + 6),
+					HASH_INIT(8 * i + 7));
+		for (x = 0; x + 64 <= width; x += 64)
+			for (i = 0; i < 2; i++)
+				v[i] = _mm256_mullo_epi32(_mm256_xor_si256(v[i],
+						_mm256_loadu_si256((const __m256i *)
+							(s + x + 32 * i))),
+						prime);
+		for (i = 0; i < 2; i++)
+			_mm256_storeu_si256((__m256i *)&lanes[8 * i], v[i]);
+		h = kernel_hash_finish(lanes, s + x, width - x, h);
+	}
+
+	return h;
+}
+
+AVX512 static uint64_t avx512_hash(const uint8_t *src, unsigned int stride,
+		unsigned int width, unsigned int rows)
+{
+	const __m512i prime = _mm512_set1_epi32(KERNEL_HASH_PRIME);
+	uint32_t lanes[KERNEL_HASH_LANES], init[KERNEL_HASH_LANES];
+	uint64_t h = 0xcbf29ce484222325ull;
+	const uint8_t *s;
+	unsigned int r, x, i;
+	__m512i v;
+
+	for (i = 0; i < KERNEL_HASH_LANES; i++)
+		init[i] = HASH_INIT(i);
+
+	for (r = 0; r < rows; r++) {
+		s = src + r * stride;
+		v = _mm512_loadu_si512(init);
+		for (x = 0; x + 64 <= width; x += 64)
+			v = _mm512_mullo_epi32(_mm512_xor_si512(v,
+					_mm512_loadu_si512(s + x)), prime);
+		_mm512_storeu_si512(lanes, v);
+		h = kernel_hash_finish(lanes, s + x, width - x, h);
+	}
+
+	return h;
+}
+
+/*
+ * stats: bytes other than every step-th are masked to 0, which adds nothing
+ * to any sum. sad against zero sums bytes, squares are multiply-added in 32
+ * bit lanes which are folded every row, before they could overflow.
+ */
+
+static void tail_stats(const uint8_t *s, const uint8_t *p, unsigned int x,
+		unsigned int width, unsigned int step, struct kernel_stats *st)
+{
+	for (; x < width; x += step) {
+		st->sum += s[x];
+		st->sumsq += s[x] * s[x];
+		st->sad += s[x] > p[x] ? s[x] - p[x] : p[x] - s[x];
+	}
+}
+
+#define DEFINE_STATS(name, attr, vec, n, pre)				\
+attr static void name(const uint8_t *src, const uint8_t *ref,		\
+		unsigned int stride, unsigned int width, unsigned int rows,\
+		unsigned int step, struct kernel_stats *st)		\
+{									\
+	const vec zero = pre##_setzero_si##n();				\
+	const vec mask = step == 1 ? pre##_set1_epi8(-1) :		\
+		step == 2 ? pre##_set1_epi16(0xff) :			\
+		pre##_set1_epi32(0xff);					\
+	uint64_t sum[sizeof(vec) / 8], sad[sizeof(vec) / 8];		\
+	uint32_t sq[sizeof(vec) / 4];					\
+	vec vsum = zero, vsad = zero, vsq, a, b;			\
+	const uint8_t *s, *p;						\
+	unsigned int r, x, i;						\
+									\
+	for (r = 0; r < rows; r++) {					\
+		s = src + r * stride;					\
+		p = ref + r * stride;					\
+		vsq = zero;						\
+		for (x = 0; x + sizeof(vec) <= width; x += sizeof(vec)) {\
+			a = pre##_and_si##n(pre##_loadu_si##n(		\
+					(const void *)(s + x)), mask);	\
+			b = pre##_and_si##n(pre##_loadu_si##n(		\
+					(const void *)(p + x)), mask);	\
+			vsum = pre##_add_epi64(vsum, pre##_sad_epu8(a, zero));\
+			vsad = pre##_add_epi64(vsad, pre##_sad_epu8(a, b));\
+			a = pre##_add_epi32(				\
+				pre##_madd_epi16(pre##_unpacklo_epi8(a, zero),\
+					pre##_unpacklo_epi8(a, zero)),	\
+				pre##_madd_epi16(pre##_unpackhi_epi8(a, zero),\
+					pre##_unpackhi_epi8(a, zero)));	\
+			vsq = pre##_add_epi32(vsq, a);			\
+		}							\
+		pre##_storeu_si##n((void *)sq, vsq);			\
+		for (i = 0; i < sizeof(vec) / 4; i++)			\
+			st->sumsq += sq[i];				\
+		tail_stats(s, p, x, width, step, st);			\
+	}								\
+	pre##_storeu_si##n((void *)sum, vsum);				\
+	pre##_storeu_si##n((void *)sad, vsad);				\
+	for (i = 0; i < sizeof(vec) / 8; i++) {				\
+		st->sum += sum[i];					\
+		st->sad += sad[i];					\
+	}								\
+}
+
+DEFINE_STATS(sse2_stats, SSE2, __m128i, 128, _mm)
+DEFINE_STATS(avx2_stats, AVX2, __m256i, 256, _mm256)
+DEFINE_STATS(avx512_stats, AVX512, __m512i, 512, _mm512)
+
+/*
+ * remap: a gather of the 4 bytes at each offset of both rows, pixel pairs
+ * spread into 16 bit halves and multiply-added with the pair of horizontal
+ * weights, then the vertical blend in 32 bit. chroma pairs are every other
+ * byte, so they're just masked.
+ */
+
+AVX2 static inline __m256i avx2_remap_blend(__m256i t, __m256i b,
+		__m256i wx, __m256i fy)
+{
+	const __m256i k256 = _mm256_set1_epi32(256);
+
+	t = _mm256_madd_epi16(t, wx);
+	b = _mm256_madd_epi16(b, wx);
+	t = _mm256_add_epi32(_mm256_mullo_epi32(t, _mm256_sub_epi32(k256, fy)),
+			_mm256_mullo_epi32(b, fy));
+	return _mm256_srli_epi32(_mm256_add_epi32(t,
+				_mm256_set1_epi32(32768)), 16);
+}
+
+AVX2 static void avx2_remap(uint8_t *dst, unsigned int dst_stride,
+		const uint8_t *src, unsigned int src_stride,
+		const uint32_t *offset, const uint16_t *weight,
+		unsigned int lut_stride, unsigned int width, unsigned int rows,
+		unsigned int bpp)
+{
+	const __m256i lo = _mm256_set1_epi32(0xff);
+	const __m256i even = _mm256_set1_epi32(0x00ff00ff);
+	const __m256i k256 = _mm256_set1_epi32(256);
+	const int *s0 = (const int *)src;
+	const int *s1 = (const int *)(src + src_stride);
+	const uint32_t *o;
+	const uint16_t *w;
+	__m256i idx, t, b, wv, fx, fy, wx, u, v;
+	__m128i p;
+	uint8_t *d;
+	unsigned int r, x;
+
+	for (r = 0; r < rows; r++) {
+		d = dst + r * dst_stride;
+		o = offset + r * lut_stride;
+		w = weight + r * lut_stride;
+		for (x = 0; x + 8 <= width; x += 8) {
+			idx = _mm256_loadu_si256((const __m256i *)(o + x));
+			t = _mm256_i32gather_epi32(s0, idx, 1);
+			b = _mm256_i32gather_epi32(s1, idx, 1);
+			wv = _mm256_cvtepu16_epi32(_mm_loadu_si128(
+						(const __m128i *)(w + x)));
+			fx = _mm256_and_si256(wv, lo);
+			fy = _mm256_srli_epi32(wv, 8);
+			wx = _mm256_or_si256(_mm256_sub_epi32(k256, fx),
+					_mm256_slli_epi32(fx, 16));
+			if (bpp == 1) {
+				/* bytes 0 and 1 into the 16 bit halves */
+				t = _mm256_or_si256(_mm256_and_si256(t, lo),
+					_mm256_slli_epi32(_mm256_and_si256(t,
+						_mm256_set1_epi32(0xff00)), 8));
+				b = _mm256_or_si256(_mm256_and_si256(b, lo),
+					_mm256_slli_epi32(_mm256_and_si256(b,
+						_mm256_set1_epi32(0xff00)), 8));
+				u = avx2_remap_blend(t, b, wx, fy);
+				u = _mm256_packus_epi32(u, u);
+				p = _mm256_castsi256_si128(
+					_mm256_permute4x64_epi64(u, 0x08));
+				_mm_storel_epi64((__m128i *)(d + x),
+						_mm_packus_epi16(p, p));
+			} else {
+				u = avx2_remap_blend(_mm256_and_si256(t, even),
+					_mm256_and_si256(b, even), wx, fy);
+				v = avx2_remap_blend(_mm256_and_si256(
+						_mm256_srli_epi32(t, 8), even),
+					_mm256_and_si256(
+						_mm256_srli_epi32(b, 8), even),
+					wx, fy);
+				u = _mm256_or_si256(u, _mm256_slli_epi32(v, 8));
+				u = _mm256_packus_epi32(u, u);
+				_mm_storeu_si128((__m128i *)(d + 2 * x),
+					_mm256_castsi256_si128(
+					_mm256_permute4x64_epi64(u, 0x08)));
+			}
+		}
+		kernel_remap_row(d, src, src_stride, o, w, x, width, bpp);
+	}
+}
+
+/*
+ * 3d lut: positions, cells and the tetrahedron of 8 pixels in 32 bit lanes
+ * without branches, the 4 nodes of each gathered, and the 10 bit channels
+ * of the nodes weighted in 32 bit.
+ */
+
+AVX2 static inline __m256i avx2_lut3d_channel(const __m256i *v,
+		const __m256i *w, __m128i shift)
+{
+	const __m256i mask = _mm256_set1_epi32(1023);
+	__m256i o = _mm256_setzero_si256();
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		o = _mm256_add_epi32(o, _mm256_mullo_epi32(w[i],
+				_mm256_and_si256(_mm256_srl_epi32(v[i], shift),
+					mask)));
+	return _mm256_srli_epi32(_mm256_add_epi32(o,
+				_mm256_set1_epi32(512)), 10);
+}
+
+AVX2 static void avx2_lut3d(uint8_t *dst, const uint8_t *src,
+		unsigned int n, const struct kernel_lut3d *lut)
+{
+	const unsigned int n1 = lut->size, n2 = n1 * n1;
+	const __m256i ff = _mm256_set1_epi32(0xff);
+	const __m256i scale = _mm256_set1_epi32(lut->scale);
+	const __m256i last = _mm256_set1_epi32(lut->size - 2);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i row = _mm256_set1_epi32(n1);
+	const __m256i plane = _mm256_set1_epi32(n2);
+	const __m256i far = _mm256_set1_epi32(1 + n1 + n2);
+	const __m256i keep = _mm256_set1_epi32(~(0xffu << lut->shift[0] |
+				0xffu << lut->shift[1] |
+				0xffu << lut->shift[2]));
+	const int *nodes = (const int *)lut->nodes;
+	__m256i p, pos, idx[3], f[3], fmax, fmin, fmid, base, smax, smin;
+	__m256i v[4], w[4], out;
+	__m128i sh[3];
+	unsigned int i, c;
+
+	for (c = 0; c < 3; c++)
+		sh[c] = _mm_cvtsi32_si128(lut->shift[c]);
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		p = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+		for (c = 0; c < 3; c++) {
+			pos = _mm256_and_si256(_mm256_srl_epi32(p, sh[c]), ff);
+			pos = _mm256_srli_epi32(_mm256_add_epi32(
+					_mm256_mullo_epi32(pos, scale),
+					_mm256_set1_epi32(128)), 8);
+			idx[c] = _mm256_min_epu32(_mm256_srli_epi32(pos, 8),
+					last);
+			f[c] = _mm256_sub_epi32(pos, _mm256_slli_epi32(idx[c],
+						8));
+		}
+		base = _mm256_add_epi32(idx[0], _mm256_add_epi32(
+				_mm256_mullo_epi32(idx[1], row),
+				_mm256_mullo_epi32(idx[2], plane)));
+		fmax = _mm256_max_epi32(f[0], _mm256_max_epi32(f[1], f[2]));
+		fmin = _mm256_min_epi32(f[0], _mm256_min_epi32(f[1], f[2]));
+		fmid = _mm256_sub_epi32(_mm256_add_epi32(f[0],
+				_mm256_add_epi32(f[1], f[2])),
+				_mm256_add_epi32(fmax, fmin));
+		smax = _mm256_blendv_epi8(plane, row,
+				_mm256_cmpeq_epi32(f[1], fmax));
+		smax = _mm256_blendv_epi8(smax, one,
+				_mm256_cmpeq_epi32(f[0], fmax));
+		smin = _mm256_blendv_epi8(one, row,
+				_mm256_cmpeq_epi32(f[1], fmin));
+		smin = _mm256_blendv_epi8(smin, plane,
+				_mm256_cmpeq_epi32(f[2], fmin));
+
+		v[0] = _mm256_i32gather_epi32(nodes, base, 4);
+		v[1] = _mm256_i32gather_epi32(nodes,
+				_mm256_add_epi32(base, smax), 4);
+		base = _mm256_add_epi32(base, far);
+		v[2] = _mm256_i32gather_epi32(nodes,
+				_mm256_sub_epi32(base, smin), 4);
+		v[3] = _mm256_i32gather_epi32(nodes, base, 4);
+		w[0] = _mm256_sub_epi32(_mm256_set1_epi32(256), fmax);
+		w[1] = _mm256_sub_epi32(fmax, fmid);
+		w[2] = _mm256_sub_epi32(fmid, fmin);
+		w[3] = fmin;
+
+		out = _mm256_and_si256(p, keep);
+		for (c = 0; c < 3; c++)
+			out = _mm256_or_si256(out, _mm256_sll_epi32(
+					avx2_lut3d_channel(v, w,
+						_mm_cvtsi32_si128(10 * c)),
+					sh[c]));
+		_mm256_storeu_si256((__m256i *)(dst + 4 * i), out);
+	}
+	kernel_lut3d_pixels(dst + 4 * i, src + 4 * i, n - i, lut);
+}
+
+const struct kernel_ops kernel_sse2_ops = {
+	.copy		= sse2_copy,
+	.yuyv_to_nv12	= sse2_yuyv_to_nv12,
+	.downscale2x	= sse2_downscale2x,
+	.blend		= sse2_blend,
+	.stats		= sse2_stats,
+};
+
+const struct kernel_ops kernel_sse41_ops = {
+	.hash		= sse41_hash,
+};
+
+const struct kernel_ops kernel_avx2_ops = {
+	.copy		= avx2_copy,
+	.yuyv_to_nv12	= avx2_yuyv_to_nv12,
+	.downscale2x	= avx2_downscale2x,
+	.blend		= avx2_blend,
+	.hash		= avx2_hash,
+	.stats		= avx2_stats,
+	.remap		= avx2_remap,
+	.lut3d		= avx2_lut3d,
+};
+
+const struct kernel_ops kernel_avx512_ops = {
+	.copy		= avx512_copy,
+	.blend		= avx512_blend,
+	.hash		= avx512_hash,
+	.stats		= avx512_stats,
+};
+
+#endif /* __x86_64__ || __i386__ */
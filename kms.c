@@ -0,0 +1,543 @@
+/*
+ * DRM/KMS display sink
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * The output of a stream can be a DRM device instead of a V4L2 output
+ * node. The dmabufs of the input are imported as framebuffers(PRIME and
+ * ADDFB2) and shown on a plane with atomic commits. A frame is committed
+ * only after the flip of the previous one, so the display paces on vblank
+ * with the latest frame waiting for the next flip, and a frame goes back to
+ * the input once the next one is on screen.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "bridge_priv.h"
+
+/* v4l2 pixel formats of drm formats */
+static const struct {
+	unsigned int v4l2;
+	uint32_t drm;
+} kms_formats[] = {
+	{V4L2_PIX_FMT_YUYV, DRM_FORMAT_YUYV},
+	{V4L2_PIX_FMT_UYVY, DRM_FORMAT_UYVY},
+	{V4L2_PIX_FMT_NV12, DRM_FORMAT_NV12},
+	{V4L2_PIX_FMT_NV12M, DRM_FORMAT_NV12},
+	{V4L2_PIX_FMT_NV16, DRM_FORMAT_NV16},
+	{V4L2_PIX_FMT_NV16M, DRM_FORMAT_NV16},
+	{V4L2_PIX_FMT_XBGR32, DRM_FORMAT_XRGB8888},
+	{V4L2_PIX_FMT_ABGR32, DRM_FORMAT_ARGB8888},
+	{V4L2_PIX_FMT_XRGB32, DRM_FORMAT_BGRX8888},
+	{V4L2_PIX_FMT_RGB565, DRM_FORMAT_RGB565},
+};
+
+/* names of properties, in order of enum kms_prop */
+static const struct {
+	const char *name;
+	uint32_t type;
+} kms_props[KMS_NUM_PROPS] = {
+	[KMS_PLANE_FB_ID] = {"FB_ID", DRM_MODE_OBJECT_PLANE},
+	[KMS_PLANE_CRTC_ID] = {"CRTC_ID", DRM_MODE_OBJECT_PLANE},
+	[KMS_PLANE_SRC_X] = {"SRC_X", DRM_MODE_OBJECT_PLANE},
+	[KMS_PLANE_SRC_Y] = {"SRC_Y", DRM_MODE_OBJECT_PLANE},
+	[KMS_PLANE_SRC_W] = {"SRC_W", DRM_MODE_OBJECT_PLANE},
+	[KMS_PLANE_SRC_H] = {"SRC_H", DRM_MODE_OBJECT_PLANE},
+	[KMS_PLANE_CRTC_X] = {"CRTC_X", DRM_MODE_OBJECT_PLANE},
+	[KMS_PLANE_CRTC_Y] = {"CRTC_Y", DRM_MODE_OBJECT_PLANE},
+	[KMS_PLANE_CRTC_W] = {"CRTC_W", DRM_MODE_OBJECT_PLANE},
+	[KMS_PLANE_CRTC_H] = {"CRTC_H", DRM_MODE_OBJECT_PLANE},
+	[KMS_CRTC_MODE_ID] = {"MODE_ID", DRM_MODE_OBJECT_CRTC},
+	[KMS_CRTC_ACTIVE] = {"ACTIVE", DRM_MODE_OBJECT_CRTC},
+	[KMS_CONN_CRTC_ID] = {"CRTC_ID", DRM_MODE_OBJECT_CONNECTOR},
+};
+
+/* parse kms args(/dev/dri/cardN[,plane=id][,connector=id]) */
+int kms_parse_args(struct kms *k, const char *arg)
+{
+	char spec[64], *opt, *save, *e;
+
+	if (strlen(arg) >= sizeof(spec))
+		return -1;
+	strcpy(spec, arg);
+
+	opt = strtok_r(spec, ",", &save);
+	if (strlen(opt) >= sizeof(k->path))
+		return -1;
+	strcpy(k->path, opt);
+
+	while ((opt = strtok_r(NULL, ",", &save))) {
+		if (!strncmp(opt, "plane=", 6))
+			k->plane_id = strtoul(opt + 6, &e, 0);
+		else if (!strncmp(opt, "connector=", 10))
+			k->connector_id = strtoul(opt + 10, &e, 0);
+		else
+			return -1;
+		if (*e)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* drm fourcc of v4l2 pixel format, 0 if none */
+uint32_t kms_format(unsigned int fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(kms_formats) / sizeof(kms_formats[0]); i++)
+		if (kms_formats[i].v4l2 == fourcc)
+			return kms_formats[i].drm;
+	return 0;
+}
+
+/* property of object by name, 0 if it has none */
+uint32_t kms_prop(int fd, uint32_t obj, uint32_t type,
+		const char *name, uint64_t *value)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	uint32_t id = 0;
+	unsigned int i;
+
+	props = drmModeObjectGetProperties(fd, obj, type);
+	if (!props)
+		return 0;
+	for (i = 0; i < props->count_props && !id; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+		if (!strcmp(prop->name, name)) {
+			id = prop->prop_id;
+			if (value)
+				*value = props->prop_values[i];
+		}
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	return id;
+}
+
+/* open drm device for atomic modesetting(and writeback connectors) */
+int kms_open(const char *path, bool writeback)
+{
+	int fd;
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	ASSERT(fd < 0, "failed to open %s: %s\n", path, ERRSTR);
+	ASSERT(drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) ||
+		drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1),
+		"%s doesn't support atomic modesetting\n", path);
+	ASSERT(writeback &&
+		drmSetClientCap(fd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1),
+		"%s doesn't support writeback connectors\n", path);
+
+	return fd;
+}
+
+/* connected connector(or the given one), its crtc and preferred mode */
+static void kms_find_pipe(struct device *d)
+{
+	struct kms *k = d->kms;
+	drmModeResPtr res;
+	drmModeConnectorPtr conn = NULL;
+	drmModeEncoderPtr enc;
+	drmModeModeInfoPtr mode;
+	unsigned int i, j;
+	int ret;
+
+	res = drmModeGetResources(d->fd);
+	ASSERT(!res, "%s has no kms resources\n", k->path);
+
+	for (i = 0; i < res->count_connectors; i++) {
+		conn = drmModeGetConnector(d->fd, res->connectors[i]);
+		if (!conn)
+			continue;
+		if (k->connector_id ? conn->connector_id == k->connector_id :
+				conn->connection == DRM_MODE_CONNECTED &&
+				conn->count_modes)
+			break;
+		drmModeFreeConnector(conn);
+		conn = NULL;
+	}
+	ASSERT(!conn || !conn->count_modes, "no connected connector on %s\n",
+			k->path);
+	k->connector_id = conn->connector_id;
+
+	mode = &conn->modes[0];
+	for (i = 0; i < conn->count_modes; i++)
+		if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED)
+			mode = &conn->modes[i];
+	k->mode_w = mode->hdisplay;
+	k->mode_h = mode->vdisplay;
+	k->mode_hz = mode->vrefresh;
+	ret = drmModeCreatePropertyBlob(d->fd, mode, sizeof(*mode),
+			&k->mode_blob);
+	ASSERT(ret < 0, "failed to create mode blob: %s\n", ERRSTR);
+
+	/* crtc of current encoder, or the first possible one */
+	k->crtc_id = 0;
+	enc = conn->encoder_id ? drmModeGetEncoder(d->fd, conn->encoder_id) :
+		NULL;
+	if (enc) {
+		k->crtc_id = enc->crtc_id;
+		drmModeFreeEncoder(enc);
+	}
+	for (i = 0; i < conn->count_encoders && !k->crtc_id; i++) {
+		enc = drmModeGetEncoder(d->fd, conn->encoders[i]);
+		if (!enc)
+			continue;
+		for (j = 0; j < res->count_crtcs; j++)
+			if (enc->possible_crtcs & (1 << j)) {
+				k->crtc_id = res->crtcs[j];
+				break;
+			}
+		drmModeFreeEncoder(enc);
+	}
+	ASSERT(!k->crtc_id, "no crtc for connector %u\n", k->connector_id);
+	for (i = 0; i < res->count_crtcs; i++)
+		if (res->crtcs[i] == k->crtc_id)
+			k->crtc_index = i;
+
+	drmModeFreeConnector(conn);
+	drmModeFreeResources(res);
+}
+
+/* plane of crtc which takes format, primary ones first(or the given one) */
+static void kms_find_plane(struct device *d)
+{
+	struct kms *k = d->kms;
+	drmModePlaneResPtr res;
+	drmModePlanePtr plane;
+	uint64_t type = DRM_PLANE_TYPE_OVERLAY;
+	uint32_t found = 0;
+	unsigned int i, j;
+
+	res = drmModeGetPlaneResources(d->fd);
+	ASSERT(!res, "%s has no planes\n", k->path);
+
+	for (i = 0; i < res->count_planes; i++) {
+		plane = drmModeGetPlane(d->fd, res->planes[i]);
+		if (!plane)
+			continue;
+		if ((k->plane_id && plane->plane_id != k->plane_id) ||
+				!(plane->possible_crtcs & (1 << k->crtc_index))) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+		for (j = 0; j < plane->count_formats; j++)
+			if (plane->formats[j] == k->format)
+				break;
+		if (j < plane->count_formats) {
+			type = DRM_PLANE_TYPE_OVERLAY;
+			kms_prop(d->fd, plane->plane_id, DRM_MODE_OBJECT_PLANE,
+					"type", &type);
+			if (!found || type == DRM_PLANE_TYPE_PRIMARY)
+				found = plane->plane_id;
+		}
+		drmModeFreePlane(plane);
+		if (found && type == DRM_PLANE_TYPE_PRIMARY)
+			break;
+	}
+	drmModeFreePlaneResources(res);
+
+	ASSERT(!found, "no plane of crtc %u takes %.4s\n", k->crtc_id,
+			(char *)&k->format);
+	k->plane_id = found;
+}
+
+/* open device, and find the pipe and plane showing frames of config */
+void kms_init(struct device *d, struct config *c)
+{
+	struct kms *k = d->kms;
+	uint32_t obj;
+	unsigned int i;
+
+	timing_begin(d->timing, PHASE_OPEN);
+	d->fd = kms_open(k->path, false);
+	timing_end(d->timing, PHASE_OPEN);
+	d->type = V4L2_CAP_VIDEO_OUTPUT;
+	d->num_planes = c->num_planes;
+
+	k->format = kms_format(c->fourcc);
+	ASSERT(!k->format, "%.4s can't be displayed\n", (char *)&c->fourcc);
+	k->config = *c;
+
+	timing_begin(d->timing, PHASE_FORMAT);
+	kms_find_pipe(d);
+	kms_find_plane(d);
+	for (i = 0; i < KMS_NUM_PROPS; i++) {
+		obj = kms_props[i].type == DRM_MODE_OBJECT_PLANE ?
+			k->plane_id : kms_props[i].type == DRM_MODE_OBJECT_CRTC ?
+			k->crtc_id : k->connector_id;
+		k->props[i] = kms_prop(d->fd, obj, kms_props[i].type,
+				kms_props[i].name, NULL);
+		ASSERT(!k->props[i], "no property %s of object %u\n",
+				kms_props[i].name, obj);
+	}
+	timing_end(d->timing, PHASE_FORMAT);
+
+	/* centered, scaled down to fit the mode if larger */
+	k->w = c->format.width;
+	k->h = c->format.height;
+	if (k->w > k->mode_w || k->h > k->mode_h) {
+		if ((uint64_t)k->w * k->mode_h > (uint64_t)k->h * k->mode_w) {
+			k->h = (uint64_t)k->h * k->mode_w / k->w;
+			k->w = k->mode_w;
+		} else {
+			k->w = (uint64_t)k->w * k->mode_h / k->h;
+			k->h = k->mode_h;
+		}
+	}
+	k->x = (k->mode_w - k->w) / 2;
+	k->y = (k->mode_h - k->h) / 2;
+
+	k->fbs = calloc(c->num_buffers, sizeof(*k->fbs));
+	ASSERT(!k->fbs, "failed to allocate framebuffers\n");
+	k->num_fbs = c->num_buffers;
+	pthread_mutex_init(&k->lock, NULL);
+	k->lat_min = UINT64_MAX;
+
+	printf("kms: %s connector %u crtc %u plane %u, %ux%u@%u, "
+		"%ux%u+%d+%d\n", k->path, k->connector_id, k->crtc_id,
+		k->plane_id, k->mode_w, k->mode_h, k->mode_hz, k->w, k->h,
+		k->x, k->y);
+}
+
+/* import dmabufs of buffer as a framebuffer */
+void kms_import(struct device *d, struct buffer *b)
+{
+	struct kms *k = d->kms;
+	struct kms_fb *fb = &k->fbs[b->index];
+	uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < k->config.num_planes; i++) {
+		ret = drmPrimeFDToHandle(d->fd, b->dbuf_fd[i], &fb->handles[i]);
+		ASSERT(ret < 0, "failed to import dmabuf: %s\n", ERRSTR);
+		handles[i] = fb->handles[i];
+		pitches[i] = k->config.planes[i].bytesperline;
+	}
+
+	/* chroma follows luma in a single plane buffer */
+	if (k->config.num_planes == 1 &&
+			(k->format == DRM_FORMAT_NV12 ||
+			 k->format == DRM_FORMAT_NV16)) {
+		handles[1] = handles[0];
+		pitches[1] = pitches[0];
+		offsets[1] = pitches[0] * k->config.format.height;
+	}
+
+	ret = drmModeAddFB2(d->fd, k->config.format.width,
+			k->config.format.height, k->format, handles, pitches,
+			offsets, &fb->fb_id, 0);
+	ASSERT(ret < 0, "ADDFB2 failed: %s\n", ERRSTR);
+}
+
+/* remove framebuffers and close device */
+void kms_exit(struct device *d)
+{
+	struct kms *k = d->kms;
+	struct drm_gem_close gc;
+	unsigned int i, j;
+
+	for (i = 0; i < k->num_fbs; i++) {
+		if (k->fbs[i].fb_id)
+			drmModeRmFB(d->fd, k->fbs[i].fb_id);
+		for (j = 0; j < k->config.num_planes; j++) {
+			if (!k->fbs[i].handles[j])
+				continue;
+			memset(&gc, 0, sizeof(gc));
+			gc.handle = k->fbs[i].handles[j];
+			drmIoctl(d->fd, DRM_IOCTL_GEM_CLOSE, &gc);
+		}
+	}
+	free(k->fbs);
+	k->fbs = NULL;
+	k->num_fbs = 0;
+	if (k->mode_blob)
+		drmModeDestroyPropertyBlob(d->fd, k->mode_blob);
+	k->mode_blob = 0;
+	pthread_mutex_destroy(&k->lock);
+	close(d->fd);
+}
+
+/* commit framebuffer of buffer(or none to disable), with lock held */
+static void kms_commit(struct device *d, struct buffer *b, bool nonblock)
+{
+	struct kms *k = d->kms;
+	drmModeAtomicReqPtr req;
+	uint32_t flags = 0;
+	int ret;
+
+	req = drmModeAtomicAlloc();
+	ASSERT(!req, "failed to allocate atomic request\n");
+
+	if (k->modeset) {
+		drmModeAtomicAddProperty(req, k->connector_id,
+				k->props[KMS_CONN_CRTC_ID], k->crtc_id);
+		drmModeAtomicAddProperty(req, k->crtc_id,
+				k->props[KMS_CRTC_MODE_ID], k->mode_blob);
+		drmModeAtomicAddProperty(req, k->crtc_id,
+				k->props[KMS_CRTC_ACTIVE], 1);
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+#define PLANE(p, v) \
+	drmModeAtomicAddProperty(req, k->plane_id, k->props[KMS_PLANE_##p], v)
+	PLANE(FB_ID, b ? k->fbs[b->index].fb_id : 0);
+	PLANE(CRTC_ID, b ? k->crtc_id : 0);
+	/* source in 16.16 fixed point */
+	PLANE(SRC_X, 0);
+	PLANE(SRC_Y, 0);
+	PLANE(SRC_W, (uint64_t)k->config.format.width << 16);
+	PLANE(SRC_H, (uint64_t)k->config.format.height << 16);
+	PLANE(CRTC_X, k->x);
+	PLANE(CRTC_Y, k->y);
+	PLANE(CRTC_W, k->w);
+	PLANE(CRTC_H, k->h);
+#undef PLANE
+
+	if (nonblock)
+		flags |= DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+	ret = drmModeAtomicCommit(d->fd, req, flags, d);
+	drmModeAtomicFree(req);
+	ASSERT(ret < 0, "atomic commit failed: %s\n", ERRSTR);
+	k->modeset = false;
+}
+
+void kms_on(struct device *d)
+{
+	struct kms *k = d->kms;
+
+	/* the pipe is set up with the first frame */
+	k->modeset = true;
+	k->shown = NULL;
+	k->flipping = NULL;
+	k->next = NULL;
+}
+
+void kms_off(struct device *d)
+{
+	struct kms *k = d->kms;
+
+	pthread_mutex_lock(&k->lock);
+	if (k->shown || k->flipping)
+		kms_commit(d, NULL, false);
+	k->shown = NULL;
+	k->flipping = NULL;
+	k->next = NULL;
+	pthread_mutex_unlock(&k->lock);
+}
+
+/* show buffer at the next vblank, or after the pending flip. returns the
+ * buffer it replaced, which goes back to the input */
+struct buffer *kms_queue(struct device *d, struct buffer *b)
+{
+	struct kms *k = d->kms;
+	struct buffer *dropped = NULL;
+
+	k->fbs[b->index].queued_ns = timing_now();
+
+	pthread_mutex_lock(&k->lock);
+	if (!k->flipping) {
+		kms_commit(d, b, true);
+		k->flipping = b;
+		k->chained = false;
+	} else {
+		dropped = k->next;
+		k->next = b;
+		if (dropped)
+			k->dropped++;
+	}
+	pthread_mutex_unlock(&k->lock);
+
+	return dropped;
+}
+
+static void kms_page_flip(int fd, unsigned int sequence, unsigned int tv_sec,
+		unsigned int tv_usec, void *user_data)
+{
+	struct kms *k = ((struct device *)user_data)->kms;
+
+	k->flip_seq = sequence;
+	k->flip_ns = (uint64_t)tv_sec * 1000000000ull + tv_usec * 1000ull;
+	k->flipped = true;
+}
+
+/* handle flip event, and commit the waiting frame. returns the buffer which
+ * left the screen, which goes back to the input */
+struct buffer *kms_flipped(struct device *d)
+{
+	struct kms *k = d->kms;
+	drmEventContext ev = {
+		.version = 2,
+		.page_flip_handler = kms_page_flip,
+	};
+	struct buffer *prev;
+	uint64_t lat;
+
+	drmHandleEvent(d->fd, &ev);
+
+	pthread_mutex_lock(&k->lock);
+	if (!k->flipped || !k->flipping) {
+		pthread_mutex_unlock(&k->lock);
+		return NULL;
+	}
+	k->flipped = false;
+
+	/* latency from forward to scanout */
+	lat = k->flip_ns - k->fbs[k->flipping->index].queued_ns;
+	k->flips++;
+	k->lat_ns += lat;
+	if (lat < k->lat_min)
+		k->lat_min = lat;
+	if (lat > k->lat_max)
+		k->lat_max = lat;
+	/* committed at the last flip, it should land on the next vblank */
+	if (k->chained && k->flip_seq > k->last_seq + 1)
+		k->missed += k->flip_seq - k->last_seq - 1;
+	k->last_seq = k->flip_seq;
+
+	prev = k->shown;
+	k->shown = k->flipping;
+	k->flipping = NULL;
+	if (k->next) {
+		kms_commit(d, k->next, true);
+		k->flipping = k->next;
+		k->next = NULL;
+		k->chained = true;
+	}
+	pthread_mutex_unlock(&k->lock);
+
+	return prev;
+}
+
+/* dump stats of kms sink */
+void kms_dump_stats(struct kms *k, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s kms plane %u flips %llu dropped %llu missed_vblanks "
+			"%llu latency_us min %.1f avg %.1f max %.1f\n", who,
+			k->plane_id, (unsigned long long)k->flips,
+			(unsigned long long)k->dropped,
+			(unsigned long long)k->missed,
+			k->flips ? k->lat_min / 1000.0 : 0,
+			k->flips ? k->lat_ns / 1000.0 / k->flips : 0,
+			k->lat_max / 1000.0);
+}
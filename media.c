@@ -0,0 +1,535 @@
+/*
+ * Media controller graph setup of a stream
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * A stream config can start with the media graph its pipelines need, in
+ * the syntax of media-ctl:
+ *
+ * {/dev/media0;reset;"src":0->"sink":0[1];"ent":0[fmt:CODE/WxH crop:(l,t)/WxH]}
+ *
+ * links are set up with MEDIA_IOC_SETUP_LINK and pad formats with
+ * VIDIOC_SUBDEV_S_FMT(propagated to linked sink pads) and
+ * VIDIOC_SUBDEV_S_SELECTION, in the given order and before the video nodes
+ * are opened. The format of the pad feeding the input video node is then
+ * checked against the format of the video node.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+#include <linux/media-bus-format.h>
+
+#include "bridge_priv.h"
+
+/* entity of graph */
+struct media_ent {
+	struct media_entity_desc desc;	/* entity */
+	struct media_pad_desc *pads;	/* pads */
+	struct media_link_desc *links;	/* outbound links */
+	int fd;				/* subdev(-1: not open, -2: none) */
+};
+
+/* media bus format, and pixel format of video nodes for it(0: any) */
+struct media_bus_format {
+	const char *name;
+	unsigned int code;
+	unsigned int fourcc;
+};
+
+#define BUS_FMT(name, fourcc)	{ #name, MEDIA_BUS_FMT_##name, fourcc }
+
+static const struct media_bus_format media_bus_formats[] = {
+	BUS_FMT(UYVY8_2X8, V4L2_PIX_FMT_UYVY),
+	BUS_FMT(VYUY8_2X8, V4L2_PIX_FMT_VYUY),
+	BUS_FMT(YUYV8_2X8, V4L2_PIX_FMT_YUYV),
+	BUS_FMT(YVYU8_2X8, V4L2_PIX_FMT_YVYU),
+	BUS_FMT(UYVY8_1X16, V4L2_PIX_FMT_UYVY),
+	BUS_FMT(VYUY8_1X16, V4L2_PIX_FMT_VYUY),
+	BUS_FMT(YUYV8_1X16, V4L2_PIX_FMT_YUYV),
+	BUS_FMT(YVYU8_1X16, V4L2_PIX_FMT_YVYU),
+	BUS_FMT(VUY8_1X24, 0),
+	BUS_FMT(YUV8_1X24, 0),
+	BUS_FMT(RGB565_2X8_LE, V4L2_PIX_FMT_RGB565),
+	BUS_FMT(RGB888_1X24, 0),
+	BUS_FMT(BGR888_1X24, 0),
+	BUS_FMT(RBG888_1X24, 0),
+	BUS_FMT(SBGGR8_1X8, V4L2_PIX_FMT_SBGGR8),
+	BUS_FMT(SGBRG8_1X8, V4L2_PIX_FMT_SGBRG8),
+	BUS_FMT(SGRBG8_1X8, V4L2_PIX_FMT_SGRBG8),
+	BUS_FMT(SRGGB8_1X8, V4L2_PIX_FMT_SRGGB8),
+	BUS_FMT(SBGGR10_1X10, V4L2_PIX_FMT_SBGGR10),
+	BUS_FMT(SGBRG10_1X10, V4L2_PIX_FMT_SGBRG10),
+	BUS_FMT(SGRBG10_1X10, V4L2_PIX_FMT_SGRBG10),
+	BUS_FMT(SRGGB10_1X10, V4L2_PIX_FMT_SRGGB10),
+	BUS_FMT(SBGGR12_1X12, V4L2_PIX_FMT_SBGGR12),
+	BUS_FMT(SGBRG12_1X12, V4L2_PIX_FMT_SGBRG12),
+	BUS_FMT(SGRBG12_1X12, V4L2_PIX_FMT_SGRBG12),
+	BUS_FMT(SRGGB12_1X12, V4L2_PIX_FMT_SRGGB12),
+	BUS_FMT(JPEG_1X8, V4L2_PIX_FMT_JPEG),
+};
+
+static const struct media_bus_format *media_bus_format(unsigned int code)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(media_bus_formats) /
+			sizeof(media_bus_formats[0]); i++)
+		if (media_bus_formats[i].code == code)
+			return &media_bus_formats[i];
+	return NULL;
+}
+
+/*
+ * parsing
+ */
+
+/* parse "entity":pad, the name is quoted with " or ' */
+static const char *media_parse_pad(const char *p, struct media_pad_ref *r)
+{
+	const char *end;
+	char *e;
+
+	if (*p != '"' && *p != '\'')
+		return NULL;
+	end = strchr(p + 1, *p);
+	if (!end || end - p - 1 >= sizeof(r->entity) || end[1] != ':')
+		return NULL;
+	memcpy(r->entity, p + 1, end - p - 1);
+	r->entity[end - p - 1] = '\0';
+
+	r->pad = strtoul(end + 2, &e, 10);
+	return e == end + 2 ? NULL : e;
+}
+
+/* parse CODE/WxH, CODE is a name of MEDIA_BUS_FMT_ or a number */
+static const char *media_parse_fmt(const char *p, struct v4l2_mbus_framefmt *f)
+{
+	char name[32], *e;
+	unsigned int i;
+	int n = 0;
+
+	if (sscanf(p, "%31[^/]/%ux%u%n", name, &f->width, &f->height,
+				&n) != 3 || !n)
+		return NULL;
+
+	f->code = strtoul(name, &e, 0);
+	if (*e) {
+		f->code = 0;
+		for (i = 0; i < sizeof(media_bus_formats) /
+				sizeof(media_bus_formats[0]); i++)
+			if (!strcmp(name, media_bus_formats[i].name))
+				f->code = media_bus_formats[i].code;
+	}
+	f->field = V4L2_FIELD_NONE;
+
+	return f->code ? p + n : NULL;
+}
+
+/* parse (left,top)/WxH */
+static const char *media_parse_rect(const char *p, struct v4l2_rect *r)
+{
+	int n = 0;
+
+	if (sscanf(p, "(%d,%d)/%ux%u%n", &r->left, &r->top, &r->width,
+				&r->height, &n) != 4 || !n || !r->width)
+		return NULL;
+
+	return p + n;
+}
+
+/* parse "src":pad->"sink":pad[flags], or "ent":pad[fmt:.. crop:.. compose:..] */
+static int media_parse_item(struct media_item *it, const char *p)
+{
+	p = media_parse_pad(p, &it->pad);
+	if (!p)
+		return -1;
+
+	if (!strncmp(p, "->", 2)) {
+		it->link = true;
+		p = media_parse_pad(p + 2, &it->sink);
+		if (!p || sscanf(p, "[%u]", &it->flags) != 1)
+			return -1;
+		return 0;
+	}
+
+	if (*p++ != '[')
+		return -1;
+	while (p && *p != ']') {
+		if (*p == ' ')
+			p++;
+		else if (!strncmp(p, "fmt:", 4))
+			p = media_parse_fmt(p + 4, &it->fmt);
+		else if (!strncmp(p, "crop:", 5))
+			p = media_parse_rect(p + 5, &it->crop);
+		else if (!strncmp(p, "compose:", 8))
+			p = media_parse_rect(p + 8, &it->compose);
+		else
+			return -1;
+	}
+
+	return p ? 0 : -1;
+}
+
+/* parse graph(media_dev;item;item...) of len chars */
+int media_parse_args(struct media *md, const char *arg, size_t len)
+{
+	char spec[1024], *item, *save;
+
+	if (len >= sizeof(spec))
+		return -1;
+	memcpy(spec, arg, len);
+	spec[len] = '\0';
+
+	item = strtok_r(spec, ";", &save);
+	if (!item || strlen(item) >= sizeof(md->devname))
+		return -1;
+	strcpy(md->devname, item);
+	md->fd = -1;
+
+	while ((item = strtok_r(NULL, ";", &save))) {
+		if (!strcmp(item, "reset")) {
+			md->reset = true;
+			continue;
+		}
+		if (WARN_ON(md->num_items == MEDIA_MAX_ITEMS,
+					"too many media items\n"))
+			return -1;
+		if (WARN_ON(media_parse_item(&md->items[md->num_items], item),
+					"invalid media item %s\n", item))
+			return -1;
+		md->num_items++;
+	}
+
+	return 0;
+}
+
+/*
+ * graph operations
+ */
+
+/* enumerate entities with their pads and outbound links */
+static void media_enum(struct media *md)
+{
+	struct media_entity_desc desc;
+	struct media_links_enum links;
+	struct media_ent *e;
+	int ret;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.id = MEDIA_ENT_ID_FLAG_NEXT;
+	while (!ioctl(md->fd, MEDIA_IOC_ENUM_ENTITIES, &desc)) {
+		e = realloc(md->ents, sizeof(*e) * (md->num_ents + 1));
+		ASSERT(!e, "failed to allocate entities\n");
+		md->ents = e;
+		e = &md->ents[md->num_ents++];
+		memset(e, 0, sizeof(*e));
+		e->desc = desc;
+		e->fd = -1;
+		e->pads = calloc(desc.pads + 1, sizeof(*e->pads));
+		e->links = calloc(desc.links + 1, sizeof(*e->links));
+		ASSERT(!e->pads || !e->links, "failed to allocate links\n");
+
+		memset(&links, 0, sizeof(links));
+		links.entity = desc.id;
+		links.pads = e->pads;
+		links.links = e->links;
+		ret = ioctl(md->fd, MEDIA_IOC_ENUM_LINKS, &links);
+		ASSERT(ret < 0, "MEDIA_IOC_ENUM_LINKS failed: %s\n", ERRSTR);
+
+		desc.id |= MEDIA_ENT_ID_FLAG_NEXT;
+	}
+}
+
+static struct media_ent *media_find(struct media *md, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < md->num_ents; i++)
+		if (!strcmp(md->ents[i].desc.name, name))
+			return &md->ents[i];
+	ASSERT(1, "media: no entity '%s' in %s\n", name, md->devname);
+	return NULL;
+}
+
+static struct media_ent *media_find_id(struct media *md, unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < md->num_ents; i++)
+		if (md->ents[i].desc.id == id)
+			return &md->ents[i];
+	return NULL;
+}
+
+/* open subdev node of entity, which is found through sysfs */
+static int media_subdev(struct media_ent *e)
+{
+	char path[64], line[64], node[80] = "";
+	FILE *fp;
+
+	if (e->fd != -1)
+		return e->fd;
+	e->fd = -2;
+
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/uevent",
+			e->desc.dev.major, e->desc.dev.minor);
+	fp = fopen(path, "r");
+	if (!fp)
+		return e->fd;
+	while (fgets(line, sizeof(line), fp))
+		if (!strncmp(line, "DEVNAME=", 8))
+			snprintf(node, sizeof(node), "/dev/%.*s",
+					(int)strcspn(line + 8, "\n"), line + 8);
+	fclose(fp);
+	if (strncmp(node, "/dev/v4l-subdev", 15))
+		return e->fd;
+
+	e->fd = open(node, O_RDWR);
+	ASSERT(e->fd < 0, "failed to open %s: %s\n", node, ERRSTR);
+	return e->fd;
+}
+
+static void media_setup_link(struct media *md, struct media_link_desc *l,
+		unsigned int flags)
+{
+	int ret;
+
+	if (l->flags == flags)
+		return;
+	l->flags = flags;
+	ret = ioctl(md->fd, MEDIA_IOC_SETUP_LINK, l);
+	ASSERT(ret < 0, "MEDIA_IOC_SETUP_LINK failed: %s\n", ERRSTR);
+	md->links++;
+}
+
+/* disable all links which can be */
+static void media_reset(struct media *md)
+{
+	struct media_link_desc *l;
+	unsigned int i, j;
+
+	for (i = 0; i < md->num_ents; i++) {
+		for (j = 0; j < md->ents[i].desc.links; j++) {
+			l = &md->ents[i].links[j];
+			if (!(l->flags & MEDIA_LNK_FL_IMMUTABLE))
+				media_setup_link(md, l,
+						l->flags & ~MEDIA_LNK_FL_ENABLED);
+		}
+	}
+}
+
+static void media_link(struct media *md, struct media_item *it)
+{
+	struct media_ent *src, *sink;
+	struct media_link_desc *l;
+	unsigned int i;
+
+	src = media_find(md, it->pad.entity);
+	sink = media_find(md, it->sink.entity);
+	for (i = 0; i < src->desc.links; i++) {
+		l = &src->links[i];
+		if (l->source.index == it->pad.pad &&
+				l->sink.entity == sink->desc.id &&
+				l->sink.index == it->sink.pad)
+			break;
+	}
+	ASSERT(i == src->desc.links, "media: no link '%s':%u->'%s':%u\n",
+			it->pad.entity, it->pad.pad, it->sink.entity,
+			it->sink.pad);
+
+	media_setup_link(md, l, (l->flags & ~MEDIA_LNK_FL_ENABLED) |
+			(it->flags & MEDIA_LNK_FL_ENABLED));
+}
+
+/* set active format of pad, keeping fields which weren't given */
+static void media_set_fmt(struct media *md, struct media_ent *e,
+		unsigned int pad, struct v4l2_mbus_framefmt *fmt)
+{
+	struct v4l2_subdev_format f;
+	int ret;
+
+	memset(&f, 0, sizeof(f));
+	f.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+	f.pad = pad;
+	ret = ioctl(e->fd, VIDIOC_SUBDEV_G_FMT, &f);
+	ASSERT(ret < 0, "VIDIOC_SUBDEV_G_FMT failed: %s\n", ERRSTR);
+
+	f.format.code = fmt->code;
+	f.format.width = fmt->width;
+	f.format.height = fmt->height;
+	f.format.field = fmt->field;
+	ret = ioctl(e->fd, VIDIOC_SUBDEV_S_FMT, &f);
+	ASSERT(ret < 0, "VIDIOC_SUBDEV_S_FMT('%s':%u) failed: %s\n",
+			e->desc.name, pad, ERRSTR);
+	WARN_ON(f.format.code != fmt->code || f.format.width != fmt->width ||
+			f.format.height != fmt->height,
+			"media: '%s':%u adjusted to 0x%x/%ux%u\n", e->desc.name,
+			pad, f.format.code, f.format.width, f.format.height);
+	*fmt = f.format;
+	md->formats++;
+}
+
+static void media_set_selection(struct media_ent *e, unsigned int pad,
+		unsigned int target, struct v4l2_rect *r)
+{
+	struct v4l2_subdev_selection sel;
+	int ret;
+
+	memset(&sel, 0, sizeof(sel));
+	sel.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+	sel.pad = pad;
+	sel.target = target;
+	sel.r = *r;
+	ret = ioctl(e->fd, VIDIOC_SUBDEV_S_SELECTION, &sel);
+	ASSERT(ret < 0, "VIDIOC_SUBDEV_S_SELECTION('%s':%u) failed: %s\n",
+			e->desc.name, pad, ERRSTR);
+	WARN_ON(memcmp(&sel.r, r, sizeof(*r)), "media: '%s':%u selection "
+			"adjusted to (%d,%d)/%ux%u\n", e->desc.name, pad,
+			sel.r.left, sel.r.top, sel.r.width, sel.r.height);
+}
+
+/* set format of pad, and propagate it from a source pad to linked sink
+ * pads as media-ctl does */
+static void media_format(struct media *md, struct media_item *it)
+{
+	struct v4l2_mbus_framefmt fmt = it->fmt;
+	struct media_link_desc *l;
+	struct media_ent *e, *sink;
+	unsigned int i;
+
+	e = media_find(md, it->pad.entity);
+	ASSERT(media_subdev(e) < 0, "media: '%s' isn't a subdev\n",
+			e->desc.name);
+	ASSERT(it->pad.pad >= e->desc.pads, "media: '%s' has no pad %u\n",
+			e->desc.name, it->pad.pad);
+
+	if (it->crop.width)
+		media_set_selection(e, it->pad.pad, V4L2_SEL_TGT_CROP,
+				&it->crop);
+	if (it->compose.width)
+		media_set_selection(e, it->pad.pad, V4L2_SEL_TGT_COMPOSE,
+				&it->compose);
+	if (!fmt.code)
+		return;
+	media_set_fmt(md, e, it->pad.pad, &fmt);
+
+	if (!(e->pads[it->pad.pad].flags & MEDIA_PAD_FL_SOURCE))
+		return;
+	for (i = 0; i < e->desc.links; i++) {
+		l = &e->links[i];
+		if (l->source.index != it->pad.pad ||
+				!(l->flags & MEDIA_LNK_FL_ENABLED))
+			continue;
+		sink = media_find_id(md, l->sink.entity);
+		if (sink && media_subdev(sink) >= 0)
+			media_set_fmt(md, sink, l->sink.index, &fmt);
+	}
+}
+
+/* find the pad which feeds video node over an enabled link, and its format */
+static void media_video_format(struct media *md, const char *video)
+{
+	struct v4l2_subdev_format f;
+	struct media_link_desc *l;
+	struct media_ent *e, *sink;
+	struct stat st;
+	unsigned int i, j;
+
+	if (stat(video, &st) < 0)
+		return;
+
+	for (i = 0; i < md->num_ents; i++) {
+		e = &md->ents[i];
+		for (j = 0; j < e->desc.links; j++) {
+			l = &e->links[j];
+			sink = media_find_id(md, l->sink.entity);
+			if (!sink || !(l->flags & MEDIA_LNK_FL_ENABLED) ||
+					sink->desc.dev.major != major(st.st_rdev) ||
+					sink->desc.dev.minor != minor(st.st_rdev) ||
+					media_subdev(e) < 0)
+				continue;
+
+			memset(&f, 0, sizeof(f));
+			f.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+			f.pad = l->source.index;
+			if (WARN_ON(ioctl(e->fd, VIDIOC_SUBDEV_G_FMT, &f) < 0,
+						"VIDIOC_SUBDEV_G_FMT failed: %s\n",
+						ERRSTR))
+				return;
+			md->video = f.format;
+			snprintf(md->video_src, sizeof(md->video_src),
+					"'%.32s':%u", e->desc.name, f.pad);
+			return;
+		}
+	}
+}
+
+/* set up links and pad formats in order, before video nodes are opened */
+void media_setup(struct media *md, const char *video)
+{
+	struct media_item *it;
+	unsigned int i;
+
+	md->fd = open(md->devname, O_RDWR);
+	ASSERT(md->fd < 0, "failed to open %s: %s\n", md->devname, ERRSTR);
+
+	media_enum(md);
+	if (md->reset)
+		media_reset(md);
+	for (i = 0; i < md->num_items; i++) {
+		it = &md->items[i];
+		if (it->link)
+			media_link(md, it);
+		else
+			media_format(md, it);
+	}
+	media_video_format(md, video);
+
+	printf("media: %s, %u links changed, %u formats set\n", md->devname,
+			md->links, md->formats);
+
+	for (i = 0; i < md->num_ents; i++) {
+		if (md->ents[i].fd >= 0)
+			close(md->ents[i].fd);
+		free(md->ents[i].pads);
+		free(md->ents[i].links);
+	}
+	free(md->ents);
+	md->ents = NULL;
+	md->num_ents = 0;
+	close(md->fd);
+	md->fd = -1;
+}
+
+/* check the format of input video node against the pad feeding it */
+void media_validate(struct media *md, struct config *c)
+{
+	const struct media_bus_format *bf;
+
+	if (!md->video.code)
+		return;
+
+	ASSERT(md->video.width != c->format.width ||
+		md->video.height != c->format.height,
+		"media: %s gives %ux%u, video node takes %ux%u\n",
+		md->video_src, md->video.width, md->video.height,
+		c->format.width, c->format.height);
+
+	bf = media_bus_format(md->video.code);
+	ASSERT(bf && bf->fourcc && bf->fourcc != c->format.pixelformat,
+		"media: %s gives %s, video node takes %.4s\n",
+		md->video_src, bf->name, (char *)&c->format.pixelformat);
+}
@@ -0,0 +1,301 @@
+/*
+ * Metadata capture node companion of a stream
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Sensors and ISPs give per frame metadata(statistics, embedded data) on
+ * a V4L2_BUF_TYPE_META_CAPTURE node next to the video node. Its buffers are
+ * matched to the frames of the input by sequence or timestamp, and the
+ * frame carries the mapping of the matched buffer(bridge_frame.meta) to
+ * callbacks and plugins until it's forwarded or dropped. Buffers which
+ * don't match are kept for a bounded window of frames.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bridge_priv.h"
+
+#define META_WINDOW		4	/* default window */
+#define META_TOLERANCE_US	1000	/* default timestamp difference */
+
+/* parse meta args(dev[,seq|ts[:us]][,window]) which end at the next stage,
+ * returns the length of args */
+int meta_parse_args(struct meta *mt, const char *arg)
+{
+	char spec[128], *opt, *save;
+	unsigned int len;
+	char *e;
+
+	len = strcspn(arg, "+<>");
+	if (!len || len >= sizeof(spec))
+		return -1;
+	memcpy(spec, arg, len);
+	spec[len] = '\0';
+
+	opt = strtok_r(spec, ",", &save);
+	if (!opt || strlen(opt) >= sizeof(mt->devname))
+		return -1;
+	strcpy(mt->devname, opt);
+	mt->fd = -1;
+	mt->window = META_WINDOW;
+	mt->tolerance_us = META_TOLERANCE_US;
+
+	while ((opt = strtok_r(NULL, ",", &save))) {
+		if (!strcmp(opt, "seq")) {
+			mt->by_timestamp = false;
+		} else if (!strcmp(opt, "ts")) {
+			mt->by_timestamp = true;
+		} else if (!strncmp(opt, "ts:", 3)) {
+			mt->by_timestamp = true;
+			mt->tolerance_us = strtoul(opt + 3, &e, 10);
+			if (!opt[3] || *e)
+				return -1;
+		} else {
+			mt->window = strtoul(opt, &e, 10);
+			if (*e || !mt->window)
+				return -1;
+		}
+	}
+
+	return len;
+}
+
+static void meta_queue(struct meta *mt, struct meta_buffer *mb)
+{
+	struct v4l2_buffer vb;
+	int ret;
+
+	memset(&vb, 0, sizeof(vb));
+	vb.type = V4L2_BUF_TYPE_META_CAPTURE;
+	vb.memory = V4L2_MEMORY_MMAP;
+	vb.index = mb->index;
+	ret = ioctl(mt->fd, VIDIOC_QBUF, &vb);
+	ASSERT(ret < 0, "meta VIDIOC_QBUF failed: %s\n", ERRSTR);
+}
+
+/* open node, and map and queue buffers for num_frames frames in flight */
+void meta_init(struct meta *mt, unsigned int num_frames)
+{
+	struct v4l2_capability caps;
+	struct v4l2_requestbuffers rqbufs;
+	struct v4l2_format fmt;
+	struct v4l2_buffer vb;
+	struct meta_buffer *mb;
+	unsigned int dev_caps, i;
+	int ret;
+
+	mt->fd = open(mt->devname, O_RDWR | O_NONBLOCK);
+	ASSERT(mt->fd < 0, "failed to open %s: %s\n", mt->devname, ERRSTR);
+
+	memset(&caps, 0, sizeof(caps));
+	ret = ioctl(mt->fd, VIDIOC_QUERYCAP, &caps);
+	ASSERT(ret < 0, "meta VIDIOC_QUERYCAP failed: %s\n", ERRSTR);
+	dev_caps = caps.capabilities & V4L2_CAP_DEVICE_CAPS ?
+		caps.device_caps : caps.capabilities;
+	ASSERT(!(dev_caps & V4L2_CAP_META_CAPTURE),
+		"%s isn't a metadata capture node\n", mt->devname);
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_META_CAPTURE;
+	ret = ioctl(mt->fd, VIDIOC_G_FMT, &fmt);
+	ASSERT(ret < 0, "meta VIDIOC_G_FMT failed: %s\n", ERRSTR);
+	mt->dataformat = fmt.fmt.meta.dataformat;
+	printf("meta: %s %.4s, buffersize = %u, match by %s\n", mt->devname,
+		(char *)&mt->dataformat, fmt.fmt.meta.buffersize,
+		mt->by_timestamp ? "timestamp" : "sequence");
+
+	/* frames in flight hold one each, and the window the rest */
+	memset(&rqbufs, 0, sizeof(rqbufs));
+	rqbufs.count = num_frames + mt->window;
+	rqbufs.type = V4L2_BUF_TYPE_META_CAPTURE;
+	rqbufs.memory = V4L2_MEMORY_MMAP;
+	ret = ioctl(mt->fd, VIDIOC_REQBUFS, &rqbufs);
+	ASSERT(ret < 0, "meta VIDIOC_REQBUFS failed: %s\n", ERRSTR);
+	ASSERT(!rqbufs.count, "meta allocated no buffers\n");
+
+	mt->num_buffers = rqbufs.count;
+	mt->buffers = calloc(mt->num_buffers, sizeof(*mt->buffers));
+	mt->pending = calloc(mt->window, sizeof(*mt->pending));
+	ASSERT(!mt->buffers || !mt->pending, "failed to allocate meta\n");
+	pthread_mutex_init(&mt->lock, NULL);
+
+	for (i = 0; i < mt->num_buffers; i++) {
+		mb = &mt->buffers[i];
+		memset(&vb, 0, sizeof(vb));
+		vb.type = V4L2_BUF_TYPE_META_CAPTURE;
+		vb.memory = V4L2_MEMORY_MMAP;
+		vb.index = i;
+		ret = ioctl(mt->fd, VIDIOC_QUERYBUF, &vb);
+		ASSERT(ret < 0, "meta VIDIOC_QUERYBUF failed: %s\n", ERRSTR);
+
+		mb->index = i;
+		mb->length = vb.length;
+		mb->data = mmap(NULL, vb.length, PROT_READ, MAP_SHARED,
+				mt->fd, vb.m.offset);
+		ASSERT(mb->data == MAP_FAILED, "failed to map meta buffer: "
+				"%s\n", ERRSTR);
+		meta_queue(mt, mb);
+	}
+}
+
+/* unmap buffers and close node */
+void meta_exit(struct meta *mt)
+{
+	unsigned int i;
+
+	if (mt->fd < 0)
+		return;
+
+	for (i = 0; i < mt->num_buffers; i++)
+		if (mt->buffers[i].data && mt->buffers[i].data != MAP_FAILED)
+			munmap(mt->buffers[i].data, mt->buffers[i].length);
+	free(mt->buffers);
+	mt->buffers = NULL;
+	free(mt->pending);
+	mt->pending = NULL;
+	mt->num_pending = 0;
+	pthread_mutex_destroy(&mt->lock);
+	close(mt->fd);
+	mt->fd = -1;
+}
+
+void meta_on(struct meta *mt)
+{
+	unsigned int type = V4L2_BUF_TYPE_META_CAPTURE;
+	int ret;
+
+	ret = ioctl(mt->fd, VIDIOC_STREAMON, &type);
+	ASSERT(ret < 0, "meta STREAMON failed: %s\n", ERRSTR);
+}
+
+void meta_off(struct meta *mt)
+{
+	unsigned int type = V4L2_BUF_TYPE_META_CAPTURE;
+	int ret;
+
+	ret = ioctl(mt->fd, VIDIOC_STREAMOFF, &type);
+	ASSERT(ret < 0, "meta STREAMOFF failed: %s\n", ERRSTR);
+	mt->num_pending = 0;
+}
+
+/* dequeue all ready buffers to pending, the oldest leaves a full window */
+void meta_dequeue(struct meta *mt)
+{
+	struct meta_buffer *mb;
+	struct v4l2_buffer vb;
+
+	while (1) {
+		memset(&vb, 0, sizeof(vb));
+		vb.type = V4L2_BUF_TYPE_META_CAPTURE;
+		vb.memory = V4L2_MEMORY_MMAP;
+		if (ioctl(mt->fd, VIDIOC_DQBUF, &vb) < 0) {
+			ASSERT(errno != EAGAIN, "meta VIDIOC_DQBUF failed: "
+					"%s\n", ERRSTR);
+			break;
+		}
+
+		mb = &mt->buffers[vb.index];
+		mb->bytesused = vb.bytesused;
+		mb->sequence = vb.sequence;
+		mb->timestamp = vb.timestamp;
+
+		pthread_mutex_lock(&mt->lock);
+		if (mt->num_pending == mt->window) {
+			meta_queue(mt, mt->pending[0]);
+			memmove(mt->pending, mt->pending + 1,
+				--mt->num_pending * sizeof(*mt->pending));
+			mt->expired++;
+		}
+		mt->pending[mt->num_pending++] = mb;
+		pthread_mutex_unlock(&mt->lock);
+	}
+}
+
+static int64_t meta_us(const struct timeval *tv)
+{
+	return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* attach pending metadata of frame to buffer, frames come in order so
+ * older pending ones can't match any more */
+void meta_match(struct meta *mt, struct buffer *b)
+{
+	struct meta_buffer *mb;
+	int64_t diff, best_diff = 0;
+	unsigned int i, best;
+
+	meta_dequeue(mt);
+
+	pthread_mutex_lock(&mt->lock);
+	best = mt->num_pending;
+	for (i = 0; i < mt->num_pending; i++) {
+		mb = mt->pending[i];
+		if (!mt->by_timestamp) {
+			if (mb->sequence == b->frame.sequence) {
+				best = i;
+				break;
+			}
+			continue;
+		}
+		diff = meta_us(&mb->timestamp) - meta_us(&b->frame.timestamp);
+		if (diff < 0)
+			diff = -diff;
+		if (diff <= mt->tolerance_us &&
+				(best == mt->num_pending || diff < best_diff)) {
+			best = i;
+			best_diff = diff;
+		}
+	}
+
+	if (best == mt->num_pending) {
+		mt->unmatched++;
+		pthread_mutex_unlock(&mt->lock);
+		return;
+	}
+
+	for (i = 0; i < best; i++)
+		meta_queue(mt, mt->pending[i]);
+	mt->expired += best;
+	b->meta = mt->pending[best];
+	mt->num_pending -= best + 1;
+	memmove(mt->pending, mt->pending + best + 1,
+			mt->num_pending * sizeof(*mt->pending));
+	mt->matched++;
+	pthread_mutex_unlock(&mt->lock);
+
+	b->frame.meta = b->meta->data;
+	b->frame.meta_size = b->meta->bytesused;
+}
+
+/* give metadata of buffer back to the node */
+void meta_release(struct meta *mt, struct buffer *b)
+{
+	if (!b->meta)
+		return;
+
+	meta_queue(mt, b->meta);
+	b->meta = NULL;
+	b->frame.meta = NULL;
+	b->frame.meta_size = 0;
+}
+
+/* dump stats of metadata node */
+void meta_dump_stats(struct meta *mt, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s meta %.4s matched %llu unmatched %llu expired %llu\n",
+			who, (char *)&mt->dataformat,
+			(unsigned long long)mt->matched,
+			(unsigned long long)mt->unmatched,
+			(unsigned long long)mt->expired);
+}
@@ -0,0 +1,558 @@
+/*
+ * CPU MJPEG decode stage
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * The input device of a stream can capture MJPEG(ex, UVC cameras), which is
+ * decoded with libjpeg(libjpeg-turbo for simd) into the buffers of the output
+ * device. The devices don't share buffers here: both export their own, and
+ * the decoder reads the capture mapping and writes the output mapping. NV12
+ * and YUYV are packed from the planar output of the decoder, and XRGB is
+ * written by the decoder itself, so there is no conversion pass over frames.
+ * Large frames with restart markers are split into slices run on workers.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <linux/dma-buf.h>
+
+#include <jpeglib.h>
+
+#include "bridge_priv.h"
+
+#define MJPEG_SLICE_MIN_LINES	720	/* split frames of these lines or more */
+#define MJPEG_MAX_SLICES	8
+
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+/* libjpeg errors return to the caller instead of exit() */
+struct mjpeg_error {
+	struct jpeg_error_mgr pub;	/* error manager of libjpeg */
+	jmp_buf env;			/* return point of error_exit */
+};
+
+/* jpeg decoded into lines of an output buffer */
+struct mjpeg_slice {
+	struct task task;		/* task of workers, must be first */
+	struct mjpeg *j;		/* stage */
+	const uint8_t *data;		/* jpeg */
+	size_t size;			/* size of jpeg */
+	uint8_t *copy;			/* data, if it's a copy of a part */
+	struct buffer *ob;		/* output buffer */
+	unsigned int y;			/* first line in output */
+	unsigned int warnings;		/* corrupt data warnings */
+	int ret;			/* result */
+};
+
+/* layout of a jpeg to split at restart markers */
+struct mjpeg_layout {
+	size_t sof;			/* offset of frame header */
+	size_t scan;			/* offset of entropy coded data */
+	unsigned int restart;		/* restart interval in mcus */
+	unsigned int width;		/* width in pixels */
+	unsigned int height;		/* height in lines */
+	unsigned int mcu_w;		/* width of mcu */
+	unsigned int mcu_h;		/* height of mcu */
+};
+
+/* parse raw format of output(4 chars) */
+int mjpeg_parse_args(struct mjpeg *j, const char *arg)
+{
+	if (strnlen(arg, 4) != 4)
+		return -1;
+
+	j->fourcc = ((unsigned)arg[0] << 0) |
+		((unsigned)arg[1] << 8) |
+		((unsigned)arg[2] << 16) |
+		((unsigned)arg[3] << 24);
+
+	switch (j->fourcc) {
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_XBGR32:
+	case V4L2_PIX_FMT_XRGB32:
+		return 0;
+	}
+
+	return -1;
+}
+
+/* config of output device for the captured format */
+void mjpeg_format(struct mjpeg *j, struct config *c)
+{
+	memset(&j->config, 0, sizeof(j->config));
+	j->config.fourcc = j->fourcc;
+	j->config.format.width = c->format.width;
+	j->config.format.height = c->format.height;
+	j->config.format.field = V4L2_FIELD_NONE;
+	j->config.num_planes = 1;
+	j->config.num_buffers = c->num_buffers;
+}
+
+static void mjpeg_error_exit(j_common_ptr cinfo)
+{
+	longjmp(((struct mjpeg_error *)cinfo->err)->env, 1);
+}
+
+/* corrupt data is counted, not printed for every frame */
+static void mjpeg_output_message(j_common_ptr cinfo)
+{
+}
+
+/* 4:2:2 or 4:2:0 YCbCr, which the decoder gives planar for NV12 and YUYV */
+static bool mjpeg_raw(struct jpeg_decompress_struct *d, unsigned int fourcc)
+{
+	jpeg_component_info *comp = d->comp_info;
+
+	if (fourcc != V4L2_PIX_FMT_NV12 && fourcc != V4L2_PIX_FMT_YUYV)
+		return false;
+
+	return d->jpeg_color_space == JCS_YCbCr && d->num_components == 3 &&
+		comp[0].h_samp_factor == 2 &&
+		(comp[0].v_samp_factor == 1 || comp[0].v_samp_factor == 2) &&
+		comp[1].h_samp_factor == 1 && comp[1].v_samp_factor == 1 &&
+		comp[2].h_samp_factor == 1 && comp[2].v_samp_factor == 1;
+}
+
+/* pack lines of planar output(chroma of vsub lines) to NV12 or YUYV */
+static void mjpeg_pack_raw(struct mjpeg *j, uint8_t *base, unsigned int line,
+		unsigned int lines, JSAMPIMAGE planes, unsigned int vsub)
+{
+	struct v4l2_pix_format *f = &j->config.format;
+	JSAMPARRAY y = planes[0], cb = planes[1], cr = planes[2];
+	unsigned int i, x, c0, c1;
+	uint8_t *dst;
+
+	if (j->fourcc == V4L2_PIX_FMT_NV12) {
+		for (i = 0; i < lines; i++)
+			memcpy(base + (line + i) * f->bytesperline, y[i],
+					f->width);
+
+		/* 4:2:2 chroma is averaged vertically */
+		dst = base + f->bytesperline * (f->height + line / 2);
+		for (i = 0; i < lines; i += 2, dst += f->bytesperline) {
+			c0 = i / vsub;
+			c1 = (i + 1 < lines ? i + 1 : i) / vsub;
+			for (x = 0; x < f->width / 2; x++) {
+				dst[2 * x] = (cb[c0][x] + cb[c1][x] + 1) >> 1;
+				dst[2 * x + 1] = (cr[c0][x] + cr[c1][x] + 1) >> 1;
+			}
+		}
+		return;
+	}
+
+	for (i = 0; i < lines; i++) {
+		dst = base + (line + i) * f->bytesperline;
+		c0 = i / vsub;
+		for (x = 0; x < f->width / 2; x++) {
+			dst[4 * x] = y[i][2 * x];
+			dst[4 * x + 1] = cb[c0][x];
+			dst[4 * x + 2] = y[i][2 * x + 1];
+			dst[4 * x + 3] = cr[c0][x];
+		}
+	}
+}
+
+/* pack a line of full resolution YCbCr to NV12 or YUYV */
+static void mjpeg_pack_ycbcr(struct mjpeg *j, uint8_t *base, unsigned int line,
+		const uint8_t *src)
+{
+	struct v4l2_pix_format *f = &j->config.format;
+	uint8_t *dst = base + line * f->bytesperline;
+	unsigned int x;
+
+	if (j->fourcc == V4L2_PIX_FMT_NV12) {
+		for (x = 0; x < f->width; x++)
+			dst[x] = src[3 * x];
+		if (line & 1)
+			return;
+		dst = base + f->bytesperline * (f->height + line / 2);
+		for (x = 0; x < f->width / 2; x++) {
+			dst[2 * x] = src[6 * x + 1];
+			dst[2 * x + 1] = src[6 * x + 2];
+		}
+		return;
+	}
+
+	for (x = 0; x < f->width / 2; x++) {
+		dst[4 * x] = src[6 * x];
+		dst[4 * x + 1] = src[6 * x + 1];
+		dst[4 * x + 2] = src[6 * x + 3];
+		dst[4 * x + 3] = src[6 * x + 2];
+	}
+}
+
+/* decode a slice into its lines of output buffer */
+static int mjpeg_decode_slice(struct mjpeg_slice *sl)
+{
+	struct mjpeg *j = sl->j;
+	struct v4l2_pix_format *f = &j->config.format;
+	struct jpeg_decompress_struct d;
+	struct mjpeg_error err;
+	uint8_t *base = sl->ob->frame.data;
+	JSAMPARRAY planes[3];
+	JSAMPROW row;
+	unsigned int vsub, lines, line;
+
+	d.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = mjpeg_error_exit;
+	err.pub.output_message = mjpeg_output_message;
+	jpeg_create_decompress(&d);
+	if (setjmp(err.env)) {
+		jpeg_destroy_decompress(&d);
+		return -1;
+	}
+
+	jpeg_mem_src(&d, sl->data, sl->size);
+	jpeg_read_header(&d, TRUE);
+	if (d.image_width != f->width || sl->y + d.image_height > f->height) {
+		jpeg_destroy_decompress(&d);
+		return -1;
+	}
+
+	switch (j->fourcc) {
+	case V4L2_PIX_FMT_XBGR32:
+	case V4L2_PIX_FMT_XRGB32:
+		/* decoder writes lines of output. merged upsampling doesn't
+		 * look across slices as fancy upsampling of 4:2:0 does */
+		d.out_color_space = j->fourcc == V4L2_PIX_FMT_XBGR32 ?
+			JCS_EXT_BGRX : JCS_EXT_XRGB;
+		d.do_fancy_upsampling = FALSE;
+		jpeg_start_decompress(&d);
+		while (d.output_scanline < d.output_height) {
+			row = base + (sl->y + d.output_scanline) *
+				f->bytesperline;
+			jpeg_read_scanlines(&d, &row, 1);
+		}
+		break;
+	default:
+		d.out_color_space = JCS_YCbCr;
+		if (mjpeg_raw(&d, j->fourcc)) {
+			/* an imcu row of planes without upsampling */
+			d.raw_data_out = TRUE;
+			jpeg_start_decompress(&d);
+			vsub = d.max_v_samp_factor;
+			lines = vsub * DCTSIZE;
+			planes[0] = (*d.mem->alloc_sarray)((j_common_ptr)&d,
+					JPOOL_IMAGE, d.comp_info[0].width_in_blocks *
+					DCTSIZE, lines);
+			planes[1] = (*d.mem->alloc_sarray)((j_common_ptr)&d,
+					JPOOL_IMAGE, d.comp_info[1].width_in_blocks *
+					DCTSIZE, DCTSIZE);
+			planes[2] = (*d.mem->alloc_sarray)((j_common_ptr)&d,
+					JPOOL_IMAGE, d.comp_info[2].width_in_blocks *
+					DCTSIZE, DCTSIZE);
+			while (d.output_scanline < d.output_height) {
+				line = d.output_scanline;
+				jpeg_read_raw_data(&d, planes, lines);
+				mjpeg_pack_raw(j, base, sl->y + line,
+						min(lines, d.output_height - line),
+						planes, vsub);
+			}
+		} else {
+			jpeg_start_decompress(&d);
+			planes[0] = (*d.mem->alloc_sarray)((j_common_ptr)&d,
+					JPOOL_IMAGE, d.output_width * 3, 1);
+			while (d.output_scanline < d.output_height) {
+				line = d.output_scanline;
+				jpeg_read_scanlines(&d, planes[0], 1);
+				mjpeg_pack_ycbcr(j, base, sl->y + line,
+						planes[0][0]);
+			}
+		}
+		break;
+	}
+
+	sl->warnings = err.pub.num_warnings;
+	jpeg_destroy_decompress(&d);
+
+	return 0;
+}
+
+static void mjpeg_slice_run(struct task *t)
+{
+	struct mjpeg_slice *sl = (struct mjpeg_slice *)t;
+
+	sl->ret = mjpeg_decode_slice(sl);
+}
+
+/* find frame header, restart interval and entropy coded data of a single
+ * interleaved scan, which is what can be split */
+static int mjpeg_layout(const uint8_t *p, size_t size, struct mjpeg_layout *l)
+{
+	unsigned int marker, len, num = 0, i, h, v;
+	size_t pos = 2;
+
+	memset(l, 0, sizeof(*l));
+	if (size < 4 || p[0] != 0xff || p[1] != 0xd8)
+		return -1;
+
+	l->mcu_w = DCTSIZE;
+	l->mcu_h = DCTSIZE;
+	while (pos + 4 <= size) {
+		if (p[pos] != 0xff)
+			return -1;
+		marker = p[pos + 1];
+		if (marker == 0xff) {
+			pos++;
+			continue;
+		}
+		len = p[pos + 2] << 8 | p[pos + 3];
+		if (len < 2 || pos + 2 + len > size)
+			return -1;
+
+		switch (marker) {
+		case 0xc0:	/* baseline */
+		case 0xc1:	/* extended sequential huffman */
+			num = len >= 8 ? p[pos + 9] : 0;
+			if (num != 3 || len < 8 + 3 * num)
+				return -1;
+			l->sof = pos;
+			l->height = p[pos + 5] << 8 | p[pos + 6];
+			l->width = p[pos + 7] << 8 | p[pos + 8];
+			for (i = 0; i < num; i++) {
+				h = p[pos + 11 + 3 * i] >> 4;
+				v = p[pos + 11 + 3 * i] & 0xf;
+				if (h * DCTSIZE > l->mcu_w)
+					l->mcu_w = h * DCTSIZE;
+				if (v * DCTSIZE > l->mcu_h)
+					l->mcu_h = v * DCTSIZE;
+			}
+			break;
+		case 0xc4:	/* huffman tables */
+		case 0xc8:	/* reserved */
+		case 0xcc:	/* arithmetic conditioning */
+			break;
+		case 0xdd:	/* restart interval */
+			if (len < 4)
+				return -1;
+			l->restart = p[pos + 4] << 8 | p[pos + 5];
+			break;
+		case 0xda:	/* scan */
+			if (!l->sof || !l->restart || !l->height ||
+					p[pos + 4] != num)
+				return -1;
+			l->scan = pos + 2 + len;
+			return 0;
+		default:
+			/* progressive, lossless and arithmetic frames */
+			if (marker >= 0xc2 && marker <= 0xcf)
+				return -1;
+			break;
+		}
+		pos += 2 + len;
+	}
+
+	return -1;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	unsigned int t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/* number restart markers of a slice from RST0, first is the segment the
+ * slice starts at */
+static void mjpeg_renumber(uint8_t *p, size_t size, unsigned int first)
+{
+	uint8_t *q, *end = p + size - 1;
+
+	for (q = p; q < end && (q = memchr(q, 0xff, end - q)); q++)
+		if (q[1] >= 0xd0 && q[1] <= 0xd7)
+			q[1] = 0xd0 + ((q[1] - 0xd0 - first) & 7);
+}
+
+/*
+ * split a jpeg into num slices at most, at restart markers which start mcu
+ * rows. every slice becomes a jpeg of its own: the headers with the height
+ * of the slice and the segments of its rows, returns slices or 0
+ */
+static unsigned int mjpeg_split(const uint8_t *p, size_t size,
+		struct mjpeg_slice *sl, unsigned int num)
+{
+	struct mjpeg_layout l;
+	size_t start[MJPEG_MAX_SLICES], end[MJPEG_MAX_SLICES], pos, len;
+	unsigned int seg[MJPEG_MAX_SLICES];
+	unsigned int mcus, rows, per, step, lines, i, k;
+	const uint8_t *q;
+	uint8_t *c;
+
+	if (num < 2 || mjpeg_layout(p, size, &l) < 0)
+		return 0;
+
+	/* slices start at mcu rows which start a restart interval */
+	mcus = DIV_ROUND_UP(l.width, l.mcu_w);
+	rows = DIV_ROUND_UP(l.height, l.mcu_h);
+	step = l.restart / gcd(l.restart, mcus);
+	per = DIV_ROUND_UP(DIV_ROUND_UP(rows, num), step) * step;
+	if (per >= rows)
+		return 0;
+	num = DIV_ROUND_UP(rows, per);
+	for (i = 0; i < num; i++)
+		seg[i] = i * per * mcus / l.restart;
+
+	/* segment k starts after k-th restart marker */
+	start[0] = l.scan;
+	pos = l.scan;
+	for (i = 1, k = 0; i < num && pos + 1 < size; ) {
+		q = memchr(p + pos, 0xff, size - pos - 1);
+		if (!q)
+			break;
+		pos = q - p;
+		if (p[pos + 1] >= 0xd0 && p[pos + 1] <= 0xd7) {
+			if (++k == seg[i]) {
+				end[i - 1] = pos;
+				start[i] = pos + 2;
+				i++;
+			}
+			pos += 2;
+		} else if (p[pos + 1] == 0xd9) {
+			break;
+		} else {
+			/* stuffed 0xff00 or fill byte */
+			pos++;
+		}
+	}
+	if (i < num)
+		return 0;
+	end[num - 1] = size;
+
+	for (i = 0; i < num; i++) {
+		len = l.scan + end[i] - start[i] + 2;
+		c = malloc(len);
+		if (WARN_ON(!c, "failed to allocate mjpeg slice\n")) {
+			while (i--)
+				free(sl[i].copy);
+			return 0;
+		}
+		memcpy(c, p, l.scan);
+		memcpy(c + l.scan, p + start[i], end[i] - start[i]);
+		c[len - 2] = 0xff;
+		c[len - 1] = 0xd9;
+
+		lines = i < num - 1 ? per * l.mcu_h : l.height - i * per * l.mcu_h;
+		c[l.sof + 5] = lines >> 8;
+		c[l.sof + 6] = lines;
+		if (seg[i] % 8)
+			mjpeg_renumber(c + l.scan, end[i] - start[i], seg[i]);
+
+		sl[i].copy = c;
+		sl[i].data = c;
+		sl[i].size = len;
+		sl[i].y = i * per * l.mcu_h;
+	}
+
+	return num;
+}
+
+/* decode captured frame into a free output buffer, which goes to the output
+ * device instead of the captured one(stream_forward()) */
+int mjpeg_decode(struct bridge_stream *s, struct buffer *b)
+{
+	struct mjpeg *j = s->mjpeg;
+	struct workers *w = &s->m->workers;
+	struct mjpeg_slice sl[MJPEG_MAX_SLICES];
+	struct task *tasks[MJPEG_MAX_SLICES];
+	struct buffer *ob;
+	unsigned int num = 0, warnings = 0, i;
+	uint64_t start;
+	uint8_t *data;
+	size_t size;
+	int ret = 0;
+
+	data = bridge_frame_map(s, &b->frame);
+	if (!data || b->bytesused[0] <= b->data_offset[0]) {
+		__sync_add_and_fetch(&j->errors, 1);
+		return -1;
+	}
+	data += b->data_offset[0];
+	size = b->bytesused[0] - b->data_offset[0];
+
+	/* drop rather than wait for output */
+	ob = stage_pool_get(&j->pool);
+	if (!ob) {
+		__sync_add_and_fetch(&j->no_buffer, 1);
+		return -1;
+	}
+
+	start = timing_now();
+	memset(sl, 0, sizeof(sl));
+	if (w->threads && j->config.format.height >= MJPEG_SLICE_MIN_LINES)
+		num = mjpeg_split(data, size, sl,
+				min(w->num + 1, MJPEG_MAX_SLICES));
+	if (!num) {
+		num = 1;
+		sl[0].data = data;
+		sl[0].size = size;
+	}
+	for (i = 0; i < num; i++) {
+		sl[i].task.run = mjpeg_slice_run;
+		sl[i].j = j;
+		sl[i].ob = ob;
+		tasks[i] = &sl[i].task;
+	}
+
+	stage_pool_sync(ob, DMA_BUF_SYNC_START);
+	workers_run(w, tasks, num);
+	stage_pool_sync(ob, DMA_BUF_SYNC_END);
+
+	for (i = 0; i < num; i++) {
+		if (sl[i].ret < 0)
+			ret = -1;
+		warnings += sl[i].warnings;
+		free(sl[i].copy);
+	}
+	if (ret < 0) {
+		__sync_add_and_fetch(&j->errors, 1);
+		stage_pool_release(&j->pool, ob);
+		return -1;
+	}
+
+	ob->bytesused[0] = j->config.planes[0].sizeimage;
+	ob->data_offset[0] = 0;
+	ob->flags = b->flags;
+	ob->field = V4L2_FIELD_NONE;
+	ob->timecode = b->timecode;
+	ob->frame.sequence = b->frame.sequence;
+	ob->frame.timestamp = b->frame.timestamp;
+	b->decoded = ob;
+
+	__sync_add_and_fetch(&j->frames, 1);
+	if (num > 1)
+		__sync_add_and_fetch(&j->sliced, 1);
+	__sync_add_and_fetch(&j->warnings, warnings);
+	__sync_add_and_fetch(&j->ns, timing_now() - start);
+
+	return 0;
+}
+
+/* dump stats of mjpeg stage */
+void mjpeg_dump_stats(struct mjpeg *j, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s mjpeg %.4s frames %llu sliced %llu errors %llu "
+			"no_buffer %llu warnings %llu avg_us %.1f\n", who,
+			(char *)&j->fourcc,
+			(unsigned long long)j->frames,
+			(unsigned long long)j->sliced,
+			(unsigned long long)j->errors,
+			(unsigned long long)j->no_buffer,
+			(unsigned long long)j->warnings,
+			j->frames ? j->ns / 1000.0 / j->frames : 0);
+}
@@ -0,0 +1,245 @@
+/*
+ * Signal monitor on sampled luma statistics
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Every period-th forwarded frame, a few lines spread over the picture are
+ * copied out of the dmabuf and reduced with the simd stats kernel to the
+ * mean and variance of luma, the mean absolute difference to the same
+ * lines of the last check, and the one between neighbouring lines of the
+ * top two thirds. A black picture is dark and flat, a frozen one doesn't
+ * change, and a source without signal sends a flat field or colour bars,
+ * which don't change from line to line. A condition raises its alarm once
+ * it holds for hold checks in a row, and clears it once it doesn't as
+ * long, so a fade or a still scene doesn't flap the state.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include "bridge_priv.h"
+#include "kernel.h"
+
+#define MONITOR_LINES		32	/* lines sampled per frame */
+#define MONITOR_BLACK_LUMA	32	/* black is darker than this */
+#define MONITOR_BLACK_VAR	64	/* and flatter than this */
+#define MONITOR_STILL_MAD	0.25	/* frozen moves less than this */
+#define MONITOR_FLAT_MAD	0.25	/* bars change less than this per line */
+
+static const char *alarm_names[MONITOR_ALARMS] = {
+	"black",
+	"frozen",
+	"nosignal",
+};
+
+/* parse args(period[,hold]) */
+int monitor_parse_args(struct monitor *mon, const char *args)
+{
+	int n;
+
+	mon->hold = MONITOR_HOLD;
+	n = sscanf(args, "%u,%u", &mon->period, &mon->hold);
+	if (n < 1 || !mon->period || !mon->hold)
+		return -1;
+
+	return 0;
+}
+
+/* byte of first luma sample of a line, bytes between samples, and bytes of
+ * a line spanned by samples, or 0 if luma can't be sampled */
+static unsigned int monitor_layout(unsigned int fourcc, unsigned int width,
+		unsigned int *offset, unsigned int *step)
+{
+	*offset = 0;
+	switch (fourcc) {
+	case V4L2_PIX_FMT_GREY:
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+	case V4L2_PIX_FMT_NV24:
+	case V4L2_PIX_FMT_NV42:
+	case V4L2_PIX_FMT_NV12M:
+	case V4L2_PIX_FMT_NV21M:
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_YUV422P:
+		*step = 1;
+		return width;
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_VYUY:
+		*offset = 1;
+		/* fall through */
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+		*step = 2;
+		return width * 2 - *offset;
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_ARGB32:
+	case V4L2_PIX_FMT_XBGR32:
+	case V4L2_PIX_FMT_ABGR32:
+		/* green stands in for luma, it's the second byte of all */
+		*offset = 1;
+		*step = 4;
+		return width * 4 - *offset;
+	}
+
+	return 0;
+}
+
+/* sample geometry for config, on the first check and when it changes */
+static int monitor_setup(struct monitor *mon, const struct config *c)
+{
+	const struct v4l2_pix_format *f = &c->format;
+	size_t size;
+
+	if (mon->fourcc == f->pixelformat && mon->frame_width == f->width &&
+			mon->frame_height == f->height &&
+			mon->stride == c->planes[0].bytesperline)
+		return mon->width ? 0 : -1;
+
+	mon->fourcc = f->pixelformat;
+	mon->frame_width = f->width;
+	mon->frame_height = f->height;
+	mon->stride = c->planes[0].bytesperline;
+	mon->width = monitor_layout(f->pixelformat, f->width, &mon->offset,
+			&mon->step);
+	mon->lines = min(f->height, MONITOR_LINES);
+	mon->top = mon->lines * 2 / 3;
+	mon->valid = false;
+	if (!mon->width || mon->lines < 3 ||
+			mon->width + mon->offset > mon->stride) {
+		printf("%s: monitor doesn't support %.4s\n", mon->name,
+				(char *)&mon->fourcc);
+		mon->width = 0;
+		return -1;
+	}
+	mon->pitch = f->height / mon->lines;
+
+	size = (size_t)mon->width * mon->lines;
+	free(mon->cur);
+	free(mon->prev);
+	mon->cur = malloc(size);
+	mon->prev = malloc(size);
+	ASSERT(!mon->cur || !mon->prev, "failed to allocate monitor lines\n");
+
+	return 0;
+}
+
+/* debounce a condition into its alarm */
+static void monitor_update(struct monitor *mon, unsigned int i, bool cond)
+{
+	unsigned int bit = 1 << i;
+
+	if (cond == !!(mon->alarms & bit)) {
+		mon->count[i] = 0;
+		return;
+	}
+	if (++mon->count[i] < mon->hold)
+		return;
+
+	mon->count[i] = 0;
+	__sync_fetch_and_xor(&mon->alarms, bit);
+	if (cond)
+		mon->raised++;
+	printf("%s: %s %s\n", mon->name, alarm_names[i],
+			cond ? "detected" : "cleared");
+}
+
+/* check lines of frame data */
+static void monitor_check(struct monitor *mon, const uint8_t *data)
+{
+	struct kernel_stats t = { 0 }, v = { 0 };
+	unsigned int per = (mon->width + mon->step - 1) / mon->step;
+	double n = (double)per * mon->lines;
+	uint8_t *tmp;
+	bool black;
+
+	data += (size_t)mon->pitch / 2 * mon->stride + mon->offset;
+	kernel.copy(mon->cur, mon->width, data, mon->pitch * mon->stride,
+			mon->width, mon->lines);
+	/* against the last check, a new geometry has none yet */
+	kernel.stats(mon->cur, mon->valid ? mon->prev : mon->cur, mon->width,
+			mon->width, mon->lines, mon->step, &t);
+	/* against the next line */
+	kernel.stats(mon->cur, mon->cur + mon->width, mon->width, mon->width,
+			mon->top - 1, mon->step, &v);
+
+	mon->luma = t.sum / n;
+	mon->var = t.sumsq / n - mon->luma * mon->luma;
+	mon->motion = t.sad / n;
+	mon->bars = v.sad / ((double)per * (mon->top - 1));
+
+	black = mon->luma < MONITOR_BLACK_LUMA && mon->var < MONITOR_BLACK_VAR;
+	monitor_update(mon, MONITOR_BLACK, black);
+	if (mon->valid)
+		monitor_update(mon, MONITOR_FROZEN,
+				mon->motion < MONITOR_STILL_MAD);
+	/* black is flat too */
+	monitor_update(mon, MONITOR_NO_SIGNAL,
+			!black && mon->bars < MONITOR_FLAT_MAD);
+
+	tmp = mon->prev;
+	mon->prev = mon->cur;
+	mon->cur = tmp;
+	mon->valid = true;
+}
+
+/* check data of a frame of config, if it's the period-th */
+void monitor_frame(struct monitor *mon, const struct config *c,
+		const uint8_t *data)
+{
+	uint64_t start;
+
+	if (__sync_fetch_and_add(&mon->seen, 1) % mon->period)
+		return;
+	/* a worker is checking another frame */
+	if (pthread_mutex_trylock(&mon->lock))
+		return;
+
+	if (!monitor_setup(mon, c)) {
+		start = timing_now();
+		monitor_check(mon, data);
+		mon->checks++;
+		mon->ns += timing_now() - start;
+	}
+	pthread_mutex_unlock(&mon->lock);
+}
+
+void monitor_init(struct monitor *mon, const char *name)
+{
+	pthread_mutex_init(&mon->lock, NULL);
+	snprintf(mon->name, sizeof(mon->name), "%s", name);
+}
+
+void monitor_exit(struct monitor *mon)
+{
+	pthread_mutex_destroy(&mon->lock);
+	free(mon->cur);
+	free(mon->prev);
+	mon->cur = mon->prev = NULL;
+}
+
+/* dump stats of monitor */
+void monitor_dump_stats(struct monitor *mon, const char *who, FILE *fp)
+{
+	char state[32] = "ok";
+	unsigned int i, len = 0;
+
+	for (i = 0; i < MONITOR_ALARMS; i++)
+		if (mon->alarms & 1 << i)
+			len += snprintf(state + len, sizeof(state) - len,
+					"%s%s", len ? "," : "", alarm_names[i]);
+
+	fprintf(fp, "%s monitor state %s checks %llu raised %llu luma %.1f "
+			"var %.1f motion %.2f bars %.2f avg_us %.1f\n", who,
+			state, (unsigned long long)mon->checks,
+			(unsigned long long)mon->raised, mon->luma,
+			mon->var, mon->motion, mon->bars,
+			mon->checks ? mon->ns / 1000.0 / mon->checks : 0);
+}
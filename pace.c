@@ -0,0 +1,117 @@
+/*
+ * Frame rate limiter for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pace.h"
+
+static const char *pace_names[PACE_MAX] = {
+	[PACE_SLEEP]	= "sleep",
+	[PACE_DEADLINE]	= "deadline",
+};
+
+/* current monotonic time in ns */
+uint64_t pace_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+const char *pace_mode_name(enum pace_mode mode)
+{
+	return mode < PACE_MAX ? pace_names[mode] : "unknown";
+}
+
+/* parse pacing name, returns mode or -1 */
+int pace_mode_parse(const char *name)
+{
+	int i;
+
+	for (i = 0; i < PACE_MAX; i++)
+		if (!strcmp(name, pace_names[i]))
+			return i;
+	return -1;
+}
+
+/* initialize limiter, fps <= 0 means free run */
+void pace_init(struct pace *p, enum pace_mode mode, double fps)
+{
+	memset(p, 0, sizeof(*p));
+	p->mode = mode;
+	if (fps > 0)
+		p->period_ns = (uint64_t)(1000000000.0 / fps + 0.5);
+}
+
+/*
+ * sleep from the previous release, as the bridge always did. the time spent
+ * waiting for the next buffer and the wake up latency are not accounted, so
+ * the rate drifts below the target.
+ */
+static void pace_wait_sleep(struct pace *p)
+{
+	uint64_t now = pace_now_ns();
+	uint64_t delay = now - p->prev_ns;
+
+	if (delay < p->period_ns)
+		usleep((p->period_ns - delay) / 1000);
+	p->prev_ns = pace_now_ns();
+}
+
+/*
+ * sleep until an absolute deadline advanced by one period per frame. errors
+ * don't accumulate, and if we fall behind by more than a period (ex, source
+ * stalls) the deadline is re-armed instead of bursting to catch up.
+ */
+static void pace_wait_deadline(struct pace *p)
+{
+	uint64_t now = pace_now_ns();
+	struct timespec ts;
+
+	if (!p->next_ns) {
+		p->next_ns = now;
+		return;
+	}
+
+	p->next_ns += p->period_ns;
+	if (now > p->next_ns + p->period_ns)
+		p->next_ns = now;
+	if (now >= p->next_ns)
+		return;
+
+	ts.tv_sec = p->next_ns / 1000000000ull;
+	ts.tv_nsec = p->next_ns % 1000000000ull;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+			EINTR)
+		;
+}
+
+/* block until the next frame may be released */
+void pace_wait(struct pace *p)
+{
+	if (!p->period_ns)
+		return;
+
+	switch (p->mode) {
+	case PACE_SLEEP:
+		pace_wait_sleep(p);
+		break;
+	case PACE_DEADLINE:
+	default:
+		pace_wait_deadline(p);
+		break;
+	}
+}
@@ -0,0 +1,40 @@
+/*
+ * Frame rate limiter for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __PACE_H__
+#define __PACE_H__
+
+#include <stdint.h>
+
+/* pacing implementations */
+enum pace_mode {
+	PACE_SLEEP,			/* relative usleep() from last frame */
+	PACE_DEADLINE,			/* absolute deadline on monotonic clock */
+	PACE_MAX,
+};
+
+/* frame rate limiter */
+struct pace {
+	enum pace_mode mode;		/* pacing implementation */
+	uint64_t period_ns;		/* ns per frame(0 for free run) */
+	uint64_t prev_ns;		/* last release time */
+	uint64_t next_ns;		/* next deadline */
+};
+
+uint64_t pace_now_ns(void);
+const char *pace_mode_name(enum pace_mode mode);
+int pace_mode_parse(const char *name);
+
+void pace_init(struct pace *p, enum pace_mode mode, double fps);
+void pace_wait(struct pace *p);
+
+#endif /* __PACE_H__ */
@@ -0,0 +1,386 @@
+/*
+ * Processing stage plugins and their worker threads
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <dlfcn.h>
+
+#include "bridge_priv.h"
+#include "kernel.h"
+
+/*
+ * plugin operations
+ */
+
+/* load plugin from spec(path[,args]) and create an instance */
+int plugin_load(struct plugin *p, const char *spec)
+{
+	char path[256];
+	const char *args;
+	size_t len;
+	int tier;
+
+	args = strchr(spec, ',');
+	len = args ? args - spec : strlen(spec);
+	if (WARN_ON(len >= sizeof(path), "plugin path too long\n"))
+		return -1;
+	snprintf(path, sizeof(path), "%.*s", (int)len, spec);
+	if (args)
+		args++;
+
+	p->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (WARN_ON(!p->handle, "failed to load %s: %s\n", path, dlerror()))
+		return -1;
+
+	p->ops = dlsym(p->handle, BRIDGE_PLUGIN_SYMBOL);
+	if (WARN_ON(!p->ops, "%s has no %s\n", path, BRIDGE_PLUGIN_SYMBOL))
+		goto err_close;
+	if (WARN_ON(p->ops->abi_version != BRIDGE_PLUGIN_ABI_VERSION,
+				"%s: abi version %u, expected %u\n", path,
+				p->ops->abi_version,
+				BRIDGE_PLUGIN_ABI_VERSION))
+		goto err_close;
+	if (WARN_ON(!p->ops->process, "%s has no process()\n", path))
+		goto err_close;
+
+	/* cpu requirements */
+	for (tier = KERNEL_SCALAR + 1; tier < KERNEL_TIER_MAX; tier++) {
+		if (!(p->ops->cpu & (1 << tier)))
+			continue;
+		if (WARN_ON(!kernel_tier_supported(tier), "%s requires %s\n",
+					path, kernel_tier_name(tier)))
+			goto err_close;
+	}
+
+	if (p->ops->init && WARN_ON(p->ops->init(&p->priv, args) < 0,
+				"%s: init failed\n", path))
+		goto err_close;
+
+	return 0;
+
+err_close:
+	dlclose(p->handle);
+	memset(p, 0, sizeof(*p));
+	return -1;
+}
+
+/* destroy instance and unload plugin */
+void plugin_unload(struct plugin *p)
+{
+	if (!p->handle)
+		return;
+	if (p->ops->exit)
+		p->ops->exit(p->priv);
+	dlclose(p->handle);
+	memset(p, 0, sizeof(*p));
+}
+
+/* negotiate format through plugins of stream, after buffers are set up */
+void plugin_negotiate(struct bridge_stream *s)
+{
+	struct bridge_plugin_format f;
+	struct plugin *p;
+	unsigned int i;
+	int ret;
+
+	if (!s->num_plugins)
+		return;
+
+	f.width = s->config.format.width;
+	f.height = s->config.format.height;
+	f.fourcc = s->config.format.pixelformat;
+	f.bytesperline = s->config.format.bytesperline;
+	f.sizeimage = s->config.format.sizeimage;
+
+	s->inplace = true;
+	for (i = 0; i < s->num_plugins; i++) {
+		p = &s->plugins[i];
+		p->in = f;
+		p->out = f;
+		if (p->ops->negotiate) {
+			ret = p->ops->negotiate(p->priv, &p->in, &p->out);
+			ASSERT(ret < 0, "%s: format %ux%u %.4s rejected\n",
+					p->ops->name, f.width, f.height,
+					(char *)&f.fourcc);
+		}
+		ASSERT(p->out.sizeimage > s->config.format.sizeimage,
+				"%s: output doesn't fit in buffers\n",
+				p->ops->name);
+		if (!(p->ops->flags & BRIDGE_PLUGIN_INPLACE))
+			s->inplace = false;
+		f = p->out;
+	}
+
+	ASSERT(f.width != s->config.format.width ||
+		f.height != s->config.format.height ||
+		f.fourcc != s->config.format.pixelformat,
+		"plugins changed the stream format\n");
+
+	/* ping-pong buffers of not in place plugins */
+	if (s->inplace)
+		return;
+	for (i = 0; i < s->config.num_buffers; i++) {
+		s->buffers[i].scratch = malloc(s->buffers[i].frame.size);
+		ASSERT(!s->buffers[i].scratch, "failed to allocate scratch\n");
+	}
+}
+
+/* run plugins of stream on buffer then grade, repack or remap stage, or
+ * mjpeg stage */
+static int plugin_run(struct bridge_stream *s, struct buffer *b)
+{
+	struct bridge_plugin_frame in, out;
+	struct plugin *p;
+	uint64_t start;
+	unsigned int i;
+	void *frame;
+	int ret;
+
+	if (s->mjpeg)
+		return mjpeg_decode(s, b);
+
+	frame = bridge_frame_map(s, &b->frame);
+	if (!frame)
+		return -1;
+
+	in.data = frame;
+	in.size = b->frame.size;
+	in.sequence = b->frame.sequence;
+	in.timestamp = b->frame.timestamp;
+	in.meta = b->frame.meta;
+	in.meta_size = b->frame.meta_size;
+
+	for (i = 0; i < s->num_plugins; i++) {
+		p = &s->plugins[i];
+		in.format = &p->in;
+		out = in;
+		out.format = &p->out;
+		if (!(p->ops->flags & BRIDGE_PLUGIN_INPLACE))
+			out.data = in.data == frame ? b->scratch : frame;
+
+		start = timing_now();
+		ret = p->ops->process(p->priv, &in, &out);
+		__sync_add_and_fetch(&p->ns, timing_now() - start);
+		if (ret < 0) {
+			__sync_add_and_fetch(&p->errors, 1);
+			return ret;
+		}
+		__sync_add_and_fetch(&p->frames, 1);
+
+		in = out;
+	}
+
+	/* result ended in scratch */
+	if (in.data != frame)
+		kernel.copy(frame, b->frame.size, in.data, b->frame.size,
+				b->frame.size, 1);
+
+	if (s->grade)
+		grade_frame(s, frame);
+	if (s->repack)
+		return repack_frame(s, b);
+	if (s->remap)
+		return remap_frame(s, b);
+
+	return 0;
+}
+
+/* run plugins on buffer, and forward it or drop it on error */
+void plugin_process(struct bridge_stream *s, struct buffer *b)
+{
+	if (plugin_run(s, b) < 0)
+		stream_drop(s, b);
+	else
+		stream_forward(s, b);
+}
+
+/* dump stats of plugins of stream */
+void plugin_dump_stats(struct bridge_stream *s, const char *who, FILE *fp)
+{
+	struct plugin *p;
+	unsigned int i;
+
+	for (i = 0; i < s->num_plugins; i++) {
+		p = &s->plugins[i];
+		fprintf(fp, "%s plugin %s frames %llu errors %llu "
+				"avg_us %.1f\n", who, p->ops->name,
+				(unsigned long long)p->frames,
+				(unsigned long long)p->errors,
+				p->frames + p->errors ? p->ns / 1000.0 /
+				(p->frames + p->errors) : 0);
+		if (p->ops->stats)
+			p->ops->stats(p->priv, fp);
+	}
+}
+
+/*
+ * worker operations
+ */
+
+/* run a queued task, with lock held */
+static void workers_run_task(struct workers *w)
+{
+	struct task *t = w->tasks;
+
+	w->tasks = t->next;
+	pthread_mutex_unlock(&w->lock);
+	t->run(t);
+	pthread_mutex_lock(&w->lock);
+	(*t->pending)--;
+	pthread_cond_broadcast(&w->cond);
+}
+
+/* run tasks and jobs, frames leave in order of tickets of each stream */
+static void *worker_run(void *data)
+{
+	struct workers *w = data;
+	struct bridge_stream *s;
+	struct buffer *b;
+	int ret;
+
+	pthread_mutex_lock(&w->lock);
+	while (1) {
+		while (!w->tasks && !w->head && !w->stop)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->tasks) {
+			workers_run_task(w);
+			continue;
+		}
+		if (!w->head)
+			break;
+		b = w->head;
+		w->head = b->next;
+		if (!w->head)
+			w->tail = NULL;
+		pthread_mutex_unlock(&w->lock);
+
+		s = b->s;
+		ret = plugin_run(s, b);
+
+		pthread_mutex_lock(&w->lock);
+		while (s->next_ticket != b->ticket) {
+			if (w->tasks)
+				workers_run_task(w);
+			else
+				pthread_cond_wait(&w->cond, &w->lock);
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		if (ret < 0)
+			stream_drop(s, b);
+		else
+			stream_forward(s, b);
+
+		pthread_mutex_lock(&w->lock);
+		s->next_ticket++;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+/* start w->num workers */
+void workers_start(struct workers *w)
+{
+	unsigned int i;
+	int ret;
+
+	if (!w->num)
+		return;
+
+	w->stop = false;
+	w->threads = calloc(w->num, sizeof(*w->threads));
+	ASSERT(!w->threads, "failed to allocate workers\n");
+	for (i = 0; i < w->num; i++) {
+		ret = pthread_create(&w->threads[i], NULL, worker_run, w);
+		ASSERT(ret, "failed to create worker: %s\n", strerror(ret));
+	}
+}
+
+/* queue buffer to workers */
+void workers_queue(struct workers *w, struct buffer *b)
+{
+	pthread_mutex_lock(&w->lock);
+	b->ticket = b->s->tickets++;
+	b->next = NULL;
+	if (w->tail)
+		w->tail->next = b;
+	else
+		w->head = b;
+	w->tail = b;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* run tasks on workers and the caller, and wait until all are done. the
+ * caller runs any task while it waits, so workers may call this as well */
+void workers_run(struct workers *w, struct task **tasks, unsigned int num)
+{
+	unsigned int pending = num - 1;
+	unsigned int i;
+
+	if (!w->threads || num < 2) {
+		for (i = 0; i < num; i++)
+			tasks[i]->run(tasks[i]);
+		return;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	for (i = 1; i < num; i++) {
+		tasks[i]->pending = &pending;
+		tasks[i]->next = w->tasks;
+		w->tasks = tasks[i];
+	}
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	tasks[0]->run(tasks[0]);
+
+	pthread_mutex_lock(&w->lock);
+	while (pending) {
+		if (w->tasks)
+			workers_run_task(w);
+		else
+			pthread_cond_wait(&w->cond, &w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* wait until queued jobs of stream are forwarded */
+void workers_drain(struct workers *w, struct bridge_stream *s)
+{
+	if (!w->threads)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	while (s->next_ticket != s->tickets)
+		pthread_cond_wait(&w->cond, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* finish queued jobs and stop workers */
+void workers_stop(struct workers *w)
+{
+	unsigned int i;
+
+	if (!w->threads)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = true;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	for (i = 0; i < w->num; i++)
+		pthread_join(w->threads[i], NULL);
+	free(w->threads);
+	w->threads = NULL;
+}
@@ -0,0 +1,89 @@
+/*
+ * Example plugin which inverts frames in place
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * ex, /dev/video0:/dev/video1@o@30:4:640,480:YUYV+plugins/invert.so,luma
+ * inverts only luma of YUYV with 'luma', else all bytes.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include "../bridge_plugin.h"
+
+struct invert {
+	bool luma;			/* invert luma of YUYV only */
+};
+
+static int invert_init(void **priv, const char *args)
+{
+	struct invert *inv;
+
+	inv = calloc(1, sizeof(*inv));
+	if (!inv)
+		return -1;
+	inv->luma = args && !strcmp(args, "luma");
+	*priv = inv;
+
+	return 0;
+}
+
+static int invert_negotiate(void *priv, const struct bridge_plugin_format *in,
+		struct bridge_plugin_format *out)
+{
+	struct invert *inv = priv;
+
+	if (inv->luma && in->fourcc != V4L2_PIX_FMT_YUYV)
+		return -1;
+
+	return 0;
+}
+
+static int invert_process(void *priv, const struct bridge_plugin_frame *in,
+		struct bridge_plugin_frame *out)
+{
+	struct invert *inv = priv;
+	const struct bridge_plugin_format *f = in->format;
+	uint8_t *line;
+	unsigned int x, y;
+
+	for (y = 0; y < f->height; y++) {
+		line = (uint8_t *)out->data + y * f->bytesperline;
+		if (inv->luma)
+			for (x = 0; x < 2 * f->width; x += 2)
+				line[x] = ~line[x];
+		else
+			for (x = 0; x < f->bytesperline; x++)
+				line[x] = ~line[x];
+	}
+
+	return 0;
+}
+
+static void invert_exit(void *priv)
+{
+	free(priv);
+}
+
+const struct bridge_plugin bridge_plugin = {
+	.abi_version	= BRIDGE_PLUGIN_ABI_VERSION,
+	.name		= "invert",
+	.flags		= BRIDGE_PLUGIN_INPLACE,
+	.init		= invert_init,
+	.negotiate	= invert_negotiate,
+	.process	= invert_process,
+	.exit		= invert_exit,
+};
@@ -0,0 +1,615 @@
+/*
+ * Lens correction remap stage
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Wide angle and fisheye lenses bend straight lines. The remap stage samples
+ * every pixel of the output from where the lens put it in the input, with a
+ * lut computed once from the lens parameters: for each pixel of each plane,
+ * the byte of the top left source pixel and the 8 bit fractions between it
+ * and its neighbours. A frame is then just bilinear sampling through the lut
+ * with the simd remap kernel(gathers on avx2), in stripes of rows on workers,
+ * into a buffer of the output like the repack stage.
+ *
+ * Computing the lut takes trigonometry per pixel, a noticeable part of a
+ * second at 4K, so it's cached in a file named after the hash of its key
+ * (lens, format and stride) and read from there on the next start. The
+ * cache is a private directory of the user, files are created exclusively
+ * and renamed into place, and offsets of a loaded lut are checked against
+ * the input, so a file of someone else can't make the stage read outside
+ * of frames.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <linux/dma-buf.h>
+
+#include "bridge_priv.h"
+#include "kernel.h"
+
+#define REMAP_MAGIC		0x50414d52	/* "RMAP" */
+#define REMAP_VERSION		1
+#define REMAP_CACHE_DIR		"v4l2_bridge"	/* in $XDG_CACHE_HOME */
+#define REMAP_STRIPE_MIN_LINES	64	/* don't split into smaller stripes */
+#define REMAP_MAX_STRIPES	8
+
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+/* rows of a frame sampled by a task */
+struct remap_stripe {
+	struct task task;		/* task of workers, must be first */
+	struct remap *rm;		/* stage */
+	const uint8_t *src;		/* input frame */
+	uint8_t *dst;			/* output frame */
+	unsigned int y;			/* first row of luma */
+	unsigned int rows;		/* rows of luma */
+};
+
+static const char *model_names[] = {
+	[REMAP_RADIAL]	= "radial",
+	[REMAP_FISHEYE]	= "fisheye",
+};
+
+/* parse args(fisheye|radial[,fov=deg][,k1=n][,k2=n][,zoom=n][,cache=dir]),
+ * which end at the next part of the stream config, returns their length */
+int remap_parse_args(struct remap *rm, const char *args)
+{
+	char buf[512], *opt, *save;
+	unsigned int len, i;
+
+	len = strcspn(args, "^%&+<>");
+	if (len >= sizeof(buf))
+		return -1;
+	memcpy(buf, args, len);
+	buf[len] = '\0';
+
+	memset(&rm->key, 0, sizeof(rm->key));
+	rm->key.magic = REMAP_MAGIC;
+	rm->key.version = REMAP_VERSION;
+	rm->key.fov = 180;
+	rm->key.zoom = 1;
+	rm->cache[0] = '\0';
+
+	opt = strtok_r(buf, ",", &save);
+	if (!opt)
+		return -1;
+	for (i = 0; i < sizeof(model_names) / sizeof(model_names[0]); i++)
+		if (!strcmp(opt, model_names[i]))
+			break;
+	if (i == sizeof(model_names) / sizeof(model_names[0]))
+		return -1;
+	rm->key.model = i;
+
+	while ((opt = strtok_r(NULL, ",", &save))) {
+		if (!strncmp(opt, "fov=", 4))
+			rm->key.fov = strtod(opt + 4, NULL);
+		else if (!strncmp(opt, "k1=", 3))
+			rm->key.k1 = strtod(opt + 3, NULL);
+		else if (!strncmp(opt, "k2=", 3))
+			rm->key.k2 = strtod(opt + 3, NULL);
+		else if (!strncmp(opt, "zoom=", 5))
+			rm->key.zoom = strtod(opt + 5, NULL);
+		else if (!strncmp(opt, "cache=", 6) && opt[6] &&
+				strlen(opt + 6) < sizeof(rm->cache))
+			strcpy(rm->cache, opt + 6);
+		else
+			return -1;
+	}
+	if (rm->key.fov <= 0 || rm->key.fov >= 360 || rm->key.zoom <= 0)
+		return -1;
+
+	return len;
+}
+
+/* check if frames of fourcc can be remapped. packed 4:2:2(YUYV, UYVY)
+ * can't, the kernels write all bytes of a pixel and luma and chroma of it
+ * are sampled apart */
+bool remap_fourcc(unsigned int fourcc)
+{
+	switch (fourcc) {
+	case V4L2_PIX_FMT_GREY:
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* planes of a frame of fourcc, 0 if it can't be remapped. chroma of the
+ * semi-planar formats is sampled as pairs of bytes */
+static unsigned int remap_planes(struct remap *rm, unsigned int fourcc,
+		unsigned int width, unsigned int height)
+{
+	struct remap_plane *p = rm->planes;
+
+	p[0].width = width;
+	p[0].height = height;
+	p[0].bpp = 1;
+	p[0].hsub = 1;
+	p[0].vsub = 1;
+	switch (fourcc) {
+	case V4L2_PIX_FMT_GREY:
+		return 1;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		if (width % 2 || height % 2)
+			return 0;
+		p[1].vsub = 2;
+		break;
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+		if (width % 2)
+			return 0;
+		p[1].vsub = 1;
+		break;
+	default:
+		return 0;
+	}
+
+	p[1].hsub = 2;
+	p[1].width = width / 2;
+	p[1].height = height / p[1].vsub;
+	p[1].bpp = 2;
+
+	return 2;
+}
+
+/* point of input seen at (x, y) of output, in pixels of luma */
+static void remap_lens(const struct remap_key *k, double x, double y,
+		double *sx, double *sy)
+{
+	double cx = k->width / 2.0, cy = k->height / 2.0;
+	double dx = x - cx, dy = y - cy;
+	double f, r, t, scale;
+
+	if (k->model == REMAP_FISHEYE) {
+		/* the width of input spans fov, output is rectilinear with
+		 * zoom times the focal length of it */
+		f = cx / (k->fov * M_PI / 360);
+		r = sqrt(dx * dx + dy * dy) / (f * k->zoom);
+		t = atan(r);
+		t *= 1 + k->k1 * t * t + k->k2 * t * t * t * t;
+		scale = (r > 0 ? t / r : 1) / k->zoom;
+	} else {
+		/* r is normalized to half of the diagonal */
+		f = sqrt(cx * cx + cy * cy) * k->zoom;
+		r = (dx * dx + dy * dy) / (f * f);
+		scale = (1 + k->k1 * r + k->k2 * r * r) / k->zoom;
+	}
+
+	*sx = cx + dx * scale;
+	*sy = cy + dy * scale;
+}
+
+/* offsets and weights of pixels of plane. the kernels read the pixels
+ * right of and below an offset even with a fraction of 0, and 4 bytes at it
+ * in both rows, so close to the end of input, limit bytes from the plane,
+ * the pixel is taken as all of the weight on the next one instead, which is
+ * off by at most 1, and the last few pixels of a tight stride are shifted */
+static void remap_generate_plane(struct remap *rm, struct remap_plane *p,
+		size_t limit, uint32_t *offset, uint16_t *weight)
+{
+	double sx, sy, u, v;
+	unsigned int x, y, ix, iy, fx, fy;
+	size_t o;
+
+	for (y = 0; y < p->height; y++) {
+		for (x = 0; x < p->width; x++) {
+			remap_lens(&rm->key, (x + 0.5) * p->hsub,
+					(y + 0.5) * p->vsub, &sx, &sy);
+			u = sx / p->hsub - 0.5;
+			v = sy / p->vsub - 0.5;
+			u = u < 0 ? 0 : u > p->width - 1 ? p->width - 1 : u;
+			v = v < 0 ? 0 : v > p->height - 1 ? p->height - 1 : v;
+			ix = u;
+			iy = v;
+			fx = (u - ix) * 256 + 0.5;
+			fy = (v - iy) * 256 + 0.5;
+			if (fx == 256) {
+				ix++;
+				fx = 0;
+			}
+			if (fy == 256) {
+				iy++;
+				fy = 0;
+			}
+
+			o = (size_t)iy * rm->src_stride + ix * p->bpp;
+			if (o + rm->src_stride + 4 > limit && !fy && iy) {
+				o -= rm->src_stride;
+				fy = 255;
+			}
+			if (o + rm->src_stride + 4 > limit && !fx && ix) {
+				o -= p->bpp;
+				fx = 255;
+			}
+			if (o + rm->src_stride + 4 > limit)
+				o = limit - rm->src_stride - 4;
+			*offset++ = o;
+			*weight++ = fx | fy << 8;
+		}
+	}
+}
+
+/* point planes into lut */
+static void remap_assign(struct remap *rm)
+{
+	size_t pixels = 0, total = 0;
+	uint8_t *base = (uint8_t *)rm->lut + sizeof(rm->key);
+	unsigned int i;
+
+	for (i = 0; i < rm->num_planes; i++)
+		total += (size_t)rm->planes[i].width * rm->planes[i].height;
+	for (i = 0; i < rm->num_planes; i++) {
+		rm->planes[i].offset = (uint32_t *)base + pixels;
+		rm->planes[i].weight = (uint16_t *)(base +
+				total * sizeof(uint32_t)) + pixels;
+		pixels += (size_t)rm->planes[i].width * rm->planes[i].height;
+	}
+}
+
+/* make directory of the user only, or check that it is one */
+static int remap_private_dir(const char *dir)
+{
+	struct stat st;
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+		return -1;
+	if (lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode) ||
+			st.st_uid != geteuid() || st.st_mode & 022)
+		return -1;
+	return 0;
+}
+
+/* directory of cache files, cache=dir or a private one in $XDG_CACHE_HOME
+ * (~/.cache), returns -1 if there's none to use */
+static int remap_cache_dir(struct remap *rm, char *dir, size_t size)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	int len;
+
+	if (*rm->cache) {
+		snprintf(dir, size, "%s", rm->cache);
+		return 0;
+	}
+
+	if (base && *base) {
+		len = snprintf(dir, size, "%s", base);
+	} else {
+		base = getenv("HOME");
+		if (!base || !*base)
+			return -1;
+		len = snprintf(dir, size, "%s/.cache", base);
+	}
+	if (len < 0 || (size_t)len + sizeof(REMAP_CACHE_DIR) + 1 > size ||
+			remap_private_dir(dir) < 0)
+		return -1;
+	strcat(dir, "/" REMAP_CACHE_DIR);
+
+	return remap_private_dir(dir);
+}
+
+/* cache file of the lut in dir, named after a hash of its key */
+static void remap_cache_path(struct remap *rm, const char *dir, char *path,
+		size_t size)
+{
+	const uint8_t *k = (const uint8_t *)&rm->key;
+	uint64_t h = 0xcbf29ce484222325ull;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(rm->key); i++)
+		h = (h ^ k[i]) * 0x100000001b3ull;
+	snprintf(path, size, "%s/remap-%016llx.lut", dir,
+			(unsigned long long)h);
+}
+
+/* check that offsets of lut read 4 bytes of two rows within size bytes of
+ * input, like the generated ones */
+static int remap_check(struct remap *rm, size_t size)
+{
+	const struct remap_plane *p;
+	size_t n, j, limit;
+	unsigned int i;
+
+	for (i = 0; i < rm->num_planes; i++) {
+		p = &rm->planes[i];
+		n = (size_t)p->width * p->height;
+		limit = size - p->src_base - rm->src_stride - 4;
+		for (j = 0; j < n; j++)
+			if (p->offset[j] > limit)
+				return -1;
+	}
+
+	return 0;
+}
+
+/* read lut from cache file, if it's there, of this key and reads only size
+ * bytes of input */
+static int remap_load(struct remap *rm, const char *path, size_t size)
+{
+	struct stat st;
+	size_t done = 0;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+			(size_t)st.st_size != rm->lut_size) {
+		close(fd);
+		return -1;
+	}
+	/* a private copy, the file may change under a mapping */
+	rm->lut = malloc(rm->lut_size);
+	ASSERT(!rm->lut, "failed to allocate remap lut\n");
+	while (done < rm->lut_size) {
+		ret = read(fd, (uint8_t *)rm->lut + done, rm->lut_size - done);
+		if (ret <= 0)
+			break;
+		done += ret;
+	}
+	close(fd);
+
+	if (done == rm->lut_size && !memcmp(rm->lut, &rm->key,
+				sizeof(rm->key))) {
+		remap_assign(rm);
+		if (!remap_check(rm, size)) {
+			rm->loaded = true;
+			return 0;
+		}
+		WARN_ON(1, "%s reads outside of frames, ignored\n", path);
+	}
+	free(rm->lut);
+	rm->lut = NULL;
+
+	return -1;
+}
+
+/* write lut to cache file in dir, renamed into place once complete */
+static void remap_store(struct remap *rm, const char *dir, const char *path)
+{
+	char tmp[PATH_MAX];
+	size_t done = 0;
+	ssize_t ret;
+	int fd;
+
+	/* a new file of a name nobody can guess, 0600 */
+	if (snprintf(tmp, sizeof(tmp), "%s/.remap-XXXXXX", dir) >=
+			(int)sizeof(tmp))
+		return;
+	fd = mkstemp(tmp);
+	if (WARN_ON(fd < 0, "failed to create %s: %s\n", tmp, ERRSTR))
+		return;
+	while (done < rm->lut_size) {
+		ret = write(fd, (uint8_t *)rm->lut + done, rm->lut_size - done);
+		if (ret <= 0)
+			break;
+		done += ret;
+	}
+	close(fd);
+	if (WARN_ON(done < rm->lut_size || rename(tmp, path) < 0,
+				"failed to write %s: %s\n", path, ERRSTR))
+		unlink(tmp);
+}
+
+static void remap_free_lut(struct remap *rm)
+{
+	free(rm->lut);
+	rm->lut = NULL;
+	rm->loaded = false;
+}
+
+/* config of output device, and the lut for frames of config at src_stride
+ * into dst_stride, loaded from the cache or generated */
+int remap_format(struct remap *rm, struct config *c, unsigned int src_stride,
+		unsigned int dst_stride)
+{
+	const struct v4l2_pix_format *f = &c->format;
+	char dir[PATH_MAX - 32], path[PATH_MAX];
+	size_t pixels = 0, size;
+	bool cached;
+	uint64_t start;
+	unsigned int i;
+
+	if (c->num_planes != 1 || f->width < 4 || f->height < 4)
+		return -1;
+	rm->num_planes = remap_planes(rm, f->pixelformat, f->width, f->height);
+	if (!rm->num_planes)
+		return -1;
+
+	rm->config = *c;
+	rm->config.updated = false;
+	rm->src_stride = src_stride;
+	rm->dst_stride = dst_stride;
+	for (i = 0; i < rm->num_planes; i++) {
+		rm->planes[i].src_base = (size_t)i * src_stride * f->height;
+		rm->planes[i].dst_base = (size_t)i * dst_stride * f->height;
+		pixels += (size_t)rm->planes[i].width * rm->planes[i].height;
+		if (src_stride < rm->planes[i].width * rm->planes[i].bpp ||
+				dst_stride < rm->planes[i].width *
+				rm->planes[i].bpp)
+			return -1;
+	}
+	if ((size_t)rm->planes[i - 1].dst_base + (size_t)dst_stride *
+			rm->planes[i - 1].height > c->planes[0].sizeimage)
+		return -1;
+	/* bytes of input the lut may read */
+	size = rm->planes[i - 1].src_base + (size_t)src_stride *
+		rm->planes[i - 1].height;
+
+	/* a resumed stream keeps the lut of the same frames */
+	if (rm->lut && rm->key.fourcc == f->pixelformat &&
+			rm->key.width == f->width &&
+			rm->key.height == f->height &&
+			rm->key.src_stride == src_stride)
+		return 0;
+	if (rm->lut)
+		remap_free_lut(rm);
+
+	rm->key.fourcc = f->pixelformat;
+	rm->key.width = f->width;
+	rm->key.height = f->height;
+	rm->key.src_stride = src_stride;
+	rm->lut_size = sizeof(rm->key) +
+		pixels * (sizeof(uint32_t) + sizeof(uint16_t));
+
+	start = timing_now();
+	cached = !remap_cache_dir(rm, dir, sizeof(dir));
+	WARN_ON(!cached, "no private cache directory, lens lut isn't cached\n");
+	if (cached) {
+		remap_cache_path(rm, dir, path, sizeof(path));
+		if (!remap_load(rm, path, size)) {
+			rm->lut_ns = timing_now() - start;
+			return 0;
+		}
+	}
+
+	rm->lut = malloc(rm->lut_size);
+	ASSERT(!rm->lut, "failed to allocate remap lut\n");
+	memcpy(rm->lut, &rm->key, sizeof(rm->key));
+	remap_assign(rm);
+	for (i = 0; i < rm->num_planes; i++)
+		remap_generate_plane(rm, &rm->planes[i], size -
+				rm->planes[i].src_base,
+				(uint32_t *)rm->planes[i].offset,
+				(uint16_t *)rm->planes[i].weight);
+	rm->lut_ns = timing_now() - start;
+	if (cached)
+		remap_store(rm, dir, path);
+
+	return 0;
+}
+
+/* sample rows y to y + rows of luma, and the chroma rows of them, of frame
+ * src into dst */
+void remap_stripe(struct remap *rm, const uint8_t *src, uint8_t *dst,
+		unsigned int y, unsigned int rows)
+{
+	const struct remap_plane *p;
+	unsigned int i, first, last;
+	size_t lut;
+
+	for (i = 0; i < rm->num_planes; i++) {
+		p = &rm->planes[i];
+		first = y / p->vsub;
+		last = (y + rows) / p->vsub;
+		lut = (size_t)first * p->width;
+		kernel.remap(dst + p->dst_base + (size_t)first * rm->dst_stride,
+				rm->dst_stride, src + p->src_base,
+				rm->src_stride, p->offset + lut,
+				p->weight + lut, p->width, p->width,
+				last - first, p->bpp);
+	}
+}
+
+static void remap_stripe_run(struct task *t)
+{
+	struct remap_stripe *st = (struct remap_stripe *)t;
+	uint64_t start = timing_now();
+
+	remap_stripe(st->rm, st->src, st->dst, st->y, st->rows);
+	__sync_add_and_fetch(&st->rm->busy_ns, timing_now() - start);
+}
+
+/* remap captured frame into a free output buffer, which goes to the output
+ * device instead of the captured one(stream_forward()) */
+int remap_frame(struct bridge_stream *s, struct buffer *b)
+{
+	struct remap *rm = s->remap;
+	struct workers *w = &s->m->workers;
+	struct remap_stripe st[REMAP_MAX_STRIPES];
+	struct task *tasks[REMAP_MAX_STRIPES];
+	unsigned int height = rm->planes[0].height;
+	unsigned int num = 1, per, y, i;
+	struct buffer *ob;
+	uint64_t start;
+	uint8_t *data;
+
+	data = bridge_frame_map(s, &b->frame);
+	if (!data)
+		return -1;
+
+	/* drop rather than wait for output */
+	ob = stage_pool_get(&rm->pool);
+	if (!ob) {
+		__sync_add_and_fetch(&rm->no_buffer, 1);
+		return -1;
+	}
+
+	start = timing_now();
+	if (w->threads)
+		num = min(min(w->num + 1, REMAP_MAX_STRIPES),
+				height / REMAP_STRIPE_MIN_LINES);
+	if (!num)
+		num = 1;
+	/* even, for rows of 4:2:0 chroma */
+	per = DIV_ROUND_UP(DIV_ROUND_UP(height, num), 2) * 2;
+	for (i = 0, y = 0; y < height; i++, y += per) {
+		st[i].task.run = remap_stripe_run;
+		st[i].rm = rm;
+		st[i].src = data;
+		st[i].dst = ob->frame.data;
+		st[i].y = y;
+		st[i].rows = min(per, height - y);
+		tasks[i] = &st[i].task;
+	}
+	num = i;
+
+	stage_pool_sync(ob, DMA_BUF_SYNC_START);
+	workers_run(w, tasks, num);
+	stage_pool_sync(ob, DMA_BUF_SYNC_END);
+
+	ob->bytesused[0] = rm->config.planes[0].sizeimage;
+	ob->data_offset[0] = 0;
+	ob->flags = b->flags;
+	ob->field = b->field;
+	ob->timecode = b->timecode;
+	ob->frame.sequence = b->frame.sequence;
+	ob->frame.timestamp = b->frame.timestamp;
+	b->decoded = ob;
+
+	__sync_add_and_fetch(&rm->frames, 1);
+	if (num > 1)
+		__sync_add_and_fetch(&rm->striped, 1);
+	__sync_add_and_fetch(&rm->ns, timing_now() - start);
+
+	return 0;
+}
+
+void remap_close(struct remap *rm)
+{
+	if (rm->lut)
+		remap_free_lut(rm);
+}
+
+/* dump stats of remap stage, throughput is per core busy with stripes */
+void remap_dump_stats(struct remap *rm, const char *who, FILE *fp)
+{
+	double pixels = (double)rm->key.width * rm->key.height;
+
+	fprintf(fp, "%s remap %s lut_ms %.1f frames %llu striped %llu "
+			"no_buffer %llu avg_us %.1f mpix_core %.1f\n", who,
+			model_names[rm->key.model], rm->lut_ns / 1e6,
+			(unsigned long long)rm->frames,
+			(unsigned long long)rm->striped,
+			(unsigned long long)rm->no_buffer,
+			rm->frames ? rm->ns / 1000.0 / rm->frames : 0,
+			rm->busy_ns ? rm->frames * pixels * 1000 /
+			rm->busy_ns : 0);
+}
@@ -0,0 +1,174 @@
+/*
+ * Stride repack stage
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Capture DMA often writes lines at a wide stride(ex, 4096 bytes for 1920
+ * YUYV), while an output wants them tight or at another alignment. If the
+ * input can't be set to the stride of the output, the devices don't share
+ * buffers: both export their own, and the lines of a frame are copied from
+ * the capture mapping into the output mapping at its stride with the simd
+ * copy kernel, in stripes on workers. That's a copy of each line without
+ * looking at pixels, far cheaper than any conversion.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+
+#include <linux/dma-buf.h>
+
+#include "bridge_priv.h"
+#include "kernel.h"
+
+#define REPACK_STRIPE_MIN_LINES	64	/* don't split into smaller stripes */
+#define REPACK_MAX_STRIPES	8
+
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+/* lines of a frame copied by a task */
+struct repack_stripe {
+	struct task task;		/* task of workers, must be first */
+	struct repack *r;		/* stage */
+	const uint8_t *src;		/* first line in input */
+	uint8_t *dst;			/* first line in output */
+	unsigned int lines;		/* lines */
+};
+
+/* lines of all planes in a buffer of height, 0 if planes don't share the
+ * stride of the first one(ex, chroma of YU12 is half of it) */
+static unsigned int repack_lines(unsigned int fourcc, unsigned int height)
+{
+	switch (fourcc) {
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		return height + height / 2;
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+		return height * 2;
+	case V4L2_PIX_FMT_NV24:
+	case V4L2_PIX_FMT_NV42:
+		return height * 3;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_YUV422P:
+		return 0;
+	}
+
+	/* packed */
+	return height;
+}
+
+/* config of output device, for lines of input at another stride */
+int repack_format(struct repack *r, struct config *in, struct config *out)
+{
+	unsigned int lines;
+
+	if (in->num_planes != 1 || out->num_planes != 1)
+		return -1;
+	lines = repack_lines(in->format.pixelformat, in->format.height);
+	if (!lines)
+		return -1;
+
+	r->config = *out;
+	r->config.updated = false;
+	r->config.num_buffers = in->num_buffers;
+	r->src_stride = in->planes[0].bytesperline;
+	r->dst_stride = out->planes[0].bytesperline;
+	r->width = min(r->src_stride, r->dst_stride);
+	r->lines = lines;
+
+	return lines * r->src_stride > in->planes[0].sizeimage ||
+		lines * r->dst_stride > out->planes[0].sizeimage ? -1 : 0;
+}
+
+static void repack_stripe_run(struct task *t)
+{
+	struct repack_stripe *st = (struct repack_stripe *)t;
+	struct repack *r = st->r;
+
+	kernel.copy(st->dst, r->dst_stride, st->src, r->src_stride, r->width,
+			st->lines);
+}
+
+/* repack captured frame into a free output buffer, which goes to the output
+ * device instead of the captured one(stream_forward()) */
+int repack_frame(struct bridge_stream *s, struct buffer *b)
+{
+	struct repack *r = s->repack;
+	struct workers *w = &s->m->workers;
+	struct repack_stripe st[REPACK_MAX_STRIPES];
+	struct task *tasks[REPACK_MAX_STRIPES];
+	struct buffer *ob;
+	unsigned int num = 1, per, y, i;
+	uint64_t start;
+	uint8_t *data;
+
+	data = bridge_frame_map(s, &b->frame);
+	if (!data)
+		return -1;
+
+	/* drop rather than wait for output */
+	ob = stage_pool_get(&r->pool);
+	if (!ob) {
+		__sync_add_and_fetch(&r->no_buffer, 1);
+		return -1;
+	}
+
+	start = timing_now();
+	if (w->threads)
+		num = min(min(w->num + 1, REPACK_MAX_STRIPES),
+				r->lines / REPACK_STRIPE_MIN_LINES);
+	if (!num)
+		num = 1;
+	per = DIV_ROUND_UP(r->lines, num);
+	for (i = 0, y = 0; y < r->lines; i++, y += per) {
+		st[i].task.run = repack_stripe_run;
+		st[i].r = r;
+		st[i].src = data + (size_t)y * r->src_stride;
+		st[i].dst = (uint8_t *)ob->frame.data +
+			(size_t)y * r->dst_stride;
+		st[i].lines = min(per, r->lines - y);
+		tasks[i] = &st[i].task;
+	}
+	num = i;
+
+	stage_pool_sync(ob, DMA_BUF_SYNC_START);
+	workers_run(w, tasks, num);
+	stage_pool_sync(ob, DMA_BUF_SYNC_END);
+
+	ob->bytesused[0] = r->config.planes[0].sizeimage;
+	ob->data_offset[0] = 0;
+	ob->flags = b->flags;
+	ob->field = b->field;
+	ob->timecode = b->timecode;
+	ob->frame.sequence = b->frame.sequence;
+	ob->frame.timestamp = b->frame.timestamp;
+	b->decoded = ob;
+
+	__sync_add_and_fetch(&r->frames, 1);
+	if (num > 1)
+		__sync_add_and_fetch(&r->striped, 1);
+	__sync_add_and_fetch(&r->ns, timing_now() - start);
+
+	return 0;
+}
+
+/* dump stats of repack stage */
+void repack_dump_stats(struct repack *r, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s repack stride %u->%u frames %llu striped %llu "
+			"no_buffer %llu avg_us %.1f gbps %.2f\n", who,
+			r->src_stride, r->dst_stride,
+			(unsigned long long)r->frames,
+			(unsigned long long)r->striped,
+			(unsigned long long)r->no_buffer,
+			r->frames ? r->ns / 1000.0 / r->frames : 0,
+			r->ns ? (double)r->frames * r->lines * r->width * 8 /
+			r->ns : 0);
+}
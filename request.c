@@ -0,0 +1,342 @@
+/*
+ * Per frame controls of the input through the media Request API
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * Controls set with S_CTRL land on some later frame. With the Request API
+ * each capture buffer is queued in a request(MEDIA_IOC_REQUEST_ALLOC) which
+ * carries the controls of its frame, following a bracketing schedule which
+ * steps once per queued buffer. The values applied to the frame are read
+ * back from the completed request when the buffer is dequeued.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+
+#include "bridge_priv.h"
+
+#define REQUEST_TIMEOUT_MS	100	/* for completion after dequeue */
+
+/* parse a control(name=v1/v2/...), returns the number of values */
+static int request_parse_ctrl(struct request_ctrl *rc, char *spec)
+{
+	char *v, *e;
+	unsigned int n = 0;
+
+	v = strchr(spec, '=');
+	if (!v || v == spec || v - spec >= sizeof(rc->name))
+		return -1;
+	*v++ = '\0';
+	strcpy(rc->name, spec);
+
+	do {
+		if (n == REQUEST_MAX_STEPS)
+			return -1;
+		rc->values[n++] = strtoll(v, &e, 0);
+		if (e == v || (*e && *e != '/'))
+			return -1;
+		v = e + 1;
+	} while (*e);
+
+	return n;
+}
+
+/* parse schedule(name=v1/v2/...[,name=v1/v2/...]) which ends at the next
+ * stage, returns the length of args */
+int request_parse_args(struct request *rq, const char *arg)
+{
+	char spec[256], *opt, *save;
+	unsigned int len, i;
+	int n;
+
+	len = strcspn(arg, "&+<>");
+	if (!len || len >= sizeof(spec))
+		return -1;
+	memcpy(spec, arg, len);
+	spec[len] = '\0';
+
+	rq->num_steps = 1;
+	for (opt = strtok_r(spec, ",", &save); opt;
+			opt = strtok_r(NULL, ",", &save)) {
+		if (rq->num_ctrls == REQUEST_MAX_CTRLS)
+			return -1;
+		n = request_parse_ctrl(&rq->ctrls[rq->num_ctrls], opt);
+		if (n < 0)
+			return -1;
+		/* controls step together, a single value is constant */
+		if (n > 1 && rq->num_steps > 1 && n != rq->num_steps)
+			return -1;
+		if (n == 1)
+			for (i = 1; i < REQUEST_MAX_STEPS; i++)
+				rq->ctrls[rq->num_ctrls].values[i] =
+					rq->ctrls[rq->num_ctrls].values[0];
+		if (n > rq->num_steps)
+			rq->num_steps = n;
+		rq->num_ctrls++;
+	}
+	rq->media_fd = -1;
+
+	return rq->num_ctrls ? len : -1;
+}
+
+/* name of control as v4l2-ctl, "Exposure, Absolute" to exposure_absolute */
+static void request_ctrl_name(const char *name, char *out, size_t size)
+{
+	size_t n = 0;
+
+	for (; *name && n + 1 < size; name++) {
+		if (isalnum((unsigned char)*name))
+			out[n++] = tolower((unsigned char)*name);
+		else if (n && out[n - 1] != '_')
+			out[n++] = '_';
+	}
+	while (n && out[n - 1] == '_')
+		n--;
+	out[n] = '\0';
+}
+
+/* resolve names(or ids) of controls of schedule */
+static void request_find_ctrls(struct request *rq, struct device *d)
+{
+	struct v4l2_query_ext_ctrl qc;
+	struct request_ctrl *rc;
+	char name[32] = "";
+	unsigned int i;
+	char *e;
+
+	for (i = 0; i < rq->num_ctrls; i++) {
+		rc = &rq->ctrls[i];
+		memset(&qc, 0, sizeof(qc));
+		qc.id = strtoul(rc->name, &e, 0);
+		if (*e) {
+			/* walk all controls for the name */
+			qc.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+			while (!ioctl(d->fd, VIDIOC_QUERY_EXT_CTRL, &qc)) {
+				request_ctrl_name(qc.name, name, sizeof(name));
+				if (!strcmp(name, rc->name))
+					break;
+				qc.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+			}
+			ASSERT(strcmp(name, rc->name), "no control %s on %s\n",
+					rc->name, d->devname);
+		} else {
+			ASSERT(ioctl(d->fd, VIDIOC_QUERY_EXT_CTRL, &qc) < 0,
+				"no control %s on %s\n", rc->name, d->devname);
+		}
+		ASSERT(qc.type != V4L2_CTRL_TYPE_INTEGER &&
+			qc.type != V4L2_CTRL_TYPE_BOOLEAN &&
+			qc.type != V4L2_CTRL_TYPE_MENU &&
+			qc.type != V4L2_CTRL_TYPE_INTEGER_MENU &&
+			qc.type != V4L2_CTRL_TYPE_INTEGER64,
+			"control %s isn't a scalar\n", rc->name);
+		rc->id = qc.id;
+		rc->type = qc.type;
+	}
+}
+
+/* open media device of video node, which is a child of its parent in sysfs */
+static int request_open_media(struct device *d)
+{
+	char path[64], node[300];
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	int fd = -1;
+
+	ASSERT(fstat(d->fd, &st) < 0, "failed to stat %s: %s\n", d->devname,
+			ERRSTR);
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device",
+			major(st.st_rdev), minor(st.st_rdev));
+	dir = opendir(path);
+	ASSERT(!dir, "no parent device of %s\n", d->devname);
+	while ((de = readdir(dir)))
+		if (!strncmp(de->d_name, "media", 5) &&
+				isdigit((unsigned char)de->d_name[5]))
+			break;
+	if (de) {
+		snprintf(node, sizeof(node), "/dev/%s", de->d_name);
+		fd = open(node, O_RDWR);
+		ASSERT(fd < 0, "failed to open %s: %s\n", node, ERRSTR);
+	}
+	closedir(dir);
+	ASSERT(fd < 0, "no media device of %s\n", d->devname);
+
+	return fd;
+}
+
+/* allocate a request per buffer of capture device */
+void request_init(struct device *d, struct config *c)
+{
+	struct request *rq = d->req;
+	struct v4l2_create_buffers cb;
+	unsigned int i;
+	int ret;
+
+	/* a count of 0 only reports the capabilities of the queue */
+	memset(&cb, 0, sizeof(cb));
+	cb.memory = d->mem_type;
+	cb.format.type = d->buf_type;
+	ret = ioctl(d->fd, VIDIOC_G_FMT, &cb.format);
+	ASSERT(ret < 0, "VIDIOC_G_FMT failed: %s\n", ERRSTR);
+	ret = ioctl(d->fd, VIDIOC_CREATE_BUFS, &cb);
+	ASSERT(ret < 0 || !(cb.capabilities & V4L2_BUF_CAP_SUPPORTS_REQUESTS),
+		"%s doesn't support requests\n", d->devname);
+
+	request_find_ctrls(rq, d);
+	rq->media_fd = request_open_media(d);
+
+	rq->num_slots = c->num_buffers;
+	rq->slots = calloc(rq->num_slots, sizeof(*rq->slots));
+	ASSERT(!rq->slots, "failed to allocate requests\n");
+	for (i = 0; i < rq->num_slots; i++) {
+		ret = ioctl(rq->media_fd, MEDIA_IOC_REQUEST_ALLOC,
+				&rq->slots[i].fd);
+		ASSERT(ret < 0, "MEDIA_IOC_REQUEST_ALLOC failed: %s\n", ERRSTR);
+	}
+	rq->next_step = 0;
+	pthread_mutex_init(&rq->lock, NULL);
+
+	printf("request: %u controls, %u steps\n", rq->num_ctrls,
+			rq->num_steps);
+}
+
+/* free requests */
+void request_exit(struct device *d)
+{
+	struct request *rq = d->req;
+	unsigned int i;
+
+	if (rq->media_fd < 0)
+		return;
+
+	for (i = 0; i < rq->num_slots; i++)
+		close(rq->slots[i].fd);
+	free(rq->slots);
+	rq->slots = NULL;
+	pthread_mutex_destroy(&rq->lock);
+	close(rq->media_fd);
+	rq->media_fd = -1;
+}
+
+/* controls of schedule in request of slot, with the values of its step */
+static void request_fill(struct request *rq, struct request_slot *slot,
+		struct v4l2_ext_control *ctrls, struct v4l2_ext_controls *ecs)
+{
+	unsigned int i;
+
+	memset(ctrls, 0, sizeof(*ctrls) * rq->num_ctrls);
+	for (i = 0; i < rq->num_ctrls; i++) {
+		ctrls[i].id = rq->ctrls[i].id;
+		if (rq->ctrls[i].type == V4L2_CTRL_TYPE_INTEGER64)
+			ctrls[i].value64 = rq->ctrls[i].values[slot->step];
+		else
+			ctrls[i].value = rq->ctrls[i].values[slot->step];
+	}
+
+	memset(ecs, 0, sizeof(*ecs));
+	ecs->which = V4L2_CTRL_WHICH_REQUEST_VAL;
+	ecs->count = rq->num_ctrls;
+	ecs->request_fd = slot->fd;
+	ecs->controls = ctrls;
+}
+
+/* set controls of the next step in request of buffer, before queue */
+void request_prepare(struct device *d, struct v4l2_buffer *vb)
+{
+	struct request *rq = d->req;
+	struct v4l2_ext_control ctrls[REQUEST_MAX_CTRLS];
+	struct v4l2_ext_controls ecs;
+	struct request_slot *slot = &rq->slots[vb->index];
+	int ret;
+
+	/* buffers are queued in frame order from several threads */
+	pthread_mutex_lock(&rq->lock);
+	slot->step = rq->next_step;
+	rq->next_step = (rq->next_step + 1) % rq->num_steps;
+	pthread_mutex_unlock(&rq->lock);
+
+	if (slot->used) {
+		ret = ioctl(slot->fd, MEDIA_REQUEST_IOC_REINIT);
+		ASSERT(ret < 0, "MEDIA_REQUEST_IOC_REINIT failed: %s\n",
+				ERRSTR);
+	}
+	slot->used = true;
+
+	request_fill(rq, slot, ctrls, &ecs);
+	ret = ioctl(d->fd, VIDIOC_S_EXT_CTRLS, &ecs);
+	ASSERT(ret < 0, "VIDIOC_S_EXT_CTRLS(request) failed: %s\n", ERRSTR);
+
+	vb->flags |= V4L2_BUF_FLAG_REQUEST_FD;
+	vb->request_fd = slot->fd;
+}
+
+/* queue request of buffer, after the buffer is queued to it */
+void request_queue(struct device *d, unsigned int index)
+{
+	int ret;
+
+	ret = ioctl(d->req->slots[index].fd, MEDIA_REQUEST_IOC_QUEUE);
+	ASSERT(ret < 0, "MEDIA_REQUEST_IOC_QUEUE failed: %s\n", ERRSTR);
+}
+
+/* read back controls applied to dequeued frame */
+void request_done(struct device *d, struct buffer *b)
+{
+	struct request *rq = d->req;
+	struct v4l2_ext_control ctrls[REQUEST_MAX_CTRLS];
+	struct v4l2_ext_controls ecs;
+	struct request_slot *slot = &rq->slots[b->index];
+	struct pollfd pfd = {.fd = slot->fd, .events = POLLPRI};
+	int64_t value;
+	unsigned int i;
+	int ret;
+
+	b->frame.bracket = slot->step;
+	rq->frames++;
+
+	/* the request completes with its last object, not always the buffer */
+	if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) <= 0) {
+		rq->incomplete++;
+		return;
+	}
+
+	request_fill(rq, slot, ctrls, &ecs);
+	ret = ioctl(d->fd, VIDIOC_G_EXT_CTRLS, &ecs);
+	ASSERT(ret < 0, "VIDIOC_G_EXT_CTRLS(request) failed: %s\n", ERRSTR);
+
+	/* drivers clamp or round values out of range */
+	for (i = 0; i < rq->num_ctrls; i++) {
+		value = rq->ctrls[i].type == V4L2_CTRL_TYPE_INTEGER64 ?
+			ctrls[i].value64 : ctrls[i].value;
+		if (value != rq->ctrls[i].values[slot->step]) {
+			rq->mismatched++;
+			break;
+		}
+	}
+}
+
+/* dump stats of requests */
+void request_dump_stats(struct request *rq, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s request %u steps frames %llu mismatched %llu "
+			"incomplete %llu\n", who, rq->num_steps,
+			(unsigned long long)rq->frames,
+			(unsigned long long)rq->mismatched,
+			(unsigned long long)rq->incomplete);
+}
@@ -0,0 +1,568 @@
+/*
+ * RFC 4175 uncompressed video over RTP network sink
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * The output of a stream can be a UDP destination. Frames are packetised
+ * into RTP with RFC 4175 payload headers, a packet never spanning lines,
+ * and packets of the same size go out in one sendmsg segmented by the
+ * kernel(UDP_SEGMENT). Payloads are sent from the mapping of the dmabuf
+ * with MSG_ZEROCOPY, so a frame goes back to the input only once all of its
+ * sends are reported complete on the error queue. Sends are paced over the
+ * frame period to avoid microbursts.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <linux/errqueue.h>
+#include <linux/udp.h>
+
+#include "bridge_priv.h"
+
+#define RTP_PT			96	/* dynamic payload type */
+#define RTP_HDR_SIZE		20	/* rtp, extended sequence, a segment */
+#define RTP_IP_OVERHEAD		48	/* ipv6 and udp headers */
+#define RTP_MAX_GSO_BYTES	65000	/* bytes of a segmented send */
+#define RTP_MAX_FRAGS		17	/* pages a zero copy send can pin */
+#define RTP_PAGE_SIZE		4096
+#define RTP_RATE_HEADROOM	1.25	/* of the rate of frames at fps */
+
+/* pixel groups of rfc 4175 samplings */
+static const struct rtp_format rtp_formats[] = {
+	{V4L2_PIX_FMT_UYVY, "YCbCr-4:2:2", 4, 2},
+	{V4L2_PIX_FMT_RGB24, "RGB", 3, 1},
+	{V4L2_PIX_FMT_BGR24, "BGR", 3, 1},
+	{V4L2_PIX_FMT_RGBA32, "RGBA", 4, 1},
+	{V4L2_PIX_FMT_ABGR32, "BGRA", 4, 1},
+};
+
+/* pixel group of pixel format */
+const struct rtp_format *rtp_format(unsigned int fourcc)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(rtp_formats) / sizeof(rtp_formats[0]); i++)
+		if (rtp_formats[i].fourcc == fourcc)
+			return &rtp_formats[i];
+	return NULL;
+}
+
+/* parse host and port of rtp/host/port[,..] into spec, and leave save
+ * at the options */
+int rtp_parse_addr(const char *arg, char *spec, size_t size, char *host,
+		size_t host_size, char *port, size_t port_size, char **save)
+{
+	char *opt;
+
+	if (strncmp(arg, "rtp/", 4) || strlen(arg) >= size)
+		return -1;
+	strcpy(spec, arg + 4);
+
+	opt = strtok_r(spec, "/", save);
+	if (!opt || strlen(opt) >= host_size)
+		return -1;
+	strcpy(host, opt);
+	opt = strtok_r(NULL, ",", save);
+	if (!opt || strlen(opt) >= port_size)
+		return -1;
+	strcpy(port, opt);
+
+	return 0;
+}
+
+/* parse rtp args(rtp/host/port[,mtu=bytes][,rate=mbps][,copy]) */
+int rtp_parse_args(struct rtp *r, const char *arg)
+{
+	char spec[128], *opt, *save, *e;
+
+	if (rtp_parse_addr(arg, spec, sizeof(spec), r->host, sizeof(r->host),
+				r->port, sizeof(r->port), &save))
+		return -1;
+
+	r->mtu = 1500;
+	r->zerocopy = true;
+	while ((opt = strtok_r(NULL, ",", &save))) {
+		if (!strncmp(opt, "mtu=", 4)) {
+			r->mtu = strtoul(opt + 4, &e, 10);
+			if (*e || r->mtu < 576)
+				return -1;
+		} else if (!strncmp(opt, "rate=", 5)) {
+			r->rate = strtod(opt + 5, &e) * 1000000;
+			if (*e || r->rate <= 0)
+				return -1;
+		} else if (!strcmp(opt, "copy")) {
+			r->zerocopy = false;
+		} else {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* udp socket connected to host and port, or bound to them for a source,
+ * joining the group if host is multicast */
+int rtp_socket(const char *host, const char *port, bool source)
+{
+	struct addrinfo hints, *res, *ai;
+	struct ip_mreq mreq;
+	struct sockaddr_in *sin;
+	int fd = -1, ret, one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = source ? AI_PASSIVE : 0;
+	ret = getaddrinfo(host, port, &hints, &res);
+	ASSERT(ret, "failed to resolve %s/%s: %s\n", host, port,
+			gai_strerror(ret));
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+				ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (source)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one,
+					sizeof(one));
+		if (!(source ? bind(fd, ai->ai_addr, ai->ai_addrlen) :
+					connect(fd, ai->ai_addr, ai->ai_addrlen)))
+			break;
+		close(fd);
+		fd = -1;
+	}
+	ASSERT(fd < 0, "failed to %s %s/%s: %s\n",
+			source ? "bind" : "connect", host, port, ERRSTR);
+
+	sin = (struct sockaddr_in *)ai->ai_addr;
+	if (source && ai->ai_family == AF_INET &&
+			IN_MULTICAST(ntohl(sin->sin_addr.s_addr))) {
+		mreq.imr_multiaddr = sin->sin_addr;
+		mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+		ret = setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+				sizeof(mreq));
+		ASSERT(ret < 0, "failed to join %s: %s\n", host, ERRSTR);
+	}
+	freeaddrinfo(res);
+
+	return fd;
+}
+
+/* open socket, and plan the packets of a frame */
+void rtp_init(struct device *d, struct config *c)
+{
+	struct rtp *r = d->rtp;
+	unsigned int max, size, i;
+	uint32_t gso = 0;
+	int one = 1;
+	uint64_t pacing;
+
+	r->fmt = rtp_format(c->fourcc);
+	ASSERT(!r->fmt, "%.4s has no rfc 4175 sampling\n",
+			(char *)&c->fourcc);
+	ASSERT(c->num_planes != 1, "rtp takes single plane frames\n");
+
+	d->fd = rtp_socket(r->host, r->port, false);
+	d->type = V4L2_CAP_VIDEO_OUTPUT;
+	d->num_planes = 1;
+
+	/* fall back to a send per packet and copies without support */
+	r->gso = !setsockopt(d->fd, IPPROTO_UDP, UDP_SEGMENT, &gso, sizeof(gso));
+	if (r->zerocopy && setsockopt(d->fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+				sizeof(one))) {
+		printf("rtp: no zero copy: %s\n", ERRSTR);
+		r->zerocopy = false;
+	}
+
+	r->width = c->format.width;
+	r->height = c->format.height;
+	r->bytesperline = c->planes[0].bytesperline;
+	r->line_bytes = r->width / r->fmt->pg_pixels * r->fmt->pg_bytes;
+	ASSERT(r->width % r->fmt->pg_pixels ||
+		r->bytesperline < r->line_bytes,
+		"lines of %u pixels don't fit rfc 4175\n", r->width);
+
+	/* the largest payload dividing lines evenly, so that packets have the
+	 * same size across lines, if it isn't much smaller than the max */
+	max = (r->mtu - RTP_IP_OVERHEAD - RTP_HDR_SIZE) / r->fmt->pg_bytes *
+		r->fmt->pg_bytes;
+	max = min(max, r->line_bytes);
+	r->payload = max;
+	for (size = max; size >= max / 2; size -= r->fmt->pg_bytes)
+		if (!(r->line_bytes % size)) {
+			r->payload = size;
+			break;
+		}
+	r->packets = (r->line_bytes + r->payload - 1) / r->payload * r->height;
+
+	r->headers = calloc(c->num_buffers, r->packets * RTP_HDR_SIZE);
+	r->pending = calloc(c->num_buffers, sizeof(*r->pending));
+	ASSERT(!r->headers || !r->pending, "failed to allocate rtp headers\n");
+	r->num_buffers = c->num_buffers;
+
+	/* pace at the rate of frames with headroom, unless it's given */
+	if (!r->rate && c->fps > 0)
+		r->rate = (double)(r->packets * RTP_HDR_SIZE + r->line_bytes *
+				r->height) * 8 * c->fps * RTP_RATE_HEADROOM;
+	if (r->rate) {
+		pacing = r->rate / 8;
+		setsockopt(d->fd, SOL_SOCKET, SO_MAX_PACING_RATE, &pacing,
+				sizeof(pacing));
+	}
+
+	for (i = 0; i < sizeof(r->ssrc); i++)
+		r->ssrc = r->ssrc << 8 ^ (timing_now() >> (i * 7) & 0xff);
+	r->ssrc ^= getpid();
+	pthread_mutex_init(&r->lock, NULL);
+
+	printf("rtp: %s/%s %u packets of %u bytes a frame, gso %s, "
+		"zero copy %s, pacing %.1f mbps\n", r->host, r->port,
+		r->packets, r->payload, r->gso ? "on" : "off",
+		r->zerocopy ? "on" : "off", r->rate / 1000000);
+	printf("rtp: a=rtpmap:%u raw/90000\n", RTP_PT);
+	printf("rtp: a=fmtp:%u sampling=%s; width=%u; height=%u; depth=8; "
+		"colorimetry=BT709; exactframerate=%.0f\n", RTP_PT,
+		r->fmt->sampling, r->width, r->height, c->fps > 0 ? c->fps : 30);
+}
+
+/* close socket */
+void rtp_exit(struct device *d)
+{
+	struct rtp *r = d->rtp;
+
+	free(r->headers);
+	r->headers = NULL;
+	free(r->pending);
+	r->pending = NULL;
+	r->num_pending = 0;
+	pthread_mutex_destroy(&r->lock);
+	close(d->fd);
+}
+
+static uint64_t rtp_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* pages spanned by len bytes at p */
+static unsigned int rtp_pages(const void *p, unsigned int len)
+{
+	uintptr_t start = (uintptr_t)p;
+
+	return (start + len - 1) / RTP_PAGE_SIZE - start / RTP_PAGE_SIZE + 1;
+}
+
+/* rtp header, extended sequence and a line segment header */
+static void rtp_header(struct rtp *r, uint8_t *h, uint32_t ts, bool marker,
+		unsigned int line, unsigned int offset, unsigned int len)
+{
+	h[0] = 0x80;
+	h[1] = (marker ? 0x80 : 0) | RTP_PT;
+	h[2] = r->seq >> 8;
+	h[3] = r->seq;
+	h[4] = ts >> 24;
+	h[5] = ts >> 16;
+	h[6] = ts >> 8;
+	h[7] = ts;
+	h[8] = r->ssrc >> 24;
+	h[9] = r->ssrc >> 16;
+	h[10] = r->ssrc >> 8;
+	h[11] = r->ssrc;
+	h[12] = r->seq >> 24;
+	h[13] = r->seq >> 16;
+	h[14] = len >> 8;
+	h[15] = len;
+	h[16] = line >> 8 & 0x7f;
+	h[17] = line;
+	h[18] = offset >> 8 & 0x7f;
+	h[19] = offset;
+	r->seq++;
+}
+
+/* read zero copy completions, with lock held */
+static void rtp_reap(struct rtp *r, int fd)
+{
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *ee;
+	uint32_t lo, hi, first, last;
+	unsigned int i;
+
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == SOL_IP &&
+					cm->cmsg_type == IP_RECVERR) ||
+				(cm->cmsg_level == SOL_IPV6 &&
+				 cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+			ee = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			/* sends lo to hi completed */
+			lo = ee->ee_info;
+			hi = ee->ee_data;
+			if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				r->copied += hi - lo + 1;
+			for (i = 0; i < r->num_pending; i++) {
+				first = lo > r->pending[i].first ?
+					lo : r->pending[i].first;
+				last = min(hi, r->pending[i].last);
+				if (first <= last)
+					r->pending[i].remaining -=
+						last - first + 1;
+			}
+		}
+	}
+}
+
+/* send n packets of size in iov, segmented by the kernel, with lock held.
+ * the lock is dropped while pacing, so completions can be reaped */
+static void rtp_flush(struct device *d, struct iovec *iov, unsigned int n,
+		unsigned int size)
+{
+	struct rtp *r = d->rtp;
+	char control[CMSG_SPACE(sizeof(uint16_t))];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct pollfd pfd;
+	struct timespec ts;
+	unsigned int i;
+	ssize_t ret;
+	uint64_t at;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n * 2;
+	if (n > 1) {
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cm = CMSG_FIRSTHDR(&msg);
+		cm->cmsg_level = IPPROTO_UDP;
+		cm->cmsg_type = UDP_SEGMENT;
+		cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		*(uint16_t *)CMSG_DATA(cm) = size;
+	}
+
+	while ((ret = sendmsg(d->fd, &msg, r->zerocopy ? MSG_ZEROCOPY : 0)) < 0) {
+		if (errno == ENOBUFS && r->zerocopy) {
+			/* out of option memory until sends complete */
+			pfd.fd = d->fd;
+			pfd.events = 0;
+			poll(&pfd, 1, 10);
+			rtp_reap(r, d->fd);
+		} else if (errno == EFAULT && r->zerocopy) {
+			/* pages of the mapping can't be pinned */
+			WARN_ON(1, "rtp: no zero copy from the mapping\n");
+			r->zerocopy = false;
+		} else if ((errno == EIO || errno == EMSGSIZE) && n > 1) {
+			/* the device can't segment, or the send pins too many
+			 * pages */
+			if (errno == EIO)
+				r->gso = false;
+			for (i = 0; i < n; i++)
+				rtp_flush(d, iov + i * 2, 1, size);
+			return;
+		} else if (errno == EINTR) {
+			/* interrupted before anything was sent */
+			continue;
+		} else if (errno == ECONNREFUSED) {
+			/* nobody listens, yet */
+			r->refused++;
+			return;
+		} else {
+			ASSERT(1, "rtp send failed: %s\n", ERRSTR);
+		}
+	}
+
+	if (r->zerocopy) {
+		/* the send holds the frame, the last one pending */
+		r->pending[r->num_pending - 1].last = r->next_id;
+		r->pending[r->num_pending - 1].remaining++;
+		r->next_id++;
+	}
+	r->sends++;
+	r->packets_sent += n;
+	r->bytes += ret;
+
+	/* spread the frame at the pacing rate */
+	r->frame_bytes += ret;
+	if (!r->rate)
+		return;
+	at = r->frame_ns + r->frame_bytes * 8 * 1000000000ull / r->rate;
+	if (at > timing_now()) {
+		ts.tv_sec = at / 1000000000ull;
+		ts.tv_nsec = at % 1000000000ull;
+		pthread_mutex_unlock(&r->lock);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		pthread_mutex_lock(&r->lock);
+	}
+}
+
+/* packetise and send frame, returns true if buffer can go back now, or
+ * false if it's held until rtp_complete() returns it */
+bool rtp_send(struct device *d, struct buffer *b)
+{
+	struct rtp *r = d->rtp;
+	struct iovec iov[RTP_MAX_SEGS * 2];
+	struct rtp_pending *pd;
+	uint8_t *data, *h, *p;
+	unsigned int line, off, len, pkt, n = 0, size = 0, frags = 0, f;
+	uint64_t cpu;
+	uint32_t first_id, rtp_ts;
+	bool last;
+
+	data = bridge_frame_map(b->s, &b->frame);
+	if (!data)
+		return true;
+
+	pthread_mutex_lock(&r->lock);
+	cpu = rtp_cpu_ns();
+	r->frame_ns = timing_now();
+	r->frame_bytes = 0;
+	if (!r->first_ns)
+		r->first_ns = r->frame_ns;
+	first_id = r->next_id;
+	/* the frame is pending from its first send, as completions can be
+	 * reaped while pacing, and held by one until all are sent */
+	pd = &r->pending[r->num_pending++];
+	pd->b = b;
+	pd->first = first_id;
+	pd->last = first_id;
+	pd->remaining = 1;
+	rtp_ts = (uint32_t)b->frame.timestamp.tv_sec * 90000 +
+		(uint32_t)b->frame.timestamp.tv_usec * 9 / 100;
+	h = r->headers + (size_t)b->index * r->packets * RTP_HDR_SIZE;
+
+	for (line = 0; line < r->height; line++) {
+		for (off = 0; off < r->line_bytes; off += len) {
+			len = min(r->payload, r->line_bytes - off);
+			pkt = len + RTP_HDR_SIZE;
+			last = line == r->height - 1 && off + len == r->line_bytes;
+
+			/* a send holds packets of a size, a shorter one last */
+			p = data + (size_t)line * r->bytesperline + off;
+			f = rtp_pages(h, RTP_HDR_SIZE) + rtp_pages(p, len);
+			if (n && (pkt > size || n == RTP_MAX_SEGS ||
+					(n + 1) * size > RTP_MAX_GSO_BYTES ||
+					(r->zerocopy && frags + f > RTP_MAX_FRAGS))) {
+				rtp_flush(d, iov, n, size);
+				n = 0;
+			}
+			if (!n) {
+				size = pkt;
+				frags = 0;
+			}
+			frags += f;
+
+			rtp_header(r, h, rtp_ts, last, line,
+					off / r->fmt->pg_bytes *
+					r->fmt->pg_pixels, len);
+			iov[n * 2].iov_base = h;
+			iov[n * 2].iov_len = RTP_HDR_SIZE;
+			iov[n * 2 + 1].iov_base = p;
+			iov[n * 2 + 1].iov_len = len;
+			h += RTP_HDR_SIZE;
+			n++;
+
+			if (pkt == size && r->gso && !last)
+				continue;
+			rtp_flush(d, iov, n, size);
+			n = 0;
+		}
+	}
+
+	r->frames++;
+	r->last_ns = timing_now();
+	r->cpu_ns += rtp_cpu_ns() - cpu;
+
+	/* zero copy sends of frame complete later, even if zero copy was
+	 * turned off after some of them. it goes back now if there were none,
+	 * or all completed and no frame is before it */
+	pd = &r->pending[r->num_pending - 1];
+	pd->remaining--;
+	if (r->next_id != first_id && (pd->remaining || r->num_pending > 1)) {
+		pthread_mutex_unlock(&r->lock);
+		return false;
+	}
+	r->num_pending--;
+	pthread_mutex_unlock(&r->lock);
+
+	return true;
+}
+
+/* read completions, returns buffers all of whose sends completed, in order
+ * and linked by next */
+struct buffer *rtp_complete(struct device *d)
+{
+	struct rtp *r = d->rtp;
+	struct buffer *done = NULL, **tail = &done;
+	socklen_t len = sizeof(int);
+	unsigned int n = 0;
+	int err;
+
+	/* clear an error of icmp, which otherwise keeps polling */
+	if (!getsockopt(d->fd, SOL_SOCKET, SO_ERROR, &err, &len) &&
+			err == ECONNREFUSED)
+		r->refused++;
+
+	pthread_mutex_lock(&r->lock);
+	rtp_reap(r, d->fd);
+	while (n < r->num_pending && !r->pending[n].remaining) {
+		*tail = r->pending[n].b;
+		tail = &r->pending[n].b->next;
+		*tail = NULL;
+		n++;
+	}
+	r->num_pending -= n;
+	memmove(r->pending, r->pending + n,
+			r->num_pending * sizeof(*r->pending));
+	pthread_mutex_unlock(&r->lock);
+
+	return done;
+}
+
+/* dump stats of rtp sink */
+void rtp_dump_stats(struct rtp *r, const char *who, FILE *fp)
+{
+	double secs = (r->last_ns - r->first_ns) / 1e9;
+	double gbits = r->bytes * 8 / 1e9;
+
+	fprintf(fp, "%s rtp frames %llu packets %llu sends %llu pps %.0f "
+			"gbps %.3f cpu_ms_per_gbit %.1f copied %llu "
+			"refused %llu\n", who,
+			(unsigned long long)r->frames,
+			(unsigned long long)r->packets_sent,
+			(unsigned long long)r->sends,
+			secs > 0 ? r->packets_sent / secs : 0,
+			secs > 0 ? gbits / secs : 0,
+			gbits > 0 ? r->cpu_ns / 1e6 / gbits : 0,
+			(unsigned long long)r->copied,
+			(unsigned long long)r->refused);
+}
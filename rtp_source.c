@@ -0,0 +1,433 @@
+/*
+ * RFC 4175 uncompressed video over RTP network source
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * The input of a stream can be a UDP port receiving what the rtp sink
+ * sends. Packets are received in batches with recvmmsg, coalesced by the
+ * kernel(UDP_GRO), and their line segments are copied straight into the
+ * mapping of the buffer exported by the output, at the line and offset
+ * they carry, so packets can come in any order. Up to two frames are
+ * assembled at once. A frame is passed on once all of its pixels arrived,
+ * and is abandoned when a newer one completes or a third one begins.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE		/* recvmmsg */
+
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <linux/udp.h>
+
+#include "bridge_priv.h"
+
+#define RTP_RX_MSG_SIZE		65536	/* bytes of a coalesced message */
+#define RTP_RX_MAX_BATCHES	8	/* batches read per poll */
+#define RTP_RX_RCVBUF		(32 << 20)	/* socket receive buffer */
+
+/* parse rtp source args(rtp/host/port) */
+int rtp_source_parse_args(struct rtp_source *r, const char *arg)
+{
+	char spec[128], *save;
+
+	if (rtp_parse_addr(arg, spec, sizeof(spec), r->host, sizeof(r->host),
+				r->port, sizeof(r->port), &save))
+		return -1;
+	if (strtok_r(NULL, ",", &save))
+		return -1;
+
+	return 0;
+}
+
+/* bind socket, and set up batches of messages */
+void rtp_source_init(struct device *d, struct config *c)
+{
+	struct rtp_source *r = d->rtpsrc;
+	unsigned int i;
+	int one = 1, size = RTP_RX_RCVBUF;
+
+	r->fmt = rtp_format(c->fourcc);
+	ASSERT(!r->fmt, "%.4s has no rfc 4175 sampling\n",
+			(char *)&c->fourcc);
+
+	d->fd = rtp_socket(r->host, r->port, true);
+	d->type = V4L2_CAP_VIDEO_CAPTURE;
+	d->num_planes = 1;
+
+	r->gro = !setsockopt(d->fd, IPPROTO_UDP, UDP_GRO, &one, sizeof(one));
+	setsockopt(d->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	/* frames are packed lines unless the output pads them */
+	r->width = c->format.width;
+	r->height = c->format.height;
+	r->line_bytes = r->width / r->fmt->pg_pixels * r->fmt->pg_bytes;
+	ASSERT(r->width % r->fmt->pg_pixels,
+		"lines of %u pixels don't fit rfc 4175\n", r->width);
+	if (c->num_planes != 1 || c->planes[0].bytesperline < r->line_bytes) {
+		c->num_planes = 1;
+		c->planes[0].bytesperline = r->line_bytes;
+		c->planes[0].sizeimage = r->line_bytes * r->height;
+	}
+	c->format.pixelformat = c->fourcc;
+	c->format.field = V4L2_FIELD_NONE;
+	c->format.bytesperline = c->planes[0].bytesperline;
+	c->format.sizeimage = c->planes[0].sizeimage;
+	r->bytesperline = c->planes[0].bytesperline;
+	r->sizeimage = c->planes[0].sizeimage;
+
+	r->ring = malloc(RTP_RX_BATCH * RTP_RX_MSG_SIZE);
+	r->msgs = calloc(RTP_RX_BATCH, sizeof(*r->msgs));
+	r->iovs = calloc(RTP_RX_BATCH, sizeof(*r->iovs));
+	r->controls = calloc(RTP_RX_BATCH, CMSG_SPACE(sizeof(int)));
+	r->free = calloc(c->num_buffers, sizeof(*r->free));
+	ASSERT(!r->ring || !r->msgs || !r->iovs || !r->controls || !r->free,
+			"failed to allocate rtp messages\n");
+	r->num_buffers = c->num_buffers;
+	for (i = 0; i < RTP_RX_BATCH; i++) {
+		r->iovs[i].iov_base = r->ring + i * RTP_RX_MSG_SIZE;
+		r->iovs[i].iov_len = RTP_RX_MSG_SIZE;
+	}
+	pthread_mutex_init(&r->lock, NULL);
+
+	printf("rtp: receiving %ux%u %s on %s/%s, gro %s\n", r->width,
+		r->height, r->fmt->sampling, r->host, r->port,
+		r->gro ? "on" : "off");
+}
+
+/* close socket */
+void rtp_source_exit(struct device *d)
+{
+	struct rtp_source *r = d->rtpsrc;
+
+	free(r->ring);
+	free(r->msgs);
+	free(r->iovs);
+	free(r->controls);
+	free(r->free);
+	r->ring = NULL;
+	r->msgs = NULL;
+	r->iovs = NULL;
+	r->controls = NULL;
+	r->free = NULL;
+	r->num_free = 0;
+	memset(r->frames, 0, sizeof(r->frames));
+	pthread_mutex_destroy(&r->lock);
+	close(d->fd);
+}
+
+static void rtp_source_queue_buffer(struct rtp_source *r, struct buffer *b)
+{
+	pthread_mutex_lock(&r->lock);
+	r->free[r->num_free++] = b;
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* give buffer to receive a frame into */
+void rtp_source_queue(struct device *d, struct buffer *b)
+{
+	rtp_source_queue_buffer(d->rtpsrc, b);
+}
+
+static struct buffer *rtp_source_get(struct rtp_source *r)
+{
+	struct buffer *b = NULL;
+	unsigned int i;
+
+	pthread_mutex_lock(&r->lock);
+	if (r->num_free) {
+		b = r->free[0];
+		for (i = 1; i < r->num_free; i++)
+			r->free[i - 1] = r->free[i];
+		r->num_free--;
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	return b;
+}
+
+/* give up on frame, its buffer goes back to free */
+static void rtp_source_abandon(struct rtp_source *r, struct rtp_assembly *a)
+{
+	if (a->b) {
+		r->incomplete++;
+		rtp_source_queue_buffer(r, a->b);
+	}
+	if (!r->done_valid || (int32_t)(a->ts - r->done_ts) > 0)
+		r->done_ts = a->ts;
+	r->done_valid = true;
+	a->used = false;
+}
+
+/* pass frame on, after giving up on older ones */
+static void rtp_source_complete(struct rtp_source *r, struct rtp_assembly *a,
+		uint64_t now, struct buffer ***tail)
+{
+	struct buffer *b = a->b;
+	unsigned int i;
+
+	for (i = 0; i < RTP_RX_FRAMES; i++)
+		if (r->frames[i].used && (int32_t)(r->frames[i].ts - a->ts) < 0)
+			rtp_source_abandon(r, &r->frames[i]);
+
+	b->bytesused[0] = r->sizeimage;
+	b->data_offset[0] = 0;
+	b->flags = 0;
+	b->field = V4L2_FIELD_NONE;
+	memset(&b->timecode, 0, sizeof(b->timecode));
+	b->frame.sequence = r->sequence++;
+	b->frame.timestamp.tv_sec = a->first_ns / 1000000000ull;
+	b->frame.timestamp.tv_usec = a->first_ns % 1000000000ull / 1000;
+	b->frame.dequeued_ns = now;
+	b->frame.bytesused = r->sizeimage;
+	b->frame.flags = 0;
+	r->frames_done++;
+
+	b->next = NULL;
+	**tail = b;
+	*tail = &b->next;
+
+	r->done_ts = a->ts;
+	r->done_valid = true;
+	a->used = false;
+}
+
+/* frame of timestamp, begun if it's new. returns NULL for a frame already
+ * passed on or given up */
+static struct rtp_assembly *rtp_source_frame(struct rtp_source *r,
+		uint32_t ts, uint64_t now)
+{
+	struct rtp_assembly *a = NULL;
+	unsigned int i;
+
+	if (r->done_valid && (int32_t)(ts - r->done_ts) <= 0)
+		return NULL;
+
+	for (i = 0; i < RTP_RX_FRAMES; i++) {
+		if (r->frames[i].used && r->frames[i].ts == ts)
+			return &r->frames[i];
+		if (!r->frames[i].used)
+			a = &r->frames[i];
+	}
+
+	/* a frame begins with all slots taken, the oldest is lost */
+	if (!a) {
+		a = &r->frames[0];
+		for (i = 1; i < RTP_RX_FRAMES; i++)
+			if ((int32_t)(r->frames[i].ts - a->ts) < 0)
+				a = &r->frames[i];
+		rtp_source_abandon(r, a);
+	}
+
+	a->used = true;
+	a->ts = ts;
+	a->received = 0;
+	a->first_ns = now;
+	a->data = NULL;
+	a->b = rtp_source_get(r);
+	if (a->b)
+		a->data = bridge_frame_map(a->b->s, &a->b->frame);
+	if (!a->b) {
+		r->dropped++;
+	} else if (!a->data) {
+		rtp_source_queue_buffer(r, a->b);
+		a->b = NULL;
+	}
+
+	return a;
+}
+
+/* check extended sequence against the window of received ones. returns
+ * false for a duplicate or one too old to tell */
+static bool rtp_source_seq(struct rtp_source *r, uint32_t seq)
+{
+	uint32_t bit = seq % RTP_RX_WINDOW, i;
+
+	if (!r->started) {
+		r->started = true;
+		r->first_seq = seq;
+		r->max_seq = seq;
+		memset(r->seen, 0, sizeof(r->seen));
+	} else if ((int32_t)(seq - r->max_seq) > 0) {
+		/* forget the sequences the window slides over */
+		if (seq - r->max_seq >= RTP_RX_WINDOW)
+			memset(r->seen, 0, sizeof(r->seen));
+		else
+			for (i = r->max_seq + 1; i != seq; i++)
+				r->seen[i % RTP_RX_WINDOW / 64] &=
+					~(1ull << (i % 64));
+		r->max_seq = seq;
+	} else if (r->max_seq - seq >= RTP_RX_WINDOW) {
+		r->late++;
+		return false;
+	} else if (r->seen[bit / 64] & 1ull << (bit % 64)) {
+		r->duplicates++;
+		return false;
+	} else {
+		r->reordered++;
+	}
+
+	r->seen[bit / 64] |= 1ull << (bit % 64);
+	return true;
+}
+
+/* place line segments of packet into its frame */
+static void rtp_source_packet(struct rtp_source *r, uint8_t *p,
+		unsigned int len, uint64_t now, struct buffer ***tail)
+{
+	struct rtp_assembly *a;
+	unsigned int hdr, n, i, seg, line, off;
+	uint8_t *h, *data, *end;
+	uint32_t seq, ts;
+
+	/* rtp header with csrcs, extension and padding */
+	if (len < 12 || (p[0] & 0xc0) != 0x80)
+		goto invalid;
+	hdr = 12 + (p[0] & 0xf) * 4;
+	if (p[0] & 0x10) {
+		if (len < hdr + 4)
+			goto invalid;
+		hdr += 4 + (p[hdr + 2] << 8 | p[hdr + 3]) * 4;
+	}
+	if (p[0] & 0x20) {
+		if (p[len - 1] > len)
+			goto invalid;
+		len -= p[len - 1];
+	}
+	if (len < hdr + 2 + 6)
+		goto invalid;
+	end = p + len;
+
+	seq = (uint32_t)p[hdr] << 24 | p[hdr + 1] << 16 | p[2] << 8 | p[3];
+	ts = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+	if (!rtp_source_seq(r, seq))
+		return;
+	r->packets++;
+
+	a = rtp_source_frame(r, ts, now);
+	if (!a) {
+		r->late++;
+		return;
+	}
+
+	/* segment headers until one without continuation, then their data */
+	h = p + hdr + 2;
+	for (n = 1; h + n * 6 <= end && h[n * 6 - 2] & 0x80; n++)
+		;
+	if (h + n * 6 > end)
+		goto invalid;
+	data = h + n * 6;
+	for (i = 0; i < n; i++, h += 6) {
+		seg = h[0] << 8 | h[1];
+		line = (h[2] & 0x7f) << 8 | h[3];
+		off = ((h[4] & 0x7f) << 8 | h[5]) / r->fmt->pg_pixels *
+			r->fmt->pg_bytes;
+		if (seg > end - data || line >= r->height ||
+				off + seg > r->line_bytes)
+			goto invalid;
+		if (a->data) {
+			memcpy(a->data + (size_t)line * r->bytesperline + off,
+					data, seg);
+			a->received += seg;
+			r->bytes += seg;
+		}
+		data += seg;
+	}
+
+	if (a->data && a->received >= r->line_bytes * r->height)
+		rtp_source_complete(r, a, now, tail);
+	return;
+
+invalid:
+	r->invalid++;
+}
+
+/* receive batches of packets, returns the frames completed by them linked
+ * by next, in order */
+struct buffer *rtp_source_receive(struct device *d)
+{
+	struct rtp_source *r = d->rtpsrc;
+	struct buffer *done = NULL, **tail = &done;
+	struct msghdr *mh;
+	struct cmsghdr *cm;
+	unsigned int i, batch, len, seg, off;
+	uint64_t now;
+	int n;
+
+	for (batch = 0; batch < RTP_RX_MAX_BATCHES; batch++) {
+		for (i = 0; i < RTP_RX_BATCH; i++) {
+			mh = &r->msgs[i].msg_hdr;
+			memset(mh, 0, sizeof(*mh));
+			mh->msg_iov = &r->iovs[i];
+			mh->msg_iovlen = 1;
+			mh->msg_control = r->controls +
+				i * CMSG_SPACE(sizeof(int));
+			mh->msg_controllen = CMSG_SPACE(sizeof(int));
+		}
+		n = recvmmsg(d->fd, r->msgs, RTP_RX_BATCH, MSG_DONTWAIT, NULL);
+		if (n <= 0)
+			break;
+
+		now = timing_now();
+		if (!r->first_ns)
+			r->first_ns = now;
+		r->last_ns = now;
+		for (i = 0; i < n; i++) {
+			mh = &r->msgs[i].msg_hdr;
+			len = r->msgs[i].msg_len;
+			r->recvs++;
+			if (mh->msg_flags & MSG_TRUNC) {
+				r->invalid++;
+				continue;
+			}
+
+			/* packets coalesced by gro are of a size */
+			seg = len;
+			for (cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm))
+				if (cm->cmsg_level == IPPROTO_UDP &&
+						cm->cmsg_type == UDP_GRO)
+					seg = *(int *)CMSG_DATA(cm);
+			for (off = 0; off < len && seg; off += seg)
+				rtp_source_packet(r, (uint8_t *)r->iovs[i].iov_base
+						+ off, min(seg, len - off), now,
+						&tail);
+		}
+		if (n < RTP_RX_BATCH)
+			break;
+	}
+
+	return done;
+}
+
+/* dump stats of rtp source */
+void rtp_source_dump_stats(struct rtp_source *r, const char *who, FILE *fp)
+{
+	double secs = (r->last_ns - r->first_ns) / 1e9;
+	uint64_t expected = r->started ? r->max_seq - r->first_seq + 1ull : 0;
+
+	fprintf(fp, "%s rtp_source frames %llu incomplete %llu dropped %llu "
+			"packets %llu lost %llu reordered %llu duplicates %llu "
+			"late %llu invalid %llu packets_per_recv %.1f "
+			"gbps %.3f\n", who,
+			(unsigned long long)r->frames_done,
+			(unsigned long long)r->incomplete,
+			(unsigned long long)r->dropped,
+			(unsigned long long)r->packets,
+			(unsigned long long)(expected > r->packets ?
+				expected - r->packets : 0),
+			(unsigned long long)r->reordered,
+			(unsigned long long)r->duplicates,
+			(unsigned long long)r->late,
+			(unsigned long long)r->invalid,
+			r->recvs ? (double)r->packets / r->recvs : 0,
+			secs > 0 ? r->bytes * 8 / 1e9 / secs : 0);
+}
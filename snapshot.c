@@ -0,0 +1,454 @@
+/*
+ * On demand snapshots of streams
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * A still image of the next forwarded frame of a stream, taken without
+ * holding up forwarding: the stream only hands the buffer to the thread of
+ * the snapshot and goes on. The buffer is queued to the output as usual,
+ * and is kept from going back to the input only until the thread has copied
+ * it into a private buffer, reading it while the output does. Conversion to
+ * RGB and writing the image as PPM or PNG happen after the buffer is given
+ * back.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/dma-buf.h>
+
+#include "bridge_priv.h"
+#include "kernel.h"
+
+#define PNG_STORED_MAX		65535	/* bytes of a stored deflate block */
+
+/* parse path of images(prefix.ppm or prefix.png) */
+int snapshot_parse_args(struct snapshot *sn, const char *path)
+{
+	const char *ext = strrchr(path, '.');
+	size_t len = strlen(path);
+
+	sn->png = ext && !strcmp(ext, ".png");
+	if (sn->png || (ext && !strcmp(ext, ".ppm")))
+		len = ext - path;
+	if (!len || len >= sizeof(sn->prefix))
+		return -1;
+	memcpy(sn->prefix, path, len);
+	sn->prefix[len] = '\0';
+
+	return 0;
+}
+
+/* convert a frame to packed RGB, returns -1 for formats it doesn't know */
+static int snapshot_rgb(const struct v4l2_pix_format *f, const uint8_t *src,
+		uint8_t *rgb)
+{
+	const uint8_t *line, *uv;
+	unsigned int x, y, i;
+	int c, d, e;
+
+#define CLIP(v)		((v) < 0 ? 0 : (v) > 255 ? 255 : (v))
+	/* bt.601 limited range */
+#define YUV(py, pu, pv, dst) do {					\
+		c = 298 * ((py) - 16);					\
+		d = (pu) - 128;						\
+		e = (pv) - 128;						\
+		(dst)[0] = CLIP((c + 409 * e + 128) >> 8);		\
+		(dst)[1] = CLIP((c - 100 * d - 208 * e + 128) >> 8);	\
+		(dst)[2] = CLIP((c + 516 * d + 128) >> 8);		\
+	} while (0)
+
+	for (y = 0; y < f->height; y++) {
+		line = src + y * f->bytesperline;
+		for (x = 0; x < f->width; x++, rgb += 3) {
+			switch (f->pixelformat) {
+			case V4L2_PIX_FMT_YUYV:
+				i = (x & ~1) * 2;
+				YUV(line[x * 2], line[i + 1], line[i + 3], rgb);
+				break;
+			case V4L2_PIX_FMT_UYVY:
+				i = (x & ~1) * 2;
+				YUV(line[x * 2 + 1], line[i], line[i + 2], rgb);
+				break;
+			case V4L2_PIX_FMT_NV12:
+			case V4L2_PIX_FMT_NV21:
+				uv = src + (f->height + y / 2) * f->bytesperline +
+					(x & ~1);
+				if (f->pixelformat == V4L2_PIX_FMT_NV12)
+					YUV(line[x], uv[0], uv[1], rgb);
+				else
+					YUV(line[x], uv[1], uv[0], rgb);
+				break;
+			case V4L2_PIX_FMT_GREY:
+				rgb[0] = rgb[1] = rgb[2] = line[x];
+				break;
+			case V4L2_PIX_FMT_RGB24:
+				memcpy(rgb, line + x * 3, 3);
+				break;
+			case V4L2_PIX_FMT_BGR24:
+				rgb[0] = line[x * 3 + 2];
+				rgb[1] = line[x * 3 + 1];
+				rgb[2] = line[x * 3];
+				break;
+			case V4L2_PIX_FMT_XBGR32:
+			case V4L2_PIX_FMT_ABGR32:
+				/* b, g, r, x in memory */
+				rgb[0] = line[x * 4 + 2];
+				rgb[1] = line[x * 4 + 1];
+				rgb[2] = line[x * 4];
+				break;
+			case V4L2_PIX_FMT_XRGB32:
+			case V4L2_PIX_FMT_ARGB32:
+				/* x, r, g, b in memory */
+				memcpy(rgb, line + x * 4 + 1, 3);
+				break;
+			case V4L2_PIX_FMT_RGBX32:
+			case V4L2_PIX_FMT_RGBA32:
+				memcpy(rgb, line + x * 4, 3);
+				break;
+			default:
+				return -1;
+			}
+		}
+	}
+#undef YUV
+#undef CLIP
+
+	return 0;
+}
+
+static uint32_t png_crc(const uint32_t *table, uint32_t crc,
+		const uint8_t *p, size_t len)
+{
+	while (len--)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static void png_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* write a chunk of type with len bytes of data */
+static void png_chunk(FILE *fp, const uint32_t *table, const char *type,
+		const uint8_t *data, size_t len)
+{
+	uint8_t hdr[8], crc[4];
+
+	png_be32(hdr, len);
+	memcpy(hdr + 4, type, 4);
+	png_be32(crc, png_crc(table, png_crc(table, ~0u, hdr + 4, 4), data,
+				len) ^ ~0u);
+	fwrite(hdr, 1, sizeof(hdr), fp);
+	fwrite(data, 1, len, fp);
+	fwrite(crc, 1, sizeof(crc), fp);
+}
+
+/* write rgb as png with stored(uncompressed) deflate blocks, there's no
+ * zlib dependency and nothing to wait for */
+static int snapshot_write_png(FILE *fp, const uint8_t *rgb, unsigned int w,
+		unsigned int h)
+{
+	static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n',
+		0x1a, '\n' };
+	uint8_t ihdr[13] = { 0 };
+	uint32_t table[256], crc, a = 1, b = 0;
+	size_t raw = (size_t)(w * 3 + 1) * h, len, left, n, off;
+	uint8_t *idat, *p, *row;
+	unsigned int i, k, y;
+
+	for (i = 0; i < 256; i++) {
+		for (crc = i, k = 0; k < 8; k++)
+			crc = crc & 1 ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+		table[i] = crc;
+	}
+
+	len = 2 + raw + 5 * ((raw + PNG_STORED_MAX - 1) / PNG_STORED_MAX) + 4;
+	idat = malloc(len);
+	row = malloc(w * 3 + 1);
+	if (!idat || !row) {
+		free(idat);
+		free(row);
+		return -1;
+	}
+
+	/* zlib stream of filter type 0 lines */
+	p = idat;
+	*p++ = 0x78;
+	*p++ = 0x01;
+	left = 0;
+	for (y = 0, off = 0; y < h || left; ) {
+		if (!left) {
+			row[0] = 0;
+			memcpy(row + 1, rgb + (size_t)y * w * 3, w * 3);
+			left = w * 3 + 1;
+			y++;
+		}
+		if (off % PNG_STORED_MAX == 0) {
+			n = min(raw - off, (size_t)PNG_STORED_MAX);
+			*p++ = raw - off == n;
+			*p++ = n;
+			*p++ = n >> 8;
+			*p++ = ~n;
+			*p++ = ~n >> 8;
+		}
+		n = min(left, PNG_STORED_MAX - off % PNG_STORED_MAX);
+		memcpy(p, row + (w * 3 + 1 - left), n);
+		for (i = 0; i < n; i++) {
+			a = (a + p[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		p += n;
+		off += n;
+		left -= n;
+	}
+	png_be32(p, b << 16 | a);
+
+	png_be32(ihdr, w);
+	png_be32(ihdr + 4, h);
+	ihdr[8] = 8;			/* bits per sample */
+	ihdr[9] = 2;			/* rgb */
+	fwrite(sig, 1, sizeof(sig), fp);
+	png_chunk(fp, table, "IHDR", ihdr, sizeof(ihdr));
+	png_chunk(fp, table, "IDAT", idat, len);
+	png_chunk(fp, table, "IEND", NULL, 0);
+
+	free(idat);
+	free(row);
+
+	return 0;
+}
+
+/* convert the copy and write it */
+static int snapshot_write(struct snapshot *sn, unsigned int sequence)
+{
+	const struct v4l2_pix_format *f = &sn->format;
+	char path[320];
+	uint8_t *rgb;
+	FILE *fp;
+	int ret;
+
+	rgb = malloc((size_t)f->width * f->height * 3);
+	if (WARN_ON(!rgb, "failed to allocate snapshot\n"))
+		return -1;
+	if (WARN_ON(snapshot_rgb(f, sn->copy, rgb) < 0,
+				"can't convert %.4s for a snapshot\n",
+				(char *)&f->pixelformat)) {
+		free(rgb);
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s-%u.%s", sn->prefix, sequence,
+			sn->png ? "png" : "ppm");
+	fp = fopen(path, "wb");
+	if (WARN_ON(!fp, "failed to open %s: %s\n", path, ERRSTR)) {
+		free(rgb);
+		return -1;
+	}
+	if (sn->png) {
+		ret = snapshot_write_png(fp, rgb, f->width, f->height);
+	} else {
+		fprintf(fp, "P6\n%u %u\n255\n", f->width, f->height);
+		ret = fwrite(rgb, (size_t)f->width * 3, f->height, fp) ==
+			f->height ? 0 : -1;
+	}
+	if (fclose(fp))
+		ret = -1;
+	free(rgb);
+	if (WARN_ON(ret < 0, "failed to write %s\n", path))
+		return -1;
+	printf("%s: snapshot\n", path);
+
+	return 0;
+}
+
+/* copy buffer into the private one, reading along with the output */
+static int snapshot_copy(struct snapshot *sn, struct buffer *b)
+{
+	struct dma_buf_sync sync = {
+		.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ,
+	};
+	size_t size = b->frame.size;
+	void *data;
+
+	if (size > sn->size) {
+		free(sn->copy);
+		sn->copy = malloc(size);
+		sn->size = sn->copy ? size : 0;
+		if (WARN_ON(!sn->copy, "failed to allocate snapshot\n"))
+			return -1;
+	}
+
+	data = mmap(NULL, size, PROT_READ, MAP_SHARED, b->dbuf_fd[0], 0);
+	if (WARN_ON(data == MAP_FAILED, "failed to map snapshot: %s\n",
+				ERRSTR))
+		return -1;
+	WARN_ON(ioctl(b->dbuf_fd[0], DMA_BUF_IOCTL_SYNC, &sync) < 0 &&
+			errno != ENOTTY, "DMA_BUF_IOCTL_SYNC failed: %s\n",
+			ERRSTR);
+	kernel.copy(sn->copy, size, data, size, size, 1);
+	sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+	WARN_ON(ioctl(b->dbuf_fd[0], DMA_BUF_IOCTL_SYNC, &sync) < 0 &&
+			errno != ENOTTY, "DMA_BUF_IOCTL_SYNC failed: %s\n",
+			ERRSTR);
+	munmap(data, size);
+
+	return 0;
+}
+
+static void *snapshot_run(void *data)
+{
+	struct snapshot *sn = data;
+	struct buffer *b;
+	unsigned int sequence;
+	uint64_t start;
+	int ret;
+
+	pthread_mutex_lock(&sn->lock);
+	while (1) {
+		while (!sn->b && !sn->stop)
+			pthread_cond_wait(&sn->cond, &sn->lock);
+		if (!sn->b)
+			break;
+		b = sn->b;
+		sn->format = *sn->frame_format;
+		sequence = sn->sequence;
+		pthread_mutex_unlock(&sn->lock);
+
+		ret = snapshot_copy(sn, b);
+
+		/* give the buffer back if it already came back from output */
+		pthread_mutex_lock(&sn->lock);
+		if (sn->returned)
+			sn->release(sn->priv, b);
+		sn->b = NULL;
+		sn->hold_ns += timing_now() - sn->taken_ns;
+		pthread_cond_broadcast(&sn->cond);
+		pthread_mutex_unlock(&sn->lock);
+
+		start = timing_now();
+		if (!ret)
+			ret = snapshot_write(sn, sequence);
+
+		pthread_mutex_lock(&sn->lock);
+		if (ret < 0)
+			sn->failed++;
+		else
+			sn->written++;
+		sn->write_ns += timing_now() - start;
+	}
+	pthread_mutex_unlock(&sn->lock);
+
+	return NULL;
+}
+
+/* start thread, release gives back buffers held past their return from
+ * output */
+void snapshot_start(struct snapshot *sn,
+		void (*release)(void *priv, struct buffer *b), void *priv)
+{
+	int ret;
+
+	pthread_mutex_init(&sn->lock, NULL);
+	pthread_cond_init(&sn->cond, NULL);
+	sn->release = release;
+	sn->priv = priv;
+	sn->stop = false;
+	ret = pthread_create(&sn->thread, NULL, snapshot_run, sn);
+	ASSERT(ret, "failed to create snapshot thread: %s\n", strerror(ret));
+}
+
+/* finish a snapshot in progress and stop thread */
+void snapshot_stop(struct snapshot *sn)
+{
+	pthread_mutex_lock(&sn->lock);
+	sn->stop = true;
+	pthread_cond_broadcast(&sn->cond);
+	pthread_mutex_unlock(&sn->lock);
+	pthread_join(sn->thread, NULL);
+
+	pthread_mutex_destroy(&sn->lock);
+	pthread_cond_destroy(&sn->cond);
+	free(sn->copy);
+	sn->copy = NULL;
+	sn->size = 0;
+}
+
+/* snapshot the next forwarded frame, safe to call from signal handlers */
+void snapshot_arm(struct snapshot *sn)
+{
+	__sync_lock_test_and_set(&sn->armed, 1);
+}
+
+/* frame of format is being forwarded in b, hand it to the thread if armed */
+void snapshot_take(struct snapshot *sn, struct buffer *b,
+		const struct v4l2_pix_format *format, unsigned int sequence)
+{
+	if (!sn->armed)
+		return;
+
+	pthread_mutex_lock(&sn->lock);
+	if (!sn->b && __sync_lock_test_and_set(&sn->armed, 0)) {
+		sn->b = b;
+		sn->frame_format = format;
+		sn->sequence = sequence;
+		sn->returned = false;
+		sn->taken_ns = timing_now();
+		sn->taken++;
+		pthread_cond_broadcast(&sn->cond);
+	}
+	pthread_mutex_unlock(&sn->lock);
+}
+
+/* frame is back from output, returns true if it's kept until copied */
+bool snapshot_hold(struct snapshot *sn, struct buffer *b)
+{
+	bool held = false;
+
+	if (sn->b != b)
+		return false;
+
+	pthread_mutex_lock(&sn->lock);
+	if (sn->b == b) {
+		sn->returned = true;
+		sn->held++;
+		held = true;
+	}
+	pthread_mutex_unlock(&sn->lock);
+
+	return held;
+}
+
+/* wait until no buffer is held, before the devices go away */
+void snapshot_drain(struct snapshot *sn)
+{
+	pthread_mutex_lock(&sn->lock);
+	while (sn->b)
+		pthread_cond_wait(&sn->cond, &sn->lock);
+	pthread_mutex_unlock(&sn->lock);
+}
+
+/* dump stats of snapshots */
+void snapshot_dump_stats(struct snapshot *sn, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s snapshot taken %llu written %llu failed %llu "
+			"held %llu hold_us %.1f write_ms %.1f\n", who,
+			(unsigned long long)sn->taken,
+			(unsigned long long)sn->written,
+			(unsigned long long)sn->failed,
+			(unsigned long long)sn->held,
+			sn->taken ? sn->hold_ns / 1e3 / sn->taken : 0,
+			sn->taken ? sn->write_ns / 1e6 / sn->taken : 0);
+}
@@ -0,0 +1,139 @@
+/*
+ * Startup and teardown phase timing for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "timing.h"
+
+static const char *phase_names[PHASE_MAX] = {
+	[PHASE_PARSE]		= "parse",
+	[PHASE_MEDIA]		= "media",
+	[PHASE_OPEN]		= "open",
+	[PHASE_QUERYCAP]	= "querycap",
+	[PHASE_FORMAT]		= "format",
+	[PHASE_REQBUFS]		= "reqbufs",
+	[PHASE_EXPBUF]		= "expbuf",
+	[PHASE_QBUF]		= "qbuf",
+	[PHASE_STREAMON]	= "streamon",
+	[PHASE_FIRST_FRAME]	= "first_frame",
+	[PHASE_STREAMOFF]	= "streamoff",
+	[PHASE_CLOSE]		= "close",
+	[PHASE_SHUTDOWN]	= "shutdown",
+};
+
+static uint64_t epoch;
+
+/* monotonic time in ns, safe to call from signal handlers */
+uint64_t timing_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* set the reference point of all timestamps(process start) */
+void timing_epoch(void)
+{
+	epoch = timing_now();
+}
+
+const char *timing_phase_name(enum timing_phase phase)
+{
+	return phase < PHASE_MAX ? phase_names[phase] : "unknown";
+}
+
+/* parse phase name, returns phase or -1 */
+int timing_phase_parse(const char *name)
+{
+	int i;
+
+	for (i = 0; i < PHASE_MAX; i++)
+		if (!strcmp(name, phase_names[i]))
+			return i;
+	return -1;
+}
+
+void timing_begin(struct timing *t, enum timing_phase phase)
+{
+	t->start[phase] = timing_now();
+}
+
+/* end a phase, phases which never began are ignored */
+void timing_end(struct timing *t, enum timing_phase phase)
+{
+	uint64_t now = timing_now();
+
+	if (!t->start[phase])
+		return;
+
+	t->ns[phase] += now - t->start[phase];
+	t->at[phase] = now - epoch;
+}
+
+/* dump completed phases: <who> <phase> <duration ns> <end ns from epoch> */
+void timing_dump(struct timing *t, const char *who, FILE *fp)
+{
+	int i;
+
+	for (i = 0; i < PHASE_MAX; i++) {
+		if (!t->at[i])
+			continue;
+		fprintf(fp, "%s %s %llu %llu\n", who, phase_names[i],
+				(unsigned long long)t->ns[i],
+				(unsigned long long)t->at[i]);
+	}
+}
+
+/* bucket of ns: exact below 16, then 16 per power of 2 */
+static unsigned int latency_bucket(uint64_t ns)
+{
+	unsigned int e;
+
+	if (ns < 16)
+		return ns;
+	e = 63 - __builtin_clzll(ns);
+	return (e - 3) * 16 + ((ns >> (e - 4)) & 15);
+}
+
+/* lowest ns of bucket */
+static uint64_t latency_value(unsigned int bucket)
+{
+	if (bucket < 16)
+		return bucket;
+	return (uint64_t)(16 + bucket % 16) << (bucket / 16 - 1);
+}
+
+/* add a sample, from any thread */
+void latency_add(struct latency *l, uint64_t ns)
+{
+	__sync_add_and_fetch(&l->buckets[latency_bucket(ns)], 1);
+	__sync_add_and_fetch(&l->count, 1);
+	if (ns > l->max)
+		l->max = ns;
+}
+
+/* p(0 to 1) percentile in ns, within 1/16 of it */
+uint64_t latency_percentile(struct latency *l, double p)
+{
+	uint64_t sum = 0, rank = l->count * p;
+	unsigned int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		sum += l->buckets[i];
+		if (sum > rank)
+			return latency_value(i);
+	}
+
+	return l->max;
+}
@@ -0,0 +1,65 @@
+/*
+ * Startup and teardown phase timing for the V4L2 bridge
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* phases of a stream life cycle */
+enum timing_phase {
+	PHASE_PARSE,			/* argument parsing(manager) */
+	PHASE_MEDIA,			/* media graph links and formats */
+	PHASE_OPEN,			/* open device nodes */
+	PHASE_QUERYCAP,			/* VIDIOC_QUERYCAP */
+	PHASE_FORMAT,			/* format negotiation */
+	PHASE_REQBUFS,			/* VIDIOC_REQBUFS */
+	PHASE_EXPBUF,			/* VIDIOC_EXPBUF of all buffers */
+	PHASE_QBUF,			/* first VIDIOC_QBUF of all buffers */
+	PHASE_STREAMON,			/* VIDIOC_STREAMON of both devices */
+	PHASE_FIRST_FRAME,		/* streamon to first frame forwarded */
+	PHASE_STREAMOFF,		/* manager_off() to VIDIOC_STREAMOFF */
+	PHASE_CLOSE,			/* close device nodes */
+	PHASE_SHUTDOWN,			/* manager_off() to manager_exit()(manager) */
+	PHASE_MAX,
+};
+
+/* timing of phases */
+struct timing {
+	uint64_t start[PHASE_MAX];	/* last start of phase */
+	uint64_t ns[PHASE_MAX];		/* total time spent in phase */
+	uint64_t at[PHASE_MAX];		/* last end of phase from epoch */
+};
+
+/* distribution of latencies, in buckets of 1/16 of a power of 2 */
+#define LATENCY_BUCKETS		1024
+
+struct latency {
+	uint32_t buckets[LATENCY_BUCKETS];	/* count per bucket */
+	uint64_t count;			/* samples */
+	uint64_t max;			/* longest sample */
+};
+
+uint64_t timing_now(void);
+void timing_epoch(void);
+const char *timing_phase_name(enum timing_phase phase);
+int timing_phase_parse(const char *name);
+
+void timing_begin(struct timing *t, enum timing_phase phase);
+void timing_end(struct timing *t, enum timing_phase phase);
+void timing_dump(struct timing *t, const char *who, FILE *fp);
+
+void latency_add(struct latency *l, uint64_t ns);
+uint64_t latency_percentile(struct latency *l, double p);
+
+#endif /* __TIMING_H__ */
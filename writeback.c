@@ -0,0 +1,517 @@
+/*
+ * DRM writeback connector source
+ *
+ * Copyright (C) 2013 Xilinx, Inc. All rights reserved.
+ *
+ * Description:
+ *
+ * The input of a stream can be a writeback connector of a DRM device, which
+ * writes what a crtc composites into a framebuffer. The source allocates
+ * dumb buffers, exports them to the output as dmabufs, and attaches one per
+ * atomic commit as WRITEBACK_FB_ID. A commit goes out at every vblank while
+ * buffers are queued, and a buffer is passed on once the out fence of its
+ * job signals.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "bridge_priv.h"
+
+#define WRITEBACK_TIMEOUT_MS	100	/* for a job with no later flip */
+
+/* names of properties, in order of enum writeback_prop */
+static const struct {
+	const char *name;
+	uint32_t type;
+} writeback_props[WRITEBACK_NUM_PROPS] = {
+	[WRITEBACK_CONN_CRTC_ID] = {"CRTC_ID", DRM_MODE_OBJECT_CONNECTOR},
+	[WRITEBACK_CONN_FB_ID] = {"WRITEBACK_FB_ID",
+		DRM_MODE_OBJECT_CONNECTOR},
+	[WRITEBACK_CONN_FENCE] = {"WRITEBACK_OUT_FENCE_PTR",
+		DRM_MODE_OBJECT_CONNECTOR},
+	[WRITEBACK_CRTC_MODE_ID] = {"MODE_ID", DRM_MODE_OBJECT_CRTC},
+	[WRITEBACK_CRTC_ACTIVE] = {"ACTIVE", DRM_MODE_OBJECT_CRTC},
+};
+
+/* parse writeback args(/dev/dri/cardN[,connector=id]) */
+int writeback_parse_args(struct writeback *wb, const char *arg)
+{
+	char spec[64], *opt, *save, *e;
+
+	if (strlen(arg) >= sizeof(spec))
+		return -1;
+	strcpy(spec, arg);
+
+	opt = strtok_r(spec, ",", &save);
+	if (strlen(opt) >= sizeof(wb->path))
+		return -1;
+	strcpy(wb->path, opt);
+
+	while ((opt = strtok_r(NULL, ",", &save))) {
+		if (strncmp(opt, "connector=", 10))
+			return -1;
+		wb->connector_id = strtoul(opt + 10, &e, 0);
+		if (*e)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* bits per pixel of packed formats, 0 for others */
+static unsigned int writeback_bpp(uint32_t format)
+{
+	switch (format) {
+	case DRM_FORMAT_XRGB8888:
+	case DRM_FORMAT_ARGB8888:
+	case DRM_FORMAT_BGRX8888:
+		return 32;
+	case DRM_FORMAT_YUYV:
+	case DRM_FORMAT_UYVY:
+	case DRM_FORMAT_RGB565:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+/* check format against WRITEBACK_PIXEL_FORMATS of connector */
+static bool writeback_takes(struct device *d, uint32_t format)
+{
+	struct writeback *wb = d->wb;
+	drmModePropertyBlobPtr blob;
+	uint64_t id = 0;
+	uint32_t *formats;
+	unsigned int i;
+	bool found = false;
+
+	kms_prop(d->fd, wb->connector_id, DRM_MODE_OBJECT_CONNECTOR,
+			"WRITEBACK_PIXEL_FORMATS", &id);
+	blob = id ? drmModeGetPropertyBlob(d->fd, id) : NULL;
+	if (!blob)
+		return false;
+	formats = blob->data;
+	for (i = 0; i < blob->length / sizeof(*formats); i++)
+		if (formats[i] == format)
+			found = true;
+	drmModeFreePropertyBlob(blob);
+
+	return found;
+}
+
+/* writeback connector(or the given one) and its crtc, an active one first */
+static void writeback_find_pipe(struct device *d)
+{
+	struct writeback *wb = d->wb;
+	drmModeResPtr res;
+	drmModeConnectorPtr conn = NULL;
+	drmModeEncoderPtr enc;
+	drmModeCrtcPtr crtc;
+	drmModeModeInfo mode;
+	unsigned int i, j;
+	int ret;
+
+	res = drmModeGetResources(d->fd);
+	ASSERT(!res, "%s has no kms resources\n", wb->path);
+
+	for (i = 0; i < res->count_connectors; i++) {
+		conn = drmModeGetConnector(d->fd, res->connectors[i]);
+		if (!conn)
+			continue;
+		if (conn->connector_type == DRM_MODE_CONNECTOR_WRITEBACK &&
+				(!wb->connector_id ||
+				 conn->connector_id == wb->connector_id))
+			break;
+		drmModeFreeConnector(conn);
+		conn = NULL;
+	}
+	ASSERT(!conn, "no writeback connector on %s\n", wb->path);
+	wb->connector_id = conn->connector_id;
+
+	/* the crtc it can write back, which is compositing if any is */
+	wb->crtc_id = 0;
+	memset(&mode, 0, sizeof(mode));
+	for (i = 0; i < conn->count_encoders; i++) {
+		enc = drmModeGetEncoder(d->fd, conn->encoders[i]);
+		if (!enc)
+			continue;
+		for (j = 0; j < res->count_crtcs; j++) {
+			if (!(enc->possible_crtcs & (1 << j)))
+				continue;
+			crtc = drmModeGetCrtc(d->fd, res->crtcs[j]);
+			if (!crtc)
+				continue;
+			if (!wb->crtc_id || crtc->mode_valid) {
+				wb->crtc_id = crtc->crtc_id;
+				mode = crtc->mode;
+			}
+			drmModeFreeCrtc(crtc);
+			if (mode.hdisplay)
+				break;
+		}
+		drmModeFreeEncoder(enc);
+	}
+	ASSERT(!wb->crtc_id, "no crtc for connector %u\n", wb->connector_id);
+
+	/* an inactive crtc is set up in the preferred mode of connector */
+	wb->modeset = !mode.hdisplay;
+	if (wb->modeset) {
+		ASSERT(!conn->count_modes, "no mode of connector %u\n",
+				wb->connector_id);
+		mode = conn->modes[0];
+		for (i = 0; i < conn->count_modes; i++)
+			if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED)
+				mode = conn->modes[i];
+		ret = drmModeCreatePropertyBlob(d->fd, &mode, sizeof(mode),
+				&wb->mode_blob);
+		ASSERT(ret < 0, "failed to create mode blob: %s\n", ERRSTR);
+	}
+	wb->mode_w = mode.hdisplay;
+	wb->mode_h = mode.vdisplay;
+
+	drmModeFreeConnector(conn);
+	drmModeFreeResources(res);
+}
+
+/* open device, find the connector and set config to the size of its crtc */
+void writeback_init(struct device *d, struct config *c)
+{
+	struct writeback *wb = d->wb;
+	struct drm_mode_create_dumb dumb;
+	struct drm_gem_close gc;
+	uint32_t obj;
+	unsigned int i;
+	int ret;
+
+	timing_begin(d->timing, PHASE_OPEN);
+	d->fd = kms_open(wb->path, true);
+	timing_end(d->timing, PHASE_OPEN);
+	d->type = V4L2_CAP_VIDEO_CAPTURE;
+	d->num_planes = 1;
+
+	timing_begin(d->timing, PHASE_FORMAT);
+	wb->format = kms_format(c->fourcc);
+	wb->bpp = writeback_bpp(wb->format);
+	ASSERT(!wb->bpp, "%.4s can't be written back\n", (char *)&c->fourcc);
+	writeback_find_pipe(d);
+	ASSERT(!writeback_takes(d, wb->format), "connector %u doesn't take "
+			"%.4s\n", wb->connector_id, (char *)&c->fourcc);
+	for (i = 0; i < WRITEBACK_NUM_PROPS; i++) {
+		obj = writeback_props[i].type == DRM_MODE_OBJECT_CRTC ?
+			wb->crtc_id : wb->connector_id;
+		wb->props[i] = kms_prop(d->fd, obj, writeback_props[i].type,
+				writeback_props[i].name, NULL);
+		ASSERT(!wb->props[i], "no property %s of object %u\n",
+				writeback_props[i].name, obj);
+	}
+
+	/* frames are the size of crtc, with the pitch of dumb buffers */
+	memset(&dumb, 0, sizeof(dumb));
+	dumb.width = wb->mode_w;
+	dumb.height = wb->mode_h;
+	dumb.bpp = wb->bpp;
+	ret = drmIoctl(d->fd, DRM_IOCTL_MODE_CREATE_DUMB, &dumb);
+	ASSERT(ret < 0, "failed to create dumb buffer: %s\n", ERRSTR);
+	memset(&gc, 0, sizeof(gc));
+	gc.handle = dumb.handle;
+	drmIoctl(d->fd, DRM_IOCTL_GEM_CLOSE, &gc);
+
+	if (c->format.width != wb->mode_w || c->format.height != wb->mode_h)
+		printf("writeback: %ux%u of crtc instead of %ux%u\n",
+			wb->mode_w, wb->mode_h, c->format.width,
+			c->format.height);
+	c->format.width = wb->mode_w;
+	c->format.height = wb->mode_h;
+	c->format.pixelformat = c->fourcc;
+	c->format.field = V4L2_FIELD_NONE;
+	c->format.bytesperline = dumb.pitch;
+	c->format.sizeimage = dumb.pitch * wb->mode_h;
+	c->num_planes = 1;
+	c->planes[0].bytesperline = dumb.pitch;
+	c->planes[0].sizeimage = c->format.sizeimage;
+	wb->sizeimage = c->format.sizeimage;
+	timing_end(d->timing, PHASE_FORMAT);
+
+	wb->num_fbs = c->num_buffers;
+	wb->fbs = calloc(wb->num_fbs, sizeof(*wb->fbs));
+	wb->waiting = calloc(wb->num_fbs, sizeof(*wb->waiting));
+	wb->inflight = calloc(wb->num_fbs, sizeof(*wb->inflight));
+	ASSERT(!wb->fbs || !wb->waiting || !wb->inflight,
+			"failed to allocate writeback buffers\n");
+	pthread_mutex_init(&wb->lock, NULL);
+	wb->lat_min = UINT64_MAX;
+
+	printf("writeback: %s connector %u crtc %u, %ux%u %.4s%s\n",
+		wb->path, wb->connector_id, wb->crtc_id, wb->mode_w,
+		wb->mode_h, (char *)&c->fourcc,
+		wb->modeset ? ", crtc set up" : "");
+}
+
+/* allocate a dumb buffer as framebuffer, and export it */
+void writeback_prepare(struct device *d, struct buffer *b)
+{
+	struct writeback *wb = d->wb;
+	struct writeback_fb *fb = &wb->fbs[b->index];
+	struct drm_mode_create_dumb dumb;
+	uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+	int ret;
+
+	memset(&dumb, 0, sizeof(dumb));
+	dumb.width = wb->mode_w;
+	dumb.height = wb->mode_h;
+	dumb.bpp = wb->bpp;
+	ret = drmIoctl(d->fd, DRM_IOCTL_MODE_CREATE_DUMB, &dumb);
+	ASSERT(ret < 0, "failed to create dumb buffer: %s\n", ERRSTR);
+	fb->handle = dumb.handle;
+	fb->fence = -1;
+
+	handles[0] = dumb.handle;
+	pitches[0] = dumb.pitch;
+	ret = drmModeAddFB2(d->fd, wb->mode_w, wb->mode_h, wb->format,
+			handles, pitches, offsets, &fb->fb_id, 0);
+	ASSERT(ret < 0, "ADDFB2 failed: %s\n", ERRSTR);
+
+	ret = drmPrimeHandleToFD(d->fd, dumb.handle, DRM_CLOEXEC | DRM_RDWR,
+			&b->dbuf_fd[0]);
+	ASSERT(ret < 0, "failed to export dumb buffer: %s\n", ERRSTR);
+}
+
+/* remove framebuffers and close device */
+void writeback_exit(struct device *d)
+{
+	struct writeback *wb = d->wb;
+	struct drm_gem_close gc;
+	unsigned int i;
+
+	for (i = 0; i < wb->num_fbs; i++) {
+		if (wb->fbs[i].fence >= 0)
+			close(wb->fbs[i].fence);
+		if (wb->fbs[i].fb_id)
+			drmModeRmFB(d->fd, wb->fbs[i].fb_id);
+		if (!wb->fbs[i].handle)
+			continue;
+		memset(&gc, 0, sizeof(gc));
+		gc.handle = wb->fbs[i].handle;
+		drmIoctl(d->fd, DRM_IOCTL_GEM_CLOSE, &gc);
+	}
+	free(wb->fbs);
+	wb->fbs = NULL;
+	free(wb->waiting);
+	wb->waiting = NULL;
+	free(wb->inflight);
+	wb->inflight = NULL;
+	wb->num_fbs = 0;
+	if (wb->mode_blob)
+		drmModeDestroyPropertyBlob(d->fd, wb->mode_blob);
+	wb->mode_blob = 0;
+	pthread_mutex_destroy(&wb->lock);
+	close(d->fd);
+}
+
+/* commit a job with the oldest waiting buffer, with lock held */
+static void writeback_commit(struct device *d)
+{
+	struct writeback *wb = d->wb;
+	struct writeback_fb *fb;
+	struct buffer *b;
+	drmModeAtomicReqPtr req;
+	uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+	int ret;
+
+	b = wb->waiting[0];
+	fb = &wb->fbs[b->index];
+	fb->fence = -1;
+	fb->late = false;
+
+	req = drmModeAtomicAlloc();
+	ASSERT(!req, "failed to allocate atomic request\n");
+	if (wb->modeset) {
+		drmModeAtomicAddProperty(req, wb->crtc_id,
+				wb->props[WRITEBACK_CRTC_MODE_ID], wb->mode_blob);
+		drmModeAtomicAddProperty(req, wb->crtc_id,
+				wb->props[WRITEBACK_CRTC_ACTIVE], 1);
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+	drmModeAtomicAddProperty(req, wb->connector_id,
+			wb->props[WRITEBACK_CONN_CRTC_ID], wb->crtc_id);
+	drmModeAtomicAddProperty(req, wb->connector_id,
+			wb->props[WRITEBACK_CONN_FB_ID], fb->fb_id);
+	drmModeAtomicAddProperty(req, wb->connector_id,
+			wb->props[WRITEBACK_CONN_FENCE],
+			(uint64_t)(uintptr_t)&fb->fence);
+	ret = drmModeAtomicCommit(d->fd, req, flags, d);
+	drmModeAtomicFree(req);
+	ASSERT(ret < 0, "writeback commit failed: %s\n", ERRSTR);
+
+	wb->modeset = false;
+	fb->queued_ns = timing_now();
+	memmove(wb->waiting, wb->waiting + 1,
+			--wb->num_waiting * sizeof(*wb->waiting));
+	wb->inflight[wb->num_inflight++] = b;
+	wb->committing = true;
+}
+
+/* queue buffer for a job, committed right away if none is waiting a flip */
+void writeback_queue(struct device *d, struct buffer *b)
+{
+	struct writeback *wb = d->wb;
+
+	pthread_mutex_lock(&wb->lock);
+	wb->waiting[wb->num_waiting++] = b;
+	if (wb->on && !wb->committing)
+		writeback_commit(d);
+	pthread_mutex_unlock(&wb->lock);
+}
+
+void writeback_on(struct device *d)
+{
+	struct writeback *wb = d->wb;
+
+	pthread_mutex_lock(&wb->lock);
+	wb->on = true;
+	if (wb->num_waiting)
+		writeback_commit(d);
+	pthread_mutex_unlock(&wb->lock);
+}
+
+void writeback_off(struct device *d)
+{
+	struct writeback *wb = d->wb;
+	unsigned int i;
+
+	pthread_mutex_lock(&wb->lock);
+	wb->on = false;
+	for (i = 0; i < wb->num_inflight; i++) {
+		if (wb->fbs[wb->inflight[i]->index].fence < 0)
+			continue;
+		close(wb->fbs[wb->inflight[i]->index].fence);
+		wb->fbs[wb->inflight[i]->index].fence = -1;
+	}
+	wb->num_inflight = 0;
+	wb->num_waiting = 0;
+	wb->committing = false;
+	pthread_mutex_unlock(&wb->lock);
+}
+
+static void writeback_flip(int fd, unsigned int sequence, unsigned int tv_sec,
+		unsigned int tv_usec, void *user_data)
+{
+	((struct device *)user_data)->wb->flipped = true;
+}
+
+/* handle flip event, commit the next job and collect completed ones.
+ * returns the completed buffers linked by next, in order */
+struct buffer *writeback_capture(struct device *d)
+{
+	struct writeback *wb = d->wb;
+	drmEventContext ev = {
+		.version = 2,
+		.page_flip_handler = writeback_flip,
+	};
+	struct buffer *b, *done = NULL, **tail = &done;
+	struct writeback_fb *fb;
+	struct pollfd pfd;
+	uint64_t now, lat;
+	int timeout, ret;
+
+	drmHandleEvent(d->fd, &ev);
+
+	pthread_mutex_lock(&wb->lock);
+	/* the job of the last commit is latched, the next can go */
+	if (wb->flipped) {
+		wb->flipped = false;
+		wb->committing = false;
+		if (wb->on && wb->num_waiting)
+			writeback_commit(d);
+	}
+
+	/* latched jobs complete a frame later, the next flip checks on the
+	 * newest unless no commit is out to report it. a job past the timeout
+	 * keeps its buffer, which the hardware may still write, and is only
+	 * checked on from then on */
+	while (wb->num_inflight > (wb->committing ? 1 : 0)) {
+		b = wb->inflight[0];
+		fb = &wb->fbs[b->index];
+		timeout = fb->late || (wb->committing &&
+				wb->num_inflight == 2) ? 0 : WRITEBACK_TIMEOUT_MS;
+		pfd.fd = fb->fence;
+		pfd.events = POLLIN;
+
+		/* buffers are queued meanwhile */
+		pthread_mutex_unlock(&wb->lock);
+		ret = pfd.fd < 0 ? 1 : poll(&pfd, 1, timeout);
+		pthread_mutex_lock(&wb->lock);
+		/* turned off meanwhile */
+		if (!wb->num_inflight || wb->inflight[0] != b ||
+				fb->fence != pfd.fd)
+			break;
+		if (ret <= 0) {
+			if (!ret && timeout) {
+				fb->late = true;
+				wb->timeouts++;
+			}
+			break;
+		}
+
+		if (fb->fence >= 0)
+			close(fb->fence);
+		fb->fence = -1;
+		memmove(wb->inflight, wb->inflight + 1,
+				--wb->num_inflight * sizeof(*wb->inflight));
+
+		now = timing_now();
+		lat = now - fb->queued_ns;
+		wb->frames++;
+		wb->lat_ns += lat;
+		if (lat < wb->lat_min)
+			wb->lat_min = lat;
+		if (lat > wb->lat_max)
+			wb->lat_max = lat;
+
+		b->bytesused[0] = wb->sizeimage;
+		b->data_offset[0] = 0;
+		b->flags = 0;
+		b->field = V4L2_FIELD_NONE;
+		memset(&b->timecode, 0, sizeof(b->timecode));
+		b->frame.sequence = wb->sequence++;
+		b->frame.timestamp.tv_sec = now / 1000000000ull;
+		b->frame.timestamp.tv_usec = now % 1000000000ull / 1000;
+		b->frame.dequeued_ns = now;
+		b->frame.bytesused = wb->sizeimage;
+		b->frame.flags = 0;
+
+		b->next = NULL;
+		*tail = b;
+		tail = &b->next;
+	}
+	if (wb->on && !wb->committing && wb->num_waiting)
+		writeback_commit(d);
+	pthread_mutex_unlock(&wb->lock);
+
+	return done;
+}
+
+/* dump stats of writeback source */
+void writeback_dump_stats(struct writeback *wb, const char *who, FILE *fp)
+{
+	fprintf(fp, "%s writeback connector %u frames %llu timeouts %llu "
+			"latency_us min %.1f avg %.1f max %.1f\n", who,
+			wb->connector_id, (unsigned long long)wb->frames,
+			(unsigned long long)wb->timeouts,
+			wb->frames ? wb->lat_min / 1000.0 : 0,
+			wb->frames ? wb->lat_ns / 1000.0 / wb->frames : 0,
+			wb->lat_max / 1000.0);
+}